@@ -0,0 +1,90 @@
+#include "AccountStore.hpp"
+#include "PasswordHash.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+static std::string lowerName(const std::string& name) {
+    std::string lower = name;
+    for (size_t i = 0; i < lower.size(); ++i) {
+        if (lower[i] >= 'A' && lower[i] <= 'Z') lower[i] = lower[i] - 'A' + 'a';
+    }
+    return lower;
+}
+
+AccountStore::AccountStore() {}
+
+AccountStore::~AccountStore() {}
+
+AccountStore* AccountStore::load(const std::string& path, std::string& error) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = path + ": " + std::strerror(errno);
+        return NULL;
+    }
+    AccountStore* store = new AccountStore();
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        std::string problem;
+        if (!store->_parseLine(line, problem)) {
+            std::ostringstream oss;
+            oss << path << ":" << number << ": " << problem;
+            error = oss.str();
+            delete store;
+            return NULL;
+        }
+    }
+    if (file.bad()) {
+        error = path + ": read error";
+        delete store;
+        return NULL;
+    }
+    return store;
+}
+
+bool AccountStore::_parseLine(const std::string& line, std::string& error) {
+    std::istringstream iss(line.substr(0, line.find('#')));
+    std::string kind;
+    if (!(iss >> kind)) return true;
+
+    Kind index;
+    if (kind == "account") {
+        index = ACCOUNT;
+    } else if (kind == "oper") {
+        index = OPER;
+    } else {
+        error = "unknown entry \"" + kind + "\"";
+        return false;
+    }
+    Entry entry;
+    if (!(iss >> entry.name)) {
+        error = "expected a name after \"" + kind + "\"";
+        return false;
+    }
+    if (!(iss >> entry.hash) || !PasswordHash::wellFormed(entry.hash)) {
+        error = "expected a password hash after \"" + entry.name + "\" (see ircserv --mkpasswd)";
+        return false;
+    }
+    std::string rest;
+    if (iss >> rest) {
+        error = "unexpected \"" + rest + "\" after the hash";
+        return false;
+    }
+    if (!_entries[index].insert(std::make_pair(lowerName(entry.name), entry)).second) {
+        error = kind + " \"" + entry.name + "\" is listed twice";
+        return false;
+    }
+    return true;
+}
+
+const std::string* AccountStore::find(Kind kind, std::string& name) const {
+    EntryMap::const_iterator it = _entries[kind].find(lowerName(name));
+    if (it == _entries[kind].end()) return NULL;
+    name = it->second.name;
+    return &it->second.hash;
+}
+
+size_t AccountStore::count(Kind kind) const {
+    return _entries[kind].size();
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <string>
+#include <map>
+
+// Credentials from the --accounts file, one per line:
+//
+//     account <name> <hash>   # SASL PLAIN login, sets the account name
+//     oper    <name> <hash>   # OPER <name> <password>
+//
+// with '#' starting a comment and <hash> as printed by ircserv --mkpasswd
+// (see PasswordHash). Names are matched without regard to ASCII case; a
+// name listed twice for one kind is an error. Only hashes are held, and
+// checking a password against one is left to AuthPool.
+class AccountStore {
+public:
+    enum Kind { ACCOUNT, OPER };
+
+    AccountStore();
+    ~AccountStore();
+
+    // NULL with error set ("<path>:<line>: ...") if the file is unusable
+    static AccountStore* load(const std::string& path, std::string& error);
+
+    // The stored hash, or NULL; name receives the spelling from the file
+    const std::string* find(Kind kind, std::string& name) const;
+    size_t count(Kind kind) const;
+
+private:
+    AccountStore(const AccountStore& other);
+    AccountStore& operator=(const AccountStore& other);
+
+    struct Entry {
+        std::string name;
+        std::string hash;
+    };
+    typedef std::map<std::string, Entry> EntryMap;
+
+    bool _parseLine(const std::string& line, std::string& error);
+
+    // Keyed by lower-cased name
+    EntryMap _entries[2];
+};
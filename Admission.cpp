@@ -0,0 +1,201 @@
+#include "Admission.hpp"
+#include "MemoryUsage.hpp"
+#include <fstream>
+#include <sstream>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+static const char HOST_LIMIT_FAREWELL[] = "ERROR :Closing Link: Too many connections from your host\r\n";
+static const char SUBNET_LIMIT_FAREWELL[] = "ERROR :Closing Link: Too many connections from your network\r\n";
+
+AdmissionRules::AdmissionRules() {}
+
+AdmissionRules::~AdmissionRules() {}
+
+AdmissionRules* AdmissionRules::load(const std::string& path, std::string& error) {
+    std::ifstream file(path.c_str());
+    if (!file) {
+        error = path + ": " + std::strerror(errno);
+        return NULL;
+    }
+    AdmissionRules* rules = new AdmissionRules();
+    std::string line;
+    for (size_t number = 1; std::getline(file, line); ++number) {
+        std::string problem;
+        if (!rules->_parseLine(line, problem)) {
+            std::ostringstream oss;
+            oss << path << ":" << number << ": " << problem;
+            error = oss.str();
+            delete rules;
+            return NULL;
+        }
+    }
+    if (file.bad()) {
+        error = path + ": read error";
+        delete rules;
+        return NULL;
+    }
+    for (size_t i = 0; i < rules->_rules.size(); ++i) {
+        const Rule& rule = rules->_rules[i];
+        PrefixTree& tree = (rule.kind == DENY) ? rules->_denies : rules->_limits;
+        tree.set(rule.address, rule.length, static_cast<uint32_t>(i));
+    }
+    return rules;
+}
+
+bool AdmissionRules::_parseLine(const std::string& line, std::string& error) {
+    std::istringstream iss(line.substr(0, line.find('#')));
+    std::string kind;
+    if (!(iss >> kind)) return true;
+
+    Rule rule;
+    if (kind == "deny") {
+        rule.kind = DENY;
+    } else if (kind == "limit") {
+        rule.kind = LIMIT;
+    } else {
+        error = "unknown rule \"" + kind + "\"";
+        return false;
+    }
+    if (!(iss >> rule.prefix) || !PrefixTree::parse(rule.prefix, rule.address, rule.length)) {
+        error = "expected an address or prefix after \"" + kind + "\"";
+        return false;
+    }
+
+    std::string number;
+    if (!(iss >> number) || number.find_first_not_of("0123456789") != std::string::npos || number.size() > 10) {
+        error = (rule.kind == DENY) ? "expected an expiry time (0 for never)" : "expected a connection count";
+        return false;
+    }
+    unsigned long value = std::strtoul(number.c_str(), NULL, 10);
+    rule.expires = 0;
+    rule.limit = 0;
+    if (rule.kind == DENY) {
+        rule.expires = static_cast<time_t>(value);
+        std::string reason;
+        std::getline(iss >> std::ws, reason);
+        while (!reason.empty() && (reason[reason.size() - 1] == ' ' || reason[reason.size() - 1] == '\r')) {
+            reason.erase(reason.size() - 1);
+        }
+        if (reason.empty()) {
+            reason = "You are banned from this server";
+        }
+        rule.farewell = "ERROR :Closing Link: " + reason + "\r\n";
+    } else {
+        if (value == 0 || value > 0xffffffffUL) {
+            error = "connection count must be between 1 and 4294967295";
+            return false;
+        }
+        rule.limit = static_cast<uint32_t>(value);
+        rule.farewell = "ERROR :Closing Link: Too many connections from " + rule.prefix + "\r\n";
+        std::string extra;
+        if (iss >> extra) {
+            error = "unexpected \"" + extra + "\" after the connection count";
+            return false;
+        }
+    }
+    _rules.push_back(rule);
+    return true;
+}
+
+const std::vector<AdmissionRules::Rule>& AdmissionRules::rules() const {
+    return _rules;
+}
+
+const PrefixTree& AdmissionRules::denies() const {
+    return _denies;
+}
+
+const PrefixTree& AdmissionRules::limits() const {
+    return _limits;
+}
+
+size_t AdmissionRules::memoryUsage() const {
+    size_t bytes = heapBytes(_rules) + _denies.memoryUsage() + _limits.memoryUsage();
+    for (size_t i = 0; i < _rules.size(); ++i) {
+        bytes += heapBytes(_rules[i].prefix) + heapBytes(_rules[i].farewell);
+    }
+    return bytes;
+}
+
+Admission::Admission() : _rules(NULL), _perHost(0), _perSubnet(0) {}
+
+Admission::~Admission() {
+    delete _rules;
+}
+
+void Admission::setLimits(size_t perHost, size_t perSubnet) {
+    _perHost = static_cast<uint32_t>(perHost);
+    _perSubnet = static_cast<uint32_t>(perSubnet);
+}
+
+void Admission::replaceRules(AdmissionRules* rules) {
+    delete _rules;
+    _rules = rules;
+}
+
+const AdmissionRules* Admission::getRules() const {
+    return _rules;
+}
+
+Admission::Verdict Admission::check(const PrefixTree::Address& address, time_t now, const char*& farewell) const {
+    uint32_t matches[MAX_ADMISSION_MATCHES];
+    if (_rules) {
+        const std::vector<AdmissionRules::Rule>& rules = _rules->rules();
+        size_t found = _rules->denies().match(address, matches, MAX_ADMISSION_MATCHES);
+        for (size_t i = 0; i < found; ++i) {
+            const AdmissionRules::Rule& rule = rules[matches[i]];
+            if (rule.expires == 0 || rule.expires > now) {
+                farewell = rule.farewell.c_str();
+                return DENIED;
+            }
+        }
+    }
+    if (_perHost && _connections.count(address, 128) >= _perHost) {
+        farewell = HOST_LIMIT_FAREWELL;
+        return HOST_LIMIT;
+    }
+    if (_perSubnet) {
+        int bits = PrefixTree::isIPv4(address) ? SUBNET_BITS_IPV4 : SUBNET_BITS_IPV6;
+        if (_connections.count(address, bits) >= _perSubnet) {
+            farewell = SUBNET_LIMIT_FAREWELL;
+            return SUBNET_LIMIT;
+        }
+    }
+    if (_rules) {
+        const std::vector<AdmissionRules::Rule>& rules = _rules->rules();
+        size_t found = _rules->limits().match(address, matches, MAX_ADMISSION_MATCHES);
+        for (size_t i = 0; i < found; ++i) {
+            const AdmissionRules::Rule& rule = rules[matches[i]];
+            if (_connections.count(rule.address, rule.length) >= rule.limit) {
+                farewell = rule.farewell.c_str();
+                return PREFIX_LIMIT;
+            }
+        }
+    }
+    return ADMIT;
+}
+
+void Admission::admit(const PrefixTree::Address& address) {
+    _connections.add(address, 1);
+}
+
+void Admission::release(const PrefixTree::Address& address) {
+    _connections.add(address, -1);
+}
+
+const char* Admission::describe(Verdict verdict) {
+    switch (verdict) {
+        case ADMIT: return "admitted";
+        case DENIED: return "denied";
+        case HOST_LIMIT: return "per-host limit";
+        case SUBNET_LIMIT: return "per-subnet limit";
+        case PREFIX_LIMIT: return "prefix limit";
+        default: return "unknown";
+    }
+}
+
+size_t Admission::memoryUsage() const {
+    return _connections.memoryUsage() + (_rules ? sizeof(AdmissionRules) + _rules->memoryUsage() : 0);
+}
@@ -0,0 +1,95 @@
+#pragma once
+#include "PrefixTree.hpp"
+#include <string>
+#include <vector>
+#include <ctime>
+#include <stdint.h>
+
+// Most rules containing one address that a check looks at, per kind
+#define MAX_ADMISSION_MATCHES 32
+// Prefix the per-subnet limit counts, in tree bits (IPv4 /24, IPv6 /64)
+#define SUBNET_BITS_IPV4 120
+#define SUBNET_BITS_IPV6 64
+
+// Address rules from the --admission-rules file, one per line:
+//
+//     deny  <prefix> <expires> <reason...>   # expires: unix time, 0 = never
+//     limit <prefix> <connections>
+//
+// with '#' starting a comment. Prefixes are "192.0.2.0/24", "2001:db8::/32"
+// or a bare address. Each kind has its own prefix tree whose values index
+// the rules; a prefix listed twice for one kind keeps its last line.
+// A loaded rule set is never modified, so a reload builds a new one.
+class AdmissionRules {
+public:
+    enum Kind { DENY, LIMIT };
+
+    struct Rule {
+        Kind kind;
+        std::string prefix;
+        PrefixTree::Address address;
+        int length;
+        time_t expires;
+        uint32_t limit;
+        // The whole ERROR line sent to a connection the rule turns away
+        std::string farewell;
+    };
+
+    AdmissionRules();
+    ~AdmissionRules();
+
+    // NULL with error set ("<path>:<line>: ...") if the file is unusable
+    static AdmissionRules* load(const std::string& path, std::string& error);
+
+    const std::vector<Rule>& rules() const;
+    const PrefixTree& denies() const;
+    const PrefixTree& limits() const;
+    size_t memoryUsage() const;
+
+private:
+    AdmissionRules(const AdmissionRules& other);
+    AdmissionRules& operator=(const AdmissionRules& other);
+
+    bool _parseLine(const std::string& line, std::string& error);
+
+    std::vector<Rule> _rules;
+    PrefixTree _denies;
+    PrefixTree _limits;
+};
+
+// Decides, right after accept(), whether a connection may stay: deny rules
+// first, then the per-host and per-subnet limits, then limit rules. The
+// live connections are counted in a prefix tree of their own, whose
+// subtree totals give the count under any prefix in one walk. check()
+// does O(prefix length) work and never allocates, so turning a flood away
+// costs no more than the accept itself.
+class Admission {
+public:
+    enum Verdict { ADMIT, DENIED, HOST_LIMIT, SUBNET_LIMIT, PREFIX_LIMIT, VERDICT_COUNT };
+
+    Admission();
+    ~Admission();
+
+    // 0 leaves that limit off
+    void setLimits(size_t perHost, size_t perSubnet);
+    // Takes ownership of rules (may be NULL) and deletes the previous set
+    void replaceRules(AdmissionRules* rules);
+    const AdmissionRules* getRules() const;
+
+    // When not ADMIT, farewell is the ERROR line to send before closing
+    Verdict check(const PrefixTree::Address& address, time_t now, const char*& farewell) const;
+    void admit(const PrefixTree::Address& address);
+    void release(const PrefixTree::Address& address);
+
+    static const char* describe(Verdict verdict);
+    size_t memoryUsage() const;
+
+private:
+    Admission(const Admission& other);
+    Admission& operator=(const Admission& other);
+
+    AdmissionRules* _rules;
+    PrefixTree _connections;
+    uint32_t _perHost;
+    uint32_t _perSubnet;
+};
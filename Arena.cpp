@@ -0,0 +1,96 @@
+#include "Arena.hpp"
+#include <cstdlib>
+
+// First chunk, and the most a reset keeps after merging the chunks of a
+// busy tick; beyond that it goes back to one first-size chunk
+#define ARENA_CHUNK_BYTES 65536
+#define ARENA_MAX_RETAINED (4 * 1024 * 1024)
+// Every allocation is aligned for any fundamental type
+#define ARENA_ALIGN (2 * sizeof(void*))
+
+static size_t alignUp(size_t bytes) {
+    return (bytes + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+Arena::Arena() : _chunks(NULL), _cursor(NULL), _end(NULL), _held(0) {}
+
+Arena::~Arena() {
+    while (_chunks) {
+        Chunk* next = _chunks->next;
+        std::free(_chunks);
+        _chunks = next;
+    }
+}
+
+void* Arena::allocate(size_t bytes) {
+    bytes = alignUp(bytes ? bytes : 1);
+    if (static_cast<size_t>(_end - _cursor) < bytes) {
+        return _grow(bytes);
+    }
+    void* result = _cursor;
+    _cursor += bytes;
+    return result;
+}
+
+void* Arena::_grow(size_t bytes) {
+    size_t size = _chunks ? _chunks->size * 2 : ARENA_CHUNK_BYTES;
+    size_t header = alignUp(sizeof(Chunk));
+    if (size < header + bytes) {
+        size = header + bytes;
+    }
+    Chunk* chunk = static_cast<Chunk*>(std::malloc(size));
+    if (!chunk) throw std::bad_alloc();
+    chunk->next = _chunks;
+    chunk->size = size;
+    _chunks = chunk;
+    _held += size;
+    _cursor = reinterpret_cast<char*>(chunk) + header + bytes;
+    _end = reinterpret_cast<char*>(chunk) + size;
+    return reinterpret_cast<char*>(chunk) + header;
+}
+
+void Arena::reset() {
+    if (!_chunks) return;
+    if (_chunks->next) {
+        size_t total = _held;
+        while (_chunks) {
+            Chunk* next = _chunks->next;
+            std::free(_chunks);
+            _chunks = next;
+        }
+        _held = 0;
+        _cursor = _end = NULL;
+        // One chunk the size of the whole tick, so that the next such tick
+        // does not allocate at all
+        _grow(alignUp(total <= ARENA_MAX_RETAINED ? total : ARENA_CHUNK_BYTES) - alignUp(sizeof(Chunk)));
+    }
+    _cursor = reinterpret_cast<char*>(_chunks) + alignUp(sizeof(Chunk));
+}
+
+size_t Arena::memoryUsage() const {
+    return _held;
+}
+
+void splitList(const ArenaString& list, char separator, ArenaVector<ArenaString>::type& out) {
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(separator, start);
+        if (end == ArenaString::npos) end = list.size();
+        if (end > start) {
+            out.push_back(ArenaString(list.data() + start, end - start, out.get_allocator()));
+        }
+        start = end + 1;
+    }
+}
+
+void appendNumber(ArenaString& out, unsigned long value) {
+    char digits[24];
+    size_t length = 0;
+    do {
+        digits[length++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    while (length) {
+        out += digits[--length];
+    }
+}
@@ -0,0 +1,135 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <new>
+
+// Bump-pointer memory for the temporaries of one event loop tick. Nothing
+// is freed on its own; reset() takes everything back at once when the tick
+// ends, so whatever is allocated here must be gone by then (locals of a
+// command handler, in practice). After a busy tick the chunks are merged
+// into one, so a steady load allocates nothing from the heap.
+class Arena {
+public:
+    Arena();
+    ~Arena();
+
+    void* allocate(size_t bytes);
+    void reset();
+
+    // Heap bytes held, used or not
+    size_t memoryUsage() const;
+
+private:
+    Arena(const Arena& other);
+    Arena& operator=(const Arena& other);
+
+    void* _grow(size_t bytes);
+
+    struct Chunk {
+        Chunk* next;
+        size_t size;
+    };
+    // Newest first; allocation goes on in _chunks
+    Chunk* _chunks;
+    char* _cursor;
+    char* _end;
+    size_t _held;
+};
+
+// Standard allocator over an Arena, for containers that live no longer
+// than a tick. deallocate() does nothing: the memory comes back on reset.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    explicit ArenaAllocator(Arena& arena) : _arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : _arena(other.arena()) {}
+
+    pointer allocate(size_type count, const void* hint = 0) {
+        (void)hint;
+        if (count > max_size()) throw std::bad_alloc();
+        return static_cast<pointer>(_arena->allocate(count * sizeof(T)));
+    }
+    void deallocate(pointer, size_type) {}
+    size_type max_size() const { return static_cast<size_type>(-1) / sizeof(T); }
+
+    void construct(pointer p, const T& value) { new (static_cast<void*>(p)) T(value); }
+    void destroy(pointer p) { p->~T(); }
+    pointer address(reference value) const { return &value; }
+    const_pointer address(const_reference value) const { return &value; }
+
+    Arena* arena() const { return _arena; }
+
+private:
+    Arena* _arena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena() != b.arena();
+}
+
+typedef std::basic_string<char, std::char_traits<char>, ArenaAllocator<char> > ArenaString;
+
+// std::vector<T> on an arena (ArenaVector<T>::type, for want of alias
+// templates)
+template <typename T>
+struct ArenaVector {
+    typedef std::vector<T, ArenaAllocator<T> > type;
+};
+
+// A set for the handful of elements a command deals with: a vector
+// searched from the front, which beats a tree at these sizes and
+// allocates once per doubling rather than once per element
+template <typename T>
+class ArenaSmallSet {
+public:
+    explicit ArenaSmallSet(Arena& arena) : _items(ArenaAllocator<T>(arena)) {}
+
+    // False if value was there already
+    bool insert(const T& value) {
+        if (contains(value)) return false;
+        _items.push_back(value);
+        return true;
+    }
+    bool contains(const T& value) const {
+        for (size_t i = 0; i < _items.size(); ++i) {
+            if (_items[i] == value) return true;
+        }
+        return false;
+    }
+    size_t size() const { return _items.size(); }
+
+private:
+    typename ArenaVector<T>::type _items;
+};
+
+// The non-empty items of a separator-delimited list ("#a,#b,,#c")
+void splitList(const ArenaString& list, char separator, ArenaVector<ArenaString>::type& out);
+
+// An arena string copied out, for a value that has to outlive the tick
+// or go to code that takes a std::string
+inline std::string toString(const ArenaString& value) {
+    return std::string(value.data(), value.size());
+}
+
+void appendNumber(ArenaString& out, unsigned long value);
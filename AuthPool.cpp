@@ -0,0 +1,111 @@
+#include "AuthPool.hpp"
+#include "PasswordHash.hpp"
+#include "Server.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <sstream>
+
+AuthPool::AuthPool()
+    : _server(NULL), _capacity(0), _inFlight(0), _stopping(false) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_jobReady, NULL);
+}
+
+AuthPool::~AuthPool() {
+    stop();
+    pthread_cond_destroy(&_jobReady);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void AuthPool::start(Server* server, size_t workers, size_t capacity) {
+    stop();
+    _server = server;
+    _capacity = capacity;
+    _stopping = false;
+    for (size_t i = 0; i < workers; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, &AuthPool::_workerMain, this) != 0) {
+            ngircd_log("warning", "Cannot start authentication worker; continuing with fewer");
+            break;
+        }
+        _threads.push_back(thread);
+    }
+    if (_threads.empty()) {
+        _capacity = 0;
+        ngircd_log("error", "No authentication worker could be started; logins will be refused");
+        return;
+    }
+    std::ostringstream oss;
+    oss << "Authentication pool: " << _threads.size() << " worker(s), at most " << _capacity << " check(s) in flight";
+    ngircd_log("info", oss.str());
+}
+
+void AuthPool::stop() {
+    if (_threads.empty()) return;
+
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_jobReady);
+    pthread_mutex_unlock(&_mutex);
+    for (size_t i = 0; i < _threads.size(); ++i) {
+        pthread_join(_threads[i], NULL);
+    }
+    _threads.clear();
+    for (size_t i = 0; i < _queue.size(); ++i) {
+        delete _queue[i];
+    }
+    _queue.clear();
+    for (size_t i = 0; i < _done.size(); ++i) {
+        delete _done[i];
+    }
+    _done.clear();
+    _inFlight = 0;
+    _capacity = 0;
+}
+
+bool AuthPool::submit(AuthJob* job) {
+    pthread_mutex_lock(&_mutex);
+    bool accepted = _inFlight < _capacity;
+    if (accepted) {
+        ++_inFlight;
+        _queue.push_back(job);
+        pthread_cond_signal(&_jobReady);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return accepted;
+}
+
+void AuthPool::collect(std::vector<AuthJob*>& done) {
+    pthread_mutex_lock(&_mutex);
+    done.insert(done.end(), _done.begin(), _done.end());
+    _inFlight -= _done.size();
+    _done.clear();
+    pthread_mutex_unlock(&_mutex);
+}
+
+void* AuthPool::_workerMain(void* arg) {
+    static_cast<AuthPool*>(arg)->_workerLoop();
+    return NULL;
+}
+
+void AuthPool::_workerLoop() {
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        while (_queue.empty() && !_stopping) {
+            pthread_cond_wait(&_jobReady, &_mutex);
+        }
+        if (_stopping) break;
+        AuthJob* job = _queue.front();
+        _queue.pop_front();
+        pthread_mutex_unlock(&_mutex);
+
+        job->granted = PasswordHash::verify(job->password, job->hash) && job->known;
+        std::fill(job->password.begin(), job->password.end(), '\0');
+        job->password.clear();
+
+        pthread_mutex_lock(&_mutex);
+        _done.push_back(job);
+        _server->authCompleted();
+    }
+    pthread_mutex_unlock(&_mutex);
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstddef>
+#include <pthread.h>
+#include "AccountStore.hpp"
+
+class Server;
+
+// One credential check, owned by the pool from submit() until collect()
+// hands it back
+struct AuthJob {
+    int fd;
+    // Client::getAuthTicket() when submitted: a client that went away, or
+    // a descriptor reused since, does not match any more
+    unsigned long ticket;
+    AccountStore::Kind kind;
+    std::string name;
+    // Wiped by the worker once checked
+    std::string password;
+    std::string hash;
+    // False for a name that is not in the store: the check still runs, on a
+    // decoy hash of the same cost, so that the reply time does not tell
+    // which names exist, and then fails
+    bool known;
+    bool granted;
+};
+
+// Fixed set of threads that run slow password hashes off the event loop.
+// The loop submits a job and carries on; a worker verifies it, queues it
+// as done and wakes the loop (Server::authCompleted), which collects it.
+// At most `capacity` jobs are queued, running or waiting to be collected,
+// so a login storm is turned away instead of queueing without bound.
+class AuthPool {
+public:
+    AuthPool();
+    ~AuthPool();
+
+    void start(Server* server, size_t workers, size_t capacity);
+    // Waits for the checks in progress; queued and uncollected jobs are dropped
+    void stop();
+
+    // Event loop: false, with the job still the caller's, when full
+    bool submit(AuthJob* job);
+    // Event loop: appends the finished jobs, which the caller then deletes
+    void collect(std::vector<AuthJob*>& done);
+
+private:
+    AuthPool(const AuthPool& other);
+    AuthPool& operator=(const AuthPool& other);
+
+    static void* _workerMain(void* arg);
+    void _workerLoop();
+
+    Server* _server;
+    std::vector<pthread_t> _threads;
+    size_t _capacity;
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _jobReady;
+    // Guarded by _mutex
+    std::deque<AuthJob*> _queue;
+    std::vector<AuthJob*> _done;
+    size_t _inFlight;
+    bool _stopping;
+};
@@ -0,0 +1,133 @@
+#include "AuthenticateCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Capabilities.hpp"
+#include <algorithm>
+#include <cctype>
+
+// A chunk this long means another one follows
+#define SASL_CHUNK 400
+// Base64 bytes one exchange may add up to
+#define SASL_MAX_DATA 1200
+
+static int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+') return 62;
+    if (c == '/') return 63;
+    return -1;
+}
+
+static bool decodeBase64(const std::string& in, std::string& out) {
+    if (in.size() % 4 != 0) return false;
+    out.clear();
+    for (size_t i = 0; i < in.size(); i += 4) {
+        // '=' pads the last group only
+        int padding = 0;
+        if (i + 4 == in.size() && in[i + 3] == '=') {
+            padding = (in[i + 2] == '=') ? 2 : 1;
+        }
+        unsigned int bits = 0;
+        for (int j = 0; j < 4; ++j) {
+            int value = (j >= 4 - padding) ? 0 : base64Value(in[i + j]);
+            if (value < 0) return false;
+            bits = (bits << 6) | static_cast<unsigned int>(value);
+        }
+        out += static_cast<char>(bits >> 16);
+        if (padding < 2) out += static_cast<char>((bits >> 8) & 0xff);
+        if (padding < 1) out += static_cast<char>(bits & 0xff);
+    }
+    return true;
+}
+
+static void failSasl(Client* client, int replyCode) {
+    client->setSasl(false, "");
+    client->reply(replyCode, "");
+}
+
+AuthenticateCommand::AuthenticateCommand() {}
+
+AuthenticateCommand::~AuthenticateCommand() {}
+
+bool AuthenticateCommand::requiresRegistration() const {
+    return false;
+}
+
+void AuthenticateCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    if (args.size() < 2) {
+        client->reply(461, toString(args[0]));
+        return;
+    }
+    std::string argument = toString(args[1]);
+    if (!client->hasCap(CAP_SASL)) {
+        failSasl(client, 904);
+        return;
+    }
+    if (argument == "*") {
+        failSasl(client, 906);
+        return;
+    }
+    if (!client->getAccount().empty()) {
+        failSasl(client, 907);
+        return;
+    }
+
+    if (!client->isSaslStarted()) {
+        std::string mechanism = argument;
+        for (size_t i = 0; i < mechanism.size(); ++i) {
+            mechanism[i] = std::toupper(static_cast<unsigned char>(mechanism[i]));
+        }
+        if (mechanism != "PLAIN") {
+            client->reply(908, "PLAIN");
+            failSasl(client, 904);
+            return;
+        }
+        client->setSasl(true, "");
+        client->queueMessage("AUTHENTICATE +\r\n");
+        return;
+    }
+
+    if (argument.size() > SASL_CHUNK) {
+        failSasl(client, 905);
+        return;
+    }
+    std::string data = client->getSaslData();
+    if (argument != "+") {
+        data += argument;
+    }
+    if (data.size() > SASL_MAX_DATA) {
+        failSasl(client, 905);
+        return;
+    }
+    if (argument.size() == SASL_CHUNK) {
+        client->setSasl(true, data);
+        return;
+    }
+
+    // authzid NUL authcid NUL password; a different authzid is not allowed
+    std::string decoded;
+    size_t first;
+    size_t second;
+    if (!decodeBase64(data, decoded)
+        || (first = decoded.find('\0')) == std::string::npos
+        || (second = decoded.find('\0', first + 1)) == std::string::npos
+        || decoded.find('\0', second + 1) != std::string::npos
+        || second == first + 1
+        || (first > 0 && decoded.compare(0, first, decoded, first + 1, second - first - 1) != 0)) {
+        failSasl(client, 904);
+        return;
+    }
+    std::string account = decoded.substr(first + 1, second - first - 1);
+    std::string password = decoded.substr(second + 1);
+    std::fill(decoded.begin(), decoded.end(), '\0');
+
+    // Still started while the check runs; Server::_finishAuth ends it
+    client->setSasl(true, "");
+    bool started = server.startAuth(client, AccountStore::ACCOUNT, account, password);
+    std::fill(password.begin(), password.end(), '\0');
+    if (!started) {
+        client->reply(263, toString(args[0]));
+        failSasl(client, 904);
+    }
+}
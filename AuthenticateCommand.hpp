@@ -0,0 +1,23 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+// Handles IRCv3 SASL with the PLAIN mechanism, for clients that enabled
+// the sasl capability: AUTHENTICATE PLAIN, then the base64 of
+// "authzid NUL authcid NUL password" in chunks of at most 400 bytes. The
+// password is checked off the event loop (Server::startAuth), which sends
+// 900/903 or 904 once it is done.
+class AuthenticateCommand : public ICommand {
+public:
+    AuthenticateCommand();
+    virtual ~AuthenticateCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    AuthenticateCommand(const AuthenticateCommand& other);
+    AuthenticateCommand& operator=(const AuthenticateCommand& other);
+};
@@ -0,0 +1,112 @@
+#include "CapCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Capabilities.hpp"
+#include <sstream>
+#include <cctype>
+
+static const struct {
+    const char* name;
+    uint32_t bit;
+} CAPABILITIES[] = {
+    { "server-time", CAP_SERVER_TIME },
+    { "message-tags", CAP_MESSAGE_TAGS },
+    { "echo-message", CAP_ECHO_MESSAGE },
+    { "account-tag", CAP_ACCOUNT_TAG },
+    { "sasl", CAP_SASL },
+    { "batch", CAP_BATCH }
+};
+static const size_t CAPABILITY_COUNT = sizeof(CAPABILITIES) / sizeof(CAPABILITIES[0]);
+
+static uint32_t capabilityBit(const std::string& name) {
+    for (size_t i = 0; i < CAPABILITY_COUNT; ++i) {
+        if (name == CAPABILITIES[i].name) {
+            return CAPABILITIES[i].bit;
+        }
+    }
+    return 0;
+}
+
+static std::string capabilityNames(uint32_t caps) {
+    std::string names;
+    for (size_t i = 0; i < CAPABILITY_COUNT; ++i) {
+        if (caps & CAPABILITIES[i].bit) {
+            if (!names.empty()) names += " ";
+            names += CAPABILITIES[i].name;
+        }
+    }
+    return names;
+}
+
+static uint32_t offeredCaps(const Server& server) {
+    uint32_t caps = ~0u;
+    if (!server.hasCredentials(AccountStore::ACCOUNT)) {
+        caps &= ~static_cast<uint32_t>(CAP_SASL);
+    }
+    return caps;
+}
+
+static void sendCap(Server& server, Client* client, const std::string& subcommand, const std::string& text) {
+    std::string nickname = client->getNickname().empty() ? "*" : client->getNickname();
+    client->queueMessage(":" + server.getServerName() + " CAP " + nickname + " " + subcommand + " :" + text + "\r\n");
+}
+
+CapCommand::CapCommand() {}
+
+CapCommand::~CapCommand() {}
+
+bool CapCommand::requiresRegistration() const {
+    return false;
+}
+
+void CapCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    if (args.size() < 2) {
+        client->reply(461, toString(args[0]));
+        return;
+    }
+    std::string subcommand = toString(args[1]);
+    for (size_t i = 0; i < subcommand.size(); ++i) {
+        subcommand[i] = std::toupper(static_cast<unsigned char>(subcommand[i]));
+    }
+
+    if (subcommand == "LS") {
+        if (!client->hasRegistered()) {
+            client->setCapNegotiating(true);
+        }
+        sendCap(server, client, "LS", capabilityNames(offeredCaps(server)));
+    } else if (subcommand == "LIST") {
+        sendCap(server, client, "LIST", capabilityNames(client->getCaps()));
+    } else if (subcommand == "REQ") {
+        if (!client->hasRegistered()) {
+            client->setCapNegotiating(true);
+        }
+        const std::string requested = args.size() > 2 ? toString(args[2]) : "";
+        // All or nothing: one unknown name refuses the whole request
+        uint32_t caps = client->getCaps();
+        std::istringstream iss(requested);
+        std::string name;
+        bool valid = !requested.empty();
+        while (valid && iss >> name) {
+            bool remove = name[0] == '-';
+            uint32_t bit = capabilityBit(remove ? name.substr(1) : name) & offeredCaps(server);
+            if (!bit) {
+                valid = false;
+            } else if (remove) {
+                caps &= ~bit;
+            } else {
+                caps |= bit;
+            }
+        }
+        if (!valid) {
+            sendCap(server, client, "NAK", requested);
+            return;
+        }
+        client->setCaps(caps);
+        sendCap(server, client, "ACK", requested);
+    } else if (subcommand == "END") {
+        // Registration completes, if NICK and USER are in, once this returns
+        client->setCapNegotiating(false);
+    } else {
+        client->reply(410, toString(args[1]));
+    }
+}
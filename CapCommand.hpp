@@ -0,0 +1,20 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+// Handles IRCv3 capability negotiation (CAP LS/LIST/REQ/END). LS or REQ
+// before registration holds registration back until CAP END.
+class CapCommand : public ICommand {
+public:
+    CapCommand();
+    virtual ~CapCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    CapCommand(const CapCommand& other);
+    CapCommand& operator=(const CapCommand& other);
+};
@@ -0,0 +1,19 @@
+#pragma once
+
+// IRCv3 capabilities a client can enable with CAP REQ (see CapCommand),
+// as bits of Client::getCaps()
+enum Capability {
+    CAP_SERVER_TIME = 1 << 0,
+    CAP_MESSAGE_TAGS = 1 << 1,
+    CAP_ACCOUNT_TAG = 1 << 2,
+    CAP_ECHO_MESSAGE = 1 << 3,
+    // Offered only when there are accounts to log in to
+    CAP_SASL = 1 << 4,
+    // CHATHISTORY replies come wrapped in a BATCH
+    CAP_BATCH = 1 << 5
+};
+
+// The capabilities that change how a line is rendered; every combination
+// of them is one variant of a broadcast (see OutboundMessage)
+#define CAP_TAG_MASK (CAP_SERVER_TIME | CAP_MESSAGE_TAGS | CAP_ACCOUNT_TAG)
+#define CAP_VARIANTS (CAP_TAG_MASK + 1)
@@ -1,11 +1,28 @@
 #include "Channel.hpp"
 #include "Client.hpp"
+#include "FanoutPool.hpp"
+#include "OutboundMessage.hpp"
+#include "MemoryUsage.hpp"
+#include "utils.hpp"
 #include <sstream>
 #include <algorithm>
 #include <cstring>
+#include <sys/time.h>
 
-Channel::Channel(const std::string& name)
-    : _name(name), _topic(""), _topicSetter(""), _key(""), _userLimit(0), _createdAt(time(NULL)) {
+static uint64_t g_nextMaskVersion = 1;
+
+static std::string foldedPrefix(const Client* client) {
+    std::string prefix = client->getPrefix();
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        prefix[i] = ircToLower(prefix[i]);
+    }
+    return prefix;
+}
+
+Channel::Channel(const std::string& name, size_t historyLines, size_t historyBytes)
+    : _name(name), _handle(INVALID_CHANNEL_HANDLE), _topic(""), _topicSetter(""), _key(""), _userLimit(0), _createdAt(time(NULL)),
+      _localMembersStale(true), _fanout(NULL), _maskVersion(g_nextMaskVersion++), _history(historyLines, historyBytes) {
+    std::memset(_variantMembers, 0, sizeof(_variantMembers));
 }
 
 Channel::~Channel() {
@@ -14,10 +31,18 @@ Channel::~Channel() {
     _inviteList.clear();
 }
 
-std::string Channel::getName() const {
+const std::string& Channel::getName() const {
     return _name;
 }
 
+ChannelHandle Channel::getHandle() const {
+    return _handle;
+}
+
+void Channel::setHandle(ChannelHandle handle) {
+    _handle = handle;
+}
+
 std::string Channel::getTopic() const {
     return _topic;
 }
@@ -34,7 +59,11 @@ void Channel::addClient(Client* client) {
     if (!client) return;
 
     int fd = client->getFd();
+    if (!client->isRemote() && _members.find(fd) == _members.end()) {
+        ++_variantMembers[client->getCaps() & CAP_TAG_MASK];
+    }
     _members[fd] = client;
+    _localMembersStale = true;
 
     if (_members.size() == 1) {
         _operators.insert(fd);
@@ -47,15 +76,24 @@ void Channel::removeClient(Client* client) {
 }
 
 void Channel::removeClientByFd(int fd) {
+    std::map<int, Client*>::iterator member = _members.find(fd);
+    if (member != _members.end() && member->second && !member->second->isRemote()) {
+        --_variantMembers[member->second->getCaps() & CAP_TAG_MASK];
+    }
     _members.erase(fd);
+    _localMembersStale = true;
     _operators.erase(fd);
     _inviteList.erase(fd);
 }
 
 Client* Channel::findClientByNickname(const std::string& nickname) {
+    return findClientByNickname(nickname.data(), nickname.size());
+}
+
+Client* Channel::findClientByNickname(const char* nickname, size_t length) {
     for (std::map<int, Client*>::iterator it = _members.begin();
          it != _members.end(); ++it) {
-        if (it->second && it->second->getNickname() == nickname) {
+        if (it->second && it->second->getNickname().compare(0, std::string::npos, nickname, length) == 0) {
             return it->second;
         }
     }
@@ -66,20 +104,61 @@ bool Channel::isMember(int clientFd) const {
     return _members.find(clientFd) != _members.end();
 }
 
-void Channel::broadcast(const std::string& message, int senderFd) {
-    for (std::map<int, Client*>::iterator it = _members.begin();
-         it != _members.end(); ++it) {
-        if (it->first != senderFd && it->second) {
-            it->second->queueMessage(message);
+// Both broadcasts reach local members only; Server::relayToChannel() carries
+// a message to the links of remote members
+void Channel::setFanoutPool(FanoutPool* pool) {
+    _fanout = pool;
+}
+
+void Channel::memberCapsChanged(unsigned int from, unsigned int to) {
+    --_variantMembers[from];
+    ++_variantMembers[to];
+}
+
+// Hands the broadcast to the fan-out pool when the channel is big enough
+bool Channel::_fanOut(OutboundMessage& message, const Client* except) {
+    if (!_fanout || !_fanout->shouldSplit(_members.size())) {
+        return false;
+    }
+    if (_localMembersStale) {
+        _localMembers.clear();
+        for (std::map<int, Client*>::iterator it = _members.begin(); it != _members.end(); ++it) {
+            if (it->second && !it->second->isRemote()) {
+                _localMembers.push_back(it->second);
+            }
+        }
+        _localMembersStale = false;
+    }
+    unsigned int present = 0;
+    for (unsigned int v = 0; v < CAP_VARIANTS; ++v) {
+        if (_variantMembers[v] > 0) {
+            present |= 1u << v;
         }
     }
+    message.prepare(present);
+    _fanout->deliver(_localMembers, except, message);
+    return true;
+}
+
+void Channel::broadcast(const std::string& message, int senderFd) {
+    std::map<int, Client*>::iterator sender = _members.find(senderFd);
+    OutboundMessage outbound(message);
+    broadcast(outbound, sender != _members.end() ? sender->second : NULL);
 }
 
 void Channel::broadcastToAll(const std::string& message) {
+    OutboundMessage outbound(message);
+    broadcast(outbound, NULL);
+}
+
+void Channel::broadcast(OutboundMessage& message, const Client* except) {
+    if (_fanOut(message, except)) {
+        return;
+    }
     for (std::map<int, Client*>::iterator it = _members.begin();
          it != _members.end(); ++it) {
-        if (it->second) {
-            it->second->queueMessage(message);
+        if (it->second != except && it->second && !it->second->isRemote()) {
+            message.deliver(it->second);
         }
     }
 }
@@ -122,11 +201,23 @@ void Channel::removeInvite(int clientFd) {
     _inviteList.erase(clientFd);
 }
 
-Channel::JoinError Channel::canClientJoin(int clientFd, const std::string& key) const {
-    if (hasMode('i') && !isInvited(clientFd)) {
+const std::set<int>& Channel::getInviteList() const {
+    return _inviteList;
+}
+
+Channel::JoinError Channel::canClientJoin(Client* client, const char* key, size_t keyLength) const {
+    int clientFd = client->getFd();
+    // An INVITE gets past both bans and +i
+    if (!isInvited(clientFd) && isBanned(client)) {
+        return ERR_BANNEDFROMCHAN;
+    }
+    // A channel restored from the store may be +i with nobody left to
+    // invite: only an IRC operator gets back in (and becomes its operator)
+    bool operatorReopens = _members.empty() && client->hasMode('o');
+    if (hasMode('i') && !isInvited(clientFd) && !isInviteException(client) && !operatorReopens) {
         return ERR_INVITEONLYCHAN;
     }
-    if (hasMode('k') && key != _key) {
+    if (hasMode('k') && _key.compare(0, std::string::npos, key, keyLength) != 0) {
         return ERR_BADCHANNELKEY;
     }
     if (hasMode('l') && _members.size() >= _userLimit) {
@@ -135,6 +226,52 @@ Channel::JoinError Channel::canClientJoin(int clientFd, const std::string& key)
     return JOIN_SUCCESS;
 }
 
+bool Channel::isListMode(char mode) {
+    return mode == 'b' || mode == 'e' || mode == 'I';
+}
+
+MaskList& Channel::_maskList(char mode) {
+    if (mode == 'e') return _banExceptions;
+    if (mode == 'I') return _inviteExceptions;
+    return _bans;
+}
+
+const MaskList& Channel::getMaskList(char mode) const {
+    if (mode == 'e') return _banExceptions;
+    if (mode == 'I') return _inviteExceptions;
+    return _bans;
+}
+
+bool Channel::addListMask(char mode, const std::string& mask, const std::string& setBy, time_t setAt) {
+    if (!_maskList(mode).add(mask, setBy, setAt)) return false;
+    _maskVersion = g_nextMaskVersion++;
+    return true;
+}
+
+bool Channel::removeListMask(char mode, const std::string& mask) {
+    if (!_maskList(mode).remove(mask)) return false;
+    _maskVersion = g_nextMaskVersion++;
+    return true;
+}
+
+bool Channel::isBanned(Client* client) const {
+    if (_bans.empty()) return false;
+    bool banned;
+    if (client->findBanVerdict(_handle, _maskVersion, banned)) {
+        return banned;
+    }
+    std::string subject = foldedPrefix(client);
+    banned = _bans.matches(subject) && !_banExceptions.matches(subject);
+    if (client->isInChannel(_handle)) {
+        client->storeBanVerdict(_handle, _maskVersion, banned);
+    }
+    return banned;
+}
+
+bool Channel::isInviteException(const Client* client) const {
+    return !_inviteExceptions.empty() && _inviteExceptions.matches(foldedPrefix(client));
+}
+
 bool Channel::hasMode(char mode) const {
     return _modes.find(mode) != _modes.end();
 }
@@ -246,3 +383,39 @@ const std::string Channel::getCreationTimeString() const {
     oss << static_cast<long>(_createdAt);
     return oss.str();
 }
+
+time_t Channel::getCreationTime() const {
+    return _createdAt;
+}
+
+size_t Channel::memoryUsage() const {
+    return sizeof(*this) + heapBytes(_name) + heapBytes(_topic) + heapBytes(_topicSetter) + heapBytes(_key)
+        + heapBytes(_modes) + heapBytes(_members) + heapBytes(_localMembers) + heapBytes(_operators)
+        + heapBytes(_inviteList) + _bans.memoryUsage() + _banExceptions.memoryUsage()
+        + _inviteExceptions.memoryUsage() + _history.memoryUsage();
+}
+
+void Channel::setCreationTime(time_t createdAt) {
+    _createdAt = createdAt;
+}
+
+void Channel::recordMessage(const std::string& prefix, const std::string& text) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    uint64_t timeMs = static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+    _history.append(prefix, text, timeMs);
+}
+
+void Channel::recordMessage(const std::string& prefix, const char* text, size_t length, OutboundMessage& message) {
+    if (_history.getMaxLines() == 0 || _history.getMaxBytes() == 0) return;
+    _history.append(prefix, text, length, message.getTimeMs());
+    message.setMsgid(_history.endSeq() - 1);
+}
+
+const MessageHistory& Channel::getHistory() const {
+    return _history;
+}
+
+MessageHistory& Channel::getHistory() {
+    return _history;
+}
@@ -4,22 +4,31 @@
 #include <set>
 #include <vector>
 #include <ctime>
+#include "MessageHistory.hpp"
+#include "MaskList.hpp"
+#include "ChannelRegistry.hpp"
+#include "Capabilities.hpp"
 
 class Client;
+class FanoutPool;
+class OutboundMessage;
 
 class Channel {
 public:
     enum JoinError {
         JOIN_SUCCESS = 0,
         ERR_INVITEONLYCHAN = 473,
+        ERR_BANNEDFROMCHAN = 474,
         ERR_BADCHANNELKEY = 475,
         ERR_CHANNELISFULL = 471
     };
 
-    explicit Channel(const std::string& name);
+    Channel(const std::string& name, size_t historyLines, size_t historyBytes);
     ~Channel();
 
-    std::string getName() const;
+    const std::string& getName() const;
+    ChannelHandle getHandle() const;
+    void setHandle(ChannelHandle handle);
     std::string getTopic() const;
     std::string getTopicSetter() const;
     size_t getMemberCount() const;
@@ -28,10 +37,17 @@ public:
     void removeClient(Client* client);
     void removeClientByFd(int fd);
     Client* findClientByNickname(const std::string& nickname);
+    Client* findClientByNickname(const char* nickname, size_t length);
     bool isMember(int clientFd) const;
 
     void broadcast(const std::string& message, int senderFd);
     void broadcastToAll(const std::string& message);
+    // Each local member but `except` (may be NULL) gets its tag variant
+    void broadcast(OutboundMessage& message, const Client* except);
+    // A local member's tag capabilities (caps & CAP_TAG_MASK) changed
+    void memberCapsChanged(unsigned int from, unsigned int to);
+    // Broadcasts to at least the pool's threshold of members are spread over it
+    void setFanoutPool(FanoutPool* pool);
 
     bool isOperator(int clientFd) const;
     void addOperator(int clientFd);
@@ -43,8 +59,19 @@ public:
     void inviteClient(int clientFd);
     bool isInvited(int clientFd) const;
     void removeInvite(int clientFd);
+    const std::set<int>& getInviteList() const;
 
-    JoinError canClientJoin(int clientFd, const std::string& key) const;
+    JoinError canClientJoin(Client* client, const char* key, size_t keyLength) const;
+
+    // Ban (+b), ban exception (+e) and invite exception (+I) masks
+    static bool isListMode(char mode);
+    const MaskList& getMaskList(char mode) const;
+    // false if the mask is already on the list
+    bool addListMask(char mode, const std::string& mask, const std::string& setBy, time_t setAt);
+    bool removeListMask(char mode, const std::string& mask);
+    // Matches +b and no +e; remembered per member until either side changes
+    bool isBanned(Client* client) const;
+    bool isInviteException(const Client* client) const;
 
     bool hasMode(char mode) const;
     void addMode(char mode);
@@ -65,13 +92,28 @@ public:
     const std::map<int, Client*>& getMembers() const;
 
     const std::string getCreationTimeString() const;
+    time_t getCreationTime() const;
+    void setCreationTime(time_t createdAt);
+
+    void recordMessage(const std::string& prefix, const std::string& text);
+    // Records under the message's time and, if history is kept, tags the
+    // message with its msgid (the history sequence number)
+    void recordMessage(const std::string& prefix, const char* text, size_t length, OutboundMessage& message);
+    const MessageHistory& getHistory() const;
+    MessageHistory& getHistory();
+
+    // Bytes held by the channel: metadata, member and mode sets, history
+    size_t memoryUsage() const;
 
 private:
     Channel();
+    bool _fanOut(OutboundMessage& message, const Client* except);
+    MaskList& _maskList(char mode);
     Channel(const Channel& other);
     Channel& operator=(const Channel& other);
 
     std::string _name;
+    ChannelHandle _handle;
     std::string _topic;
     std::string _topicSetter;
     std::string _key;
@@ -80,6 +122,19 @@ private:
 
     std::set<char> _modes;
     std::map<int, Client*> _members;
+    // Local members in a flat array for FanoutPool, rebuilt after joins and parts
+    std::vector<Client*> _localMembers;
+    bool _localMembersStale;
+    FanoutPool* _fanout;
+    // Local members per tag variant, so the pool's variants are rendered
+    // before its threads need them
+    size_t _variantMembers[CAP_VARIANTS];
     std::set<int> _operators;
     std::set<int> _inviteList;
+    MaskList _bans;
+    MaskList _banExceptions;
+    MaskList _inviteExceptions;
+    // Server-wide unique, renewed on every list change; see Client::findBanVerdict
+    uint64_t _maskVersion;
+    MessageHistory _history;
 };
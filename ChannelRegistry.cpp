@@ -0,0 +1,149 @@
+#include "ChannelRegistry.hpp"
+#include "Channel.hpp"
+#include "utils.hpp"
+
+#define HANDLE_INDEX_BITS 22
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_MAX_GENERATION ((1u << (32 - HANDLE_INDEX_BITS)) - 1)
+#define MIN_SLOTS 16
+#define EMPTY_SLOT 0u
+#define TOMBSTONE_SLOT 0xFFFFFFFFu
+
+ChannelRegistry::ChannelRegistry()
+    : _live(0),
+      _tombstones(0) {
+}
+
+ChannelRegistry::~ChannelRegistry() {}
+
+Channel* ChannelRegistry::find(const std::string& name) const {
+    return find(name.data(), name.size());
+}
+
+Channel* ChannelRegistry::find(const char* name, size_t length) const {
+    long slot = _findSlot(name, length, ircHash(name, length));
+    if (slot < 0) {
+        return NULL;
+    }
+    return _entries[_slots[slot] - 1].channel;
+}
+
+Channel* ChannelRegistry::resolve(ChannelHandle handle) const {
+    uint32_t entryNo = handle & HANDLE_INDEX_MASK;
+    if (entryNo >= _entries.size()) {
+        return NULL;
+    }
+    const Entry& entry = _entries[entryNo];
+    if (entry.generation != (handle >> HANDLE_INDEX_BITS)) {
+        return NULL;
+    }
+    return entry.channel;
+}
+
+// The caller has checked with find() that the name is not taken
+ChannelHandle ChannelRegistry::insert(Channel* channel) {
+    if ((_live + _tombstones + 1) * 4 > _slots.size() * 3) {
+        size_t slotCount = MIN_SLOTS;
+        while (slotCount < (_live + 1) * 2) slotCount *= 2;
+        _rehash(slotCount);
+    }
+
+    uint32_t entryNo;
+    if (!_freeEntries.empty()) {
+        entryNo = _freeEntries.back();
+        _freeEntries.pop_back();
+    } else {
+        if (_entries.size() > HANDLE_INDEX_MASK) {
+            throw std::runtime_error("Error: too many channels");
+        }
+        entryNo = static_cast<uint32_t>(_entries.size());
+        Entry fresh;
+        fresh.channel = NULL;
+        fresh.hash = 0;
+        fresh.generation = 1;
+        _entries.push_back(fresh);
+    }
+
+    Entry& entry = _entries[entryNo];
+    entry.channel = channel;
+    entry.hash = ircHash(channel->getName());
+    _placeSlot(entry.hash, entryNo);
+    _live++;
+    return (entry.generation << HANDLE_INDEX_BITS) | entryNo;
+}
+
+void ChannelRegistry::erase(ChannelHandle handle) {
+    Channel* channel = resolve(handle);
+    if (!channel) {
+        return;
+    }
+    uint32_t entryNo = handle & HANDLE_INDEX_MASK;
+    Entry& entry = _entries[entryNo];
+
+    const std::string& name = channel->getName();
+    long slot = _findSlot(name.data(), name.size(), entry.hash);
+    if (slot >= 0) {
+        _slots[slot] = TOMBSTONE_SLOT;
+        _tombstones++;
+    }
+    entry.channel = NULL;
+    entry.generation = (entry.generation == HANDLE_MAX_GENERATION) ? 1 : entry.generation + 1;
+    _freeEntries.push_back(entryNo);
+    _live--;
+}
+
+size_t ChannelRegistry::size() const {
+    return _live;
+}
+
+size_t ChannelRegistry::capacity() const {
+    return _entries.size();
+}
+
+Channel* ChannelRegistry::at(size_t index) const {
+    return _entries[index].channel;
+}
+
+long ChannelRegistry::_findSlot(const char* name, size_t length, uint32_t hash) const {
+    if (_slots.empty()) {
+        return -1;
+    }
+    size_t mask = _slots.size() - 1;
+    for (size_t i = 0, slot = hash & mask; i < _slots.size(); ++i, slot = (slot + 1) & mask) {
+        uint32_t value = _slots[slot];
+        if (value == EMPTY_SLOT) {
+            return -1;
+        }
+        if (value == TOMBSTONE_SLOT) {
+            continue;
+        }
+        const Entry& entry = _entries[value - 1];
+        if (entry.hash == hash && ircEquals(name, length, entry.channel->getName().c_str())) {
+            return static_cast<long>(slot);
+        }
+    }
+    return -1;
+}
+
+void ChannelRegistry::_placeSlot(uint32_t hash, uint32_t entryNo) {
+    size_t mask = _slots.size() - 1;
+    size_t slot = hash & mask;
+    while (_slots[slot] != EMPTY_SLOT && _slots[slot] != TOMBSTONE_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    if (_slots[slot] == TOMBSTONE_SLOT) {
+        _tombstones--;
+    }
+    _slots[slot] = entryNo + 1;
+}
+
+// Rebuilds the index at the given power-of-two size, dropping tombstones
+void ChannelRegistry::_rehash(size_t slotCount) {
+    _slots.assign(slotCount, EMPTY_SLOT);
+    _tombstones = 0;
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (_entries[i].channel) {
+            _placeSlot(_entries[i].hash, static_cast<uint32_t>(i));
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+class Channel;
+
+// Refers to a channel without pinning it: the entry number in the low bits
+// and the entry's generation above them. Once the channel is gone the entry
+// moves to a new generation and the old handle stops resolving.
+typedef uint32_t ChannelHandle;
+#define INVALID_CHANNEL_HANDLE 0u
+
+// Live channels by RFC 1459 casemapped name.
+//
+// Channels sit in a dense entry array; an open-addressing index (linear
+// probing) of entry numbers is keyed by the folded name's hash. A lookup
+// folds and compares in place against the name the channel already holds,
+// so neither side needs a lowered copy. The registry does not own channels.
+class ChannelRegistry {
+public:
+    ChannelRegistry();
+    ~ChannelRegistry();
+
+    Channel* find(const std::string& name) const;
+    Channel* find(const char* name, size_t length) const;
+    Channel* resolve(ChannelHandle handle) const;
+    ChannelHandle insert(Channel* channel);
+    void erase(ChannelHandle handle);
+    size_t size() const;
+
+    // Entry-order iteration; entries without a live channel yield NULL
+    size_t capacity() const;
+    Channel* at(size_t index) const;
+
+private:
+    ChannelRegistry(const ChannelRegistry& other);
+    ChannelRegistry& operator=(const ChannelRegistry& other);
+
+    struct Entry {
+        Channel* channel;
+        uint32_t hash;
+        uint32_t generation;
+    };
+
+    long _findSlot(const char* name, size_t length, uint32_t hash) const;
+    void _placeSlot(uint32_t hash, uint32_t entryNo);
+    void _rehash(size_t slotCount);
+
+    std::vector<Entry> _entries;
+    std::vector<uint32_t> _slots;
+    std::vector<uint32_t> _freeEntries;
+    size_t _live;
+    size_t _tombstones;
+};
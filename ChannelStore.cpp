@@ -0,0 +1,355 @@
+#include "ChannelStore.hpp"
+#include "Channel.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define INITIAL_INDEX_CAPACITY 1024
+#define INITIAL_RECORD_CAPACITY 256
+#define EMPTY_SLOT 0u
+#define TOMBSTONE_SLOT 0xFFFFFFFFu
+
+#define CASE_SENSITIVE_VERSION 1
+static void copyField(char* dst, size_t size, const std::string& value) {
+    size_t length = value.size() < size - 1 ? value.size() : size - 1;
+    std::memcpy(dst, value.data(), length);
+    std::memset(dst + length, 0, size - length);
+}
+
+static std::string readField(const char* src, size_t size) {
+    size_t length = 0;
+    while (length < size && src[length] != '\0') ++length;
+    return std::string(src, length);
+}
+
+ChannelStore::ChannelStore() : _fd(-1), _base(NULL), _length(0) {}
+
+ChannelStore::~ChannelStore() {
+    close();
+}
+
+bool ChannelStore::isOpen() const {
+    return _base != NULL;
+}
+
+size_t ChannelStore::size() const {
+    return _base ? reinterpret_cast<Header*>(_base)->liveCount : 0;
+}
+
+uint32_t* ChannelStore::_index() const {
+    return reinterpret_cast<uint32_t*>(_base + sizeof(Header));
+}
+
+ChannelStore::Record* ChannelStore::_records() const {
+    const Header* header = reinterpret_cast<const Header*>(_base);
+    return reinterpret_cast<Record*>(_base + sizeof(Header) + header->indexCapacity * sizeof(uint32_t));
+}
+
+bool ChannelStore::_map(size_t length) {
+    void* addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    _base = static_cast<char*>(addr);
+    _length = length;
+    return true;
+}
+
+void ChannelStore::_unmap() {
+    if (_base) {
+        msync(_base, _length, MS_ASYNC);
+        munmap(_base, _length);
+        _base = NULL;
+        _length = 0;
+    }
+}
+
+void ChannelStore::close() {
+    _unmap();
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+// Builds an empty store in "<path>.tmp"; it replaces <path> on rename
+bool ChannelStore::_create(const std::string& path, uint32_t indexCapacity, uint32_t recordCapacity) {
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    size_t length = sizeof(Header) + indexCapacity * sizeof(uint32_t) + recordCapacity * sizeof(Record);
+    _fd = fd;
+    _path = path;
+    if (ftruncate(fd, length) < 0 || !_map(length)) {
+        close();
+        unlink(tmpPath.c_str());
+        return false;
+    }
+
+    Header* header = reinterpret_cast<Header*>(_base);
+    std::memcpy(header->magic, CHANNEL_STORE_MAGIC, sizeof(header->magic));
+    header->version = CHANNEL_STORE_VERSION;
+    header->recordSize = sizeof(Record);
+    header->indexCapacity = indexCapacity;
+    header->recordCapacity = recordCapacity;
+    return true;
+}
+
+bool ChannelStore::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+            _fd = fd;
+            _path = path;
+            if (_map(st.st_size)) {
+                const Header* header = reinterpret_cast<const Header*>(_base);
+                bool valid = std::memcmp(header->magic, CHANNEL_STORE_MAGIC, sizeof(header->magic)) == 0
+                    && (header->version == CHANNEL_STORE_VERSION || header->version == CASE_SENSITIVE_VERSION)
+                    && header->recordSize == sizeof(Record)
+                    && header->indexCapacity > 0
+                    && (header->indexCapacity & (header->indexCapacity - 1)) == 0
+                    && header->recordCount <= header->recordCapacity
+                    && _length == sizeof(Header) + header->indexCapacity * sizeof(uint32_t)
+                        + static_cast<size_t>(header->recordCapacity) * sizeof(Record);
+                if (valid) {
+                    if (header->version == CASE_SENSITIVE_VERSION) {
+                        _migrateCasemapping();
+                    }
+                    return true;
+                }
+            }
+            ngircd_log("warning", "Channel store " + path + " has an incompatible format, starting a new one");
+            close();
+        } else {
+            ::close(fd);
+        }
+    }
+
+    if (!_create(path, INITIAL_INDEX_CAPACITY, INITIAL_RECORD_CAPACITY)
+        || rename((path + ".tmp").c_str(), path.c_str()) < 0) {
+        ngircd_log("error", "Cannot create channel store " + path + ": " + std::strerror(errno));
+        close();
+        return false;
+    }
+    return true;
+}
+
+long ChannelStore::_findSlot(const std::string& name, uint32_t hash) const {
+    const Header* header = reinterpret_cast<const Header*>(_base);
+    const uint32_t* index = _index();
+    const Record* records = _records();
+    uint32_t mask = header->indexCapacity - 1;
+
+    for (uint32_t i = 0, slot = hash & mask; i < header->indexCapacity; ++i, slot = (slot + 1) & mask) {
+        uint32_t value = index[slot];
+        if (value == EMPTY_SLOT) {
+            return -1;
+        }
+        if (value == TOMBSTONE_SLOT) {
+            continue;
+        }
+        const Record& record = records[value - 1];
+        if (record.hash == hash && name.size() < sizeof(record.name) && ircEquals(name, record.name)) {
+            return static_cast<long>(slot);
+        }
+    }
+    return -1;
+}
+
+void ChannelStore::_insertIndex(uint32_t hash, uint32_t recordNo) {
+    Header* header = reinterpret_cast<Header*>(_base);
+    uint32_t* index = _index();
+    uint32_t mask = header->indexCapacity - 1;
+
+    uint32_t slot = hash & mask;
+    while (index[slot] != EMPTY_SLOT && index[slot] != TOMBSTONE_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    if (index[slot] == TOMBSTONE_SLOT) {
+        header->tombstones--;
+    }
+    index[slot] = recordNo + 1;
+}
+
+// Version 1 hashed and compared names case-sensitively. Every live record is
+// indexed again under the casemapping; where two names now fold together,
+// the later record is dropped.
+void ChannelStore::_migrateCasemapping() {
+    Header* header = reinterpret_cast<Header*>(_base);
+    uint32_t* index = _index();
+    Record* records = _records();
+
+    std::vector<uint32_t> live;
+    for (uint32_t slot = 0; slot < header->indexCapacity; ++slot) {
+        if (index[slot] != EMPTY_SLOT && index[slot] != TOMBSTONE_SLOT) {
+            live.push_back(index[slot] - 1);
+        }
+    }
+    std::sort(live.begin(), live.end());
+    std::memset(index, 0, header->indexCapacity * sizeof(uint32_t));
+    header->tombstones = 0;
+
+    for (size_t i = 0; i < live.size(); ++i) {
+        uint32_t recordNo = live[i];
+        Record& record = records[recordNo];
+        std::string name = readField(record.name, sizeof(record.name));
+        record.hash = ircHash(name);
+        if (_findSlot(name, record.hash) >= 0) {
+            ngircd_log("warning", "Channel store: dropping " + name + ", which now folds onto an existing channel");
+            std::memset(&record, 0, sizeof(record));
+            record.nextFree = header->freeHead;
+            header->freeHead = recordNo + 1;
+            header->liveCount--;
+            continue;
+        }
+        _insertIndex(record.hash, recordNo);
+    }
+    header->version = CHANNEL_STORE_VERSION;
+    ngircd_log("info", "Channel store " + _path + " converted to casemapped names");
+}
+
+// Rebuilds the store with room to spare: live records are copied compactly
+// into a new file which then atomically replaces the old one
+bool ChannelStore::_grow() {
+    const Header* header = reinterpret_cast<const Header*>(_base);
+    uint32_t live = header->liveCount;
+    uint32_t indexCapacity = header->indexCapacity;
+    while ((live + 1) * 4 > indexCapacity) indexCapacity *= 2;
+    uint32_t recordCapacity = header->recordCapacity;
+    while ((live + 1) * 2 > recordCapacity) recordCapacity *= 2;
+
+    ChannelStore next;
+    if (!next._create(_path, indexCapacity, recordCapacity)) {
+        ngircd_log("error", "Cannot grow channel store " + _path + ": " + std::strerror(errno));
+        return false;
+    }
+
+    Header* nextHeader = reinterpret_cast<Header*>(next._base);
+    const uint32_t* index = _index();
+    const Record* records = _records();
+    Record* nextRecords = next._records();
+    for (uint32_t slot = 0; slot < header->indexCapacity; ++slot) {
+        uint32_t value = index[slot];
+        if (value == EMPTY_SLOT || value == TOMBSTONE_SLOT) continue;
+        uint32_t recordNo = nextHeader->recordCount++;
+        nextRecords[recordNo] = records[value - 1];
+        next._insertIndex(nextRecords[recordNo].hash, recordNo);
+    }
+    nextHeader->liveCount = nextHeader->recordCount;
+
+    if (rename((_path + ".tmp").c_str(), _path.c_str()) < 0) {
+        ngircd_log("error", "Cannot replace channel store " + _path + ": " + std::strerror(errno));
+        unlink((_path + ".tmp").c_str());
+        return false;
+    }
+
+    std::swap(_fd, next._fd);
+    std::swap(_base, next._base);
+    std::swap(_length, next._length);
+    return true;
+}
+
+bool ChannelStore::load(const std::string& name, Channel& channel) const {
+    if (!_base) return false;
+
+    long slot = _findSlot(name, ircHash(name));
+    if (slot < 0) {
+        return false;
+    }
+    const Record& record = _records()[_index()[slot] - 1];
+
+    for (size_t i = 0; i < sizeof(record.modes) && record.modes[i] != '\0'; ++i) {
+        channel.addMode(record.modes[i]);
+    }
+    std::string key = readField(record.key, sizeof(record.key));
+    if (!key.empty()) {
+        channel.setKey(key);
+    }
+    if (record.userLimit > 0) {
+        channel.setUserLimit(record.userLimit);
+    }
+    std::string topic = readField(record.topic, sizeof(record.topic));
+    if (!topic.empty()) {
+        channel.setTopic(topic, readField(record.topicSetter, sizeof(record.topicSetter)));
+    }
+    channel.setCreationTime(static_cast<time_t>(record.createdAt));
+    return true;
+}
+
+void ChannelStore::save(const Channel& channel) {
+    if (!_base) return;
+
+    const std::string name = channel.getName();
+    uint32_t hash = ircHash(name);
+    if (name.size() >= STORED_NAME_SIZE) {
+        return;
+    }
+
+    Record* record;
+    long slot = _findSlot(name, hash);
+    if (slot >= 0) {
+        record = &_records()[_index()[slot] - 1];
+    } else {
+        Header* header = reinterpret_cast<Header*>(_base);
+        if ((header->liveCount + header->tombstones + 1) * 2 > header->indexCapacity
+            || (header->freeHead == 0 && header->recordCount == header->recordCapacity)) {
+            if (!_grow()) return;
+            header = reinterpret_cast<Header*>(_base);
+        }
+
+        uint32_t recordNo;
+        if (header->freeHead != 0) {
+            recordNo = header->freeHead - 1;
+            header->freeHead = _records()[recordNo].nextFree;
+        } else {
+            recordNo = header->recordCount++;
+        }
+        _insertIndex(hash, recordNo);
+        header->liveCount++;
+        record = &_records()[recordNo];
+        record->hash = hash;
+        record->nextFree = 0;
+        copyField(record->name, sizeof(record->name), name);
+    }
+
+    std::string modes = channel.getModeString();
+    copyField(record->modes, sizeof(record->modes), modes.substr(1));
+    copyField(record->key, sizeof(record->key), channel.getKey());
+    record->userLimit = static_cast<uint32_t>(channel.getUserLimit());
+    copyField(record->topic, sizeof(record->topic), channel.getTopic());
+    copyField(record->topicSetter, sizeof(record->topicSetter), channel.getTopicSetter());
+    record->createdAt = static_cast<int64_t>(channel.getCreationTime());
+}
+
+void ChannelStore::erase(const std::string& name) {
+    if (!_base) return;
+
+    long slot = _findSlot(name, ircHash(name));
+    if (slot < 0) {
+        return;
+    }
+    Header* header = reinterpret_cast<Header*>(_base);
+    uint32_t* index = _index();
+    uint32_t recordNo = index[slot] - 1;
+
+    Record& record = _records()[recordNo];
+    std::memset(&record, 0, sizeof(record));
+    record.nextFree = header->freeHead;
+    header->freeHead = recordNo + 1;
+
+    index[slot] = TOMBSTONE_SLOT;
+    header->tombstones++;
+    header->liveCount--;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+class Channel;
+
+#define CHANNEL_STORE_MAGIC "FTIRCCHN"
+#define CHANNEL_STORE_VERSION 2
+#define STORED_NAME_SIZE 64
+
+// Channel metadata (topic, setter, key, limit, modes) kept in a memory-mapped
+// file so that it survives a restart.
+//
+// The file is a header, an open-addressing index of record numbers and a
+// dense array of fixed-size records. Names are matched under the RFC 1459
+// casemapping. Opening it only maps and checks the
+// header; a channel is looked up when it is first created again. Every state
+// change writes its record in place.
+class ChannelStore {
+public:
+    ChannelStore();
+    ~ChannelStore();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+    size_t size() const;
+
+    bool load(const std::string& name, Channel& channel) const;
+    void save(const Channel& channel);
+    void erase(const std::string& name);
+
+private:
+    ChannelStore(const ChannelStore& other);
+    ChannelStore& operator=(const ChannelStore& other);
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t indexCapacity;
+        uint32_t recordCapacity;
+        uint32_t recordCount;
+        uint32_t liveCount;
+        uint32_t tombstones;
+        uint32_t freeHead;
+        char reserved[24];
+    };
+
+    struct Record {
+        uint32_t hash;
+        uint32_t nextFree;
+        uint32_t userLimit;
+        uint32_t reserved;
+        int64_t createdAt;
+        char modes[16];
+        char name[STORED_NAME_SIZE];
+        char key[64];
+        char topicSetter[64];
+        char topic[512];
+    };
+
+    bool _map(size_t length);
+    void _unmap();
+    bool _create(const std::string& path, uint32_t indexCapacity, uint32_t recordCapacity);
+    bool _grow();
+    void _migrateCasemapping();
+    uint32_t* _index() const;
+    Record* _records() const;
+    long _findSlot(const std::string& name, uint32_t hash) const;
+    void _insertIndex(uint32_t hash, uint32_t recordNo);
+
+    std::string _path;
+    int _fd;
+    char* _base;
+    size_t _length;
+};
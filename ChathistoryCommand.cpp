@@ -0,0 +1,225 @@
+#include "ChathistoryCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "ReplyStream.hpp"
+#include "OutboundMessage.hpp"
+#include "utils.hpp"
+#include "MemoryUsage.hpp"
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <stdint.h>
+
+#define CHATHISTORY_MAX_LIMIT 100
+
+// Replays a fixed range of a channel's history, a few lines at a time.
+// Lines evicted from the ring while the replay is paused are skipped. With
+// a batch reference the lines go out tagged inside "BATCH +ref chathistory
+// <channel>" ... "BATCH -ref", which is sent even when nothing is left to
+// replay, so the client can tell an empty range from one still coming.
+class HistoryReplayStream : public ReplyStream {
+public:
+    HistoryReplayStream(const std::string& channelName, uint64_t fromSeq, uint64_t toSeq, const std::string& batch)
+        : _channelName(channelName), _nextSeq(fromSeq), _endSeq(toSeq), _batch(batch), _opened(false) {}
+
+    virtual size_t memoryUsage() const {
+        return sizeof(*this) + heapBytes(_channelName) + heapBytes(_batch);
+    }
+
+    virtual bool resume(Server& server, Client* client) {
+        if (!_batch.empty() && !_opened) {
+            client->queueMessage(":" + server.getServerName() + " BATCH +" + _batch + " chathistory " + _channelName + "\r\n");
+            _opened = true;
+        }
+        Channel* channel = server.getChannel(_channelName);
+        if (!channel || !channel->isMember(client->getFd())) {
+            return _close(server, client);
+        }
+        const MessageHistory& history = channel->getHistory();
+        if (_nextSeq < history.firstSeq()) {
+            _nextSeq = history.firstSeq();
+        }
+        while (_nextSeq < _endSeq && client->getSendQueue().size() < SENDQ_WATERMARK) {
+            uint64_t seq = _nextSeq++;
+            const MessageHistory::Entry* entry = history.find(seq);
+            if (!entry) continue;
+            OutboundMessage line(":" + history.prefixOf(*entry) + " PRIVMSG " + _channelName
+                + " :" + history.textOf(*entry) + "\r\n");
+            line.setTimeMs(entry->timeMs);
+            line.setMsgid(seq);
+            line.setBatch(_batch);
+            line.deliver(client);
+        }
+        return _nextSeq >= _endSeq && _close(server, client);
+    }
+
+private:
+    bool _close(Server& server, Client* client) {
+        if (!_batch.empty()) {
+            client->queueMessage(":" + server.getServerName() + " BATCH -" + _batch + "\r\n");
+        }
+        return true;
+    }
+
+    std::string _channelName;
+    uint64_t _nextSeq;
+    uint64_t _endSeq;
+    std::string _batch;
+    bool _opened;
+};
+
+// Batch references only have to be unique per connection
+static unsigned long nextBatchId = 0;
+
+ChathistoryCommand::ChathistoryCommand() {}
+ChathistoryCommand::~ChathistoryCommand() {}
+
+bool ChathistoryCommand::requiresRegistration() const {
+    return true;
+}
+
+static void sendFail(Server& server, Client* client, const std::string& code, const std::string& context, const std::string& description) {
+    client->queueMessage(":" + server.getServerName() + " FAIL CHATHISTORY " + code + " " + context + " :" + description + "\r\n");
+}
+
+// Parses "YYYY-MM-DDThh:mm:ss[.sss]Z" into milliseconds since the epoch
+static bool parseTimestamp(const std::string& value, uint64_t& outMs) {
+    struct tm tm;
+    std::memset(&tm, 0, sizeof(tm));
+    int millis = 0;
+    int consumed = 0;
+    if (std::sscanf(value.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n",
+            &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &consumed) != 6) {
+        return false;
+    }
+    const char* rest = value.c_str() + consumed;
+    if (*rest == '.') {
+        int digits = 0;
+        ++rest;
+        while (*rest >= '0' && *rest <= '9') {
+            if (digits < 3) {
+                millis = millis * 10 + (*rest - '0');
+                ++digits;
+            }
+            ++rest;
+        }
+        while (digits++ < 3) millis *= 10;
+    }
+    if (*rest != 'Z' || rest[1] != '\0') {
+        return false;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    time_t seconds = timegm(&tm);
+    if (seconds < 0) {
+        return false;
+    }
+    outMs = static_cast<uint64_t>(seconds) * 1000 + millis;
+    return true;
+}
+
+enum Boundary { BEFORE_REF, AFTER_REF };
+
+// Resolves "msgid=N" or "timestamp=..." into the first sequence number on the
+// requested side of the reference
+static bool resolveReference(const MessageHistory& history, const std::string& ref, Boundary side, uint64_t& outSeq) {
+    if (ref.compare(0, 6, "msgid=") == 0) {
+        std::string digits = ref.substr(6);
+        if (digits.empty() || digits.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        errno = 0;
+        unsigned long long seq = std::strtoull(digits.c_str(), NULL, 10);
+        if (errno == ERANGE) {
+            return false;
+        }
+        outSeq = (side == BEFORE_REF) ? seq : seq + 1;
+        return true;
+    }
+    if (ref.compare(0, 10, "timestamp=") == 0) {
+        uint64_t timeMs;
+        if (!parseTimestamp(ref.substr(10), timeMs)) {
+            return false;
+        }
+        outSeq = (side == BEFORE_REF) ? history.seqAtOrAfterTime(timeMs) : history.seqAfterTime(timeMs);
+        return true;
+    }
+    return false;
+}
+
+void ChathistoryCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    if (args.size() != 5) {
+        client->reply(461, toString(args[0]));
+        return;
+    }
+
+    std::string subcommand = toString(args[1]);
+    for (size_t i = 0; i < subcommand.length(); ++i) {
+        subcommand[i] = std::toupper(subcommand[i]);
+    }
+    std::string target = toString(args[2]);
+    std::string ref = toString(args[3]);
+
+    if (subcommand != "LATEST" && subcommand != "BEFORE" && subcommand != "AFTER") {
+        sendFail(server, client, "INVALID_PARAMS", toString(args[1]), "Unknown subcommand");
+        return;
+    }
+
+    Channel* channel = server.getChannel(target);
+    if (!isValidChannelName(target) || !channel || !channel->isMember(client->getFd())) {
+        sendFail(server, client, "INVALID_TARGET", subcommand + " " + target, "Messages could not be retrieved");
+        return;
+    }
+
+    char* endptr = NULL;
+    errno = 0;
+    unsigned long limit = std::strtoul(args[4].c_str(), &endptr, 10);
+    if (args[4].empty() || *endptr != '\0' || errno == ERANGE || limit == 0) {
+        sendFail(server, client, "INVALID_PARAMS", subcommand + " " + toString(args[4]), "Invalid limit");
+        return;
+    }
+    if (limit > CHATHISTORY_MAX_LIMIT) {
+        limit = CHATHISTORY_MAX_LIMIT;
+    }
+
+    const MessageHistory& history = channel->getHistory();
+    uint64_t first = history.firstSeq();
+    uint64_t end = history.endSeq();
+    uint64_t from = first;
+    uint64_t to = end;
+    bool valid = true;
+
+    if (subcommand == "LATEST") {
+        if (ref != "*") {
+            valid = resolveReference(history, ref, AFTER_REF, from);
+            if (from < first) from = first;
+        }
+        if (to - first > limit && to - limit > from) {
+            from = to - limit;
+        }
+    } else if (subcommand == "BEFORE") {
+        valid = resolveReference(history, ref, BEFORE_REF, to);
+        if (to > end) to = end;
+        if (to > first + limit) from = to - limit;
+    } else {
+        valid = resolveReference(history, ref, AFTER_REF, from);
+        if (from < first) from = first;
+        if (from < end && end - from > limit) to = from + limit;
+    }
+
+    if (!valid) {
+        sendFail(server, client, "INVALID_PARAMS", subcommand + " " + ref, "Invalid message reference");
+        return;
+    }
+    std::string batch;
+    if (client->getCaps() & CAP_BATCH) {
+        std::ostringstream oss;
+        oss << "ch" << ++nextBatchId;
+        batch = oss.str();
+    }
+    client->addReplyStream(new HistoryReplayStream(channel->getName(), from, to, batch));
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+class ChathistoryCommand : public ICommand {
+public:
+    ChathistoryCommand();
+    virtual ~ChathistoryCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    ChathistoryCommand(const ChathistoryCommand& other);
+    ChathistoryCommand& operator=(const ChathistoryCommand& other);
+};
@@ -1,30 +1,81 @@
 #include "Client.hpp"
 #include "Server.hpp"
+#include "Channel.hpp"
+#include "Capabilities.hpp"
+#include "ReplyStream.hpp"
+#include "MemoryUsage.hpp"
 #include <unistd.h>
 #include <iostream>
 #include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#define CLIENT_ALIGN 64
 
 Client::Client(int fd, const std::string& hostname, Server* server, uint32_t epollEvents):
     _fd(fd),
-    _recvBuffer(""),
-    _sendBuffer(""),
-    _password(""),
-    _nickname(""),
-    _username(""),
-    _hostname(hostname),
+    _epollEvents(epollEvents),
+    _caps(0),
     _hasRegistered(false),
+    _flushPending(false),
+    _isServerLink(false),
+    _capNegotiating(false),
+    _authPending(false),
     _server(server),
-    _epollEvents(epollEvents)
-{}
+    _uplink(NULL),
+    _fanoutMark(0),
+    _bufferBytes(0),
+    _recvScanned(0),
+    _prefix("*"),
+    _hostname(server->internHostname(hostname)),
+    _zerocopy(ZEROCOPY_OFF),
+    _modes(0),
+    _nextReady(NULL),
+    _identityGeneration(0),
+    _cold(new Cold())
+{
+    _cold->nickTs = 0;
+    _cold->linkInitiated = false;
+    _cold->connecting = false;
+    _cold->admitted = false;
+    _cold->authTicket = 0;
+    _cold->saslStarted = false;
+    _cold->createWindow = 0;
+    _cold->channelsCreated = 0;
+}
 
-Client::~Client() {}
+Client::~Client() {
+    for (size_t i = 0; i < _replyStreams.size(); ++i) {
+        delete _replyStreams[i];
+    }
+    if (_bufferBytes) {
+        _server->adjustBufferBytes(-static_cast<long>(_bufferBytes));
+    }
+    _server->releaseHostname(_hostname);
+    delete _cold;
+}
+
+// Cache line aligned, so that the hot fields at the front share as few
+// lines as they can
+void* Client::operator new(size_t size) {
+    void* p = NULL;
+    if (posix_memalign(&p, CLIENT_ALIGN, size) != 0) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void Client::operator delete(void* p) {
+    std::free(p);
+}
 
 int Client::getFd() const {
     return _fd;
 }
 
 const std::string& Client::getPassword() const {
-    return _password;
+    return _cold->password;
 }
 
 const std::string& Client::getNickname() const {
@@ -36,30 +87,39 @@ const std::string& Client::getUsername() const {
 }
 
 const std::string& Client::getRealname() const {
-    return _realname;
+    return _cold->realname;
 }
 
 const std::string& Client::getHostname() const {
-    return _hostname;
+    return _server->getHostname(_hostname);
 }
 
 bool Client::hasRegistered() const {
     return _hasRegistered;
 }
 
-std::string Client::getPrefix() const {
+const std::string& Client::getPrefix() const {
+    return _prefix;
+}
+
+void Client::_updatePrefix() {
     if (_nickname.empty()) {
-        return "*";
+        _prefix = "*";
+        return;
     }
-    return _nickname + "!" + (_username.empty() ? "*" : "~" +  _username) + "@" + _hostname;
+    _prefix = _nickname + "!" + (_username.empty() ? "*" : "~" +  _username) + "@" + getHostname();
 }
 
 const std::string& Client::getRecvBuffer() const {
     return _recvBuffer;
 }
 
-const std::string& Client::getSendBuffer() const {
-    return _sendBuffer;
+size_t Client::getRecvScanned() const {
+    return _recvScanned;
+}
+
+const SendQueue& Client::getSendQueue() const {
+    return _sendQueue;
 }
 
 uint32_t Client::getEpollEvents() const {
@@ -67,8 +127,24 @@ uint32_t Client::getEpollEvents() const {
 }
 
 void Client::queueMessage(const std::string& message) {
-    _sendBuffer += message;
-    _server->enableEpollOut(_fd);
+    queueMessage(message.data(), message.size());
+}
+
+void Client::queueMessage(const char* message, size_t length) {
+    // Users on other servers are reached through the link toward them
+    if (_uplink) {
+        _uplink->queueMessage(message, length);
+        return;
+    }
+    _sendQueue.append(message, length);
+    _accountBuffers();
+    _server->scheduleFlush(this);
+}
+
+void Client::queueShared(SharedMessage* message) {
+    _sendQueue.append(message);
+    _accountBuffers();
+    _server->scheduleFlush(this);
 }
 
 void Client::reply(int replyCode, const std::string& message) {
@@ -94,6 +170,18 @@ void Client::reply(int replyCode, const std::string& message) {
         case 003:
             replyMsg += " :This server has been started " + _server->getStartTimeString();
             break;
+        case 263: // RPL_TRYAGAIN
+            replyMsg += " :Please wait a while and try again.";
+            break;
+        case 381: // RPL_YOUREOPER
+            replyMsg += " :You are now an IRC operator";
+            break;
+        case 410: // ERR_INVALIDCAPCMD
+            replyMsg += " :Invalid CAP command";
+            break;
+        case 417: // ERR_INPUTTOOLONG
+            replyMsg += " :Input line was too long";
+            break;
         case 421: // ERR_UNKNOWNCOMMAND
             replyMsg += " :Unknown command";
             break;
@@ -103,96 +191,457 @@ void Client::reply(int replyCode, const std::string& message) {
         case 461: // ERR_NEEDMOREPARAMS
             replyMsg += " :Syntax error";
             break;
+        case 464: // ERR_PASSWDMISMATCH
+            replyMsg += " :Password incorrect";
+            break;
         case 471: // ERR_CHANNELISFULL
             replyMsg += " :Cannot join channel (+l) -- Channel is full, try later";
             break;
         case 473: // ERR_INVITEONLYCHAN
             replyMsg += " :Cannot join channel (+i) -- Invited users only";
             break;
+        case 474: // ERR_BANNEDFROMCHAN
+            replyMsg += " :Cannot join channel (+b) -- You are banned";
+            break;
         case 475: // ERR_BADCHANNELKEY
             replyMsg += " :Cannot join channel (+k) -- Wrong channel key";
             break;
+        case 481: // ERR_NOPRIVILEGES
+            replyMsg += " :Permission Denied- You're not an IRC operator";
+            break;
+        case 491: // ERR_NOOPERHOST
+            replyMsg += " :No O-lines for your host";
+            break;
+        case 900: // RPL_LOGGEDIN (message: "<prefix> <account>")
+            replyMsg += " :You are now logged in as " + getAccount();
+            break;
+        case 903: // RPL_SASLSUCCESS
+            replyMsg += " :SASL authentication successful";
+            break;
+        case 904: // ERR_SASLFAIL
+            replyMsg += " :SASL authentication failed";
+            break;
+        case 905: // ERR_SASLTOOLONG
+            replyMsg += " :SASL message too long";
+            break;
+        case 906: // ERR_SASLABORTED
+            replyMsg += " :SASL authentication aborted";
+            break;
+        case 907: // ERR_SASLALREADY
+            replyMsg += " :You have already authenticated using SASL";
+            break;
+        case 908: // RPL_SASLMECHS
+            replyMsg += " :are available SASL mechanisms";
+            break;
     }
     replyMsg += "\r\n";
     queueMessage(replyMsg);
 }
 
+static uint64_t modeBit(char mode) {
+    unsigned int index = static_cast<unsigned char>(mode) - 'A';
+    return (index < 64) ? (static_cast<uint64_t>(1) << index) : 0;
+}
+
 bool Client::hasMode(char mode) const {
-    return _modes.count(mode) > 0;
+    return (_modes & modeBit(mode)) != 0;
+}
+
+std::string Client::getModes() const {
+    std::string letters;
+    for (unsigned int index = 0; index < 64; ++index) {
+        if (_modes & (static_cast<uint64_t>(1) << index)) {
+            letters += static_cast<char>('A' + index);
+        }
+    }
+    return letters;
+}
+
+uint32_t Client::getCaps() const {
+    return _caps;
 }
 
+bool Client::hasCap(uint32_t cap) const {
+    return (_caps & cap) != 0;
+}
+
+bool Client::isCapNegotiating() const {
+    return _capNegotiating;
+}
+
+const std::string& Client::getAccount() const {
+    return _cold->account;
+}
+
+// Sized to fit, so that clearing it after registration frees it too
 void Client::setPassword(const std::string& password) {
-    _password = password;
+    std::string(password).swap(_cold->password);
 }
 
 void Client::setNickname(const std::string& nickname) {
     _nickname = nickname;
+    ++_identityGeneration;
+    _updatePrefix();
 }
 
 void Client::setUsername(const std::string& username) {
     _username = username;
+    ++_identityGeneration;
+    _updatePrefix();
 }
 
 void Client::setRealname(const std::string& realname) {
-    _realname = realname;
+    _cold->realname = realname;
 }
 
 void Client::setHasRegistered(bool val) {
     _hasRegistered = val;
 }
 
+// Channels count their local members per tag variant, for the fan-out pool
+void Client::setCaps(uint32_t caps) {
+    uint32_t previous = _caps;
+    _caps = caps;
+    if (((previous ^ caps) & CAP_TAG_MASK) == 0) return;
+    for (size_t i = 0; i < _joinedChannels.size(); ++i) {
+        Channel* channel = _server->resolveChannel(_joinedChannels[i]);
+        if (channel) {
+            channel->memberCapsChanged(previous & CAP_TAG_MASK, caps & CAP_TAG_MASK);
+        }
+    }
+}
+
+void Client::setCapNegotiating(bool val) {
+    _capNegotiating = val;
+}
+
+void Client::setAccount(const std::string& account) {
+    _cold->account = account;
+}
+
+bool Client::isAuthPending() const {
+    return _authPending;
+}
+
+unsigned long Client::getAuthTicket() const {
+    return _cold->authTicket;
+}
+
+void Client::setAuthTicket(unsigned long ticket) {
+    _cold->authTicket = ticket;
+    _authPending = ticket != 0;
+}
+
+bool Client::isSaslStarted() const {
+    return _cold->saslStarted;
+}
+
+const std::string& Client::getSaslData() const {
+    return _cold->saslData;
+}
+
+void Client::setSasl(bool started, const std::string& data) {
+    _cold->saslStarted = started;
+    if (data.empty()) {
+        std::string().swap(_cold->saslData);
+    } else {
+        _cold->saslData = data;
+    }
+}
+
+unsigned int Client::getChannelsCreated(time_t window) const {
+    return _cold->createWindow == window ? _cold->channelsCreated : 0;
+}
+
+void Client::countChannelCreated(time_t window) {
+    if (_cold->createWindow != window) {
+        _cold->createWindow = window;
+        _cold->channelsCreated = 0;
+    }
+    ++_cold->channelsCreated;
+}
+
 void Client::appendRecvBuffer(const char* buf, ssize_t len) {
     _recvBuffer.append(buf, len);
+    _accountBuffers();
 }
 
+// A buffer read to the end is freed: most clients are idle most of the time
 void Client::clearRecvBuffer(size_t len) {
     if (len >= _recvBuffer.length()) {
-        _recvBuffer.clear();
+        std::string().swap(_recvBuffer);
     } else {
         _recvBuffer.erase(0, len);
     }
+    _accountBuffers();
+    _recvScanned = (len >= _recvScanned) ? 0 : _recvScanned - len;
+}
+
+void Client::setRecvScanned(size_t len) {
+    _recvScanned = (len < _recvBuffer.length()) ? len : _recvBuffer.length();
 }
 
 void Client::appendSendBuffer(const char* buf, ssize_t len) {
-    _sendBuffer.append(buf, len);
+    _sendQueue.append(buf, len);
+    _accountBuffers();
+}
+
+void Client::appendShared(SharedMessage* message) {
+    _sendQueue.append(message);
+    _accountBuffers();
 }
 
 void Client::clearSendBuffer(size_t len) {
-    if (len >= _sendBuffer.length()) {
-        _sendBuffer.clear();
-    } else {
-        _sendBuffer.erase(0, len);
+    _sendQueue.consume(len);
+    _accountBuffers();
+}
+
+void Client::clearSendBufferZerocopy(size_t len) {
+    _sendQueue.pinZerocopy(len);
+    _sendQueue.consume(len);
+    _accountBuffers();
+}
+
+void Client::zerocopyCompleted(uint32_t id) {
+    _sendQueue.zerocopyCompleted(id);
+    _accountBuffers();
+}
+
+ZerocopyMode Client::getZerocopy() const {
+    return _zerocopy;
+}
+
+void Client::setZerocopy(ZerocopyMode mode) {
+    _zerocopy = mode;
+}
+
+void Client::setZerocopyNext(uint32_t id) {
+    _sendQueue.setZerocopyNext(id);
+}
+
+// Called from fan-out workers too, each on clients no other thread touches;
+// only the server-wide total is shared
+void Client::_accountBuffers() {
+    size_t bytes = heapBytes(_recvBuffer) + _sendQueue.memoryUsage();
+    if (bytes != _bufferBytes) {
+        _server->adjustBufferBytes(static_cast<long>(bytes) - static_cast<long>(_bufferBytes));
+        _bufferBytes = bytes;
+    }
+}
+
+size_t Client::memoryUsage() const {
+    size_t bytes = sizeof(*this) + sizeof(Cold) + _bufferBytes + heapBytes(_cold->password) + heapBytes(_nickname)
+        + heapBytes(_username) + heapBytes(_cold->realname) + heapBytes(_prefix) + heapBytes(_cold->homeServer) + heapBytes(_cold->account)
+        + heapBytes(_cold->saslData)
+        + heapBytes(_joinedChannels) + heapBytes(_replyStreams) + heapBytes(_banVerdicts) + _inbox.pendingBytes();
+    for (size_t i = 0; i < _replyStreams.size(); ++i) {
+        bytes += _replyStreams[i]->memoryUsage();
     }
+    return bytes;
+}
+
+size_t Client::getBufferBytes() const {
+    return _bufferBytes;
+}
+
+size_t Client::getQueuedBytes() const {
+    return _sendQueue.size() + _recvBuffer.size() + _inbox.pendingBytes();
+}
+
+size_t Client::shrinkBuffers() {
+    size_t before = _bufferBytes;
+    _sendQueue.shrink();
+    // A copy is allocated for its contents only
+    if (_recvBuffer.capacity() > _recvBuffer.size() * 2) {
+        std::string(_recvBuffer).swap(_recvBuffer);
+    }
+    _accountBuffers();
+    return (before > _bufferBytes) ? before - _bufferBytes : 0;
 }
 
 void Client::setEpollEvents(uint32_t events) {
     _epollEvents = events;
 }
 
+bool Client::isFlushPending() const {
+    return _flushPending;
+}
+
+void Client::setFlushPending(bool val) {
+    _flushPending = val;
+}
+
+void Client::addReplyStream(ReplyStream* stream) {
+    if (!stream) return;
+    _replyStreams.push_back(stream);
+    _server->scheduleFlush(this);
+}
+
+bool Client::isAdmitted() const {
+    return _cold->admitted;
+}
+
+void Client::setAdmitted(bool val) {
+    _cold->admitted = val;
+}
+
+MessageInbox& Client::getInbox() {
+    return _inbox;
+}
+
+Client* Client::getNextReady() const {
+    return _nextReady;
+}
+
+void Client::setNextReady(Client* next) {
+    _nextReady = next;
+}
+
+void Client::drainInbox() {
+    if (_inbox.drainInto(_sendQueue) > 0) {
+        _accountBuffers();
+        _server->scheduleFlush(this);
+    }
+}
+
+bool Client::hasReplyStreams() const {
+    return !_replyStreams.empty();
+}
+
+ReplyStream* Client::frontReplyStream() const {
+    return _replyStreams.empty() ? NULL : _replyStreams.front();
+}
+
+// Rarely more than one stream at a time, so shifting the rest is cheap
+void Client::popReplyStream() {
+    if (_replyStreams.empty()) return;
+    delete _replyStreams.front();
+    _replyStreams.erase(_replyStreams.begin());
+}
+
 void Client::addMode(char mode) {
-    _modes.insert(mode);
+    _modes |= modeBit(mode);
 }
 
 void Client::removeMode(char mode) {
-    _modes.erase(mode);
+    _modes &= ~modeBit(mode);
 }
 
-void Client::addChannel(Channel* channel) {
-    if (channel) {
-        _joinedChannels.insert(channel);
+void Client::addChannel(ChannelHandle channel) {
+    if (!isInChannel(channel)) {
+        _joinedChannels.push_back(channel);
     }
 }
 
-void Client::removeChannel(Channel* channel) {
-    if (channel) {
-        _joinedChannels.erase(channel);
+void Client::removeChannel(ChannelHandle channel) {
+    std::vector<ChannelHandle>::iterator it = std::find(_joinedChannels.begin(), _joinedChannels.end(), channel);
+    if (it != _joinedChannels.end()) {
+        *it = _joinedChannels.back();
+        _joinedChannels.pop_back();
+    }
+    for (size_t i = 0; i < _banVerdicts.size(); ++i) {
+        if (_banVerdicts[i].channel == channel) {
+            _banVerdicts[i] = _banVerdicts.back();
+            _banVerdicts.pop_back();
+            break;
+        }
     }
 }
 
-const std::set<Channel*>& Client::getJoinedChannels() const {
+const std::vector<ChannelHandle>& Client::getJoinedChannels() const {
     return _joinedChannels;
 }
 
-bool Client::isInChannel(Channel* channel) const {
-    return channel && _joinedChannels.find(channel) != _joinedChannels.end();
+bool Client::isInChannel(ChannelHandle channel) const {
+    return std::find(_joinedChannels.begin(), _joinedChannels.end(), channel) != _joinedChannels.end();
+}
+
+bool Client::findBanVerdict(ChannelHandle channel, uint64_t listVersion, bool& banned) const {
+    for (size_t i = 0; i < _banVerdicts.size(); ++i) {
+        const BanVerdict& verdict = _banVerdicts[i];
+        if (verdict.channel == channel) {
+            if (verdict.listVersion != listVersion || verdict.identityGeneration != _identityGeneration) {
+                return false;
+            }
+            banned = verdict.banned;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Client::storeBanVerdict(ChannelHandle channel, uint64_t listVersion, bool banned) {
+    BanVerdict verdict;
+    verdict.channel = channel;
+    verdict.listVersion = listVersion;
+    verdict.identityGeneration = _identityGeneration;
+    verdict.banned = banned;
+    for (size_t i = 0; i < _banVerdicts.size(); ++i) {
+        if (_banVerdicts[i].channel == channel) {
+            _banVerdicts[i] = verdict;
+            return;
+        }
+    }
+    _banVerdicts.push_back(verdict);
+}
+
+bool Client::isServerLink() const {
+    return _isServerLink;
+}
+
+void Client::setServerLink(const std::string& serverName) {
+    _isServerLink = true;
+    _cold->homeServer = serverName;
+}
+
+bool Client::isLinkInitiated() const {
+    return _cold->linkInitiated;
+}
+
+void Client::setLinkInitiated(bool val) {
+    _cold->linkInitiated = val;
+}
+
+bool Client::isConnecting() const {
+    return _cold->connecting;
+}
+
+void Client::setConnecting(bool val) {
+    _cold->connecting = val;
+}
+
+bool Client::isRemote() const {
+    return _uplink != NULL;
+}
+
+Client* Client::getUplink() const {
+    return _uplink;
+}
+
+void Client::setUplink(Client* link) {
+    _uplink = link;
+}
+
+const std::string& Client::getHomeServer() const {
+    return _cold->homeServer;
+}
+
+void Client::setHomeServer(const std::string& serverName) {
+    _cold->homeServer = serverName;
+}
+
+time_t Client::getNickTs() const {
+    return _cold->nickTs;
+}
+
+void Client::setNickTs(time_t ts) {
+    _cold->nickTs = ts;
+}
+
+unsigned long Client::getFanoutMark() const {
+    return _fanoutMark;
+}
+
+void Client::setFanoutMark(unsigned long mark) {
+    _fanoutMark = mark;
 }
@@ -1,36 +1,126 @@
 #pragma once
 #include <string>
-#include <set>
+#include <vector>
 #include <sys/types.h>
 #include <stdint.h>
+#include <ctime>
+#include "MessageInbox.hpp"
+#include "SendQueue.hpp"
 
 class Server;
 class Channel;
+class ReplyStream;
+typedef uint32_t ChannelHandle;
 
+// Whether large flushes to a client's socket use MSG_ZEROCOPY: not at all,
+// yes, or no longer because the kernel reported it copied them anyway (as
+// it does over loopback). See ServerZerocopy.cpp.
+enum ZerocopyMode {
+    ZEROCOPY_OFF,
+    ZEROCOPY_ON,
+    ZEROCOPY_COPIED
+};
+
+// Longest nickname accepted; NICK answers 432 beyond it
+#define CLIENT_NICKLEN 15
+
+// Laid out hot first: the fields the event loop and the fan-out touch for
+// every event or message lead the object, which is allocated on a cache
+// line boundary. What only registration, WHO/WHOIS, linking or a hot
+// upgrade need lives in a separate record (Cold), and the hostname is
+// interned on the server, as whole NAT gateways share one.
 class Client {
 private:
     int _fd;
-    std::string _recvBuffer;
-    std::string _sendBuffer;
-    std::string _password;
-    std::string _nickname;
-    std::string _username;
-    std::string _realname;
-    std::string _hostname;
+    uint32_t _epollEvents;
+    // Enabled IRCv3 capabilities (Capability bits)
+    uint32_t _caps;
     bool _hasRegistered;
-    std::set<char> _modes;
-    std::set<Channel*> _joinedChannels;
+    bool _flushPending;
+    bool _isServerLink;
+    // CAP LS or REQ has put registration on hold until CAP END
+    bool _capNegotiating;
+    // A credential check is out (see Server::startAuth); input waits
+    bool _authPending;
     Server* _server;
-    uint32_t _epollEvents;
+    // Users on another server are reached through the link _uplink
+    Client* _uplink;
+    // Epoch of the last fan-out pass that reached this client (see
+    // Server::notifyNeighbors and Server::relayToChannel)
+    unsigned long _fanoutMark;
+    // Heap bytes of the two buffers as last reported to the server
+    size_t _bufferBytes;
+    // Leading bytes of _recvBuffer already searched for a line break
+    size_t _recvScanned;
+    SendQueue _sendQueue;
+    std::string _nickname;
+    // nick!~user@host, rebuilt when the nick or user name changes
+    std::string _prefix;
+    std::string _recvBuffer;
+    std::string _username;
+    // Server::getHostname() id
+    uint32_t _hostname;
+    ZerocopyMode _zerocopy;
+    // User modes, one bit per letter from 'A'
+    uint64_t _modes;
+    std::vector<ChannelHandle> _joinedChannels;
+    std::vector<ReplyStream*> _replyStreams;
+    // Lines posted from other threads (Server::postFromThread)
+    MessageInbox _inbox;
+    // Link in the server's list of announced inboxes
+    Client* _nextReady;
+
+    // Bumped whenever the nick or user name changes, which invalidates
+    // the cached channel ban verdicts below
+    uint32_t _identityGeneration;
+    struct BanVerdict {
+        ChannelHandle channel;
+        uint64_t listVersion;
+        uint32_t identityGeneration;
+        bool banned;
+    };
+    std::vector<BanVerdict> _banVerdicts;
+
+    struct Cold {
+        // Dropped once registration succeeds
+        std::string password;
+        std::string realname;
+        // Account the user is logged in to ("" if none), for account-tag
+        std::string account;
+        // Server linking: the server a user is on, or the peer of a link
+        std::string homeServer;
+        time_t nickTs;
+        bool linkInitiated;
+        bool connecting;
+        // Counted against the per-address connection limits (see Admission)
+        bool admitted;
+        // Identifies the credential check in progress (0: none)
+        unsigned long authTicket;
+        // SASL PLAIN: AUTHENTICATE PLAIN was accepted, and the base64
+        // chunks received so far
+        bool saslStarted;
+        std::string saslData;
+        // Channels created in the current rate window (see
+        // Server::mayCreateChannel)
+        time_t createWindow;
+        unsigned int channelsCreated;
+    };
+    Cold* _cold;
 
     Client();
     Client(const Client& other);
     Client& operator=(const Client& other);
 
+    void _accountBuffers();
+    void _updatePrefix();
+
 public:
     explicit Client(int fd, const std::string& hostname, Server* server, uint32_t epollEvents);
     ~Client();
 
+    static void* operator new(size_t size);
+    static void operator delete(void* p);
+
     int getFd() const;
     const std::string& getPassword() const;
     const std::string& getNickname() const;
@@ -39,14 +129,25 @@ public:
     const std::string& getRealname() const;
     bool hasRegistered() const;
     bool hasMode(char mode) const;
-    std::string getPrefix() const;
+    // The letters of the modes set, in order
+    std::string getModes() const;
+    uint32_t getCaps() const;
+    bool hasCap(uint32_t cap) const;
+    bool isCapNegotiating() const;
+    const std::string& getAccount() const;
+    const std::string& getPrefix() const;
 
     const std::string& getRecvBuffer() const;
-    const std::string& getSendBuffer() const;
+    size_t getRecvScanned() const;
+    const SendQueue& getSendQueue() const;
 
     uint32_t getEpollEvents() const;
 
     void queueMessage(const std::string& message);
+    void queueMessage(const char* message, size_t length);
+    // Local clients only: queues a line shared with other clients, taking
+    // over one reference to it
+    void queueShared(SharedMessage* message);
     void reply(int replyCode, const std::string& message);
 
     void setPassword(const std::string& password);
@@ -54,19 +155,91 @@ public:
     void setUsername(const std::string& username);
     void setRealname(const std::string& realname);
     void setHasRegistered(bool val);
+    void setCaps(uint32_t caps);
+    void setCapNegotiating(bool val);
+    void setAccount(const std::string& account);
+    bool isAuthPending() const;
+    unsigned long getAuthTicket() const;
+    // 0 ends the wait
+    void setAuthTicket(unsigned long ticket);
+    bool isSaslStarted() const;
+    const std::string& getSaslData() const;
+    // Ends the exchange too when data is empty and started false
+    void setSasl(bool started, const std::string& data);
+    // Channels created during <window>, a window number
+    unsigned int getChannelsCreated(time_t window) const;
+    void countChannelCreated(time_t window);
 
     void appendRecvBuffer(const char* buf, ssize_t len);
     void clearRecvBuffer(size_t len);
+    void setRecvScanned(size_t len);
     void appendSendBuffer(const char* buf, ssize_t len);
+    // As queueShared(), without scheduling a flush (fan-out workers)
+    void appendShared(SharedMessage* message);
     void clearSendBuffer(size_t len);
+    // As clearSendBuffer(), for bytes sent with MSG_ZEROCOPY: they stay
+    // allocated until zerocopyCompleted() covers the send
+    void clearSendBufferZerocopy(size_t len);
+    void zerocopyCompleted(uint32_t id);
+    ZerocopyMode getZerocopy() const;
+    void setZerocopy(ZerocopyMode mode);
+    // Hot upgrade: the id of the socket's next zerocopy send
+    void setZerocopyNext(uint32_t id);
 
     void setEpollEvents(uint32_t events);
 
+    bool isFlushPending() const;
+    void setFlushPending(bool val);
+
+    void addReplyStream(ReplyStream* stream);
+    bool hasReplyStreams() const;
+    ReplyStream* frontReplyStream() const;
+    void popReplyStream();
+
+    // Memory accounting: everything the client holds, the part of it that
+    // is buffer heap, and the bytes waiting to be sent or parsed
+    size_t memoryUsage() const;
+    size_t getBufferBytes() const;
+    size_t getQueuedBytes() const;
+    // Gives back buffer capacity well beyond the contents; returns bytes freed
+    size_t shrinkBuffers();
+
+    bool isAdmitted() const;
+    void setAdmitted(bool val);
+
+    MessageInbox& getInbox();
+    Client* getNextReady() const;
+    void setNextReady(Client* next);
+    // Event loop only: moves whatever other threads posted to the send queue
+    void drainInbox();
+
     void addMode(char mode);
     void removeMode(char mode);
 
-    void addChannel(Channel* channel);
-    void removeChannel(Channel* channel);
-    const std::set<Channel*>& getJoinedChannels() const;
-    bool isInChannel(Channel* channel) const;
+    // Channels as registry handles; resolve with Server::resolveChannel()
+    void addChannel(ChannelHandle channel);
+    void removeChannel(ChannelHandle channel);
+    const std::vector<ChannelHandle>& getJoinedChannels() const;
+    bool isInChannel(ChannelHandle channel) const;
+
+    // Memo of Channel::isBanned() for joined channels, valid while both
+    // the channel's mask lists (listVersion) and this client's name stay
+    bool findBanVerdict(ChannelHandle channel, uint64_t listVersion, bool& banned) const;
+    void storeBanVerdict(ChannelHandle channel, uint64_t listVersion, bool banned);
+
+    bool isServerLink() const;
+    void setServerLink(const std::string& serverName);
+    bool isLinkInitiated() const;
+    void setLinkInitiated(bool val);
+    bool isConnecting() const;
+    void setConnecting(bool val);
+    bool isRemote() const;
+    Client* getUplink() const;
+    void setUplink(Client* link);
+    const std::string& getHomeServer() const;
+    void setHomeServer(const std::string& serverName);
+    time_t getNickTs() const;
+    void setNickTs(time_t ts);
+    unsigned long getFanoutMark() const;
+    void setFanoutMark(unsigned long mark);
 };
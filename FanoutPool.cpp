@@ -0,0 +1,148 @@
+#include "FanoutPool.hpp"
+#include "Client.hpp"
+#include "Server.hpp"
+#include "OutboundMessage.hpp"
+#include "utils.hpp"
+#include <sstream>
+
+FanoutPool::FanoutPool()
+    : _server(NULL), _threshold(0), _generation(0), _remaining(0), _stopping(false),
+      _recipients(NULL), _except(NULL), _message(NULL) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_jobReady, NULL);
+    pthread_cond_init(&_jobDone, NULL);
+}
+
+FanoutPool::~FanoutPool() {
+    stop();
+    pthread_cond_destroy(&_jobDone);
+    pthread_cond_destroy(&_jobReady);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void FanoutPool::start(Server* server, size_t workers, size_t threshold) {
+    stop();
+    _server = server;
+    _stopping = false;
+    for (size_t i = 0; i < workers; ++i) {
+        Worker* worker = new Worker();
+        worker->pool = this;
+        worker->index = i + 1;
+        worker->seen = _generation;
+        if (pthread_create(&worker->thread, NULL, &FanoutPool::_workerMain, worker) != 0) {
+            delete worker;
+            ngircd_log("warning", "Cannot start fan-out worker; continuing with fewer");
+            break;
+        }
+        _workers.push_back(worker);
+    }
+    _threshold = _workers.empty() ? 0 : threshold;
+    if (!_workers.empty()) {
+        std::ostringstream oss;
+        oss << "Fan-out pool: " << _workers.size() << " worker(s) for channels of at least " << _threshold << " members";
+        ngircd_log("info", oss.str());
+    }
+}
+
+void FanoutPool::stop() {
+    if (_workers.empty()) return;
+
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_broadcast(&_jobReady);
+    pthread_mutex_unlock(&_mutex);
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        pthread_join(_workers[i]->thread, NULL);
+        delete _workers[i];
+    }
+    _workers.clear();
+    _threshold = 0;
+}
+
+bool FanoutPool::shouldSplit(size_t recipients) const {
+    return _threshold > 0 && recipients >= _threshold;
+}
+
+void FanoutPool::deliver(const std::vector<Client*>& recipients, const Client* except, OutboundMessage& message) {
+    for (size_t v = 0; v < CAP_VARIANTS; ++v) {
+        _taken[v] = 0;
+        for (size_t i = 0; i < _workers.size(); ++i) {
+            _workers[i]->taken[v] = 0;
+        }
+    }
+    pthread_mutex_lock(&_mutex);
+    _recipients = &recipients;
+    _except = except;
+    _message = &message;
+    _remaining = _workers.size();
+    ++_generation;
+    pthread_cond_broadcast(&_jobReady);
+    pthread_mutex_unlock(&_mutex);
+
+    _deliverRange(0, _pending, _taken);
+
+    pthread_mutex_lock(&_mutex);
+    while (_remaining > 0) {
+        pthread_cond_wait(&_jobDone, &_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    _server->scheduleFlushes(_pending);
+    _pending.clear();
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        _server->scheduleFlushes(_workers[i]->pending);
+        _workers[i]->pending.clear();
+        for (size_t v = 0; v < CAP_VARIANTS; ++v) {
+            _taken[v] += _workers[i]->taken[v];
+        }
+    }
+    // Nothing queued can have been sent yet, so the references may come late
+    for (size_t v = 0; v < CAP_VARIANTS; ++v) {
+        message.addReferences(static_cast<unsigned int>(v), _taken[v]);
+    }
+}
+
+// Part 0 belongs to the calling thread, part i to worker i
+void FanoutPool::_deliverRange(size_t part, std::vector<int>& pending, unsigned int* taken) {
+    const std::vector<Client*>& recipients = *_recipients;
+    size_t parts = _workers.size() + 1;
+    size_t begin = recipients.size() * part / parts;
+    size_t end = recipients.size() * (part + 1) / parts;
+    for (size_t i = begin; i < end; ++i) {
+        Client* client = recipients[i];
+        if (client == _except) continue;
+        unsigned int caps = client->getCaps() & CAP_TAG_MASK;
+        client->appendShared(_message->variant(caps));
+        ++taken[caps];
+        if (!client->isFlushPending()) {
+            client->setFlushPending(true);
+            pending.push_back(client->getFd());
+        }
+    }
+}
+
+void* FanoutPool::_workerMain(void* arg) {
+    Worker* worker = static_cast<Worker*>(arg);
+    worker->pool->_workerLoop(*worker);
+    return NULL;
+}
+
+void FanoutPool::_workerLoop(Worker& worker) {
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        while (_generation == worker.seen && !_stopping) {
+            pthread_cond_wait(&_jobReady, &_mutex);
+        }
+        if (_stopping) break;
+        worker.seen = _generation;
+        pthread_mutex_unlock(&_mutex);
+
+        _deliverRange(worker.index, worker.pending, worker.taken);
+
+        pthread_mutex_lock(&_mutex);
+        if (--_remaining == 0) {
+            pthread_cond_signal(&_jobDone);
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
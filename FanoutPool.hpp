@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <pthread.h>
+#include "Capabilities.hpp"
+
+class Client;
+class Server;
+class OutboundMessage;
+
+// Fixed set of worker threads that queue one message on the send queues of
+// a large set of local clients. The recipients are cut into one contiguous
+// range per thread, the calling (reactor) thread included, and deliver()
+// returns only once every range is done. Each client is therefore written
+// by exactly one thread while nothing else runs, and needs no locking.
+// Workers never call into the server: clients they find idle are marked
+// flush-pending and handed to the server's dirty list by the reactor.
+// Every recipient gets a reference to the message variant its tag
+// capabilities select; ranges count the references they hand out and the
+// reactor adds them to the variants once all ranges are done.
+class FanoutPool {
+public:
+    FanoutPool();
+    ~FanoutPool();
+
+    // workers: threads besides the caller (0 keeps every broadcast inline)
+    void start(Server* server, size_t workers, size_t threshold);
+    void stop();
+    bool shouldSplit(size_t recipients) const;
+
+    // Queues message on every recipient except `except` (which may be
+    // NULL); the variants the recipients need must have been prepare()d
+    void deliver(const std::vector<Client*>& recipients, const Client* except, OutboundMessage& message);
+
+private:
+    FanoutPool(const FanoutPool& other);
+    FanoutPool& operator=(const FanoutPool& other);
+
+    struct Worker {
+        FanoutPool* pool;
+        size_t index;
+        pthread_t thread;
+        // Last job generation this worker has taken
+        unsigned long seen;
+        std::vector<int> pending;
+        unsigned int taken[CAP_VARIANTS];
+    };
+
+    static void* _workerMain(void* arg);
+    void _workerLoop(Worker& worker);
+    void _deliverRange(size_t part, std::vector<int>& pending, unsigned int* taken);
+
+    Server* _server;
+    std::vector<Worker*> _workers;
+    size_t _threshold;
+    // Clients found idle by the calling thread's own range
+    std::vector<int> _pending;
+    unsigned int _taken[CAP_VARIANTS];
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _jobReady;
+    pthread_cond_t _jobDone;
+    // Guarded by _mutex
+    unsigned long _generation;
+    size_t _remaining;
+    bool _stopping;
+
+    // The current job, written before _generation is bumped
+    const std::vector<Client*>* _recipients;
+    const Client* _except;
+    const OutboundMessage* _message;
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include "Arena.hpp"
 #include <iostream>
 #include <string>
 #include <vector>
@@ -6,13 +7,17 @@
 class Server;
 class Client;
 
+// A command line split into its command and parameters, in the tick's
+// arena: anything that has to outlive the tick is copied out of it
+typedef ArenaVector<ArenaString>::type CommandArgs;
+
 class ICommand {
 public:
     virtual ~ICommand() {}
 
     virtual bool requiresRegistration() const = 0;
 
-    virtual void execute(Server& server, Client* client, const std::vector<std::string>& args) = 0;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args) = 0;
 
 protected:
     ICommand() {}
@@ -12,14 +12,14 @@ bool InviteCommand::requiresRegistration() const {
     return true;
 }
 
-void InviteCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void InviteCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     if (args.size() != 3) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    const std::string& nick = args[1];
-    const std::string& channelName = args[2];
+    std::string nick = toString(args[1]);
+    std::string channelName = toString(args[2]);
 
     Channel* channel = server.getChannel(channelName);
     Client* targetClient = server.getClientByNickname(nick);
@@ -1,9 +1,11 @@
 #include "JoinCommand.hpp"
+#include "NamesCommand.hpp"
 #include "Server.hpp"
 #include "Client.hpp"
 #include "Channel.hpp"
+#include "OutboundMessage.hpp"
+#include "Arena.hpp"
 #include "utils.hpp"
-#include <sstream>
 
 JoinCommand::JoinCommand() {}
 
@@ -13,58 +15,58 @@ bool JoinCommand::requiresRegistration() const {
     return true;
 }
 
-void JoinCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void JoinCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     if (args.size() != 2 && args.size() != 3) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    const std::string& channelList = args[1];
-    std::string keyList = (args.size() == 3) ? args[2] : "";
-
-    std::vector<std::string> channels;
-    std::istringstream channelStream(channelList);
-    std::string channelName;
-    while (std::getline(channelStream, channelName, ',')) {
-        if (!channelName.empty()) {
-            channels.push_back(channelName);
-        }
-    }
-
-    std::vector<std::string> keys;
-    std::istringstream keyStream(keyList);
-    std::string key;
-    while (std::getline(keyStream, key, ',')) {
-        if (!key.empty()) {
-            keys.push_back(key);
-        }
+    Arena& arena = server.getArena();
+    ArenaVector<ArenaString>::type channels((ArenaAllocator<ArenaString>(arena)));
+    splitList(args[1], ',', channels);
+    ArenaVector<ArenaString>::type keys((ArenaAllocator<ArenaString>(arena)));
+    if (args.size() == 3) {
+        splitList(args[2], ',', keys);
     }
 
+    ArenaString noKey((ArenaAllocator<char>(arena)));
     for (size_t i = 0; i < channels.size(); ++i) {
-        std::string currentKey = (i < keys.size()) ? keys[i] : "";
-        _joinSingleChannel(server, client, channels[i], currentKey);
+        _joinSingleChannel(server, client, channels[i], (i < keys.size()) ? keys[i] : noKey);
     }
 }
 
-void JoinCommand::_joinSingleChannel(Server& server, Client* client, const std::string& channelName, const std::string& key) {
-    if (!isValidChannelName(channelName)) {
-        client->reply(403, channelName);
+void JoinCommand::_joinSingleChannel(Server& server, Client* client, const ArenaString& channelName, const ArenaString& key) {
+    if (!isValidChannelName(channelName.data(), channelName.size())) {
+        client->reply(403, toString(channelName));
         return;
     }
 
     int clientFd = client->getFd();
 
-    Channel* channel = server.getOrCreateChannel(channelName);
-
-    if (channel->isMember(clientFd)) {
+    // A new channel only enters the registry once the join has passed
+    Channel* channel = server.getChannel(channelName.data(), channelName.size());
+    bool creating = channel == NULL;
+    if (creating) {
+        if (!server.mayCreateChannel(client)) {
+            client->reply(263, "JOIN");
+            return;
+        }
+        channel = server.prepareChannel(toString(channelName));
+    } else if (channel->isMember(clientFd)) {
         return;
     }
 
-    Channel::JoinError joinError = channel->canClientJoin(clientFd, key);
+    Channel::JoinError joinError = channel->canClientJoin(client, key.data(), key.size());
     if (joinError != Channel::JOIN_SUCCESS) {
-        client->reply(joinError, channelName);
+        client->reply(joinError, toString(channelName));
+        if (creating) {
+            delete channel;
+        }
         return;
     }
+    if (creating) {
+        server.adoptChannel(channel, client);
+    }
 
     // Use server helper so both channel and client internal state are updated
     server.addClientToChannel(client, channel);
@@ -73,19 +75,24 @@ void JoinCommand::_joinSingleChannel(Server& server, Client* client, const std::
         channel->removeInvite(clientFd);
     }
 
-    std::string joinMsg = ":" + client->getPrefix() + " JOIN " + channelName + "\r\n";
-    channel->broadcastToAll(joinMsg);
+    const std::string& prefix = client->getPrefix();
+    const std::string& name = channel->getName();
+    ArenaString joinMsg((ArenaAllocator<char>(server.getArena())));
+    joinMsg.reserve(prefix.size() + name.size() + 9);
+    joinMsg += ":";
+    joinMsg.append(prefix.data(), prefix.size());
+    joinMsg += " JOIN ";
+    joinMsg.append(name.data(), name.size());
+    joinMsg += "\r\n";
+    OutboundMessage outbound(joinMsg.data(), joinMsg.size());
+    channel->broadcast(outbound, NULL);
+    server.propagate(outbound.data(), outbound.size(), NULL);
 
     if (!channel->getTopic().empty()) {
-        client->reply(332, channelName + " :" + channel->getTopic());
-        client->reply(333, channelName + " " + channel->getTopicSetter() + " " + channel->getCreationTimeString());
+        client->reply(332, channel->getName() + " :" + channel->getTopic());
+        client->reply(333, channel->getName() + " " + channel->getTopicSetter() + " " + channel->getCreationTimeString());
     }
 
-    // Send NAMES list
-    // RPL_NAMREPLY
-    std::string memberList = channel->getMemberListString();
-    client->reply(353, "= " + channelName + " :" + memberList);
-
-    // RPL_ENDOFNAMES
-    client->reply(366, channelName + " :End of /NAMES list");
+    // Send NAMES list, paced by the send queue like any other reply stream
+    client->addReplyStream(new NamesReplyStream(std::vector<std::string>(1, channel->getName())));
 }
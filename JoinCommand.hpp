@@ -10,10 +10,10 @@ public:
     virtual ~JoinCommand();
 
     virtual bool requiresRegistration() const;
-    virtual void execute(Server& server, Client* client, const std::vector<std::string>& args);
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
 
 private:
-    void _joinSingleChannel(Server& server, Client* client, const std::string& channelName, const std::string& key);
+    void _joinSingleChannel(Server& server, Client* client, const ArenaString& channelName, const ArenaString& key);
     bool _isValidChannelName(const std::string& name) const;
 
     JoinCommand(const JoinCommand& other);
@@ -2,8 +2,9 @@
 #include "Server.hpp"
 #include "Client.hpp"
 #include "Channel.hpp"
+#include "OutboundMessage.hpp"
+#include "Arena.hpp"
 #include "utils.hpp"
-#include <sstream>
 
 KickCommand::KickCommand() {}
 KickCommand::~KickCommand() {}
@@ -12,56 +13,67 @@ bool KickCommand::requiresRegistration() const {
     return true;
 }
 
-void KickCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void KickCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     if (args.size() != 3 && args.size() != 4) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    std::string channelName = args[1];
-    std::string targetList = args[2];
-    std::string comment = (args.size() == 4) ? args[3] : client->getNickname();
+    const ArenaString& channelName = args[1];
+    const char* comment = client->getNickname().data();
+    size_t commentLength = client->getNickname().size();
+    if (args.size() == 4) {
+        comment = args[3].data();
+        commentLength = args[3].size();
+    }
 
-    Channel* channel = server.getChannel(channelName);
-    if (!isValidChannelName(channelName) || !channel) {
-        client->reply(403, channelName + " :No such channel");
+    Channel* channel = server.getChannel(channelName.data(), channelName.size());
+    if (!isValidChannelName(channelName.data(), channelName.size()) || !channel) {
+        client->reply(403, toString(channelName) + " :No such channel");
         return;
     }
 
-    std::vector<std::string> targets;
-    std::istringstream tss(targetList);
-    std::string tnick;
-    while (std::getline(tss, tnick, ',')) {
-        if (!tnick.empty()) targets.push_back(tnick);
-    }
+    Arena& arena = server.getArena();
+    ArenaVector<ArenaString>::type targets((ArenaAllocator<ArenaString>(arena)));
+    splitList(args[2], ',', targets);
+    ArenaString kickMsg((ArenaAllocator<char>(arena)));
 
     int issuerFd = client->getFd();
     if (!channel->isMember(issuerFd)) {
-        client->reply(442, channelName + " :You are not on that channel");
+        client->reply(442, toString(channelName) + " :You are not on that channel");
         return;
     }
 
     if (!channel->isOperator(issuerFd)) {
-        client->reply(482, channelName + " :You are not channel operator");
+        client->reply(482, toString(channelName) + " :You are not channel operator");
         return;
     }
 
     for (size_t i = 0; i < targets.size(); ++i) {
-        const std::string& targetNick = targets[i];
-        Client* targetClient = server.getClientByNickname(targetNick);
+        const ArenaString& targetNick = targets[i];
+        Client* targetClient = server.getClientByNickname(targetNick.data(), targetNick.size());
         if (!targetClient) {
-            client->reply(401, targetNick + " :No such nick or channel name");
+            client->reply(401, toString(targetNick) + " :No such nick or channel name");
             continue;
         }
 
         if (!channel->isMember(targetClient->getFd())) {
-            client->reply(441, targetNick + " " + channelName + " :They aren't on that channel");
+            client->reply(441, toString(targetNick) + " " + toString(channelName) + " :They aren't on that channel");
             continue;
         }
 
-        std::string kickMsg = ":" + client->getPrefix() + " KICK " + channelName + " " + targetNick + " :" + comment;
+        kickMsg.assign(":");
+        kickMsg.append(client->getPrefix().data(), client->getPrefix().size());
+        kickMsg += " KICK ";
+        kickMsg.append(channelName.data(), channelName.size());
+        kickMsg += ' ';
+        kickMsg.append(targetNick.data(), targetNick.size());
+        kickMsg += " :";
+        kickMsg.append(comment, commentLength);
         kickMsg += "\r\n";
-        channel->broadcastToAll(kickMsg);
+        OutboundMessage outbound(kickMsg.data(), kickMsg.size());
+        channel->broadcast(outbound, NULL);
+        server.propagate(outbound.data(), outbound.size(), NULL);
 
         server.removeClientFromChannel(targetClient, channel);
     }
@@ -10,7 +10,7 @@ public:
     virtual ~KickCommand();
 
     virtual bool requiresRegistration() const;
-    virtual void execute(Server& server, Client* client, const std::vector<std::string>& args);
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
 
 private:
     KickCommand(const KickCommand& other);
@@ -0,0 +1,71 @@
+#include "LineScanner.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Control characters allowed inside a line, by bit: tab, \x01 (CTCP), and
+// bold, colour, hex colour, reset, monospace, reverse, italics,
+// strikethrough and underline
+#define LINE_ALLOWED_CONTROLS 0xe042821eu
+
+// Classifies the control character at offset (data[offset] < 0x20)
+static inline void markControl(const char* data, size_t len, size_t offset, std::vector<uint32_t>& marks) {
+    unsigned char c = static_cast<unsigned char>(data[offset]);
+    if (c == '\n') {
+        marks.push_back(static_cast<uint32_t>(offset));
+    } else if (c == '\r') {
+        if (offset + 1 < len && data[offset + 1] != '\n') {
+            marks.push_back(static_cast<uint32_t>(offset) | LINE_SCAN_FORBIDDEN);
+        }
+    } else if (!((LINE_ALLOWED_CONTROLS >> c) & 1)) {
+        marks.push_back(static_cast<uint32_t>(offset) | LINE_SCAN_FORBIDDEN);
+    }
+}
+
+void scanLineBreaksScalar(const char* data, size_t len, std::vector<uint32_t>& marks) {
+    for (size_t i = 0; i < len; ++i) {
+        if (static_cast<unsigned char>(data[i]) < 0x20) markControl(data, len, i, marks);
+    }
+}
+
+// Turns a bitmask of control characters in the block at offset base into marks
+static inline void emitMarks(const char* data, size_t len, size_t base, uint32_t mask, std::vector<uint32_t>& marks) {
+    while (mask) {
+        markControl(data, len, base + __builtin_ctz(mask), marks);
+        mask &= mask - 1;
+    }
+}
+
+void scanLineBreaks(const char* data, size_t len, std::vector<uint32_t>& marks) {
+    size_t i = 0;
+    // Control characters are the bytes min(byte, 0x1f) leaves unchanged
+#if defined(__AVX2__)
+    const __m256i lastControl = _mm256_set1_epi8(0x1f);
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i hits = _mm256_cmpeq_epi8(_mm256_min_epu8(block, lastControl), block);
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+        if (mask) emitMarks(data, len, i, mask, marks);
+    }
+#elif defined(__SSE2__)
+    const __m128i lastControl = _mm_set1_epi8(0x1f);
+    // 32 bytes per step: lines are far longer than that, so most steps
+    // end after a single movemask
+    for (; i + 32 <= len; i += 32) {
+        __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16));
+        __m128i hitsLo = _mm_cmpeq_epi8(_mm_min_epu8(lo, lastControl), lo);
+        __m128i hitsHi = _mm_cmpeq_epi8(_mm_min_epu8(hi, lastControl), hi);
+        if (!_mm_movemask_epi8(_mm_or_si128(hitsLo, hitsHi))) continue;
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hitsLo))
+            | (static_cast<uint32_t>(_mm_movemask_epi8(hitsHi)) << 16);
+        emitMarks(data, len, i, mask, marks);
+    }
+#endif
+    for (; i < len; ++i) {
+        if (static_cast<unsigned char>(data[i]) < 0x20) markControl(data, len, i, marks);
+    }
+}
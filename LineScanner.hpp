@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+// Marks a forbidden byte in the output of scanLineBreaks; the low bits hold
+// its offset
+#define LINE_SCAN_FORBIDDEN 0x80000000u
+
+// Finds every '\n' and every byte a line may not carry in data[0, len) in
+// one pass and appends their offsets to marks, in order. Forbidden offsets
+// carry LINE_SCAN_FORBIDDEN. Forbidden are NUL, a CR not followed by '\n',
+// and the control characters other than tab, CTCP's \x01 and the
+// formatting codes. A CR ending the data is left unmarked until what
+// follows it is known. Uses AVX2 or SSE2 when the build targets them,
+// otherwise a byte loop. len must stay below LINE_SCAN_FORBIDDEN.
+void scanLineBreaks(const char* data, size_t len, std::vector<uint32_t>& marks);
+
+// The byte loop, kept callable for comparison
+void scanLineBreaksScalar(const char* data, size_t len, std::vector<uint32_t>& marks);
@@ -0,0 +1,104 @@
+#include "ListCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "ReplyStream.hpp"
+#include "utils.hpp"
+#include "MemoryUsage.hpp"
+#include <sstream>
+#include <cstdlib>
+
+// Walks the channel registry slot by slot, so channels created or dropped
+// while the listing is paused are simply seen or not. Filters are applied
+// before a row is rendered.
+class ListStream : public ReplyStream {
+public:
+    ListStream(const std::vector<std::string>& masks, size_t minUsers, size_t maxUsers)
+        : _masks(masks), _minUsers(minUsers), _maxUsers(maxUsers), _nextSlot(0), _started(false) {}
+
+    virtual size_t memoryUsage() const {
+        return sizeof(*this) + heapBytes(_masks);
+    }
+
+    virtual bool resume(Server& server, Client* client) {
+        // The header waits behind any reply still streaming to this client
+        if (!_started) {
+            client->reply(321, "Channel :Users  Name");
+            _started = true;
+        }
+        size_t slots = server.getChannelSlotCount();
+        while (_nextSlot < slots && client->getSendQueue().size() < SENDQ_WATERMARK) {
+            Channel* channel = server.getChannelAtSlot(_nextSlot++);
+            if (!channel || !_matches(channel)) continue;
+            std::ostringstream row;
+            row << channel->getName() << " " << channel->getMemberCount() << " :" << channel->getTopic();
+            client->reply(322, row.str());
+        }
+        if (_nextSlot < slots) {
+            return false;
+        }
+        client->reply(323, ":End of /LIST");
+        return true;
+    }
+
+private:
+    bool _matches(Channel* channel) const {
+        size_t users = channel->getMemberCount();
+        if (users < _minUsers || users > _maxUsers) {
+            return false;
+        }
+        if (_masks.empty()) {
+            return true;
+        }
+        for (size_t i = 0; i < _masks.size(); ++i) {
+            if (ircMatch(_masks[i], channel->getName())) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::string> _masks;
+    size_t _minUsers;
+    size_t _maxUsers;
+    size_t _nextSlot;
+    bool _started;
+};
+
+ListCommand::ListCommand() {}
+ListCommand::~ListCommand() {}
+
+bool ListCommand::requiresRegistration() const {
+    return true;
+}
+
+// LIST [<target>{,<target>}]
+// A target is a channel mask, ">N" (more than N users) or "<N" (fewer than N)
+void ListCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    (void)server;
+
+    std::vector<std::string> masks;
+    size_t minUsers = 0;
+    size_t maxUsers = static_cast<size_t>(-1);
+    if (args.size() > 1) {
+        std::istringstream iss(toString(args[1]));
+        std::string target;
+        while (std::getline(iss, target, ',')) {
+            if (target.empty()) continue;
+            if (target[0] == '>' || target[0] == '<') {
+                char* end;
+                unsigned long count = std::strtoul(target.c_str() + 1, &end, 10);
+                if (target.size() == 1 || *end != '\0') continue;
+                if (target[0] == '>') {
+                    minUsers = count + 1;
+                } else {
+                    maxUsers = (count > 0) ? count - 1 : 0;
+                }
+                continue;
+            }
+            masks.push_back(target);
+        }
+    }
+
+    client->addReplyStream(new ListStream(masks, minUsers, maxUsers));
+}
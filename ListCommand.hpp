@@ -0,0 +1,18 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+class ListCommand : public ICommand {
+public:
+    ListCommand();
+    virtual ~ListCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    ListCommand(const ListCommand& other);
+    ListCommand& operator=(const ListCommand& other);
+};
@@ -0,0 +1,303 @@
+#include "MaskList.hpp"
+#include "MemoryUsage.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <arpa/inet.h>
+
+static std::string fold(const std::string& text) {
+    std::string folded(text);
+    for (size_t i = 0; i < folded.size(); ++i) {
+        folded[i] = ircToLower(folded[i]);
+    }
+    return folded;
+}
+
+// Whether segment matches the start of text, '?' standing for any character
+static bool segmentAt(const std::string& segment, const char* text) {
+    for (size_t i = 0; i < segment.size(); ++i) {
+        if (segment[i] != '?' && segment[i] != text[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+MaskList::MaskList() {}
+
+MaskList::~MaskList() {}
+
+std::string MaskList::normalize(const std::string& mask) {
+    size_t bang = mask.find('!');
+    size_t at = mask.rfind('@');
+    if (at != std::string::npos && bang != std::string::npos && at < bang) {
+        at = std::string::npos;
+    }
+
+    std::string nick, user, host;
+    if (bang == std::string::npos && at == std::string::npos) {
+        if (mask.find_first_of(".:/") != std::string::npos) {
+            host = mask;
+        } else {
+            nick = mask;
+        }
+    } else if (bang == std::string::npos) {
+        user = mask.substr(0, at);
+        host = mask.substr(at + 1);
+    } else {
+        nick = mask.substr(0, bang);
+        if (at == std::string::npos) {
+            user = mask.substr(bang + 1);
+        } else {
+            user = mask.substr(bang + 1, at - bang - 1);
+            host = mask.substr(at + 1);
+        }
+    }
+    return fold((nick.empty() ? "*" : nick) + "!" + (user.empty() ? "*" : user) + "@" + (host.empty() ? "*" : host));
+}
+
+bool MaskList::add(const std::string& mask, const std::string& setBy, time_t setAt) {
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (_entries[i].mask == mask) return false;
+    }
+    Entry entry;
+    entry.mask = mask;
+    entry.setBy = setBy;
+    entry.setAt = setAt;
+    _entries.push_back(entry);
+    _rebuild();
+    return true;
+}
+
+bool MaskList::remove(const std::string& mask) {
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        if (_entries[i].mask == mask) {
+            _entries.erase(_entries.begin() + i);
+            _rebuild();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MaskList::empty() const {
+    return _entries.empty();
+}
+
+size_t MaskList::size() const {
+    return _entries.size();
+}
+
+const std::vector<MaskList::Entry>& MaskList::entries() const {
+    return _entries;
+}
+
+bool MaskList::matches(const std::string& subject) const {
+    if (_entries.empty()) return false;
+    if (_matchIndexed(_byPrefix, _prefixLengths, subject, false)
+        || _matchIndexed(_bySuffix, _suffixLengths, subject, true)
+        || _matchCidr(subject)) {
+        return true;
+    }
+    for (size_t i = 0; i < _unindexed.size(); ++i) {
+        if (_run(_globs[_unindexed[i]], subject.data(), subject.size())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t MaskList::memoryUsage() const {
+    size_t bytes = heapBytes(_entries) + heapBytes(_globs) + heapBytes(_byPrefix) + heapBytes(_bySuffix)
+        + heapBytes(_prefixLengths) + heapBytes(_suffixLengths) + heapBytes(_unindexed) + heapBytes(_radix);
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        bytes += heapBytes(_entries[i].mask) + heapBytes(_entries[i].setBy) + heapBytes(_globs[i].segments);
+    }
+    const LiteralIndex* indexes[2] = { &_byPrefix, &_bySuffix };
+    for (size_t x = 0; x < 2; ++x) {
+        for (LiteralIndex::const_iterator it = indexes[x]->begin(); it != indexes[x]->end(); ++it) {
+            bytes += heapBytes(it->first) + heapBytes(it->second);
+        }
+    }
+    for (size_t i = 0; i < _radix.size(); ++i) {
+        bytes += heapBytes(_radix[i].masks);
+    }
+    return bytes;
+}
+
+MaskList::Glob MaskList::_compile(const std::string& pattern) {
+    Glob glob;
+    glob.hasStar = pattern.find('*') != std::string::npos;
+    glob.leadingStar = !pattern.empty() && pattern[0] == '*';
+    glob.trailingStar = !pattern.empty() && pattern[pattern.size() - 1] == '*';
+    size_t start = 0;
+    while (start <= pattern.size()) {
+        size_t star = pattern.find('*', start);
+        if (star == std::string::npos) star = pattern.size();
+        if (star > start) {
+            glob.segments.push_back(pattern.substr(start, star - start));
+        }
+        start = star + 1;
+    }
+    if (!glob.hasStar && glob.segments.empty()) {
+        glob.segments.push_back("");
+    }
+    return glob;
+}
+
+// Anchored segments are checked in place; the ones between stars are taken
+// at their leftmost match, which is enough for '*' to be matched correctly
+bool MaskList::_run(const Glob& glob, const char* text, size_t length) {
+    const std::vector<std::string>& segments = glob.segments;
+    if (!glob.hasStar) {
+        return segments[0].size() == length && segmentAt(segments[0], text);
+    }
+    size_t first = 0;
+    size_t last = segments.size();
+    size_t pos = 0;
+    size_t end = length;
+    if (!glob.leadingStar) {
+        if (segments[0].size() > length || !segmentAt(segments[0], text)) return false;
+        pos = segments[0].size();
+        first = 1;
+    }
+    if (!glob.trailingStar) {
+        const std::string& tail = segments[last - 1];
+        if (tail.size() > end - pos || !segmentAt(tail, text + length - tail.size())) return false;
+        end = length - tail.size();
+        --last;
+    }
+    for (size_t i = first; i < last; ++i) {
+        const std::string& segment = segments[i];
+        bool found = false;
+        while (pos + segment.size() <= end) {
+            if (segmentAt(segment, text + pos)) {
+                found = true;
+                break;
+            }
+            ++pos;
+        }
+        if (!found) return false;
+        pos += segment.size();
+    }
+    return true;
+}
+
+bool MaskList::_parseCidr(const std::string& host, uint32_t& address, int& bits) {
+    size_t slash = host.find('/');
+    if (slash == std::string::npos || slash + 1 == host.size() || host.size() - slash > 3) return false;
+    for (size_t i = slash + 1; i < host.size(); ++i) {
+        if (host[i] < '0' || host[i] > '9') return false;
+    }
+    bits = std::atoi(host.c_str() + slash + 1);
+    struct in_addr parsed;
+    if (bits > 32 || inet_pton(AF_INET, host.substr(0, slash).c_str(), &parsed) != 1) return false;
+    address = ntohl(parsed.s_addr);
+    return true;
+}
+
+void MaskList::_rebuild() {
+    _globs.clear();
+    _byPrefix.clear();
+    _bySuffix.clear();
+    _prefixLengths.clear();
+    _suffixLengths.clear();
+    _unindexed.clear();
+    _radix.clear();
+
+    for (size_t i = 0; i < _entries.size(); ++i) {
+        const std::string& mask = _entries[i].mask;
+        uint32_t index = static_cast<uint32_t>(i);
+        size_t at = mask.rfind('@');
+        uint32_t address;
+        int bits;
+        if (at != std::string::npos && _parseCidr(mask.substr(at + 1), address, bits)) {
+            _globs.push_back(_compile(mask.substr(0, at)));
+            _insertCidr(index, address, bits);
+            continue;
+        }
+        _globs.push_back(_compile(mask));
+        size_t firstWild = mask.find_first_of("*?");
+        size_t lastWild = mask.find_last_of("*?");
+        if (firstWild == std::string::npos) {
+            _byPrefix[mask].push_back(index);
+        } else if (firstWild > 0) {
+            _byPrefix[mask.substr(0, firstWild)].push_back(index);
+        } else if (lastWild + 1 < mask.size()) {
+            _bySuffix[mask.substr(lastWild + 1)].push_back(index);
+        } else {
+            _unindexed.push_back(index);
+        }
+    }
+
+    for (LiteralIndex::const_iterator it = _byPrefix.begin(); it != _byPrefix.end(); ++it) {
+        _prefixLengths.push_back(it->first.size());
+    }
+    for (LiteralIndex::const_iterator it = _bySuffix.begin(); it != _bySuffix.end(); ++it) {
+        _suffixLengths.push_back(it->first.size());
+    }
+    std::vector<size_t>* lengths[2] = { &_prefixLengths, &_suffixLengths };
+    for (size_t x = 0; x < 2; ++x) {
+        std::sort(lengths[x]->begin(), lengths[x]->end());
+        lengths[x]->erase(std::unique(lengths[x]->begin(), lengths[x]->end()), lengths[x]->end());
+    }
+}
+
+void MaskList::_insertCidr(uint32_t mask, uint32_t address, int bits) {
+    if (_radix.empty()) {
+        RadixNode root;
+        root.child[0] = root.child[1] = -1;
+        _radix.push_back(root);
+    }
+    size_t node = 0;
+    for (int depth = 0; depth < bits; ++depth) {
+        int bit = (address >> (31 - depth)) & 1;
+        if (_radix[node].child[bit] < 0) {
+            RadixNode next;
+            next.child[0] = next.child[1] = -1;
+            _radix.push_back(next);
+            _radix[node].child[bit] = static_cast<int>(_radix.size() - 1);
+        }
+        node = static_cast<size_t>(_radix[node].child[bit]);
+    }
+    _radix[node].masks.push_back(mask);
+}
+
+bool MaskList::_matchIndexed(const LiteralIndex& index, const std::vector<size_t>& lengths,
+                             const std::string& subject, bool suffix) const {
+    std::string key;
+    for (size_t i = 0; i < lengths.size() && lengths[i] <= subject.size(); ++i) {
+        key.assign(subject, suffix ? subject.size() - lengths[i] : 0, lengths[i]);
+        LiteralIndex::const_iterator it = index.find(key);
+        if (it == index.end()) continue;
+        for (size_t m = 0; m < it->second.size(); ++m) {
+            if (_run(_globs[it->second[m]], subject.data(), subject.size())) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Every block on the path to the subject's address contains it; only the
+// nick!user part of those masks is left to check
+bool MaskList::_matchCidr(const std::string& subject) const {
+    if (_radix.empty()) return false;
+    size_t at = subject.rfind('@');
+    struct in_addr parsed;
+    if (at == std::string::npos || inet_pton(AF_INET, subject.c_str() + at + 1, &parsed) != 1) return false;
+    uint32_t address = ntohl(parsed.s_addr);
+
+    int node = 0;
+    for (int depth = 0; node >= 0; ++depth) {
+        const std::vector<uint32_t>& masks = _radix[node].masks;
+        for (size_t m = 0; m < masks.size(); ++m) {
+            if (_run(_globs[masks[m]], subject.data(), at)) {
+                return true;
+            }
+        }
+        if (depth == 32) break;
+        node = _radix[node].child[(address >> (31 - depth)) & 1];
+    }
+    return false;
+}
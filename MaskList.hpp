@@ -0,0 +1,83 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+#include <stdint.h>
+
+// Entries each of a channel's +b, +e and +I lists may hold
+#define MAX_CHANNEL_MASKS 100
+
+// One channel list of nick!user@host masks (+b, +e or +I), compiled for
+// matching. Every mask becomes a glob program, filed under its literal
+// prefix or, when it starts with a wildcard, its literal suffix, so a
+// lookup only runs the masks that could match the subject at all. Masks
+// whose host is an IPv4 CIDR block ("*!*@10.0.0.0/8") sit in a binary
+// radix tree keyed by address bits instead. Masks are stored casefolded.
+class MaskList {
+public:
+    struct Entry {
+        std::string mask;
+        std::string setBy;
+        time_t setAt;
+    };
+
+    MaskList();
+    ~MaskList();
+
+    // Completes and casefolds a mask as typed: "nick" becomes "nick!*@*",
+    // "user@host" "*!user@host", and a bare host or address "*!*@host"
+    static std::string normalize(const std::string& mask);
+
+    // Mask as returned by normalize(); false if it is already listed
+    bool add(const std::string& mask, const std::string& setBy, time_t setAt);
+    bool remove(const std::string& mask);
+    bool empty() const;
+    size_t size() const;
+    const std::vector<Entry>& entries() const;
+
+    // subject is nick!user@host, already casefolded with ircToLower()
+    bool matches(const std::string& subject) const;
+
+    size_t memoryUsage() const;
+
+private:
+    MaskList(const MaskList& other);
+    MaskList& operator=(const MaskList& other);
+
+    // The text between '*'s; '?' inside a segment stands for one character
+    struct Glob {
+        std::vector<std::string> segments;
+        bool hasStar;
+        bool leadingStar;
+        bool trailingStar;
+    };
+
+    struct RadixNode {
+        int child[2];
+        // Masks whose block ends at this node; their glob covers nick!user
+        std::vector<uint32_t> masks;
+    };
+
+    typedef std::map<std::string, std::vector<uint32_t> > LiteralIndex;
+
+    static Glob _compile(const std::string& pattern);
+    static bool _run(const Glob& glob, const char* text, size_t length);
+    static bool _parseCidr(const std::string& host, uint32_t& address, int& bits);
+    void _rebuild();
+    void _insertCidr(uint32_t mask, uint32_t address, int bits);
+    bool _matchIndexed(const LiteralIndex& index, const std::vector<size_t>& lengths,
+                       const std::string& subject, bool suffix) const;
+    bool _matchCidr(const std::string& subject) const;
+
+    std::vector<Entry> _entries;
+    // Parallel to _entries
+    std::vector<Glob> _globs;
+    LiteralIndex _byPrefix;
+    LiteralIndex _bySuffix;
+    // Distinct key lengths in each index, so a lookup tries only those
+    std::vector<size_t> _prefixLengths;
+    std::vector<size_t> _suffixLengths;
+    std::vector<uint32_t> _unindexed;
+    std::vector<RadixNode> _radix;
+};
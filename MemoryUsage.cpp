@@ -0,0 +1,19 @@
+#include "MemoryUsage.hpp"
+
+size_t heapBytes(const std::string& value) {
+    // Short strings live inside the object itself
+    const char* data = value.data();
+    const char* object = reinterpret_cast<const char*>(&value);
+    if (value.capacity() == 0 || (data >= object && data < object + sizeof(value))) {
+        return 0;
+    }
+    return value.capacity() + 1;
+}
+
+size_t heapBytes(const std::vector<std::string>& values) {
+    size_t bytes = values.capacity() * sizeof(std::string);
+    for (size_t i = 0; i < values.size(); ++i) {
+        bytes += heapBytes(values[i]);
+    }
+    return bytes;
+}
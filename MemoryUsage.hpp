@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <cstddef>
+
+// Heap bytes held by standard containers, as libstdc++ lays them out: a
+// string's characters once they no longer fit its inline buffer, a vector's
+// whole capacity, one tree node per map or set element. Allocator headers
+// are not counted. Elements' own heap bytes are added only where noted.
+
+// Red-black tree node bookkeeping: colour plus parent, left and right links
+#define RB_NODE_OVERHEAD (4 * sizeof(void*))
+
+size_t heapBytes(const std::string& value);
+// Includes the strings' characters
+size_t heapBytes(const std::vector<std::string>& values);
+
+template <typename T>
+size_t heapBytes(const std::vector<T>& values) {
+    return values.capacity() * sizeof(T);
+}
+
+template <typename T>
+size_t heapBytes(const std::set<T>& values) {
+    return values.size() * (RB_NODE_OVERHEAD + sizeof(T));
+}
+
+template <typename K, typename V>
+size_t heapBytes(const std::map<K, V>& values) {
+    return values.size() * (RB_NODE_OVERHEAD + sizeof(typename std::map<K, V>::value_type));
+}
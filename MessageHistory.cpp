@@ -0,0 +1,133 @@
+#include "MessageHistory.hpp"
+#include "MemoryUsage.hpp"
+#include <cstring>
+
+MessageHistory::MessageHistory(size_t maxLines, size_t maxBytes)
+    : _maxLines(maxLines), _maxBytes(maxBytes), _first(0), _count(0), _head(0), _firstSeq(0) {
+}
+
+MessageHistory::~MessageHistory() {}
+
+const MessageHistory::Entry& MessageHistory::_at(size_t index) const {
+    return _ring[(_first + index) % _ring.size()];
+}
+
+void MessageHistory::_evictOldest() {
+    _prefixes.release(_ring[_first].prefixId);
+    _first = (_first + 1) % _ring.size();
+    _count--;
+    _firstSeq++;
+}
+
+void MessageHistory::append(const std::string& prefix, const std::string& text, uint64_t timeMs) {
+    append(prefix, text.data(), text.size(), timeMs);
+}
+
+void MessageHistory::append(const std::string& prefix, const char* text, size_t textLength, uint64_t timeMs) {
+    if (_maxLines == 0 || _maxBytes == 0) return;
+
+    // Storage is reserved on first use so that silent channels cost nothing
+    if (_arena.empty()) {
+        _arena.resize(_maxBytes);
+        _ring.resize(_maxLines);
+    }
+
+    size_t length = textLength < _arena.size() ? textLength : _arena.size();
+    size_t pos = _head;
+    if (pos + length > _arena.size()) {
+        // Does not fit before the end of the arena: abandon the tail, and the
+        // oldest records stored there with it, and continue from the start
+        while (_count > 0 && _at(0).offset >= _head) {
+            _evictOldest();
+        }
+        pos = 0;
+    }
+    while (_count > 0 && (_count == _ring.size()
+            || (_at(0).offset >= pos && _at(0).offset < pos + length))) {
+        _evictOldest();
+    }
+
+    if (length > 0) {
+        std::memcpy(&_arena[pos], text, length);
+    }
+
+    Entry& entry = _ring[(_first + _count) % _ring.size()];
+    entry.timeMs = timeMs;
+    entry.prefixId = _prefixes.intern(prefix);
+    entry.offset = static_cast<uint32_t>(pos);
+    entry.length = static_cast<uint32_t>(length);
+    _count++;
+    _head = pos + length;
+}
+
+// Only meaningful while empty: lets a restored history keep its msgids
+void MessageHistory::resetSequence(uint64_t firstSeq) {
+    if (_count == 0) {
+        _firstSeq = firstSeq;
+    }
+}
+
+uint64_t MessageHistory::firstSeq() const {
+    return _firstSeq;
+}
+
+uint64_t MessageHistory::endSeq() const {
+    return _firstSeq + _count;
+}
+
+const MessageHistory::Entry* MessageHistory::find(uint64_t seq) const {
+    if (seq < _firstSeq || seq >= endSeq()) {
+        return NULL;
+    }
+    return &_at(static_cast<size_t>(seq - _firstSeq));
+}
+
+const std::string& MessageHistory::prefixOf(const Entry& entry) const {
+    return _prefixes.get(entry.prefixId);
+}
+
+std::string MessageHistory::textOf(const Entry& entry) const {
+    if (entry.length == 0) {
+        return "";
+    }
+    return std::string(&_arena[entry.offset], entry.length);
+}
+
+// Timestamps are non-decreasing along the ring, so both lookups are binary searches
+uint64_t MessageHistory::seqAtOrAfterTime(uint64_t timeMs) const {
+    size_t lo = 0;
+    size_t hi = _count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_at(mid).timeMs < timeMs) lo = mid + 1;
+        else hi = mid;
+    }
+    return _firstSeq + lo;
+}
+
+uint64_t MessageHistory::seqAfterTime(uint64_t timeMs) const {
+    size_t lo = 0;
+    size_t hi = _count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (_at(mid).timeMs <= timeMs) lo = mid + 1;
+        else hi = mid;
+    }
+    return _firstSeq + lo;
+}
+
+size_t MessageHistory::getLineCount() const {
+    return _count;
+}
+
+size_t MessageHistory::getMaxLines() const {
+    return _maxLines;
+}
+
+size_t MessageHistory::getMaxBytes() const {
+    return _maxBytes;
+}
+
+size_t MessageHistory::memoryUsage() const {
+    return heapBytes(_arena) + heapBytes(_ring) + _prefixes.memoryUsage();
+}
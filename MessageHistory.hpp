@@ -0,0 +1,61 @@
+#pragma once
+#include "StringPool.hpp"
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Bounded ring of recent channel messages, limited both by line count and by
+// payload bytes. Payloads live in one byte arena and prefixes are interned,
+// so recording a message does not allocate once the ring has warmed up.
+//
+// Every message gets a sequence number; retained messages always form the
+// contiguous range [firstSeq(), endSeq()).
+class MessageHistory {
+public:
+    struct Entry {
+        uint64_t timeMs;
+        uint32_t prefixId;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    MessageHistory(size_t maxLines, size_t maxBytes);
+    ~MessageHistory();
+
+    void append(const std::string& prefix, const std::string& text, uint64_t timeMs);
+    void append(const std::string& prefix, const char* text, size_t length, uint64_t timeMs);
+    void resetSequence(uint64_t firstSeq);
+
+    uint64_t firstSeq() const;
+    uint64_t endSeq() const;
+    const Entry* find(uint64_t seq) const;
+    const std::string& prefixOf(const Entry& entry) const;
+    std::string textOf(const Entry& entry) const;
+
+    uint64_t seqAtOrAfterTime(uint64_t timeMs) const;
+    uint64_t seqAfterTime(uint64_t timeMs) const;
+
+    size_t getLineCount() const;
+    size_t getMaxLines() const;
+    size_t getMaxBytes() const;
+    // Heap bytes of the arena, the ring and the interned prefixes
+    size_t memoryUsage() const;
+
+private:
+    MessageHistory();
+    MessageHistory(const MessageHistory& other);
+    MessageHistory& operator=(const MessageHistory& other);
+
+    const Entry& _at(size_t index) const;
+    void _evictOldest();
+
+    size_t _maxLines;
+    size_t _maxBytes;
+    std::vector<char> _arena;
+    std::vector<Entry> _ring;
+    size_t _first;
+    size_t _count;
+    size_t _head;
+    uint64_t _firstSeq;
+    StringPool _prefixes;
+};
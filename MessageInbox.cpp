@@ -0,0 +1,108 @@
+#include "MessageInbox.hpp"
+#include "SendQueue.hpp"
+#include <cstring>
+#include <new>
+
+SharedMessage* SharedMessage::create(const std::string& text, unsigned int references) {
+    SharedMessage* message = create(text.size(), references);
+    std::memcpy(message->buffer(), text.data(), text.size());
+    return message;
+}
+
+size_t SharedMessage::_liveBytes = 0;
+
+SharedMessage* SharedMessage::create(size_t length, unsigned int references) {
+    void* memory = ::operator new(sizeof(SharedMessage) + length);
+    __atomic_add_fetch(&_liveBytes, sizeof(SharedMessage) + length, __ATOMIC_RELAXED);
+    return new (memory) SharedMessage(length, references);
+}
+
+SharedMessage::SharedMessage(size_t length, unsigned int references)
+    : _length(length), _references(references) {
+}
+
+SharedMessage::~SharedMessage() {
+}
+
+const char* SharedMessage::data() const {
+    return reinterpret_cast<const char*>(this + 1);
+}
+
+size_t SharedMessage::size() const {
+    return _length;
+}
+
+char* SharedMessage::buffer() {
+    return reinterpret_cast<char*>(this + 1);
+}
+
+void SharedMessage::retain(unsigned int count) {
+    __atomic_add_fetch(&_references, count, __ATOMIC_RELAXED);
+}
+
+void SharedMessage::release() {
+    if (__atomic_sub_fetch(&_references, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_sub_fetch(&_liveBytes, sizeof(SharedMessage) + _length, __ATOMIC_RELAXED);
+        this->~SharedMessage();
+        ::operator delete(this);
+    }
+}
+
+MessageInbox::MessageInbox() : _signalled(0), _pendingBytes(0) {
+    Node* stub = new Node();
+    stub->next = NULL;
+    stub->message = NULL;
+    _head = stub;
+    _tail = stub;
+}
+
+MessageInbox::~MessageInbox() {
+    while (_tail) {
+        Node* next = _tail->next;
+        if (next && next->message) {
+            next->message->release();
+        }
+        delete _tail;
+        _tail = next;
+    }
+}
+
+void MessageInbox::push(SharedMessage* message) {
+    Node* node = new Node();
+    node->next = NULL;
+    node->message = message;
+    __atomic_add_fetch(&_pendingBytes, message->size(), __ATOMIC_RELAXED);
+    Node* previous = __atomic_exchange_n(&_head, node, __ATOMIC_ACQ_REL);
+    // Until this store the consumer sees the list end at previous and
+    // simply picks the rest up on its next drain
+    __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+}
+
+bool MessageInbox::markSignalled() {
+    return __atomic_exchange_n(&_signalled, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+size_t MessageInbox::drainInto(SendQueue& out) {
+    // An exchange, not a store: reading a producer's flag makes its push visible
+    __atomic_exchange_n(&_signalled, 0, __ATOMIC_ACQ_REL);
+    size_t count = 0;
+    while (true) {
+        Node* next = __atomic_load_n(&_tail->next, __ATOMIC_ACQUIRE);
+        if (!next) break;
+        __atomic_sub_fetch(&_pendingBytes, next->message->size(), __ATOMIC_RELAXED);
+        out.append(next->message);
+        next->message = NULL;
+        delete _tail;
+        _tail = next;
+        ++count;
+    }
+    return count;
+}
+
+size_t SharedMessage::liveBytes() {
+    return __atomic_load_n(&_liveBytes, __ATOMIC_RELAXED);
+}
+
+size_t MessageInbox::pendingBytes() const {
+    return __atomic_load_n(&_pendingBytes, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+class SendQueue;
+
+// An immutable line that can be posted to many inboxes at once; the last
+// inbox to consume it frees it. The bytes follow the object in the same
+// allocation.
+class SharedMessage {
+public:
+    static SharedMessage* create(const std::string& text, unsigned int references);
+    // Room for length bytes, which the caller writes through buffer()
+    // before the message is handed to anyone
+    static SharedMessage* create(size_t length, unsigned int references);
+
+    const char* data() const;
+    size_t size() const;
+    char* buffer();
+    // Any thread, while the caller holds a reference
+    void retain(unsigned int count);
+    void release();
+
+    // Any thread: heap bytes of every message alive, each counted once
+    // however many queues hold it (a snapshot)
+    static size_t liveBytes();
+
+private:
+    SharedMessage(size_t length, unsigned int references);
+    ~SharedMessage();
+    SharedMessage(const SharedMessage& other);
+    SharedMessage& operator=(const SharedMessage& other);
+
+    size_t _length;
+    unsigned int _references;
+
+    static size_t _liveBytes;
+};
+
+// Lock-free multi-producer, single-consumer queue of SharedMessage
+// references (Vyukov's intrusive MPSC list). Any thread may push; only the
+// thread that owns the client drains. A separate flag lets producers
+// coalesce wake-ups: the first push after a drain is told to announce it.
+class MessageInbox {
+public:
+    MessageInbox();
+    ~MessageInbox();
+
+    // Any thread
+    void push(SharedMessage* message);
+    // Any thread, after push: true if the inbox was not yet announced
+    bool markSignalled();
+
+    // Owner thread only. Re-arms the announcement, then hands every message
+    // queued so far to out, references and all, without copying the text.
+    // Returns the number of messages.
+    size_t drainInto(SendQueue& out);
+
+    // Any thread: text bytes pushed and not yet drained (a snapshot)
+    size_t pendingBytes() const;
+
+private:
+    MessageInbox(const MessageInbox& other);
+    MessageInbox& operator=(const MessageInbox& other);
+
+    struct Node {
+        Node* next;
+        SharedMessage* message;
+    };
+
+    // Producers swap themselves in at _head; the consumer walks from _tail,
+    // which always points at an already consumed (or the initial) node
+    Node* _head;
+    Node* _tail;
+    int _signalled;
+    size_t _pendingBytes;
+};
@@ -2,12 +2,14 @@
 #include "Server.hpp"
 #include "Client.hpp"
 #include "Channel.hpp"
+#include "OutboundMessage.hpp"
+#include "Arena.hpp"
 #include "utils.hpp"
-#include <sstream>
 #include <iostream>
 #include <string>
 #include <cstdlib>
 #include <cerrno>
+#include <ctime>
 
 ModeCommand::ModeCommand() {}
 
@@ -17,64 +19,103 @@ bool ModeCommand::requiresRegistration() const {
     return true;
 }
 
-static void parseModeChanges(Client* client, const std::string& target, const std::string& modestr, std::vector<std::pair<char,bool> >& outModes) {
+typedef ArenaVector<std::pair<char, bool> >::type ModeChanges;
+
+static void parseModeChanges(Client* client, const ArenaString& target, const ArenaString& modestr, ModeChanges& outModes) {
     bool add = true;
     for (size_t i = 0; i < modestr.size(); ++i) {
         char c = modestr[i];
         if (c == '+') { add = true; continue; }
         if (c == '-') { add = false; continue; }
-        if (c == 'i' || c == 't' || c == 'k' || c == 'o' || c == 'l') {
+        if (c == 'i' || c == 't' || c == 'k' || c == 'o' || c == 'l' || Channel::isListMode(c)) {
             outModes.push_back(std::make_pair(c, add));
         } else {
-            client->reply(472, std::string(1, c) + " :is unknown mode char for " + target);
+            client->reply(472, std::string(1, c) + " :is unknown mode char for " + toString(target));
         }
     }
 }
 
-void ModeCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+// RPL_BANLIST/RPL_EXCEPTLIST/RPL_INVITELIST entries and the closing numeric
+static void sendMaskList(Arena& arena, Client* client, Channel* channel, char mode) {
+    int entryReply = 367, endReply = 368;
+    const char* end = " :End of Channel Ban List";
+    if (mode == 'e') {
+        entryReply = 348;
+        endReply = 349;
+        end = " :End of Channel Exception List";
+    } else if (mode == 'I') {
+        entryReply = 346;
+        endReply = 347;
+        end = " :End of Channel Invite List";
+    }
+    const std::vector<MaskList::Entry>& entries = channel->getMaskList(mode).entries();
+    ArenaString line((ArenaAllocator<char>(arena)));
+    for (size_t i = 0; i < entries.size(); ++i) {
+        line.assign(channel->getName().data(), channel->getName().size());
+        line += ' ';
+        line.append(entries[i].mask.data(), entries[i].mask.size());
+        line += ' ';
+        line.append(entries[i].setBy.data(), entries[i].setBy.size());
+        line += ' ';
+        appendNumber(line, static_cast<unsigned long>(entries[i].setAt));
+        client->reply(entryReply, toString(line));
+    }
+    client->reply(endReply, channel->getName() + end);
+}
+
+void ModeCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     (void)server;
     if (args.size() < 2) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    const std::string target = args[1];
-    Channel* channel = server.getChannel(target);
-    if (isValidChannelName(target) && channel) {
+    const ArenaString& target = args[1];
+    Channel* channel = server.getChannel(target.data(), target.size());
+    if (isValidChannelName(target.data(), target.size()) && channel) {
 
         if (args.size() < 3) {
             std::string modes = channel->getModeString();
-            client->reply(324, target + " " + modes);
-            client->reply(329, target + " " + channel->getCreationTimeString());
+            client->reply(324, toString(target) + " " + modes);
+            client->reply(329, toString(target) + " " + channel->getCreationTimeString());
+            return;
+        }
+
+        // "MODE #channel b" (or +b, e, I) lists masks and needs no privileges
+        const ArenaString& query = args[2];
+        size_t skip = (!query.empty() && query[0] == '+') ? 1 : 0;
+        if (args.size() == 3 && query.size() == skip + 1 && Channel::isListMode(query[skip])) {
+            sendMaskList(server.getArena(), client, channel, query[skip]);
             return;
         }
 
         int clientFd = client->getFd();
         if (!channel->isMember(clientFd)) {
-            client->reply(442, target + " :You are not on that channel");
+            client->reply(442, toString(target) + " :You are not on that channel");
             return;
         }
         if (!channel->isOperator(clientFd)) {
-            client->reply(482, target + " :You are not channel operator");
+            client->reply(482, toString(target) + " :You are not channel operator");
             return;
         }
 
-        std::string modestr = args[2];
-        std::vector<std::pair<char,bool> > modeChanges;
-        parseModeChanges(client, target, modestr, modeChanges);
+        Arena& arena = server.getArena();
+        ModeChanges modeChanges((ArenaAllocator<std::pair<char, bool> >(arena)));
+        parseModeChanges(client, target, args[2], modeChanges);
 
         size_t argIndex = 3;
-        std::string appliedModes = "";
-        std::vector<std::string> appliedArgs;
+        ArenaString appliedModes((ArenaAllocator<char>(arena)));
+        ArenaVector<ArenaString>::type appliedArgs((ArenaAllocator<ArenaString>(arena)));
+        ArenaString param((ArenaAllocator<char>(arena)));
         char currentSign = 0;
 
         for (size_t i = 0; i < modeChanges.size(); ++i) {
             char mode = modeChanges[i].first;
             bool add = modeChanges[i].second;
 
-            std::string param;
+            param.clear();
             bool hasParam = false;
-            if ((add && (mode == 'k' || mode == 'l')) || mode == 'o') {
+            if ((add && (mode == 'k' || mode == 'l')) || mode == 'o' || Channel::isListMode(mode)) {
                 if (argIndex >= args.size()) {
                     continue;
                 }
@@ -85,7 +126,7 @@ void ModeCommand::execute(Server& server, Client* client, const std::vector<std:
             bool applied = false;
             if (mode == 'k') {
                 if (add) {
-                    channel->setKey(param);
+                    channel->setKey(toString(param));
                     applied = true;
                 } else {
                     if (channel->hasKey()) {
@@ -127,10 +168,21 @@ void ModeCommand::execute(Server& server, Client* client, const std::vector<std:
                     if (channel->hasMode('t')) { channel->removeMode('t'); applied = true; }
                 }
             }
+            else if (Channel::isListMode(mode)) {
+                std::string mask = MaskList::normalize(toString(param));
+                param.assign(mask.data(), mask.size());
+                if (!add) {
+                    applied = channel->removeListMask(mode, mask);
+                } else if (channel->getMaskList(mode).size() >= MAX_CHANNEL_MASKS) {
+                    client->reply(478, toString(target) + " " + mask + " :Channel list is full");
+                } else {
+                    applied = channel->addListMask(mode, mask, client->getPrefix(), time(NULL));
+                }
+            }
             else if (mode == 'o') {
-                Client* targetClient = channel->findClientByNickname(param);
+                Client* targetClient = channel->findClientByNickname(param.data(), param.size());
                 if (!targetClient) {
-                    client->reply(401, param + " :No such nick or channel name");
+                    client->reply(401, toString(param) + " :No such nick or channel name");
                 } else {
                     if (add) {
                         if (!channel->isOperator(targetClient->getFd())) { channel->addOperator(targetClient->getFd()); applied = true; }
@@ -157,16 +209,25 @@ void ModeCommand::execute(Server& server, Client* client, const std::vector<std:
         if (appliedModes.empty()) {
             return;
         }
-
-        std::ostringstream oss;
-        oss << ":" << client->getPrefix() << " MODE " << target << " " << appliedModes;
+        server.saveChannelState(channel);
+
+        ArenaString out((ArenaAllocator<char>(arena)));
+        out += ':';
+        out.append(client->getPrefix().data(), client->getPrefix().size());
+        out += " MODE ";
+        out += target;
+        out += ' ';
+        out += appliedModes;
         for (size_t i = 0; i < appliedArgs.size(); ++i) {
-            oss << " " << appliedArgs[i];
+            out += ' ';
+            out += appliedArgs[i];
         }
-        oss << "\r\n";
-        channel->broadcastToAll(oss.str());
+        out += "\r\n";
+        OutboundMessage outbound(out.data(), out.size());
+        channel->broadcast(outbound, NULL);
+        server.propagate(outbound.data(), outbound.size(), NULL);
     }
     else {
-        client->reply(401, target + " :No such nick or channel name");
+        client->reply(401, toString(target) + " :No such nick or channel name");
     }
 }
@@ -0,0 +1,118 @@
+#include "NamesCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "MemoryUsage.hpp"
+#include <sstream>
+
+#define NAMES_LINE_BYTES 400
+
+NamesReplyStream::NamesReplyStream(const std::vector<std::string>& channelNames)
+    : _channelNames(channelNames),
+      _allChannels(channelNames.empty()),
+      _next(0),
+      _current(INVALID_CHANNEL_HANDLE),
+      _inChannel(false),
+      _memberStarted(false),
+      _lastMember(0) {
+}
+
+bool NamesReplyStream::_nextChannel(Server& server, Client* client) {
+    if (_allChannels) {
+        while (_next < server.getChannelSlotCount()) {
+            Channel* channel = server.getChannelAtSlot(_next++);
+            if (channel) {
+                _current = channel->getHandle();
+                _inChannel = true;
+                _memberStarted = false;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    while (_next < _channelNames.size()) {
+        const std::string& name = _channelNames[_next++];
+        Channel* channel = server.getChannel(name);
+        if (!channel) {
+            client->reply(366, name + " :End of /NAMES list");
+            continue;
+        }
+        _current = channel->getHandle();
+        _inChannel = true;
+        _memberStarted = false;
+        return true;
+    }
+    return false;
+}
+
+bool NamesReplyStream::resume(Server& server, Client* client) {
+    while (client->getSendQueue().size() < SENDQ_WATERMARK) {
+        if (!_inChannel) {
+            if (!_nextChannel(server, client)) {
+                if (_allChannels) {
+                    client->reply(366, "* :End of /NAMES list");
+                }
+                return true;
+            }
+            continue;
+        }
+
+        // The channel may have emptied and gone since the last resume
+        Channel* channel = server.resolveChannel(_current);
+        if (!channel) {
+            _inChannel = false;
+            continue;
+        }
+
+        const std::map<int, Client*>& members = channel->getMembers();
+        std::map<int, Client*>::const_iterator it = _memberStarted ? members.upper_bound(_lastMember) : members.begin();
+        std::string list;
+        for (; it != members.end() && list.size() < NAMES_LINE_BYTES; ++it) {
+            if (!list.empty()) list += " ";
+            if (channel->isOperator(it->first)) list += "@";
+            list += it->second->getNickname();
+            _lastMember = it->first;
+            _memberStarted = true;
+        }
+        if (!list.empty()) {
+            client->reply(353, "= " + channel->getName() + " :" + list);
+        }
+        if (it == members.end()) {
+            if (!_allChannels) {
+                client->reply(366, channel->getName() + " :End of /NAMES list");
+            }
+            _inChannel = false;
+        }
+    }
+    return false;
+}
+
+size_t NamesReplyStream::memoryUsage() const {
+    return sizeof(*this) + heapBytes(_channelNames);
+}
+
+NamesCommand::NamesCommand() {}
+
+NamesCommand::~NamesCommand() {}
+
+bool NamesCommand::requiresRegistration() const {
+    return true;
+}
+
+// NAMES [<channel>{,<channel>}]
+void NamesCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    (void)server;
+
+    std::vector<std::string> channels;
+    if (args.size() > 1) {
+        std::istringstream iss(toString(args[1]));
+        std::string name;
+        while (std::getline(iss, name, ',')) {
+            if (!name.empty()) {
+                channels.push_back(name);
+            }
+        }
+    }
+    client->addReplyStream(new NamesReplyStream(channels));
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "ICommand.hpp"
+#include "ReplyStream.hpp"
+#include "ChannelRegistry.hpp"
+#include <string>
+#include <vector>
+
+class Server;
+class Client;
+
+// Handles the NAMES command
+class NamesCommand : public ICommand {
+public:
+    NamesCommand();
+    virtual ~NamesCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    NamesCommand(const NamesCommand& other);
+    NamesCommand& operator=(const NamesCommand& other);
+};
+
+// RPL_NAMREPLY lines for the given channels (every channel when the list is
+// empty), a few hundred bytes of nicknames per line, each channel closed by
+// RPL_ENDOFNAMES. Also used by JOIN. A channel's members are walked by key,
+// so one that changes between resumes is still listed without repeats.
+class NamesReplyStream : public ReplyStream {
+public:
+    explicit NamesReplyStream(const std::vector<std::string>& channelNames);
+
+    virtual bool resume(Server& server, Client* client);
+    virtual size_t memoryUsage() const;
+
+private:
+    bool _nextChannel(Server& server, Client* client);
+
+    std::vector<std::string> _channelNames;
+    bool _allChannels;
+    size_t _next;
+    ChannelHandle _current;
+    bool _inChannel;
+    bool _memberStarted;
+    int _lastMember;
+};
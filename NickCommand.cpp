@@ -10,19 +10,38 @@ bool NickCommand::requiresRegistration() const {
     return false;
 }
 
-void NickCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
-    (void)server;
+void NickCommand::execute(Server& server, Client* client, const CommandArgs& args) {
 
     if (args.size() != 2) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    Client* existing = server.getClientByNickname(args[1]);
+    // Kept as the client's nickname
+    std::string nick = toString(args[1]);
+    if (nick.empty() || nick.size() > CLIENT_NICKLEN) {
+        client->reply(432, nick + " :Erroneous nickname");
+        return;
+    }
+
+    Client* existing = server.getClientByNickname(nick);
     if (existing && existing != client) {
-        client->reply(433, args[1] + " :Nickname already in use");
+        client->reply(433, nick + " :Nickname already in use");
+        return;
+    }
+    // Before registration the client may not have logged in yet; the
+    // nickname is checked again when registration completes
+    if (client->hasRegistered() && !server.nickAllowed(client, nick)) {
+        client->reply(433, nick + " :Nickname is registered to another account");
         return;
     }
 
-    client->setNickname(args[1]);
+    std::string oldPrefix = client->getPrefix();
+    std::string oldNick = client->getNickname();
+    client->setNickname(nick);
+    if (client->hasRegistered()) {
+        server.nickSeen(client, oldNick);
+        server.nickSeen(client, nick);
+        server.nicknameChanged(client, oldPrefix);
+    }
 }
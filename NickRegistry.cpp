@@ -0,0 +1,526 @@
+#include "NickRegistry.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <cstdio>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define INITIAL_INDEX_CAPACITY 1024
+#define INITIAL_RECORD_CAPACITY 256
+#define EMPTY_SLOT 0u
+#define TOMBSTONE_SLOT 0xFFFFFFFFu
+
+#define OP_CLAIM 1u
+#define OP_DROP 2u
+#define OP_SEEN 3u
+// Log records replayed at most on open: past this many a compaction starts
+#define COMPACT_LOG_RECORDS 65536
+// A log that has anything in it is compacted at least this often (seconds)
+#define COMPACT_INTERVAL 600
+// A nickname's last use is recorded no more precisely than this (seconds)
+#define SEEN_GRANULARITY 60
+#define REPLAY_BATCH 256
+
+static void copyField(char* dst, size_t size, const std::string& value) {
+    size_t length = value.size() < size - 1 ? value.size() : size - 1;
+    std::memcpy(dst, value.data(), length);
+    std::memset(dst + length, 0, size - length);
+}
+
+static std::string readField(const char* src, size_t size) {
+    size_t length = 0;
+    while (length < size && src[length] != '\0') ++length;
+    return std::string(src, length);
+}
+
+// FNV-1a over everything after the checksum itself
+static uint32_t checksum(const void* entry, size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(entry);
+    uint32_t hash = 2166136261u;
+    for (size_t i = sizeof(uint32_t); i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+NickRegistry::NickRegistry()
+    : _base(NULL), _length(0), _logFd(-1), _logRecords(0), _compactor(-1), _compactedLogSize(0),
+      _lastCompaction(0), _nextMaintenance(0) {}
+
+NickRegistry::~NickRegistry() {
+    close();
+}
+
+bool NickRegistry::isOpen() const {
+    return _base != NULL;
+}
+
+size_t NickRegistry::size() const {
+    return _base ? reinterpret_cast<Header*>(_base)->liveCount : 0;
+}
+
+uint32_t* NickRegistry::_index() const {
+    return reinterpret_cast<uint32_t*>(_base + sizeof(Header));
+}
+
+NickRegistry::Record* NickRegistry::_records() const {
+    const Header* header = reinterpret_cast<const Header*>(_base);
+    return reinterpret_cast<Record*>(_base + sizeof(Header) + header->indexCapacity * sizeof(uint32_t));
+}
+
+void NickRegistry::_unmap() {
+    if (_base) {
+        munmap(_base, _length);
+        _base = NULL;
+        _length = 0;
+    }
+}
+
+void NickRegistry::close() {
+    settle();
+    _unmap();
+    if (_logFd >= 0) {
+        ::close(_logFd);
+        _logFd = -1;
+    }
+    _logRecords = 0;
+}
+
+// Maps <path> privately in place of the current mapping; false, leaving
+// that one as it was, if there is no usable snapshot
+bool NickRegistry::_mapSnapshot() {
+    int fd = ::open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    void* addr = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header)) {
+        addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    ::close(fd);
+    if (addr != MAP_FAILED) {
+        const Header* header = static_cast<const Header*>(addr);
+        size_t length = static_cast<size_t>(st.st_size);
+        bool valid = std::memcmp(header->magic, NICK_REGISTRY_MAGIC, sizeof(header->magic)) == 0
+            && header->version == NICK_REGISTRY_VERSION
+            && header->recordSize == sizeof(Record)
+            && header->indexCapacity > 0
+            && (header->indexCapacity & (header->indexCapacity - 1)) == 0
+            && header->recordCount <= header->recordCapacity
+            && length == sizeof(Header) + header->indexCapacity * sizeof(uint32_t)
+                + static_cast<size_t>(header->recordCapacity) * sizeof(Record);
+        if (valid) {
+            _unmap();
+            _base = static_cast<char*>(addr);
+            _length = length;
+            return true;
+        }
+        munmap(addr, st.st_size);
+    }
+    ngircd_log("warning", "Nickname registry " + _path + " has an incompatible format, starting a new one");
+    return false;
+}
+
+// An empty registry in anonymous memory, in place of the current mapping
+bool NickRegistry::_mapEmpty(uint32_t indexCapacity, uint32_t recordCapacity) {
+    size_t length = sizeof(Header) + indexCapacity * sizeof(uint32_t) + recordCapacity * sizeof(Record);
+    void* addr = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    _unmap();
+    _base = static_cast<char*>(addr);
+    _length = length;
+
+    Header* header = reinterpret_cast<Header*>(_base);
+    std::memcpy(header->magic, NICK_REGISTRY_MAGIC, sizeof(header->magic));
+    header->version = NICK_REGISTRY_VERSION;
+    header->recordSize = sizeof(Record);
+    header->indexCapacity = indexCapacity;
+    header->recordCapacity = recordCapacity;
+    return true;
+}
+
+bool NickRegistry::_openLog() {
+    _logFd = ::open((_path + ".log").c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    return _logFd >= 0;
+}
+
+// Applies the log records the snapshot does not include yet. A torn or
+// damaged tail, from a crash in the middle of an append, is cut off.
+void NickRegistry::_replayLog() {
+    LogRecord batch[REPLAY_BATCH];
+    off_t offset = 0;
+    size_t valid = 0;
+    bool damaged = false;
+    for (;;) {
+        ssize_t n = pread(_logFd, batch, sizeof(batch), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        size_t whole = static_cast<size_t>(n) / sizeof(LogRecord);
+        for (size_t i = 0; i < whole && !damaged; ++i) {
+            if (batch[i].checksum != checksum(&batch[i], sizeof(LogRecord))) {
+                damaged = true;
+                break;
+            }
+            if (batch[i].sequence > reinterpret_cast<Header*>(_base)->sequence) {
+                _apply(batch[i]);
+            }
+            ++valid;
+        }
+        if (damaged || whole * sizeof(LogRecord) != static_cast<size_t>(n)) {
+            damaged = true;
+            break;
+        }
+        offset += n;
+    }
+    if (damaged) {
+        std::ostringstream oss;
+        oss << "Nickname registry log " << _path << ".log: dropping a damaged tail after " << valid << " record(s)";
+        ngircd_log("warning", oss.str());
+        if (ftruncate(_logFd, static_cast<off_t>(valid * sizeof(LogRecord))) < 0) {
+            ngircd_log("error", "Cannot truncate " + _path + ".log: " + std::strerror(errno));
+        }
+    }
+    _logRecords = valid;
+}
+
+bool NickRegistry::open(const std::string& path) {
+    close();
+    _path = path;
+    if (!_mapSnapshot() && !_mapEmpty(INITIAL_INDEX_CAPACITY, INITIAL_RECORD_CAPACITY)) {
+        ngircd_log("error", "Cannot map nickname registry " + path + ": " + std::strerror(errno));
+        return false;
+    }
+    if (!_openLog()) {
+        ngircd_log("error", "Cannot open " + path + ".log: " + std::strerror(errno));
+        close();
+        return false;
+    }
+    _replayLog();
+    _lastCompaction = time(NULL);
+    _nextMaintenance = 0;
+    return true;
+}
+
+long NickRegistry::_findSlot(const std::string& nick, uint32_t hash) const {
+    const Header* header = reinterpret_cast<const Header*>(_base);
+    const uint32_t* index = _index();
+    const Record* records = _records();
+    uint32_t mask = header->indexCapacity - 1;
+
+    for (uint32_t i = 0, slot = hash & mask; i < header->indexCapacity; ++i, slot = (slot + 1) & mask) {
+        uint32_t value = index[slot];
+        if (value == EMPTY_SLOT) {
+            return -1;
+        }
+        if (value == TOMBSTONE_SLOT) {
+            continue;
+        }
+        const Record& record = records[value - 1];
+        if (record.hash == hash && ircEquals(nick, record.nick)) {
+            return static_cast<long>(slot);
+        }
+    }
+    return -1;
+}
+
+void NickRegistry::_insertIndex(uint32_t hash, uint32_t recordNo) {
+    Header* header = reinterpret_cast<Header*>(_base);
+    uint32_t* index = _index();
+    uint32_t mask = header->indexCapacity - 1;
+
+    uint32_t slot = hash & mask;
+    while (index[slot] != EMPTY_SLOT && index[slot] != TOMBSTONE_SLOT) {
+        slot = (slot + 1) & mask;
+    }
+    if (index[slot] == TOMBSTONE_SLOT) {
+        header->tombstones--;
+    }
+    index[slot] = recordNo + 1;
+}
+
+// Rebuilds with room to spare in anonymous memory: live records are copied
+// compactly. The next compaction puts it back in a file.
+bool NickRegistry::_grow() {
+    const Header* header = reinterpret_cast<const Header*>(_base);
+    uint32_t live = header->liveCount;
+    uint32_t indexCapacity = header->indexCapacity;
+    while ((live + 1) * 4 > indexCapacity) indexCapacity *= 2;
+    uint32_t recordCapacity = header->recordCapacity;
+    while ((live + 1) * 2 > recordCapacity) recordCapacity *= 2;
+
+    NickRegistry next;
+    if (!next._mapEmpty(indexCapacity, recordCapacity)) {
+        ngircd_log("error", "Cannot grow nickname registry " + _path + ": " + std::strerror(errno));
+        return false;
+    }
+
+    Header* nextHeader = reinterpret_cast<Header*>(next._base);
+    const uint32_t* index = _index();
+    const Record* records = _records();
+    Record* nextRecords = next._records();
+    for (uint32_t slot = 0; slot < header->indexCapacity; ++slot) {
+        uint32_t value = index[slot];
+        if (value == EMPTY_SLOT || value == TOMBSTONE_SLOT) continue;
+        uint32_t recordNo = nextHeader->recordCount++;
+        nextRecords[recordNo] = records[value - 1];
+        next._insertIndex(nextRecords[recordNo].hash, recordNo);
+    }
+    nextHeader->liveCount = nextHeader->recordCount;
+    nextHeader->sequence = header->sequence;
+
+    std::swap(_base, next._base);
+    std::swap(_length, next._length);
+    return true;
+}
+
+bool NickRegistry::_reserve() {
+    const Header* header = reinterpret_cast<const Header*>(_base);
+    if ((header->liveCount + header->tombstones + 1) * 2 > header->indexCapacity
+        || (header->freeHead == 0 && header->recordCount == header->recordCapacity)) {
+        return _grow();
+    }
+    return true;
+}
+
+void NickRegistry::_apply(const LogRecord& entry) {
+    std::string nick = readField(entry.nick, sizeof(entry.nick));
+    uint32_t hash = ircHash(nick);
+    long slot = _findSlot(nick, hash);
+
+    if (entry.op == OP_CLAIM) {
+        Record* record;
+        if (slot >= 0) {
+            record = &_records()[_index()[slot] - 1];
+        } else {
+            if (!_reserve()) return;
+            Header* header = reinterpret_cast<Header*>(_base);
+            uint32_t recordNo;
+            if (header->freeHead != 0) {
+                recordNo = header->freeHead - 1;
+                header->freeHead = _records()[recordNo].nextFree;
+            } else {
+                recordNo = header->recordCount++;
+            }
+            _insertIndex(hash, recordNo);
+            header->liveCount++;
+            record = &_records()[recordNo];
+            record->hash = hash;
+            record->nextFree = 0;
+            copyField(record->nick, sizeof(record->nick), nick);
+        }
+        record->registeredAt = entry.registeredAt;
+        record->lastSeen = entry.lastSeen;
+        std::memcpy(record->account, entry.account, sizeof(record->account));
+        record->account[sizeof(record->account) - 1] = '\0';
+    } else if (entry.op == OP_DROP && slot >= 0) {
+        Header* header = reinterpret_cast<Header*>(_base);
+        uint32_t recordNo = _index()[slot] - 1;
+        _index()[slot] = TOMBSTONE_SLOT;
+        header->tombstones++;
+        header->liveCount--;
+        Record& record = _records()[recordNo];
+        std::memset(&record, 0, sizeof(record));
+        record.nextFree = header->freeHead;
+        header->freeHead = recordNo + 1;
+    } else if (entry.op == OP_SEEN && slot >= 0) {
+        _records()[_index()[slot] - 1].lastSeen = entry.lastSeen;
+    }
+    reinterpret_cast<Header*>(_base)->sequence = entry.sequence;
+}
+
+// A change takes effect only once it is in the log
+bool NickRegistry::_append(LogRecord& entry) {
+    entry.sequence = reinterpret_cast<Header*>(_base)->sequence + 1;
+    entry.checksum = checksum(&entry, sizeof(entry));
+    ssize_t n = write(_logFd, &entry, sizeof(entry));
+    if (n != static_cast<ssize_t>(sizeof(entry))) {
+        ngircd_log("error", "Cannot append to " + _path + ".log: " + std::strerror(n < 0 ? errno : ENOSPC));
+        if (n > 0 && ftruncate(_logFd, static_cast<off_t>(_logRecords * sizeof(LogRecord))) < 0) {
+            ngircd_log("error", "Cannot truncate " + _path + ".log: " + std::strerror(errno));
+        }
+        return false;
+    }
+    _logRecords++;
+    return true;
+}
+
+const char* NickRegistry::owner(const std::string& nick) const {
+    if (!_base || nick.size() >= REGISTERED_NICK_SIZE) return NULL;
+    long slot = _findSlot(nick, ircHash(nick));
+    return slot < 0 ? NULL : _records()[_index()[slot] - 1].account;
+}
+
+bool NickRegistry::info(const std::string& nick, std::string& account, time_t& registeredAt, time_t& lastSeen) const {
+    if (!_base || nick.size() >= REGISTERED_NICK_SIZE) return false;
+    long slot = _findSlot(nick, ircHash(nick));
+    if (slot < 0) return false;
+    const Record& record = _records()[_index()[slot] - 1];
+    account = record.account;
+    registeredAt = static_cast<time_t>(record.registeredAt);
+    lastSeen = static_cast<time_t>(record.lastSeen);
+    return true;
+}
+
+bool NickRegistry::claim(const std::string& nick, const std::string& account, time_t now) {
+    if (!_base || nick.empty() || nick.size() >= REGISTERED_NICK_SIZE
+        || account.empty() || account.size() >= REGISTERED_ACCOUNT_SIZE) {
+        return false;
+    }
+    if (!_reserve()) return false;
+
+    LogRecord entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.op = OP_CLAIM;
+    entry.registeredAt = now;
+    entry.lastSeen = now;
+    copyField(entry.nick, sizeof(entry.nick), nick);
+    copyField(entry.account, sizeof(entry.account), account);
+    if (!_append(entry)) return false;
+    _apply(entry);
+    return true;
+}
+
+void NickRegistry::drop(const std::string& nick) {
+    if (!owner(nick)) return;
+
+    LogRecord entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.op = OP_DROP;
+    copyField(entry.nick, sizeof(entry.nick), nick);
+    if (_append(entry)) {
+        _apply(entry);
+    }
+}
+
+void NickRegistry::seen(const std::string& nick, time_t now) {
+    if (!_base || nick.size() >= REGISTERED_NICK_SIZE) return;
+    long slot = _findSlot(nick, ircHash(nick));
+    if (slot < 0 || now - _records()[_index()[slot] - 1].lastSeen < SEEN_GRANULARITY) return;
+
+    LogRecord entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.op = OP_SEEN;
+    entry.lastSeen = now;
+    copyField(entry.nick, sizeof(entry.nick), nick);
+    if (_append(entry)) {
+        _apply(entry);
+    }
+}
+
+void NickRegistry::maintain(time_t now) {
+    if (!_base || now < _nextMaintenance) return;
+    _nextMaintenance = now + 1;
+
+    if (_compactor > 0) {
+        int status;
+        pid_t done = waitpid(_compactor, &status, WNOHANG);
+        if (done == _compactor) {
+            _finishCompaction(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        } else if (done < 0 && errno != EINTR) {
+            _finishCompaction(false);
+        }
+        return;
+    }
+    if (_logRecords >= COMPACT_LOG_RECORDS || (_logRecords > 0 && now - _lastCompaction >= COMPACT_INTERVAL)) {
+        _startCompaction(now);
+    }
+}
+
+void NickRegistry::settle() {
+    if (_compactor <= 0) return;
+    int status = 0;
+    pid_t done;
+    while ((done = waitpid(_compactor, &status, 0)) < 0 && errno == EINTR) {}
+    _finishCompaction(done == _compactor && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+// The child has a frozen copy of the mapping for free and writes it out;
+// the loop only pays for the fork(). Unused capacity is left as a hole.
+void NickRegistry::_startCompaction(time_t now) {
+    _lastCompaction = now;
+    std::string tmpPath = _path + ".tmp";
+    pid_t pid = fork();
+    if (pid < 0) {
+        ngircd_log("error", std::string("Cannot compact nickname registry: fork() failed: ") + std::strerror(errno));
+        return;
+    }
+    if (pid == 0) {
+        // Client sockets must not outlive their close() in the parent
+#ifdef SYS_close_range
+        syscall(SYS_close_range, 3u, ~0u, 0u);
+#endif
+        int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        const Header* header = reinterpret_cast<const Header*>(_base);
+        size_t used = sizeof(Header) + header->indexCapacity * sizeof(uint32_t)
+            + static_cast<size_t>(header->recordCount) * sizeof(Record);
+        bool ok = fd >= 0;
+        for (size_t offset = 0; ok && offset < used;) {
+            ssize_t n = write(fd, _base + offset, used - offset);
+            if (n < 0 && errno == EINTR) continue;
+            ok = n > 0;
+            if (ok) offset += static_cast<size_t>(n);
+        }
+        ok = ok && ftruncate(fd, static_cast<off_t>(_length)) == 0 && fsync(fd) == 0;
+        _exit(ok ? 0 : 1);
+    }
+    _compactor = pid;
+    _compactedLogSize = static_cast<off_t>(_logRecords * sizeof(LogRecord));
+}
+
+// The new snapshot replaces the old one; the log keeps only what was
+// appended after the fork. A crash in between is harmless: replay skips
+// records the snapshot already includes.
+void NickRegistry::_finishCompaction(bool succeeded) {
+    _compactor = -1;
+    std::string tmpPath = _path + ".tmp";
+    if (!succeeded || rename(tmpPath.c_str(), _path.c_str()) < 0) {
+        ngircd_log("error", "Nickname registry compaction failed, keeping the log: " + _path);
+        unlink(tmpPath.c_str());
+        return;
+    }
+
+    std::string logPath = _path + ".log";
+    std::string logTmpPath = logPath + ".tmp";
+    int fd = ::open(logTmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    bool ok = fd >= 0;
+    char buffer[REPLAY_BATCH * sizeof(LogRecord)];
+    for (off_t offset = _compactedLogSize; ok;) {
+        ssize_t n = pread(_logFd, buffer, sizeof(buffer), offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n == 0) break;
+        ok = n > 0 && write(fd, buffer, n) == n;
+        offset += n;
+    }
+    ok = ok && fdatasync(fd) == 0 && rename(logTmpPath.c_str(), logPath.c_str()) == 0;
+    if (!ok) {
+        // The old log still replays correctly over the new snapshot
+        ngircd_log("error", "Cannot shorten " + logPath + ": " + std::strerror(errno));
+        if (fd >= 0) ::close(fd);
+        unlink(logTmpPath.c_str());
+        return;
+    }
+    ::close(_logFd);
+    _logFd = fd;
+
+    // Pages nobody has changed since are shared with the page cache again
+    if (_mapSnapshot()) {
+        _replayLog();
+    } else {
+        _logRecords = static_cast<size_t>(lseek(_logFd, 0, SEEK_END)) / sizeof(LogRecord);
+    }
+    std::ostringstream oss;
+    oss << "Nickname registry " << _path << " compacted (" << size() << " nickname(s), "
+        << _logRecords << " log record(s) left)";
+    ngircd_log("info", oss.str());
+}
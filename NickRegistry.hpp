@@ -0,0 +1,114 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <ctime>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define NICK_REGISTRY_MAGIC "FTIRCNIK"
+#define NICK_REGISTRY_VERSION 1
+#define REGISTERED_NICK_SIZE 16
+#define REGISTERED_ACCOUNT_SIZE 32
+
+// Registered nicknames: which account owns a nickname, since when, and when
+// its owner last used it. Sized for millions of entries.
+//
+// <path> is a snapshot laid out like ChannelStore (header, open-addressing
+// index, dense records) and mapped copy-on-write, so opening it costs the
+// same whatever its size and pages are only read in as nicknames are
+// looked up. Changes go to the private mapping and are appended to
+// <path>.log, which is replayed on open. Once the log is long enough, or
+// old enough, a forked child writes the mapping out as the next snapshot
+// while the parent carries on; maintain() installs it and keeps only the
+// log records appended since the fork.
+class NickRegistry {
+public:
+    NickRegistry();
+    ~NickRegistry();
+
+    bool open(const std::string& path);
+    // Waits for a compaction in progress to finish
+    void close();
+    bool isOpen() const;
+    size_t size() const;
+
+    // Account <nick> is registered to, or NULL. Reads the mapping only:
+    // no system call, no allocation.
+    const char* owner(const std::string& nick) const;
+    bool info(const std::string& nick, std::string& account, time_t& registeredAt, time_t& lastSeen) const;
+
+    // Ownership is the caller's to check; these only record
+    bool claim(const std::string& nick, const std::string& account, time_t now);
+    void drop(const std::string& nick);
+    void seen(const std::string& nick, time_t now);
+
+    // Called periodically from the event loop
+    void maintain(time_t now);
+    // Waits for a compaction in progress and installs it, so that no child
+    // is left writing the next snapshot (before a hot upgrade)
+    void settle();
+
+private:
+    NickRegistry(const NickRegistry& other);
+    NickRegistry& operator=(const NickRegistry& other);
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t indexCapacity;
+        uint32_t recordCapacity;
+        uint32_t recordCount;
+        uint32_t liveCount;
+        uint32_t tombstones;
+        uint32_t freeHead;
+        // Last log record applied
+        uint64_t sequence;
+        char reserved[16];
+    };
+
+    struct Record {
+        uint32_t hash;
+        uint32_t nextFree;
+        int64_t registeredAt;
+        int64_t lastSeen;
+        char nick[REGISTERED_NICK_SIZE];
+        char account[REGISTERED_ACCOUNT_SIZE];
+    };
+
+    struct LogRecord {
+        uint32_t checksum;
+        uint32_t op;
+        uint64_t sequence;
+        int64_t registeredAt;
+        int64_t lastSeen;
+        char nick[REGISTERED_NICK_SIZE];
+        char account[REGISTERED_ACCOUNT_SIZE];
+    };
+
+    bool _mapSnapshot();
+    bool _mapEmpty(uint32_t indexCapacity, uint32_t recordCapacity);
+    void _unmap();
+    bool _openLog();
+    void _replayLog();
+    bool _append(LogRecord& entry);
+    void _apply(const LogRecord& entry);
+    bool _reserve();
+    bool _grow();
+    uint32_t* _index() const;
+    Record* _records() const;
+    long _findSlot(const std::string& nick, uint32_t hash) const;
+    void _insertIndex(uint32_t hash, uint32_t recordNo);
+    void _startCompaction(time_t now);
+    void _finishCompaction(bool succeeded);
+
+    std::string _path;
+    char* _base;
+    size_t _length;
+    int _logFd;
+    size_t _logRecords;
+    pid_t _compactor;
+    off_t _compactedLogSize;
+    time_t _lastCompaction;
+    time_t _nextMaintenance;
+};
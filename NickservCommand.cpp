@@ -0,0 +1,85 @@
+#include "NickservCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include <ctime>
+
+namespace {
+
+void notice(Server& server, Client* client, const std::string& text) {
+    client->queueMessage(":" + server.getServerName() + " NOTICE " + client->getNickname() + " :" + text + "\r\n");
+}
+
+std::string formatTime(time_t when) {
+    char buffer[32];
+    struct tm* tm = gmtime(&when);
+    if (!tm || strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S UTC", tm) == 0) {
+        return "?";
+    }
+    return buffer;
+}
+
+std::string upper(const std::string& text) {
+    std::string result = text;
+    for (size_t i = 0; i < result.size(); ++i) {
+        if (result[i] >= 'a' && result[i] <= 'z') result[i] = result[i] - 'a' + 'A';
+    }
+    return result;
+}
+
+}
+
+NickservCommand::NickservCommand() {}
+
+NickservCommand::~NickservCommand() {}
+
+bool NickservCommand::requiresRegistration() const {
+    return true;
+}
+
+void NickservCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    NickRegistry& registry = server.getNickRegistry();
+    if (!registry.isOpen()) {
+        notice(server, client, "Nickname registration is not enabled on this server");
+        return;
+    }
+    std::string subcommand = args.size() > 1 ? upper(toString(args[1])) : "";
+    std::string nick = args.size() > 2 ? toString(args[2]) : client->getNickname();
+    const std::string& account = client->getAccount();
+    const char* owner = registry.owner(nick);
+
+    if (subcommand == "REGISTER") {
+        if (account.empty()) {
+            notice(server, client, "You must log in (SASL) to register a nickname");
+        } else if (args.size() > 2) {
+            notice(server, client, "Only your current nickname can be registered");
+        } else if (owner) {
+            notice(server, client, nick + " is already registered" + (account == owner ? " to you" : ""));
+        } else if (nick.size() >= REGISTERED_NICK_SIZE || account.size() >= REGISTERED_ACCOUNT_SIZE
+                   || !registry.claim(nick, account, time(NULL))) {
+            notice(server, client, "Cannot register " + nick);
+        } else {
+            notice(server, client, nick + " is now registered to " + account);
+        }
+    } else if (subcommand == "DROP") {
+        if (!owner) {
+            notice(server, client, nick + " is not registered");
+        } else if (account != owner && !client->hasMode('o')) {
+            notice(server, client, nick + " is not registered to you");
+        } else {
+            registry.drop(nick);
+            notice(server, client, nick + " is no longer registered");
+        }
+    } else if (subcommand == "INFO") {
+        std::string ownerAccount;
+        time_t registeredAt;
+        time_t lastSeen;
+        if (!registry.info(nick, ownerAccount, registeredAt, lastSeen)) {
+            notice(server, client, nick + " is not registered");
+        } else {
+            notice(server, client, nick + " is registered to " + ownerAccount + " since " + formatTime(registeredAt)
+                   + ", last seen " + formatTime(lastSeen));
+        }
+    } else {
+        notice(server, client, "Usage: " + toString(args[0]) + " REGISTER | DROP [nick] | INFO [nick]");
+    }
+}
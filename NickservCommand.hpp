@@ -0,0 +1,21 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+// Handles NICKSERV (or NS) REGISTER / DROP [nick] / INFO [nick] against the
+// --nick-db registry. REGISTER ties the current nickname to the account
+// the client logged in to with SASL. Replies are server NOTICEs.
+class NickservCommand : public ICommand {
+public:
+    NickservCommand();
+    virtual ~NickservCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    NickservCommand(const NickservCommand& other);
+    NickservCommand& operator=(const NickservCommand& other);
+};
@@ -0,0 +1,27 @@
+#include "OperCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+
+OperCommand::OperCommand() {}
+
+OperCommand::~OperCommand() {}
+
+bool OperCommand::requiresRegistration() const {
+    return true;
+}
+
+void OperCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    if (args.size() < 3) {
+        client->reply(461, toString(args[0]));
+        return;
+    }
+    if (!server.hasCredentials(AccountStore::OPER)) {
+        client->reply(491, "");
+        return;
+    }
+    // An unknown name is checked too (against a decoy) and gets the same
+    // 464 as a wrong password
+    if (!server.startAuth(client, AccountStore::OPER, toString(args[1]), toString(args[2]))) {
+        client->reply(263, toString(args[0]));
+    }
+}
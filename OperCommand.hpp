@@ -0,0 +1,21 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+// Handles OPER <name> <password> against the oper entries of the accounts
+// file. The password is checked off the event loop (Server::startAuth),
+// which replies once it is done.
+class OperCommand : public ICommand {
+public:
+    OperCommand();
+    virtual ~OperCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    OperCommand(const OperCommand& other);
+    OperCommand& operator=(const OperCommand& other);
+};
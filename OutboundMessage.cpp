@@ -0,0 +1,146 @@
+#include "OutboundMessage.hpp"
+#include "Client.hpp"
+#include "MessageInbox.hpp"
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/time.h>
+
+OutboundMessage::OutboundMessage(const std::string& line) : _copy(line), _line(_copy.data()), _length(_copy.size()) {
+    _init();
+}
+
+OutboundMessage::OutboundMessage(const char* line, size_t length) : _line(line), _length(length) {
+    _init();
+}
+
+void OutboundMessage::_init() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    _timeMs = static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_usec / 1000;
+    _msgid[0] = '\0';
+    for (unsigned int i = 0; i < CAP_VARIANTS; ++i) {
+        _variants[i] = NULL;
+    }
+}
+
+OutboundMessage::~OutboundMessage() {
+    for (unsigned int i = 0; i < CAP_VARIANTS; ++i) {
+        if (_variants[i]) {
+            _variants[i]->release();
+        }
+    }
+}
+
+const char* OutboundMessage::data() const {
+    return _line;
+}
+
+size_t OutboundMessage::size() const {
+    return _length;
+}
+
+uint64_t OutboundMessage::getTimeMs() const {
+    return _timeMs;
+}
+
+void OutboundMessage::setTimeMs(uint64_t timeMs) {
+    _timeMs = timeMs;
+}
+
+void OutboundMessage::setMsgid(uint64_t sequence) {
+    std::snprintf(_msgid, sizeof(_msgid), "%llu", static_cast<unsigned long long>(sequence));
+}
+
+void OutboundMessage::setAccount(const std::string& account) {
+    _account = account;
+}
+
+void OutboundMessage::setBatch(const std::string& reference) {
+    _batch = reference;
+}
+
+void OutboundMessage::deliver(Client* client) {
+    if (client->isRemote()) {
+        client->queueMessage(_line, _length);
+        return;
+    }
+    unsigned int index = _effective(client->getCaps());
+    SharedMessage* message = _variants[index] ? _variants[index] : _render(index);
+    message->retain(1);
+    client->queueShared(message);
+}
+
+void OutboundMessage::prepare(unsigned int present) {
+    present |= 1u;
+    for (unsigned int i = 0; i < CAP_VARIANTS; ++i) {
+        unsigned int index = _effective(i);
+        if ((present & (1u << i)) && !_variants[index]) {
+            _render(index);
+        }
+    }
+}
+
+SharedMessage* OutboundMessage::variant(unsigned int caps) const {
+    unsigned int index = _effective(caps);
+    return _variants[index] ? _variants[index] : _variants[0];
+}
+
+void OutboundMessage::addReferences(unsigned int caps, unsigned int count) {
+    if (count > 0) {
+        variant(caps)->retain(count);
+    }
+}
+
+// Capability bits that make no difference to this line are dropped, so
+// that, say, account-tag clients share the plain line of a user who is
+// not logged in
+unsigned int OutboundMessage::_effective(unsigned int caps) const {
+    unsigned int index = caps & CAP_TAG_MASK;
+    if (_account.empty()) index &= ~static_cast<unsigned int>(CAP_ACCOUNT_TAG);
+    if (_msgid[0] == '\0') index &= ~static_cast<unsigned int>(CAP_MESSAGE_TAGS);
+    return index;
+}
+
+static char* appendTag(char* out, const char* name, const char* value, size_t length) {
+    size_t nameLength = std::strlen(name);
+    std::memcpy(out, name, nameLength);
+    std::memcpy(out + nameLength, value, length);
+    return out + nameLength + length;
+}
+
+// "@batch=...;account=...;msgid=...;time=... " in front of the line, each
+// tag only when the variant asks for it and there is a value. Written straight
+// into the shared message, which is the only allocation.
+SharedMessage* OutboundMessage::_render(unsigned int index) {
+    bool account = (index & CAP_ACCOUNT_TAG) && !_account.empty();
+    bool msgid = (index & CAP_MESSAGE_TAGS) && _msgid[0] != '\0';
+    char time[40];
+    size_t timeLength = 0;
+    if (index & CAP_SERVER_TIME) {
+        time_t seconds = static_cast<time_t>(_timeMs / 1000);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        timeLength = strftime(time, sizeof(time), "%Y-%m-%dT%H:%M:%S", &tm);
+        timeLength += std::snprintf(time + timeLength, sizeof(time) - timeLength, ".%03uZ",
+                                    static_cast<unsigned int>(_timeMs % 1000));
+    }
+    size_t msgidLength = msgid ? std::strlen(_msgid) : 0;
+    size_t tagsLength = (_batch.empty() ? 0 : 7 + _batch.size()) + (account ? 9 + _account.size() : 0)
+        + (msgid ? 7 + msgidLength : 0) + (timeLength ? 6 + timeLength : 0);
+
+    SharedMessage* message = SharedMessage::create((tagsLength ? tagsLength + 1 : 0) + _length, 1);
+    char* out = message->buffer();
+    if (!_batch.empty()) out = appendTag(out, ";batch=", _batch.data(), _batch.size());
+    if (account) out = appendTag(out, ";account=", _account.data(), _account.size());
+    if (msgid) out = appendTag(out, ";msgid=", _msgid, msgidLength);
+    if (timeLength) out = appendTag(out, ";time=", time, timeLength);
+    if (tagsLength) {
+        // The first tag's ';' becomes the '@' that opens the tags
+        message->buffer()[0] = '@';
+        *out++ = ' ';
+    }
+    std::memcpy(out, _line, _length);
+    _variants[index] = message;
+    return message;
+}
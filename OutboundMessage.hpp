@@ -0,0 +1,72 @@
+#pragma once
+#include "Capabilities.hpp"
+#include <string>
+#include <stdint.h>
+
+// Digits of a 64-bit sequence number, plus the terminator
+#define MSGID_SIZE 21
+
+class Client;
+class SharedMessage;
+
+// A line on its way to one or more clients, with the IRCv3 tags it may
+// carry (time, msgid, account). Each client gets the variant its tag
+// capabilities call for; a variant is rendered the first time a recipient
+// needs it and then shared by every queue it goes to, so a broadcast costs
+// one render per variant present, however the recipients are mixed.
+class OutboundMessage {
+public:
+    // line: untagged, CRLF included. The time tag is taken now.
+    explicit OutboundMessage(const std::string& line);
+    // Not copied: line has to outlive the message (a line assembled in
+    // the tick's arena, typically)
+    OutboundMessage(const char* line, size_t length);
+    ~OutboundMessage();
+
+    // The untagged line
+    const char* data() const;
+    size_t size() const;
+    uint64_t getTimeMs() const;
+    // For lines sent again later, such as history replay
+    void setTimeMs(uint64_t timeMs);
+    // The msgid tag is the channel history sequence number
+    void setMsgid(uint64_t sequence);
+    void setAccount(const std::string& account);
+    // Every variant carries the batch tag: the caller only sets it for a
+    // client that enabled batch
+    void setBatch(const std::string& reference);
+
+    // Event loop: queues the client's variant; a remote user gets the
+    // untagged line through its link
+    void deliver(Client* client);
+
+    // For threads that may not render (FanoutPool): renders the variants
+    // for the tag capabilities whose bit is set in present (bit n for
+    // caps n), plus the untagged one
+    void prepare(unsigned int present);
+    // After prepare(): the variant for caps (the untagged one if it was
+    // not rendered), without a reference of its own. Callers queue it and
+    // report how many references they handed out, by the same caps, with
+    // addReferences().
+    SharedMessage* variant(unsigned int caps) const;
+    void addReferences(unsigned int caps, unsigned int count);
+
+private:
+    OutboundMessage();
+    OutboundMessage(const OutboundMessage& other);
+    OutboundMessage& operator=(const OutboundMessage& other);
+
+    void _init();
+    unsigned int _effective(unsigned int caps) const;
+    SharedMessage* _render(unsigned int index);
+
+    std::string _copy;
+    const char* _line;
+    size_t _length;
+    uint64_t _timeMs;
+    char _msgid[MSGID_SIZE];
+    std::string _account;
+    std::string _batch;
+    // One reference each, held until destruction
+    SharedMessage* _variants[CAP_VARIANTS];
+};
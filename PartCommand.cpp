@@ -2,8 +2,9 @@
 #include "Server.hpp"
 #include "Client.hpp"
 #include "Channel.hpp"
+#include "OutboundMessage.hpp"
+#include "Arena.hpp"
 #include "utils.hpp"
-#include <sstream>
 
 PartCommand::PartCommand() {}
 PartCommand::~PartCommand() {}
@@ -12,36 +13,44 @@ bool PartCommand::requiresRegistration() const {
     return true;
 }
 
-void PartCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void PartCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     if (args.size() != 2 && args.size() != 3) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    std::string channelList = args[1];
-    std::istringstream ss(channelList);
-    std::string chName;
-    while (std::getline(ss, chName, ',')) {
-        if (chName.empty()) continue;
-
-        Channel* channel = server.getChannel(chName);
-        if (!isValidChannelName(chName) || !channel) {
-            client->reply(403, chName + " :No such channel");
+    Arena& arena = server.getArena();
+    ArenaVector<ArenaString>::type channels((ArenaAllocator<ArenaString>(arena)));
+    splitList(args[1], ',', channels);
+    ArenaString partMsg((ArenaAllocator<char>(arena)));
+    const std::string& prefix = client->getPrefix();
+
+    for (size_t i = 0; i < channels.size(); ++i) {
+        const ArenaString& chName = channels[i];
+        Channel* channel = server.getChannel(chName.data(), chName.size());
+        if (!isValidChannelName(chName.data(), chName.size()) || !channel) {
+            client->reply(403, toString(chName) + " :No such channel");
             continue;
         }
 
         int fd = client->getFd();
         if (!channel->isMember(fd)) {
-            client->reply(442, chName + " :You're not on that channel");
+            client->reply(442, toString(chName) + " :You're not on that channel");
             continue;
         }
 
-        std::string partMsg = ":" + client->getPrefix() + " PART " + chName + " :";
+        partMsg.assign(":");
+        partMsg.append(prefix.data(), prefix.size());
+        partMsg += " PART ";
+        partMsg += chName;
+        partMsg += " :";
         if (args.size() == 3) {
             partMsg += args[2];
         }
         partMsg += "\r\n";
-        channel->broadcastToAll(partMsg);
+        OutboundMessage outbound(partMsg.data(), partMsg.size());
+        channel->broadcast(outbound, NULL);
+        server.propagate(outbound.data(), outbound.size(), NULL);
 
         server.removeClientFromChannel(client, channel);
     }
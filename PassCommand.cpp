@@ -10,7 +10,7 @@ bool PassCommand::requiresRegistration() const {
     return false;
 }
 
-void PassCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void PassCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     (void)server;
 
     if (!client->getPassword().empty() || !client->getNickname().empty() || !client->getUsername().empty()) {
@@ -19,9 +19,9 @@ void PassCommand::execute(Server& server, Client* client, const std::vector<std:
     }
 
     if (args.size() != 2) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    client->setPassword(args[1]);
+    client->setPassword(toString(args[1]));
 }
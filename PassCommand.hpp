@@ -11,7 +11,7 @@ public:
     virtual ~PassCommand();
 
     virtual bool requiresRegistration() const;
-    virtual void execute(Server& server, Client* client, const std::vector<std::string>& args);
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
 
 private:
     PassCommand(const PassCommand& other);
@@ -0,0 +1,267 @@
+#include "PasswordHash.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#define HASH_SCHEME "pbkdf2-sha256"
+#define SHA256_BLOCK 64
+#define SHA256_DIGEST 32
+#define SALT_BYTES 16
+// Accepted in stored hashes; a salt this short or a count this low would
+// only come from a hand-edited file
+#define MIN_SALT_BYTES 8
+#define MAX_SALT_BYTES 64
+#define MIN_ITERATIONS 1000
+#define MAX_ITERATIONS 100000000
+
+namespace {
+
+const uint32_t ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+// FIPS 180-4
+struct Sha256 {
+    uint32_t state[8];
+    unsigned char block[SHA256_BLOCK];
+    size_t used;
+    uint64_t length;
+
+    Sha256() : used(0), length(0) {
+        static const uint32_t initial[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        std::memcpy(state, initial, sizeof(state));
+    }
+
+    void compress(const unsigned char* p) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (static_cast<uint32_t>(p[4 * i]) << 24) | (static_cast<uint32_t>(p[4 * i + 1]) << 16)
+                 | (static_cast<uint32_t>(p[4 * i + 2]) << 8) | static_cast<uint32_t>(p[4 * i + 3]);
+        }
+        for (int i = 16; i < 64; ++i) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; ++i) {
+            uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + ROUND_CONSTANTS[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    void update(const unsigned char* data, size_t size) {
+        length += size;
+        while (size > 0) {
+            size_t take = SHA256_BLOCK - used;
+            if (take > size) take = size;
+            std::memcpy(block + used, data, take);
+            used += take;
+            data += take;
+            size -= take;
+            if (used == SHA256_BLOCK) {
+                compress(block);
+                used = 0;
+            }
+        }
+    }
+
+    void finish(unsigned char* digest) {
+        uint64_t bits = length * 8;
+        unsigned char pad = 0x80;
+        update(&pad, 1);
+        pad = 0;
+        while (used != SHA256_BLOCK - 8) {
+            update(&pad, 1);
+        }
+        unsigned char tail[8];
+        for (int i = 0; i < 8; ++i) {
+            tail[i] = static_cast<unsigned char>(bits >> (56 - 8 * i));
+        }
+        update(tail, 8);
+        for (int i = 0; i < 8; ++i) {
+            digest[4 * i] = static_cast<unsigned char>(state[i] >> 24);
+            digest[4 * i + 1] = static_cast<unsigned char>(state[i] >> 16);
+            digest[4 * i + 2] = static_cast<unsigned char>(state[i] >> 8);
+            digest[4 * i + 3] = static_cast<unsigned char>(state[i]);
+        }
+    }
+};
+
+// HMAC-SHA256 with the keyed inner and outer states computed once, so that
+// each PBKDF2 iteration costs two compressions rather than four
+struct Hmac {
+    Sha256 inner;
+    Sha256 outer;
+
+    explicit Hmac(const std::string& key) {
+        unsigned char pad[SHA256_BLOCK];
+        std::memset(pad, 0, sizeof(pad));
+        if (key.size() > SHA256_BLOCK) {
+            Sha256 hash;
+            hash.update(reinterpret_cast<const unsigned char*>(key.data()), key.size());
+            hash.finish(pad);
+        } else {
+            std::memcpy(pad, key.data(), key.size());
+        }
+        unsigned char innerPad[SHA256_BLOCK];
+        unsigned char outerPad[SHA256_BLOCK];
+        for (int i = 0; i < SHA256_BLOCK; ++i) {
+            innerPad[i] = pad[i] ^ 0x36;
+            outerPad[i] = pad[i] ^ 0x5c;
+        }
+        inner.update(innerPad, sizeof(innerPad));
+        outer.update(outerPad, sizeof(outerPad));
+        std::memset(pad, 0, sizeof(pad));
+    }
+
+    void mac(const unsigned char* data, size_t size, unsigned char* out) const {
+        Sha256 hash = inner;
+        hash.update(data, size);
+        unsigned char digest[SHA256_DIGEST];
+        hash.finish(digest);
+        hash = outer;
+        hash.update(digest, sizeof(digest));
+        hash.finish(out);
+    }
+};
+
+// RFC 8018, one block of output (the key is as long as the digest)
+void pbkdf2(const std::string& password, const std::string& salt, unsigned int iterations, unsigned char* key) {
+    Hmac hmac(password);
+    std::string first = salt;
+    first += std::string("\0\0\0\1", 4);
+    unsigned char u[SHA256_DIGEST];
+    hmac.mac(reinterpret_cast<const unsigned char*>(first.data()), first.size(), u);
+    std::memcpy(key, u, SHA256_DIGEST);
+    for (unsigned int i = 1; i < iterations; ++i) {
+        hmac.mac(u, sizeof(u), u);
+        for (int j = 0; j < SHA256_DIGEST; ++j) {
+            key[j] ^= u[j];
+        }
+    }
+}
+
+std::string toHex(const unsigned char* data, size_t size) {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+    hex.reserve(size * 2);
+    for (size_t i = 0; i < size; ++i) {
+        hex += digits[data[i] >> 4];
+        hex += digits[data[i] & 0xf];
+    }
+    return hex;
+}
+
+bool fromHex(const std::string& hex, std::string& out) {
+    if (hex.size() % 2 != 0) return false;
+    out.clear();
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        int value = 0;
+        for (size_t j = i; j < i + 2; ++j) {
+            char c = hex[j];
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else return false;
+        }
+        out += static_cast<char>(value);
+    }
+    return true;
+}
+
+bool decode(const std::string& encoded, unsigned int& iterations, std::string& salt, std::string& key) {
+    std::vector<std::string> fields;
+    std::istringstream iss(encoded);
+    std::string field;
+    while (std::getline(iss, field, '$')) {
+        fields.push_back(field);
+    }
+    if (fields.size() != 4 || fields[0] != HASH_SCHEME) return false;
+    const std::string& count = fields[1];
+    if (count.empty() || count.size() > 9 || count.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    unsigned long value = std::strtoul(count.c_str(), NULL, 10);
+    if (value < MIN_ITERATIONS || value > MAX_ITERATIONS) return false;
+    iterations = static_cast<unsigned int>(value);
+    return fromHex(fields[2], salt) && salt.size() >= MIN_SALT_BYTES && salt.size() <= MAX_SALT_BYTES
+        && fromHex(fields[3], key) && key.size() == SHA256_DIGEST;
+}
+
+}
+
+std::string PasswordHash::create(const std::string& password, unsigned int iterations) {
+    unsigned char salt[SALT_BYTES];
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || read(fd, salt, sizeof(salt)) != static_cast<ssize_t>(sizeof(salt))) {
+        if (fd >= 0) close(fd);
+        throw std::runtime_error(std::string("Error: cannot read /dev/urandom: ") + std::strerror(errno));
+    }
+    close(fd);
+    unsigned char key[SHA256_DIGEST];
+    pbkdf2(password, std::string(reinterpret_cast<char*>(salt), sizeof(salt)), iterations, key);
+    std::ostringstream oss;
+    oss << HASH_SCHEME << "$" << iterations << "$" << toHex(salt, sizeof(salt)) << "$" << toHex(key, sizeof(key));
+    return oss.str();
+}
+
+bool PasswordHash::verify(const std::string& password, const std::string& encoded) {
+    unsigned int iterations;
+    std::string salt;
+    std::string expected;
+    if (!decode(encoded, iterations, salt, expected)) return false;
+    unsigned char key[SHA256_DIGEST];
+    pbkdf2(password, salt, iterations, key);
+    unsigned char difference = 0;
+    for (int i = 0; i < SHA256_DIGEST; ++i) {
+        difference |= key[i] ^ static_cast<unsigned char>(expected[i]);
+    }
+    return difference == 0;
+}
+
+std::string PasswordHash::decoy() {
+    // An all-zero key is as unlikely an output as any other
+    std::ostringstream oss;
+    oss << HASH_SCHEME << "$" << DEFAULT_ITERATIONS << "$" << std::string(SALT_BYTES * 2, '0')
+        << "$" << std::string(SHA256_DIGEST * 2, '0');
+    return oss.str();
+}
+
+bool PasswordHash::wellFormed(const std::string& encoded) {
+    unsigned int iterations;
+    std::string salt;
+    std::string key;
+    return decode(encoded, iterations, salt, key);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+
+// Salted, deliberately slow password hashes (PBKDF2-HMAC-SHA256), stored as
+// "pbkdf2-sha256$<iterations>$<salt hex>$<key hex>". Verifying one costs
+// as much as creating it, which is the point: see AuthPool for where that
+// cost is paid.
+class PasswordHash {
+public:
+    // Iterations used by ircserv --mkpasswd unless told otherwise
+    static const unsigned int DEFAULT_ITERATIONS = 100000;
+
+    // Salt from /dev/urandom; throws std::runtime_error if it cannot be read
+    static std::string create(const std::string& password, unsigned int iterations);
+    // Constant time in the key comparison; false for a malformed hash too
+    static bool verify(const std::string& password, const std::string& encoded);
+    static bool wellFormed(const std::string& encoded);
+    // A hash no password matches that costs as much to verify as one made
+    // with DEFAULT_ITERATIONS, built without doing that work
+    static std::string decoy();
+
+private:
+    PasswordHash();
+};
@@ -0,0 +1,256 @@
+#include "PrefixTree.hpp"
+#include "MemoryUsage.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define ADDRESS_BITS 128
+#define IPV4_OFFSET 96
+
+static const uint8_t IPV4_MAPPED[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+
+static int bitAt(const PrefixTree::Address& address, int bit) {
+    return (address.bytes[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+// Leading bits a and b have in common, counting no further than limit
+static int commonBits(const PrefixTree::Address& a, const PrefixTree::Address& b, int limit) {
+    for (int byte = 0; byte * 8 < limit; ++byte) {
+        uint8_t diff = a.bytes[byte] ^ b.bytes[byte];
+        if (diff) {
+            int bit = byte * 8;
+            while (!(diff & 0x80)) {
+                diff = static_cast<uint8_t>(diff << 1);
+                ++bit;
+            }
+            return std::min(bit, limit);
+        }
+    }
+    return limit;
+}
+
+static void clearFrom(PrefixTree::Address& address, int length) {
+    for (int bit = length; bit < ADDRESS_BITS; ++bit) {
+        address.bytes[bit >> 3] &= static_cast<uint8_t>(~(0x80 >> (bit & 7)));
+    }
+}
+
+bool PrefixTree::parse(const std::string& text, Address& address, int& length) {
+    size_t slash = text.find('/');
+    std::string host = text.substr(0, slash);
+    int bits;
+    int offset;
+    struct in_addr v4;
+    struct in6_addr v6;
+    if (inet_pton(AF_INET, host.c_str(), &v4) == 1) {
+        std::memcpy(address.bytes, IPV4_MAPPED, sizeof(IPV4_MAPPED));
+        std::memcpy(address.bytes + 12, &v4, 4);
+        bits = 32;
+        offset = IPV4_OFFSET;
+    } else if (inet_pton(AF_INET6, host.c_str(), &v6) == 1) {
+        std::memcpy(address.bytes, &v6, 16);
+        bits = ADDRESS_BITS;
+        offset = 0;
+    } else {
+        return false;
+    }
+
+    length = bits;
+    if (slash != std::string::npos) {
+        std::string digits = text.substr(slash + 1);
+        if (digits.empty() || digits.size() > 3 || digits.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        length = std::atoi(digits.c_str());
+        if (length > bits) return false;
+    }
+    length += offset;
+    clearFrom(address, length);
+    return true;
+}
+
+bool PrefixTree::fromSockaddr(const struct sockaddr* addr, Address& address) {
+    if (addr->sa_family == AF_INET) {
+        const struct sockaddr_in* in = reinterpret_cast<const struct sockaddr_in*>(addr);
+        std::memcpy(address.bytes, IPV4_MAPPED, sizeof(IPV4_MAPPED));
+        std::memcpy(address.bytes + 12, &in->sin_addr, 4);
+        return true;
+    }
+    if (addr->sa_family == AF_INET6) {
+        const struct sockaddr_in6* in6 = reinterpret_cast<const struct sockaddr_in6*>(addr);
+        std::memcpy(address.bytes, &in6->sin6_addr, 16);
+        return true;
+    }
+    return false;
+}
+
+bool PrefixTree::isIPv4(const Address& address) {
+    return std::memcmp(address.bytes, IPV4_MAPPED, sizeof(IPV4_MAPPED)) == 0;
+}
+
+PrefixTree::PrefixTree() : _root(-1) {}
+
+PrefixTree::~PrefixTree() {}
+
+void PrefixTree::set(const Address& prefix, int length, uint32_t value) {
+    int node = _insert(prefix, length);
+    _nodes[node].hasValue = true;
+    _nodes[node].value = value;
+}
+
+size_t PrefixTree::match(const Address& address, uint32_t* values, size_t max) const {
+    size_t found = 0;
+    int node = _root;
+    while (node >= 0) {
+        const Node& n = _nodes[node];
+        if (commonBits(address, n.key, n.length) < n.length) break;
+        if (n.hasValue && found < max) {
+            values[found++] = n.value;
+        }
+        if (n.length == ADDRESS_BITS) break;
+        node = n.child[bitAt(address, n.length)];
+    }
+    return found;
+}
+
+void PrefixTree::add(const Address& address, int delta) {
+    if (delta > 0) {
+        _insert(address, ADDRESS_BITS);
+    }
+    int path[ADDRESS_BITS + 1];
+    int depth = 0;
+    int node = _root;
+    while (node >= 0) {
+        const Node& n = _nodes[node];
+        if (commonBits(address, n.key, n.length) < n.length) break;
+        path[depth++] = node;
+        if (n.length == ADDRESS_BITS) break;
+        node = n.child[bitAt(address, n.length)];
+    }
+    if (depth == 0 || _nodes[path[depth - 1]].length != ADDRESS_BITS) return;
+
+    for (int i = 0; i < depth; ++i) {
+        uint32_t& total = _nodes[path[i]].total;
+        if (delta < 0 && total < static_cast<uint32_t>(-delta)) {
+            total = 0;
+        } else {
+            total += delta;
+        }
+    }
+
+    int leaf = path[depth - 1];
+    if (_nodes[leaf].total > 0 || _nodes[leaf].hasValue) return;
+    // Unlink the empty leaf; a valueless parent left with one child is
+    // spliced out so the tree stays compressed
+    int parent = (depth >= 2) ? path[depth - 2] : -1;
+    if (parent < 0) {
+        _root = -1;
+    } else {
+        Node& p = _nodes[parent];
+        p.child[p.child[1] == leaf ? 1 : 0] = -1;
+    }
+    _freeNode(leaf);
+    if (parent < 0 || _nodes[parent].hasValue) return;
+    int remaining = (_nodes[parent].child[0] >= 0) ? _nodes[parent].child[0] : _nodes[parent].child[1];
+    int grandparent = (depth >= 3) ? path[depth - 3] : -1;
+    if (grandparent < 0) {
+        _root = remaining;
+    } else {
+        Node& g = _nodes[grandparent];
+        g.child[g.child[1] == parent ? 1 : 0] = remaining;
+    }
+    _freeNode(parent);
+}
+
+uint32_t PrefixTree::count(const Address& prefix, int length) const {
+    int node = _root;
+    while (node >= 0) {
+        const Node& n = _nodes[node];
+        int limit = std::min(length, n.length);
+        if (commonBits(prefix, n.key, limit) < limit) return 0;
+        if (n.length >= length) return n.total;
+        node = n.child[bitAt(prefix, n.length)];
+    }
+    return 0;
+}
+
+void PrefixTree::clear() {
+    _nodes.clear();
+    _freeNodes.clear();
+    _root = -1;
+}
+
+size_t PrefixTree::memoryUsage() const {
+    return heapBytes(_nodes) + heapBytes(_freeNodes);
+}
+
+int PrefixTree::_newNode(const Address& key, int length) {
+    Node node;
+    node.key = key;
+    clearFrom(node.key, length);
+    node.length = length;
+    node.child[0] = node.child[1] = -1;
+    node.hasValue = false;
+    node.value = 0;
+    node.total = 0;
+    if (!_freeNodes.empty()) {
+        int index = _freeNodes.back();
+        _freeNodes.pop_back();
+        _nodes[index] = node;
+        return index;
+    }
+    _nodes.push_back(node);
+    return static_cast<int>(_nodes.size() - 1);
+}
+
+void PrefixTree::_freeNode(int index) {
+    _freeNodes.push_back(index);
+}
+
+// Node for exactly key/length, splitting an edge when the prefix falls
+// inside one. Indices only: _newNode() may move the node array.
+int PrefixTree::_insert(const Address& key, int length) {
+    int parent = -1;
+    int side = 0;
+    int node = _root;
+    while (true) {
+        int created = -1;
+        if (node < 0) {
+            created = _newNode(key, length);
+        } else {
+            int nodeLength = _nodes[node].length;
+            int common = commonBits(key, _nodes[node].key, std::min(length, nodeLength));
+            if (common == nodeLength && nodeLength == length) {
+                return node;
+            }
+            if (common == nodeLength) {
+                parent = node;
+                side = bitAt(key, nodeLength);
+                node = _nodes[node].child[side];
+                continue;
+            }
+            if (common == length) {
+                // The new prefix sits above node
+                created = _newNode(key, length);
+                _nodes[created].child[bitAt(_nodes[node].key, length)] = node;
+                _nodes[created].total = _nodes[node].total;
+            } else {
+                // They part ways below a new branching node
+                int branch = _newNode(key, common);
+                created = _newNode(key, length);
+                _nodes[branch].child[bitAt(key, common)] = created;
+                _nodes[branch].child[bitAt(_nodes[node].key, common)] = node;
+                _nodes[branch].total = _nodes[node].total;
+                if (parent < 0) _root = branch;
+                else _nodes[parent].child[side] = branch;
+                return created;
+            }
+        }
+        if (parent < 0) _root = created;
+        else _nodes[parent].child[side] = created;
+        return created;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+struct sockaddr;
+
+// A path-compressed binary trie (PATRICIA) over 128-bit addresses. IPv4
+// addresses are kept IPv4-mapped (::ffff:a.b.c.d), so one tree serves both
+// families and an IPv4 /24 is a /120 inside it.
+//
+// A prefix can carry a value (set/match), and every node keeps the total
+// of the counts added at full-length addresses beneath it (add/count), so
+// "how many connections inside 192.0.2.0/24" is one walk down the tree.
+// Lookups never allocate.
+class PrefixTree {
+public:
+    struct Address {
+        uint8_t bytes[16];
+    };
+
+    // "192.0.2.0/24", "2001:db8::/32" or a bare address (full length);
+    // length comes back in tree bits, 96 more than written for IPv4
+    static bool parse(const std::string& text, Address& address, int& length);
+    // false for anything but AF_INET and AF_INET6
+    static bool fromSockaddr(const struct sockaddr* addr, Address& address);
+    static bool isIPv4(const Address& address);
+
+    PrefixTree();
+    ~PrefixTree();
+
+    void set(const Address& prefix, int length, uint32_t value);
+    // Values of the prefixes containing address, shortest first; at most
+    // max of them are stored and their number returned
+    size_t match(const Address& address, uint32_t* values, size_t max) const;
+
+    // Adds delta (may be negative) at the full-length address; nodes left
+    // holding nothing are removed
+    void add(const Address& address, int delta);
+    uint32_t count(const Address& prefix, int length) const;
+
+    void clear();
+    size_t memoryUsage() const;
+
+private:
+    PrefixTree(const PrefixTree& other);
+    PrefixTree& operator=(const PrefixTree& other);
+
+    struct Node {
+        Address key;
+        int length;
+        int child[2];
+        bool hasValue;
+        uint32_t value;
+        uint32_t total;
+    };
+
+    int _newNode(const Address& key, int length);
+    void _freeNode(int index);
+    int _insert(const Address& key, int length);
+
+    std::vector<Node> _nodes;
+    std::vector<int> _freeNodes;
+    int _root;
+};
@@ -2,9 +2,9 @@
 #include "Server.hpp"
 #include "Client.hpp"
 #include "Channel.hpp"
+#include "OutboundMessage.hpp"
+#include "Arena.hpp"
 #include "utils.hpp"
-#include <sstream>
-#include <set>
 
 PrivmsgCommand::PrivmsgCommand() {}
 PrivmsgCommand::~PrivmsgCommand() {}
@@ -13,9 +13,9 @@ bool PrivmsgCommand::requiresRegistration() const {
     return true;
 }
 
-void PrivmsgCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void PrivmsgCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     if (args.size() == 1) {
-        client->reply(411, " :No recipient given (" + args[0] + ")");
+        client->reply(411, " :No recipient given (" + toString(args[0]) + ")");
         return;
     }
     if (args.size() == 2) {
@@ -23,38 +23,60 @@ void PrivmsgCommand::execute(Server& server, Client* client, const std::vector<s
         return;
     }
     if (args.size() != 3) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    std::string receivers = args[1];
-    std::string message = args[2];
-    std::set<std::string> seenTargets;
+    const ArenaString& message = args[2];
+    const std::string& prefix = client->getPrefix();
+    Arena& arena = server.getArena();
+    ArenaVector<ArenaString>::type targets((ArenaAllocator<ArenaString>(arena)));
+    splitList(args[1], ',', targets);
+    ArenaSmallSet<ArenaString> seenTargets(arena);
+    ArenaString out((ArenaAllocator<char>(arena)));
 
-    std::istringstream rss(receivers);
-    std::string target;
-    while (std::getline(rss, target, ',')) {
-        if (target.empty()) continue;
+    for (size_t i = 0; i < targets.size(); ++i) {
+        if (!seenTargets.insert(targets[i])) continue;
+        const ArenaString& target = targets[i];
 
-        if (seenTargets.find(target) != seenTargets.end()) continue;
-        seenTargets.insert(target);
-
-        std::string out = ":" + client->getPrefix() + " PRIVMSG " + target + " :" + message + "\r\n";
+        out.assign(":");
+        out.append(prefix.data(), prefix.size());
+        out += " PRIVMSG ";
+        out.append(target.data(), target.size());
+        out += " :";
+        out.append(message.data(), message.size());
+        out += "\r\n";
         if (target[0] == '#' || target[0] == '&') {
-            Channel* channel = server.getChannel(target);
-            if (!isValidChannelName(target) || !channel) {
-                client->reply(401, target + " :No such nick or channel name");
+            Channel* channel = server.getChannel(target.data(), target.size());
+            if (!isValidChannelName(target.data(), target.size()) || !channel) {
+                client->reply(401, toString(target) + " :No such nick or channel name");
+                continue;
+            }
+            if (!channel->isOperator(client->getFd()) && channel->isBanned(client)) {
+                client->reply(404, channel->getName() + " :Cannot send to channel");
                 continue;
             }
-            channel->broadcast(out, client->getFd());
+            OutboundMessage outbound(out.data(), out.size());
+            outbound.setAccount(client->getAccount());
+            channel->recordMessage(prefix, message.data(), message.size(), outbound);
+            channel->broadcast(outbound, client);
+            server.relayToChannel(channel, outbound.data(), outbound.size(), NULL);
+            if (client->hasCap(CAP_ECHO_MESSAGE)) {
+                outbound.deliver(client);
+            }
         }
         else {
-            Client* dest = server.getClientByNickname(target);
+            Client* dest = server.getClientByNickname(target.data(), target.size());
             if (!dest) {
-                client->reply(401, target + " :No such nick or channel name");
+                client->reply(401, toString(target) + " :No such nick or channel name");
                 continue;
             }
-            dest->queueMessage(out);
+            OutboundMessage outbound(out.data(), out.size());
+            outbound.setAccount(client->getAccount());
+            outbound.deliver(dest);
+            if (client->hasCap(CAP_ECHO_MESSAGE)) {
+                outbound.deliver(client);
+            }
         }
     }
 }
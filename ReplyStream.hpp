@@ -0,0 +1,30 @@
+#pragma once
+#include <cstddef>
+
+class Server;
+class Client;
+
+// Send queue size above which streamed replies pause until the socket drains
+#define SENDQ_WATERMARK 16384
+
+// A long reply rendered incrementally. The server resumes it whenever the
+// client's send queue is below SENDQ_WATERMARK, so a large answer never sits
+// in memory as a whole.
+class ReplyStream {
+public:
+    virtual ~ReplyStream() {}
+
+    // Queue replies until the send queue reaches the watermark.
+    // Returns true once the reply is complete.
+    virtual bool resume(Server& server, Client* client) = 0;
+
+    // Bytes the stream itself holds, for memory accounting
+    virtual size_t memoryUsage() const = 0;
+
+protected:
+    ReplyStream() {}
+
+private:
+    ReplyStream(const ReplyStream& other);
+    ReplyStream& operator=(const ReplyStream& other);
+};
@@ -0,0 +1,251 @@
+#include "SendQueue.hpp"
+#include "MessageInbox.hpp"
+#include "MemoryUsage.hpp"
+#include <sys/uio.h>
+
+// Sent bytes a private segment keeps at its front before they are dropped;
+// erasing in bulk keeps partial writes from moving the rest every time
+#define SENDQ_COMPACT_BYTES 4096
+// Smallest allocation for private bytes: past any short-string buffer, so
+// that the bytes of a retired segment keep their address (see _popFront)
+#define SENDQ_MIN_SEGMENT 64
+// Segments a ring has room for when it is first allocated
+#define SENDQ_RING_MIN 4
+
+SendQueue::SendQueue() : _size(0), _heap(0), _zerocopyNext(0), _zerocopyDoneUpTo(0) {}
+
+SendQueue::~SendQueue() {
+    clear();
+    while (!_retired.empty()) {
+        _drop(_retired.front());
+        _retired.pop_front();
+    }
+}
+
+// A shared line's bytes are counted once, by SharedMessage::liveBytes();
+// every queue holding it is charged its segment only
+size_t SendQueue::_segmentHeap(const Segment& segment) {
+    return sizeof(Segment) + (segment.shared ? 0 : heapBytes(segment.bytes));
+}
+
+const char* SendQueue::_segmentData(const Segment& segment) {
+    return (segment.shared ? segment.shared->data() : segment.bytes.data()) + segment.offset;
+}
+
+size_t SendQueue::_segmentLength(const Segment& segment) {
+    return (segment.shared ? segment.shared->size() : segment.bytes.size()) - segment.offset;
+}
+
+void SendQueue::append(const char* data, size_t length) {
+    if (length == 0) return;
+    if (_segments.empty() || _segments.back().shared
+        || (_segments.back().pinned && !_zerocopyDone(_segments.back().zerocopy))) {
+        _segments.push_back().bytes.reserve(length > SENDQ_MIN_SEGMENT ? length : SENDQ_MIN_SEGMENT);
+        _heap += sizeof(Segment);
+    }
+    std::string& bytes = _segments.back().bytes;
+    size_t before = heapBytes(bytes);
+    bytes.append(data, length);
+    _heap += heapBytes(bytes) - before;
+    _size += length;
+}
+
+void SendQueue::append(SharedMessage* message) {
+    if (message->size() == 0) {
+        message->release();
+        return;
+    }
+    Segment& segment = _segments.push_back();
+    segment.shared = message;
+    _heap += _segmentHeap(segment);
+    _size += message->size();
+}
+
+size_t SendQueue::size() const {
+    return _size;
+}
+
+bool SendQueue::empty() const {
+    return _size == 0;
+}
+
+int SendQueue::gather(struct iovec* iov, int max) const {
+    int count = 0;
+    for (size_t i = 0; i < _segments.size() && count < max; ++i) {
+        iov[count].iov_base = const_cast<char*>(_segmentData(_segments[i]));
+        iov[count].iov_len = _segmentLength(_segments[i]);
+        ++count;
+    }
+    return count;
+}
+
+void SendQueue::consume(size_t length) {
+    while (length > 0 && !_segments.empty()) {
+        Segment& front = _segments.front();
+        size_t available = _segmentLength(front);
+        if (length >= available) {
+            length -= available;
+            _size -= available;
+            _popFront();
+            continue;
+        }
+        front.offset += length;
+        _size -= length;
+        length = 0;
+        if (!front.shared && !(front.pinned && !_zerocopyDone(front.zerocopy))
+            && front.offset >= SENDQ_COMPACT_BYTES && front.offset * 2 >= front.bytes.size()) {
+            size_t before = heapBytes(front.bytes);
+            front.bytes.erase(0, front.offset);
+            front.offset = 0;
+            _heap -= before - heapBytes(front.bytes);
+        }
+    }
+}
+
+void SendQueue::pinZerocopy(size_t length) {
+    for (size_t i = 0; i < _segments.size() && length > 0; ++i) {
+        Segment& segment = _segments[i];
+        size_t available = _segmentLength(segment);
+        segment.pinned = true;
+        segment.zerocopy = _zerocopyNext;
+        length -= (length < available) ? length : available;
+    }
+    ++_zerocopyNext;
+}
+
+void SendQueue::zerocopyCompleted(uint32_t id) {
+    if (static_cast<int32_t>(id + 1 - _zerocopyDoneUpTo) > 0) {
+        _zerocopyDoneUpTo = id + 1;
+    }
+    while (!_retired.empty() && _zerocopyDone(_retired.front().zerocopy)) {
+        _drop(_retired.front());
+        _retired.pop_front();
+    }
+}
+
+bool SendQueue::hasZerocopyPending() const {
+    return _zerocopyNext != _zerocopyDoneUpTo;
+}
+
+uint32_t SendQueue::getZerocopyNext() const {
+    return _zerocopyNext;
+}
+
+void SendQueue::setZerocopyNext(uint32_t id) {
+    _zerocopyNext = id;
+    _zerocopyDoneUpTo = id;
+}
+
+// Serial number order, so that ids may wrap
+bool SendQueue::_zerocopyDone(uint32_t id) const {
+    return static_cast<int32_t>(id - _zerocopyDoneUpTo) < 0;
+}
+
+void SendQueue::clear() {
+    while (!_segments.empty()) {
+        _popFront();
+    }
+    _size = 0;
+}
+
+std::string SendQueue::str() const {
+    std::string out;
+    out.reserve(_size);
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        out.append(_segmentData(_segments[i]), _segmentLength(_segments[i]));
+    }
+    return out;
+}
+
+size_t SendQueue::memoryUsage() const {
+    return _heap;
+}
+
+void SendQueue::shrink() {
+    for (size_t i = 0; i < _segments.size(); ++i) {
+        Segment& segment = _segments[i];
+        if (segment.shared || (segment.pinned && !_zerocopyDone(segment.zerocopy))
+            || (segment.offset == 0 && segment.bytes.capacity() <= segment.bytes.size() * 2)) continue;
+        size_t before = heapBytes(segment.bytes);
+        // A copy is allocated for its contents only
+        size_t length = segment.bytes.size() - segment.offset;
+        std::string copy;
+        copy.reserve(length > SENDQ_MIN_SEGMENT ? length : SENDQ_MIN_SEGMENT);
+        copy.append(segment.bytes, segment.offset, length);
+        copy.swap(segment.bytes);
+        segment.offset = 0;
+        _heap -= before - heapBytes(segment.bytes);
+    }
+}
+
+void SendQueue::_drop(Segment& segment) {
+    _heap -= _segmentHeap(segment);
+    if (segment.shared) {
+        segment.shared->release();
+    }
+}
+
+// A segment the kernel may still be reading moves aside, bytes and all,
+// and stays charged until its completion is reaped
+void SendQueue::_popFront() {
+    Segment& front = _segments.front();
+    if (front.pinned && !_zerocopyDone(front.zerocopy)) {
+        Segment& kept = _retired.push_back();
+        kept.shared = front.shared;
+        kept.bytes.swap(front.bytes);
+        kept.offset = front.offset;
+        kept.pinned = true;
+        kept.zerocopy = front.zerocopy;
+    } else {
+        _drop(front);
+    }
+    _segments.pop_front();
+}
+
+SendQueue::Ring::Ring() : _slots(NULL), _capacity(0), _head(0), _count(0) {}
+
+SendQueue::Ring::~Ring() {
+    delete[] _slots;
+}
+
+SendQueue::Segment& SendQueue::Ring::push_back() {
+    if (_count == _capacity) {
+        _grow();
+    }
+    ++_count;
+    Segment& segment = back();
+    segment.shared = NULL;
+    segment.offset = 0;
+    segment.pinned = false;
+    segment.zerocopy = 0;
+    return segment;
+}
+
+void SendQueue::Ring::pop_front() {
+    std::string().swap(_slots[_head].bytes);
+    _head = (_head + 1) & (_capacity - 1);
+    if (--_count == 0) {
+        delete[] _slots;
+        _slots = NULL;
+        _capacity = 0;
+        _head = 0;
+    }
+}
+
+// Swapping the bytes over keeps their address, which pinned segments need
+void SendQueue::Ring::_grow() {
+    uint32_t capacity = _capacity ? _capacity * 2 : SENDQ_RING_MIN;
+    Segment* slots = new Segment[capacity];
+    for (uint32_t i = 0; i < _count; ++i) {
+        Segment& from = (*this)[i];
+        slots[i].shared = from.shared;
+        slots[i].bytes.swap(from.bytes);
+        slots[i].offset = from.offset;
+        slots[i].pinned = from.pinned;
+        slots[i].zerocopy = from.zerocopy;
+    }
+    delete[] _slots;
+    _slots = slots;
+    _capacity = capacity;
+    _head = 0;
+}
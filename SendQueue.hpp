@@ -0,0 +1,115 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+class SharedMessage;
+struct iovec;
+
+// A client's outgoing bytes as a run of segments: private bytes (replies,
+// appended in place) or a reference to a line other queues hold as well
+// (broadcasts). A broadcast is therefore rendered once and never copied
+// per recipient; the socket is written with writev() straight from the
+// segments.
+//
+// Segments sent with MSG_ZEROCOPY are pinned: the kernel reads them after
+// the send returns, so they are neither appended to nor compacted, and once
+// consumed they are kept aside until the completion for their send is
+// reaped. Completions are numbered per socket in send order, as the kernel
+// does for TCP.
+class SendQueue {
+public:
+    SendQueue();
+    ~SendQueue();
+
+    void append(const char* data, size_t length);
+    // Takes over one reference to message
+    void append(SharedMessage* message);
+
+    size_t size() const;
+    bool empty() const;
+    // Points up to max iovecs at the front of the queue; returns how many
+    int gather(struct iovec* iov, int max) const;
+    void consume(size_t length);
+    // Pins the first length bytes as sent with MSG_ZEROCOPY; call before
+    // consume(length), once per send the kernel counted
+    void pinZerocopy(size_t length);
+    // The kernel is done with sends up to and including id
+    void zerocopyCompleted(uint32_t id);
+    bool hasZerocopyPending() const;
+    // Id the next zerocopy send gets (hot upgrade carries it over, since
+    // the kernel keeps counting on the socket)
+    uint32_t getZerocopyNext() const;
+    void setZerocopyNext(uint32_t id);
+    void clear();
+    // Everything queued, in one string (hot upgrade)
+    std::string str() const;
+
+    // Heap bytes held, kept current as the queue changes. A shared line is
+    // not included, only the segment referring to it: its bytes are in
+    // SharedMessage::liveBytes(), once for all its holders.
+    size_t memoryUsage() const;
+    // Gives back private capacity well beyond the contents
+    void shrink();
+
+private:
+    SendQueue(const SendQueue& other);
+    SendQueue& operator=(const SendQueue& other);
+
+    struct Segment {
+        // NULL for a private segment, whose bytes are in `bytes`
+        SharedMessage* shared;
+        std::string bytes;
+        // Bytes at the front already sent
+        size_t offset;
+        // Sent with MSG_ZEROCOPY, last by send `zerocopy`
+        bool pinned;
+        uint32_t zerocopy;
+    };
+
+    // Segments in order, in a power-of-two ring allocated on the first
+    // push and freed when it runs empty, so that the queue of an idle
+    // client holds no heap (an empty std::deque keeps a map and a block)
+    class Ring {
+    public:
+        Ring();
+        ~Ring();
+
+        bool empty() const { return _count == 0; }
+        size_t size() const { return _count; }
+        Segment& operator[](size_t i) const { return _slots[(_head + i) & (_capacity - 1)]; }
+        Segment& front() const { return _slots[_head]; }
+        Segment& back() const { return (*this)[_count - 1]; }
+        // Appends a segment with no bytes and returns it
+        Segment& push_back();
+        // The front segment must have been released (_drop) or moved from
+        void pop_front();
+
+    private:
+        Ring(const Ring& other);
+        Ring& operator=(const Ring& other);
+
+        void _grow();
+
+        Segment* _slots;
+        uint32_t _capacity;
+        uint32_t _head;
+        uint32_t _count;
+    };
+
+    static size_t _segmentHeap(const Segment& segment);
+    static const char* _segmentData(const Segment& segment);
+    static size_t _segmentLength(const Segment& segment);
+    bool _zerocopyDone(uint32_t id) const;
+    void _drop(Segment& segment);
+    void _popFront();
+
+    Ring _segments;
+    size_t _size;
+    size_t _heap;
+    // Consumed segments the kernel may still be reading
+    Ring _retired;
+    // Next send id, and the oldest one not completed yet
+    uint32_t _zerocopyNext;
+    uint32_t _zerocopyDoneUpTo;
+};
@@ -12,6 +12,21 @@
 #include "KickCommand.hpp"
 #include "TopicCommand.hpp"
 #include "PrivmsgCommand.hpp"
+#include "ChathistoryCommand.hpp"
+#include "ListCommand.hpp"
+#include "NamesCommand.hpp"
+#include "WhoCommand.hpp"
+#include "WhoisCommand.hpp"
+#include "ServerCommand.hpp"
+#include "CapCommand.hpp"
+#include "AuthenticateCommand.hpp"
+#include "OperCommand.hpp"
+#include "NickservCommand.hpp"
+#include "UpgradeCommand.hpp"
+#include "OutboundMessage.hpp"
+#include "ReplyStream.hpp"
+#include "LineScanner.hpp"
+#include "utils.hpp"
 
 #include <iostream>
 #include <cstring>
@@ -19,59 +34,101 @@
 #include <cerrno>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sstream>
 #include <signal.h>
 #include <ctime>
 #include <cstdio>
 
 extern volatile sig_atomic_t g_shutdown_requested;
-
-// Simple ngircd-like logger compatible with C++98
-static void ngircd_log(const std::string& level, const std::string& msg) {
-    time_t t = time(NULL);
-    struct tm* tm_info = localtime(&t);
-    char timebuf[64];
-    if (tm_info) {
-        strftime(timebuf, sizeof(timebuf), "%b %d %H:%M:%S", tm_info);
-    } else {
-        std::strncpy(timebuf, "0000-00-00 00:00:00", sizeof(timebuf));
-        timebuf[sizeof(timebuf)-1] = '\0';
-    }
-    std::cout << "[" << timebuf << "] : " << level << ": " << msg << std::endl;
-}
+extern volatile sig_atomic_t g_upgrade_requested;
+extern volatile sig_atomic_t g_reload_requested;
 
 #define BACKLOG 10
-#define BUFFER_SIZE 512
-
-Server::Server(int port, const std::string& password):
-    _serverName("ft_irc"),
-    _port(port),
-    _password(password),
+#define BUFFER_SIZE 16384
+// Longest client line, terminator excluded (RFC 1459 allows 512 bytes with CRLF)
+#define MAX_LINE_LENGTH 510
+// Unterminated input a client may leave buffered before it is disconnected
+#define MAX_PENDING_INPUT 8192
+// Send queue segments handed to one writev()
+#define SEND_IOVECS 64
+// Channel creation rates are counted per window of this many seconds
+#define CHANNEL_CREATE_WINDOW 60
+// Registry entries the reclaimer looks at per second
+#define CHANNEL_RECLAIM_BATCH 4096
+
+Server::Server(const ServerConfig& config):
+    _serverName(config.serverName),
+    _config(config),
     _serverFd(-1),
     _epollFd(-1),
-    _startTimeString(_generateTimeString(time(NULL)))
+    _startTimeString(_generateTimeString(time(NULL))),
+    _nextRemoteId(-2),
+    _uplinkFd(-1),
+    _nextLinkAttempt(0),
+    _fanoutEpoch(0),
+    _wakeFd(-1),
+    _wakePending(0),
+    _readyInboxes(NULL),
+    _bufferBytes(0),
+    _auditedBytes(0),
+    _lastAudit(0),
+    _refusingConnections(false),
+    _refusedConnections(0),
+    _lastAdmissionReport(0),
+    _reloading(false),
+    _reloadDone(0),
+    _reloadedRules(NULL),
+    _draining(false),
+    _drainDeadline(0),
+    _drainedClients(0),
+    _socketBusyPoll(false),
+    _accounts(NULL),
+    _authTickets(0),
+    _createWindow(0),
+    _channelsCreated(0),
+    _reclaimCursor(0),
+    _nextReclaim(0)
 {
+    std::memset(_rejected, 0, sizeof(_rejected));
     _initCommands();
+    _fanoutPool.start(this, _config.fanoutThreads, _config.fanoutThreshold);
 }
 
 Server::~Server() {
     _cleanupCommands();
+    if (_reloading) {
+        pthread_join(_reloadThread, NULL);
+        delete _reloadedRules;
+    }
+    // Before the wake-up descriptor goes: workers still use it
+    _authPool.stop();
+    delete _accounts;
 
     if (_serverFd >= 0) close(_serverFd);
     if (_epollFd >= 0) close(_epollFd);
+    if (_wakeFd >= 0) close(_wakeFd);
 
     for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
         close(it->first);
         delete it->second;
     }
 
-    for (std::map<std::string, Channel*>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+    for (std::map<int, Client*>::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it) {
         delete it->second;
     }
+    for (size_t i = 0; i < _drainClosed.size(); ++i) {
+        delete _drainClosed[i];
+    }
+
+    for (size_t i = 0; i < _channels.capacity(); ++i) {
+        delete _channels.at(i);
+    }
 }
 
 void Server::_initCommands() {
@@ -85,6 +142,18 @@ void Server::_initCommands() {
     _commands["KICK"] = new KickCommand();
     _commands["TOPIC"] = new TopicCommand();
     _commands["PRIVMSG"] = new PrivmsgCommand();
+    _commands["CHATHISTORY"] = new ChathistoryCommand();
+    _commands["LIST"] = new ListCommand();
+    _commands["NAMES"] = new NamesCommand();
+    _commands["WHO"] = new WhoCommand();
+    _commands["WHOIS"] = new WhoisCommand();
+    _commands["SERVER"] = new ServerCommand();
+    _commands["CAP"] = new CapCommand();
+    _commands["AUTHENTICATE"] = new AuthenticateCommand();
+    _commands["OPER"] = new OperCommand();
+    _commands["NICKSERV"] = new NickservCommand();
+    _commands["NS"] = new NickservCommand();
+    _commands["UPGRADE"] = new UpgradeCommand();
 }
 
 void Server::_cleanupCommands() {
@@ -95,7 +164,17 @@ void Server::_cleanupCommands() {
 }
 
 void Server::_initServer() {
-    _serverFd = socket(AF_INET, SOCK_STREAM, 0);
+    _initAdmission();
+    _initZerocopy();
+    _initBusyPoll();
+    _initAuth();
+    int upgradeFd = _takeUpgradeChannel();
+    if (upgradeFd >= 0) {
+        _resumeFromUpgrade(upgradeFd);
+        return;
+    }
+
+    _serverFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (_serverFd < 0) {
         throw std::runtime_error("Error: socket() failed");
     }
@@ -113,7 +192,7 @@ void Server::_initServer() {
     std::memset(&address, 0, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(_port);
+    address.sin_port = htons(_config.port);
 
     if (bind(_serverFd, (struct sockaddr *)&address, sizeof(address)) < 0) {
         throw std::runtime_error("Error: bind() failed");
@@ -123,7 +202,20 @@ void Server::_initServer() {
         throw std::runtime_error("Error: listen() failed");
     }
 
-    _epollFd = epoll_create1(0);
+    _initEpoll();
+    _openChannelStore();
+    _openNickRegistry();
+    _openCapture();
+
+    {
+        std::ostringstream oss;
+        oss << "Server started on port " << _config.port;
+        ngircd_log("info", oss.str());
+    }
+}
+
+void Server::_initEpoll() {
+    _epollFd = epoll_create1(EPOLL_CLOEXEC);
     if (_epollFd < 0) {
         throw std::runtime_error("Error: epoll_create1() failed");
     }
@@ -135,15 +227,41 @@ void Server::_initServer() {
         throw std::runtime_error("Error: epoll_ctl(ADD) failed");
     }
 
+    _wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_wakeFd < 0) {
+        throw std::runtime_error("Error: eventfd() failed");
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = _wakeFd;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, _wakeFd, &ev) < 0) {
+        throw std::runtime_error("Error: epoll_ctl(ADD) failed");
+    }
+
     _events.resize(1024);
+}
 
-    {
+void Server::_openChannelStore() {
+    if (!_config.channelDb.empty() && _channelStore.open(_config.channelDb)) {
+        std::ostringstream oss;
+        oss << "Channel store " << _config.channelDb << " opened (" << _channelStore.size() << " channel(s))";
+        ngircd_log("info", oss.str());
+    }
+}
+
+void Server::_openNickRegistry() {
+    if (!_config.nickDb.empty() && _nickRegistry.open(_config.nickDb)) {
         std::ostringstream oss;
-        oss << "Server started on port " << _port;
+        oss << "Nickname registry " << _config.nickDb << " opened (" << _nickRegistry.size() << " nickname(s))";
         ngircd_log("info", oss.str());
     }
 }
 
+void Server::_openCapture() {
+    if (!_config.captureFile.empty() && !_capture.isOpen() && _capture.open(_config.captureFile)) {
+        ngircd_log("info", "Capturing client traffic to " + _config.captureFile);
+    }
+}
+
 const std::string Server::_generateTimeString(time_t startTime) const {
     struct tm* timeinfo = gmtime(&startTime);
     char buffer[80];
@@ -157,9 +275,10 @@ const std::string Server::_generateTimeString(time_t startTime) const {
 void Server::_handleNewConnection() {
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
+    time_t now = time(NULL);
 
     while (true) {
-        int new_socket = accept(_serverFd, (struct sockaddr *)&client_addr, &client_len);
+        int new_socket = accept4(_serverFd, (struct sockaddr *)&client_addr, &client_len, SOCK_CLOEXEC);
 
         if (new_socket < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
@@ -169,6 +288,11 @@ void Server::_handleNewConnection() {
             break;
         }
 
+        PrefixTree::Address address;
+        if (!_screenConnection(new_socket, (struct sockaddr *)&client_addr, now, address)) {
+            continue;
+        }
+
         if (fcntl(new_socket, F_SETFL, O_NONBLOCK) < 0) {
             {
                 std::ostringstream oss;
@@ -180,6 +304,15 @@ void Server::_handleNewConnection() {
         }
 
         std::string hostname = inet_ntoa(client_addr.sin_addr);
+        if (_refusingConnections) {
+            // Best effort: the socket is new, so the line fits its buffer
+            static const char refusal[] = "ERROR :Closing Link: Server is out of memory, try again later\r\n";
+            ssize_t sent = send(new_socket, refusal, sizeof(refusal) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            (void)sent;
+            close(new_socket);
+            ++_refusedConnections;
+            continue;
+        }
         {
             std::ostringstream oss;
             oss << "New connection from " << hostname << " (fd=" << new_socket << ")";
@@ -188,6 +321,8 @@ void Server::_handleNewConnection() {
 
         Client* new_client = new Client(new_socket, hostname, this, EPOLLIN);
         _clients[new_socket] = new_client;
+        _enableZerocopy(new_client);
+        _enableBusyPoll(new_socket);
 
         struct epoll_event ev;
         ev.events = EPOLLIN;
@@ -203,6 +338,9 @@ void Server::_handleNewConnection() {
             _clients.erase(new_socket);
             continue;
         }
+        _admission.admit(address);
+        new_client->setAdmitted(true);
+        _capture.recordAccept(new_socket, hostname);
     }
 }
 
@@ -221,35 +359,60 @@ std::string visualizeCRLF(const std::string& input) {
     return oss.str();
 }
 
+// Commands whose parameters carry passwords or credentials
+static const char* const CREDENTIAL_COMMANDS[] = { "PASS", "OPER", "AUTHENTICATE", "NICKSERV", "NS" };
+
+// A command line as it may be logged: the parameters of the commands above
+// are left out
+static std::string loggableCommandLine(const std::string& commandLine) {
+    size_t start = 0;
+    if (!commandLine.empty() && commandLine[0] == '@') {
+        start = commandLine.find(' ');
+        if (start == std::string::npos) return visualizeCRLF(commandLine);
+    }
+    while (start < commandLine.size() && commandLine[start] == ' ') ++start;
+    size_t end = commandLine.find(' ', start);
+    if (end == std::string::npos) return visualizeCRLF(commandLine);
+    std::string name = commandLine.substr(start, end - start);
+    for (size_t i = 0; i < name.size(); ++i) {
+        name[i] = std::toupper(static_cast<unsigned char>(name[i]));
+    }
+    for (size_t i = 0; i < sizeof(CREDENTIAL_COMMANDS) / sizeof(CREDENTIAL_COMMANDS[0]); ++i) {
+        if (name == CREDENTIAL_COMMANDS[i]) {
+            return visualizeCRLF(commandLine.substr(0, end)) + " <redacted>";
+        }
+    }
+    return visualizeCRLF(commandLine);
+}
+
 // Helper: split a raw command line into whitespace-separated arguments
-std::vector<std::string> Server::_splitArgs(const std::string& commandLine) {
-    std::vector<std::string> args;
-    size_t i = 0;
-    const size_t n = commandLine.size();
+void Server::splitArgs(const std::string& commandLine, size_t start, CommandArgs& args) {
+    splitArgs(commandLine.data(), commandLine.size(), start, args);
+}
+
+void Server::splitArgs(const char* line, size_t n, size_t start, CommandArgs& args) {
+    ArenaAllocator<char> chars(args.get_allocator());
+    size_t i = start;
 
     // skip leading whitespace
-    while (i < n && isspace((unsigned char)commandLine[i])) ++i;
+    while (i < n && isspace((unsigned char)line[i])) ++i;
 
     while (i < n) {
+        args.push_back(ArenaString(chars));
         // If token starts with ':', everything after ':' is one trailing parameter
-        if (commandLine[i] == ':') {
-            std::string trailing;
-            if (i + 1 < n) trailing = commandLine.substr(i + 1);
-            else trailing = "";
-            args.push_back(trailing);
+        if (line[i] == ':') {
+            args.back().assign(line + i + 1, n - i - 1);
             break;
         }
 
         // Read next token until whitespace
-        size_t start = i;
-        while (i < n && !isspace((unsigned char)commandLine[i])) ++i;
-        args.push_back(commandLine.substr(start, i - start));
+        size_t tokenStart = i;
+        while (i < n && !isspace((unsigned char)line[i])) ++i;
+        args.back().assign(line + tokenStart, i - tokenStart);
 
         // Skip spaces to next token
-        while (i < n && isspace((unsigned char)commandLine[i])) ++i;
+        while (i < n && isspace((unsigned char)line[i])) ++i;
     }
-
-    return args;
 }
 
 void Server::_handleClientRecv(int fd) {
@@ -282,6 +445,71 @@ void Server::_handleClientRecv(int fd) {
             return;
         }
         client->appendRecvBuffer(read_buf, bytes_read);
+        _capture.recordData(fd, read_buf, bytes_read);
+    }
+}
+
+// Runs every complete line in the receive buffer. The bytes received since
+// the last call are searched once for line breaks and forbidden bytes; lines
+// end in "\r\n" or a bare "\n". A line holding a forbidden byte is dropped,
+// and a client line longer than the protocol allows is answered with
+// ERR_INPUTTOOLONG instead of being run. Server links are trusted with
+// longer lines.
+void Server::_processRecvBuffer(int fd) {
+    Client* client = _clients[fd];
+    const std::string& buf = client->getRecvBuffer();
+    if (client->isAuthPending()) {
+        // Lines wait for the credential check, within the usual limit
+        if (buf.size() > MAX_PENDING_INPUT) {
+            client->queueMessage("ERROR :Input line too long\r\n");
+            _handleClientSend(fd);
+            _handleClientDisconnect(fd);
+        }
+        return;
+    }
+    size_t scanned = client->getRecvScanned();
+    if (scanned >= buf.size()) return;
+
+    _lineMarks.clear();
+    scanLineBreaks(buf.data() + scanned, buf.size() - scanned, _lineMarks);
+
+    size_t start = 0;
+    bool forbidden = false;
+    for (size_t m = 0; m < _lineMarks.size(); ++m) {
+        if (_lineMarks[m] & LINE_SCAN_FORBIDDEN) {
+            forbidden = true;
+            continue;
+        }
+        size_t end = scanned + _lineMarks[m];
+        size_t lineEnd = (end > start && buf[end - 1] == '\r') ? end - 1 : end;
+        if (forbidden) {
+            std::ostringstream oss;
+            oss << "Dropping line with a forbidden byte from fd=" << fd;
+            ngircd_log("warning", oss.str());
+        } else if (lineEnd - start > MAX_LINE_LENGTH && !client->isServerLink()) {
+            client->reply(417, "");
+        } else if (lineEnd > start) {
+            _processCommand(fd, buf.data() + start, lineEnd - start);
+            if (!_clients.count(fd)) return;
+        }
+        start = end + 1;
+        forbidden = false;
+        if (client->isAuthPending()) break;
+    }
+    client->clearRecvBuffer(start);
+    // A forbidden byte in the unterminated tail must be seen again once its
+    // line completes, and lines held for a credential check once it is
+    // done. A trailing CR is judged with the byte that follows it.
+    if (forbidden || client->isAuthPending()) {
+        client->setRecvScanned(0);
+    } else {
+        client->setRecvScanned(!buf.empty() && buf[buf.size() - 1] == '\r' ? buf.size() - 1 : buf.size());
+    }
+
+    if (!client->isServerLink() && buf.size() > MAX_PENDING_INPUT) {
+        client->queueMessage("ERROR :Input line too long\r\n");
+        _handleClientSend(fd);
+        _handleClientDisconnect(fd);
     }
 }
 
@@ -289,12 +517,23 @@ void Server::_handleClientSend(int fd) {
     if (!_clients.count(fd)) return;
     Client* client = _clients[fd];
 
-    const std::string& send_buf = client->getSendBuffer();
-    if (send_buf.empty()) {
+    const SendQueue& queue = client->getSendQueue();
+    if (queue.empty()) {
         this->disableEpollOut(fd);
         return;
     }
-    ssize_t bytes_sent = send(fd, send_buf.c_str(), send_buf.length(), 0);
+    struct iovec iov[SEND_IOVECS];
+    int count = queue.gather(iov, SEND_IOVECS);
+    int span = _zerocopySpan(client, iov, count);
+    bool zerocopy = span > 0;
+    ssize_t bytes_sent = -1;
+    if (zerocopy) {
+        bytes_sent = _sendZerocopy(fd, iov, span);
+        zerocopy = bytes_sent >= 0 || errno != ENOBUFS;
+    }
+    if (!zerocopy) {
+        bytes_sent = writev(fd, iov, count);
+    }
     if (bytes_sent < 0) {
         if (errno == EAGAIN || errno == EWOULDBLOCK) {
             return;
@@ -307,14 +546,58 @@ void Server::_handleClientSend(int fd) {
         _handleClientDisconnect(fd);
         return;
     }
-    client->clearSendBuffer(bytes_sent);
+    if (zerocopy && bytes_sent > 0) {
+        client->clearSendBufferZerocopy(bytes_sent);
+    } else {
+        client->clearSendBuffer(bytes_sent);
+    }
 
-    if (client->getSendBuffer().empty()) {
+    if (client->hasReplyStreams() && client->getSendQueue().size() < SENDQ_WATERMARK) {
+        _pumpReplyStreams(client);
+    }
+    if (client->getSendQueue().empty()) {
         this->disableEpollOut(fd);
     }
 }
 
+void Server::_pumpReplyStreams(Client* client) {
+    while (client->hasReplyStreams() && client->getSendQueue().size() < SENDQ_WATERMARK) {
+        ReplyStream* stream = client->frontReplyStream();
+        if (!stream->resume(*this, client)) {
+            break;
+        }
+        client->popReplyStream();
+    }
+}
+
+// Write out everything queued during this tick with one writev() per client.
+// Whatever the socket does not take is left to EPOLLOUT.
+void Server::_flushDirtyClients() {
+    // Index loop on purpose: a disconnect below broadcasts QUIT and may append to the list
+    for (size_t i = 0; i < _dirtyClients.size(); ++i) {
+        int fd = _dirtyClients[i];
+        std::map<int, Client*>::iterator it = _clients.find(fd);
+        if (it == _clients.end() || !it->second->isFlushPending()) continue;
+        Client* client = it->second;
+        client->setFlushPending(false);
+        if (client->isConnecting()) continue;
+
+        if (client->hasReplyStreams()) {
+            _pumpReplyStreams(client);
+        }
+        _handleClientSend(fd);
+        if (_clients.count(fd) && !client->getSendQueue().empty()) {
+            this->enableEpollOut(fd);
+        }
+    }
+    _dirtyClients.clear();
+}
+
 void Server::_handleClientDisconnect(int fd) {
+    if (_draining && _clients.count(fd)) {
+        _closeDrainingClient(fd);
+        return;
+    }
     {
         std::ostringstream _entry;
         _entry << "_handleClientDisconnect called for fd=" << fd << " (clients=" << _clients.size() << ")";
@@ -330,12 +613,29 @@ void Server::_handleClientDisconnect(int fd) {
     }
 
     Client* client = _clients[fd];
+    _capture.recordClose(fd);
     {
         std::ostringstream _info;
         _info << "Disconnecting client fd=" << fd << " nick='" << client->getNickname() << "' prefix='" << client->getPrefix() << "'";
         ngircd_log("info", _info.str());
     }
 
+    if (client->isServerLink()) {
+        _splitServer(client->getHomeServer(), "Link to " + client->getHomeServer() + " closed", client);
+    } else if (client->hasRegistered()) {
+        propagate(":" + client->getPrefix() + " QUIT :Client disconnected\r\n", NULL);
+        nickSeen(client, client->getNickname());
+    }
+    if (fd == _uplinkFd) {
+        _uplinkFd = -1;
+    }
+    for (std::vector<Client*>::iterator lit = _links.begin(); lit != _links.end(); ++lit) {
+        if (*lit == client) {
+            _links.erase(lit);
+            break;
+        }
+    }
+
     // Show how many channels the client is in before removal
     {
         std::ostringstream _chcount;
@@ -392,6 +692,8 @@ void Server::_handleClientDisconnect(int fd) {
         _del << "Deleting client object for fd=" << fd << " nick='" << client->getNickname() << "'";
         ngircd_log("debug", _del.str());
     }
+    _releaseConnection(client);
+    _drainReadyInboxes();
     delete client;
     _clients.erase(fd);
 
@@ -402,17 +704,32 @@ void Server::_handleClientDisconnect(int fd) {
     }
 }
 
-void Server::_processCommand(int fd, const std::string& commandLine) {
+// The line points into the client's receive buffer and is only valid until
+// the buffer is next modified; nothing is copied on the client path unless
+// debug logging is on
+void Server::_processCommand(int fd, const char* commandLine, size_t n) {
     // Log the raw command line received from client (make CR/LF visible)
-    {
+    if (logEnabled("debug")) {
         std::ostringstream _logoss;
-        _logoss << "Command from fd=" << fd << " : [" << visualizeCRLF(commandLine) << "]";
-        ngircd_log("info", _logoss.str());
+        _logoss << "Command from fd=" << fd << " : [" << loggableCommandLine(std::string(commandLine, n)) << "]";
+        ngircd_log("debug", _logoss.str());
+    }
+
+    // Established server links speak the prefixed server protocol
+    std::map<int, Client*>::iterator linkIt = _clients.find(fd);
+    if (linkIt != _clients.end() && linkIt->second->isServerLink()) {
+        _processLinkLine(linkIt->second, std::string(commandLine, n));
+        return;
     }
 
     // Parse command token first (commands must come first and must not start with ':')
     size_t pos = 0;
-    const size_t n = commandLine.size();
+    // IRCv3 message tags ("@a=b;c ") are accepted and ignored
+    if (n > 0 && commandLine[0] == '@') {
+        const void* space = std::memchr(commandLine, ' ', n);
+        if (!space) return;
+        pos = static_cast<const char*>(space) - commandLine;
+    }
     // skip leading whitespace
     while (pos < n && isspace((unsigned char)commandLine[pos])) ++pos;
 
@@ -428,28 +745,23 @@ void Server::_processCommand(int fd, const std::string& commandLine) {
         return;
     }
 
-    std::string cmdToken = commandLine.substr(cmd_start, pos - cmd_start);
-    if (!cmdToken.empty() && cmdToken[0] == ':') {
+    if (commandLine[cmd_start] == ':') {
         // Command beginning with ':' is invalid in this server's parsing expectations
         {
             std::ostringstream oss;
-            oss << "Malformed command (starts with ':') from fd=" << fd << ": " << cmdToken;
+            oss << "Malformed command (starts with ':') from fd=" << fd << ": "
+                << std::string(commandLine + cmd_start, pos - cmd_start);
             ngircd_log("info", oss.str());
         }
         return;
     }
 
-    // Build args: first element is the command token, remaining are parsed from the rest of the line
-    std::vector<std::string> args;
-    args.push_back(cmdToken);
-
-    // remainder (may include leading spaces) and let _splitArgs handle trailing ':' semantics
-    std::string remainder;
-    if (pos < n) remainder = commandLine.substr(pos);
-    if (!remainder.empty()) {
-        std::vector<std::string> more = _splitArgs(remainder);
-        for (size_t i = 0; i < more.size(); ++i) args.push_back(more[i]);
-    }
+    // Build args in the tick's arena: first element is the command token,
+    // remaining are parsed from the rest of the line (splitArgs handles
+    // trailing ':' semantics)
+    CommandArgs args((ArenaAllocator<ArenaString>(_arena)));
+    args.push_back(ArenaString(commandLine + cmd_start, pos - cmd_start, ArenaAllocator<char>(_arena)));
+    splitArgs(commandLine, n, pos, args);
 
     if (args.empty()) {
         std::ostringstream _oss2;
@@ -466,25 +778,26 @@ void Server::_processCommand(int fd, const std::string& commandLine) {
     }
 
     Client* client = _clients[fd];
-    std::string cmdName = args[0];
+    std::string cmdName(args[0].data(), args[0].size());
 
     for (size_t i = 0; i < cmdName.length(); ++i) {
         cmdName[i] = std::toupper(cmdName[i]);
     }
 
-    if (_commands.count(cmdName) == 0) {
+    std::map<std::string, ICommand*>::iterator found = _commands.find(cmdName);
+    if (found == _commands.end()) {
         {
             std::ostringstream oss;
             oss << "Unknown command from fd=" << fd << ": " << args[0];
             ngircd_log("info", oss.str());
         }
         if (client->hasRegistered()) {
-            client->reply(421, args[0]);
+            client->reply(421, toString(args[0]));
         }
         return;
     }
 
-    ICommand* cmd = _commands[cmdName];
+    ICommand* cmd = found->second;
 
     if (!client->hasRegistered()) {
         if (cmd->requiresRegistration()) {
@@ -493,7 +806,8 @@ void Server::_processCommand(int fd, const std::string& commandLine) {
         }
         cmd->execute(*this, client, args);
         ///// これはいつか関数化して綺麗にする
-        if (!client->hasRegistered() && !client->getNickname().empty() && !client->getUsername().empty()) {
+        if (!client->hasRegistered() && !client->isCapNegotiating()
+            && !client->getNickname().empty() && !client->getUsername().empty()) {
             if (client->getPassword() != this->getPassword()) {
                 client->queueMessage("ERROR :Access denied: Bad password?\r\n"); //// これを送信してからdisconnectする
                 {
@@ -504,7 +818,15 @@ void Server::_processCommand(int fd, const std::string& commandLine) {
                 _handleClientDisconnect(fd);
                 return;
             }
+            // Registered to an account the client did not log in to: it
+            // has to pick another one before registration can complete
+            if (!nickAllowed(client, client->getNickname())) {
+                client->reply(433, client->getNickname() + " :Nickname is registered to another account");
+                client->setNickname("");
+                return;
+            }
             client->setHasRegistered(true);
+            client->setPassword("");
             {
                 std::ostringstream oss;
                 oss << "Client registered: " << client->getPrefix();
@@ -513,6 +835,8 @@ void Server::_processCommand(int fd, const std::string& commandLine) {
             client->reply(001, "");
             client->reply(002, "");
             client->reply(003, "");
+            introduceUser(client);
+            nickSeen(client, client->getNickname());
         }
         ////////////////////////////////
     }
@@ -526,13 +850,36 @@ void Server::run() {
     const int EPOLL_TIMEOUT_MS = 1000; // 1 second timeout to avoid indefinite blocking
     while (true) {
         // Check for shutdown signal
-        if (g_shutdown_requested) {
-            ngircd_log("info", "Shutdown signal received, cleaning up...");
-            shutdown();
-            break;
+        if (g_shutdown_requested && !_draining) {
+            ngircd_log("info", "Shutdown signal received, draining send queues...");
+            _beginDrain();
+        }
+        if (_draining) {
+            if (_drainFinished()) {
+                shutdown();
+                break;
+            }
+        } else if (g_upgrade_requested) {
+            g_upgrade_requested = 0;
+            ngircd_log("info", "Upgrade requested, handing over to " + _config.executable);
+            if (_performUpgrade()) {
+                break;
+            }
+        }
+        if (g_reload_requested && !_draining) {
+            g_reload_requested = 0;
+            _startRulesReload();
         }
 
-        int n = epoll_wait(_epollFd, _events.data(), _events.size(), EPOLL_TIMEOUT_MS);
+        if (!_draining) {
+            _maintainUplink();
+            _maintainAdmission();
+            _nickRegistry.maintain(time(NULL));
+            _reclaimEmptyChannels();
+            _enforceMemoryBudget();
+        }
+
+        int n = _waitEvents(_draining ? _drainWait() : EPOLL_TIMEOUT_MS);
         if (n < 0) {
             if (errno == EINTR) continue; // interrupted by signal, retry
             {
@@ -542,55 +889,82 @@ void Server::run() {
             }
             continue;
         }
-        if (n == 0) {
-            continue;
-        }
 
+        // Even a tick without events flushes: replies queued outside the
+        // event handlers (a resumed upgrade, the maintenance above) go out
         for (int i = 0; i < n; ++i) {
             int fd = _events[i].data.fd;
             uint32_t events = _events[i].events;
+            if (fd == _wakeFd) {
+                _drainInboxes();
+                _finishAuth();
+                continue;
+            }
             if (fd == _serverFd && (events & EPOLLIN)) {
                 _handleNewConnection();
                 continue;
             }
+            if ((events & EPOLLERR) && !(events & EPOLLHUP)) {
+                // Zerocopy completions waiting on the error queue
+                Client* client = getClientByFd(fd);
+                if (client && client->getZerocopy() != ZEROCOPY_OFF && _reapZerocopy(client)) {
+                    events &= ~static_cast<uint32_t>(EPOLLERR);
+                }
+            }
             if (events & (EPOLLHUP | EPOLLERR)) {
                 _handleClientDisconnect(fd);
                 continue;
             }
             if (events & EPOLLIN) {
-                _handleClientRecv(fd);
+                if (_draining) {
+                    _discardInput(fd);
+                } else {
+                    _handleClientRecv(fd);
+                }
             }
             if (events & EPOLLOUT) {
-                _handleClientSend(fd);
+                Client* sender = getClientByFd(fd);
+                if (sender && sender->isConnecting()) {
+                    _finishConnect(fd);
+                } else {
+                    _handleClientSend(fd);
+                }
             }
 
 
-            if (!_clients.count(fd)) continue;
-            Client* client = _clients[fd];
-            while (true) {
-                const std::string& buf = client->getRecvBuffer();
-                // std::cout << "[Socket " << fd << "] Processing command line : ["
-                //         << visualizeCRLF(buf) << "]" << std::endl;
-                size_t crlf_pos = buf.find("\r\n");
-                if (crlf_pos == std::string::npos) break;
-                std::string command_line = buf.substr(0, crlf_pos);
-                client->clearRecvBuffer(crlf_pos + 2);
-                if (!command_line.empty()) {
-                    _processCommand(fd, command_line);
-                }
-            }
+            if (_draining || !_clients.count(fd)) continue;
+            _processRecvBuffer(fd);
 
 
         }
+
+        _flushDirtyClients();
+        _arena.reset();
     }
 }
 
+Arena& Server::getArena() {
+    return _arena;
+}
+
+uint32_t Server::internHostname(const std::string& hostname) {
+    return _hostnames.intern(hostname);
+}
+
+void Server::releaseHostname(uint32_t id) {
+    _hostnames.release(id);
+}
+
+const std::string& Server::getHostname(uint32_t id) const {
+    return _hostnames.get(id);
+}
+
 int Server::getPort() const {
-    return _port;
+    return _config.port;
 }
 
 const std::string& Server::getPassword() const {
-    return _password;
+    return _config.password;
 }
 
 void Server::enableEpollOut(int fd) {
@@ -609,6 +983,64 @@ void Server::enableEpollOut(int fd) {
     }
 }
 
+void Server::scheduleFlush(Client* client) {
+    if (!client || client->isFlushPending()) return;
+    client->setFlushPending(true);
+    _dirtyClients.push_back(client->getFd());
+}
+
+void Server::scheduleFlushes(const std::vector<int>& fds) {
+    _dirtyClients.insert(_dirtyClients.end(), fds.begin(), fds.end());
+}
+
+void Server::postFromThread(Client* client, SharedMessage* message) {
+    client->getInbox().push(message);
+    if (!client->getInbox().markSignalled()) {
+        return;
+    }
+    // Only the producer that announced the inbox links the client in, so
+    // it is on the stack at most once and its own link is free to use
+    Client* head = __atomic_load_n(&_readyInboxes, __ATOMIC_RELAXED);
+    do {
+        client->setNextReady(head);
+    } while (!__atomic_compare_exchange_n(&_readyInboxes, &head, client, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    _wakeLoop();
+}
+
+// Any thread. One eventfd write per tick, however many times it is called
+void Server::_wakeLoop() {
+    if (__atomic_exchange_n(&_wakePending, 1, __ATOMIC_ACQ_REL) == 0) {
+        uint64_t one = 1;
+        ssize_t written = write(_wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+// Event loop side of postFromThread
+void Server::_drainInboxes() {
+    uint64_t count;
+    ssize_t got = read(_wakeFd, &count, sizeof(count));
+    (void)got;
+    // Re-armed before the stack is taken: a producer that pushes onto the
+    // emptied stack then sees the flag clear and writes the eventfd again
+    __atomic_store_n(&_wakePending, 0, __ATOMIC_RELAXED);
+    _drainReadyInboxes();
+}
+
+// Empties the stack of announced clients. Also run before clients are
+// freed, so that it never holds one that is gone.
+void Server::_drainReadyInboxes() {
+    Client* client = __atomic_exchange_n(&_readyInboxes, static_cast<Client*>(NULL), __ATOMIC_ACQ_REL);
+    while (client) {
+        // Read before the drain re-arms the inbox, after which a producer
+        // may link the client in again
+        Client* next = client->getNextReady();
+        client->drainInbox();
+        client = next;
+    }
+}
+
 void Server::disableEpollOut(int fd) {
     if (!_clients.count(fd)) return;
     Client* client = _clients[fd];
@@ -632,85 +1064,77 @@ const std::string Server::getStartTimeString() const {
     return _startTimeString;
 }
 
-void Server::shutdown() {
-    ngircd_log("info", "Starting graceful shutdown...");
-
-    // 1. Stop accepting new connections - close server socket first
-    if (_serverFd >= 0) {
-        {
-            std::ostringstream oss;
-            oss << "Closing server socket (fd=" << _serverFd << ")";
-            ngircd_log("info", oss.str());
-        }
-        // actually close the listening socket
-        close(_serverFd);
-        _serverFd = -1;
-    }
+Channel* Server::getChannel(const std::string& channelName) {
+    return _channels.find(channelName);
+}
 
-    // 2. Notify all clients about shutdown and close their connections
-    {
-        std::ostringstream oss;
-        oss << "Disconnecting " << _clients.size() << " client(s)...";
-        ngircd_log("info", oss.str());
-    }
+Channel* Server::getChannel(const char* channelName, size_t length) {
+    return _channels.find(channelName, length);
+}
 
-    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        int client_fd = it->first;
-        Client* client = it->second;
+Channel* Server::resolveChannel(ChannelHandle handle) const {
+    return _channels.resolve(handle);
+}
 
-        // Send shutdown message (optional but polite)
-        const char* shutdown_msg = "ERROR :Server is shutting down\r\n";
-        send(client_fd, shutdown_msg, strlen(shutdown_msg), 0);
+size_t Server::getChannelSlotCount() const {
+    return _channels.capacity();
+}
 
-        // Close client socket
-        close(client_fd);
+Channel* Server::getChannelAtSlot(size_t slot) const {
+    return _channels.at(slot);
+}
 
-        // Free client memory
-        delete client;
+Channel* Server::getOrCreateChannel(const std::string& channelName) {
+    Channel* existing = _channels.find(channelName);
+    if (existing) {
+        return existing;
     }
-    _clients.clear();
+    Channel* newChannel = prepareChannel(channelName);
+    adoptChannel(newChannel, NULL);
+    return newChannel;
+}
 
-    // 3. Close epoll instance
-    if (_epollFd >= 0) {
-        {
-            std::ostringstream oss;
-            oss << "Closing epoll instance (fd=" << _epollFd << ")";
-            ngircd_log("info", oss.str());
-        }
-        close(_epollFd);
-        _epollFd = -1;
+Channel* Server::prepareChannel(const std::string& channelName) {
+    Channel* newChannel = new Channel(channelName, _config.historyLines, _config.historyBytes);
+    newChannel->setFanoutPool(&_fanoutPool);
+    if (_channelStore.load(channelName, *newChannel)) {
+        ngircd_log("debug", std::string("Restored channel from store: ") + channelName);
     }
-
-    ngircd_log("info", "Graceful shutdown complete.");
+    return newChannel;
 }
 
-Channel* Server::getChannel(const std::string& channelName) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(channelName);
-    if (it != _channels.end()) {
-        return it->second;
+void Server::adoptChannel(Channel* channel, Client* creator) {
+    channel->setHandle(_channels.insert(channel));
+    if (creator) {
+        time_t window = time(NULL) / CHANNEL_CREATE_WINDOW;
+        if (_createWindow != window) {
+            _createWindow = window;
+            _channelsCreated = 0;
+        }
+        ++_channelsCreated;
+        creator->countChannelCreated(window);
     }
-    return NULL;
+    ngircd_log("info", std::string("Created new channel: ") + channel->getName());
 }
 
-Channel* Server::getOrCreateChannel(const std::string& channelName) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(channelName);
-    if (it != _channels.end()) {
-        return it->second;
+bool Server::mayCreateChannel(const Client* client) const {
+    time_t window = time(NULL) / CHANNEL_CREATE_WINDOW;
+    if (_config.channelCreateRateGlobal > 0 && _createWindow == window
+        && _channelsCreated >= _config.channelCreateRateGlobal) {
+        return false;
     }
-
-    // Create new channel
-    Channel* newChannel = new Channel(channelName);
-    _channels[channelName] = newChannel;
-    ngircd_log("info", std::string("Created new channel: ") + channelName);
-    return newChannel;
+    // Operators only answer to the global rate
+    return _config.channelCreateRate == 0 || client->hasMode('o')
+        || client->getChannelsCreated(window) < _config.channelCreateRate;
 }
 
 void Server::removeChannel(const std::string& channelName) {
-    std::map<std::string, Channel*>::iterator it = _channels.find(channelName);
-    if (it == _channels.end()) {
+    Channel* channel = _channels.find(channelName);
+    if (!channel) {
         return;
     }
-    Channel* channel = it->second;
+    // The name goes with the channel, so keep a copy for the log line
+    const std::string name = channel->getName();
     const std::map<int, Client*>& members = channel->getMembers();
     std::vector<Client*> membersCopy;
     for (std::map<int, Client*>::const_iterator mit = members.begin();
@@ -724,13 +1148,49 @@ void Server::removeChannel(const std::string& channelName) {
          cit != membersCopy.end(); ++cit) {
         Client* client = *cit;
         if (client) {
-            client->removeChannel(channel);
+            client->removeChannel(channel->getHandle());
         }
     }
 
+    _channelStore.erase(name);
+    _channels.erase(channel->getHandle());
     delete channel;
-    _channels.erase(it);
-    ngircd_log("info", std::string("Removed channel: ") + channelName);
+    ngircd_log("info", std::string("Removed channel: ") + name);
+}
+
+// Channels left with nobody in them by a path that did not remove them
+// (a topic burst from a link for a channel nobody here is in, say) are
+// swept up a slice of the registry at a time
+void Server::_reclaimEmptyChannels() {
+    time_t now = time(NULL);
+    if (now < _nextReclaim) return;
+    _nextReclaim = now + 1;
+
+    size_t end = _reclaimCursor + CHANNEL_RECLAIM_BATCH;
+    std::vector<std::string> empty;
+    for (; _reclaimCursor < end && _reclaimCursor < _channels.capacity(); ++_reclaimCursor) {
+        Channel* channel = _channels.at(_reclaimCursor);
+        if (channel && channel->getMemberCount() == 0) {
+            empty.push_back(channel->getName());
+        }
+    }
+    if (_reclaimCursor >= _channels.capacity()) {
+        _reclaimCursor = 0;
+    }
+    for (size_t i = 0; i < empty.size(); ++i) {
+        removeChannel(empty[i]);
+    }
+    if (!empty.empty()) {
+        std::ostringstream oss;
+        oss << "Reclaimed " << empty.size() << " empty channel(s)";
+        ngircd_log("info", oss.str());
+    }
+}
+
+void Server::saveChannelState(Channel* channel) {
+    if (channel) {
+        _channelStore.save(*channel);
+    }
 }
 
 Client* Server::getClientByFd(int fd) {
@@ -738,59 +1198,131 @@ Client* Server::getClientByFd(int fd) {
     if (it != _clients.end()) {
         return it->second;
     }
+    it = _remoteClients.find(fd);
+    if (it != _remoteClients.end()) {
+        return it->second;
+    }
     return NULL;
 }
 
 Client* Server::getClientByNickname(const std::string& nickname) {
+    return getClientByNickname(nickname.data(), nickname.size());
+}
+
+Client* Server::getClientByNickname(const char* nickname, size_t length) {
     for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->second && it->second->getNickname() == nickname) {
+        if (it->second && !it->second->isServerLink() && it->second->getNickname().compare(0, std::string::npos, nickname, length) == 0) {
+            return it->second;
+        }
+    }
+    for (std::map<int, Client*>::iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it) {
+        if (it->second->getNickname().compare(0, std::string::npos, nickname, length) == 0) {
             return it->second;
         }
     }
     return NULL;
 }
 
+Client* Server::adoptClient(int fd, const std::string& hostname) {
+    if (_clients.count(fd)) {
+        throw std::runtime_error("Error: fd already in use");
+    }
+    Client* client = new Client(fd, hostname, this, EPOLLIN);
+    _clients[fd] = client;
+    return client;
+}
+
+void Server::receive(int fd, const std::string& bytes) {
+    std::map<int, Client*>::iterator it = _clients.find(fd);
+    if (it == _clients.end()) return;
+    it->second->appendRecvBuffer(bytes.data(), bytes.size());
+    _processRecvBuffer(fd);
+    // One call stands for one tick
+    _arena.reset();
+}
+
+void Server::dropClient(int fd) {
+    _handleClientDisconnect(fd);
+}
+
+const std::map<int, Client*>& Server::getClients() const {
+    return _clients;
+}
+
+const std::map<int, Client*>& Server::getRemoteClients() const {
+    return _remoteClients;
+}
+
 void Server::addClientToChannel(Client* client, Channel* channel) {
     if (!client || !channel) return;
 
     channel->addClient(client);
-    client->addChannel(channel);
+    client->addChannel(channel->getHandle());
 
-    ngircd_log("info", std::string("[") + client->getNickname() + "] joined channel " + channel->getName());
+    if (logEnabled("debug")) {
+        ngircd_log("debug", std::string("[") + client->getNickname() + "] joined channel " + channel->getName());
+    }
 }
 
 void Server::removeClientFromChannel(Client* client, Channel* channel) {
     if (!client || !channel) return;
 
-    const std::string& channelName = channel->getName();
+    const std::string channelName = channel->getName();
 
     channel->removeClient(client);
-    client->removeChannel(channel);
+    client->removeChannel(channel->getHandle());
 
-    ngircd_log("info", std::string("[") + client->getNickname() + "] left channel " + channelName);
+    if (logEnabled("debug")) {
+        ngircd_log("debug", std::string("[") + client->getNickname() + "] left channel " + channelName);
+    }
 
     if (channel->getMemberCount() == 0) {
         removeChannel(channelName);
     }
 }
 
-void Server::removeClientFromAllChannels(Client* client) {
+void Server::removeClientFromAllChannels(Client* client, const std::string& reason) {
     if (!client) return;
 
-    const std::set<Channel*>& joinedChannels = client->getJoinedChannels();
+    // One QUIT per user who shared any channel, before the channels go
+    notifyNeighbors(client, ":" + client->getPrefix() + " QUIT :" + reason + "\r\n");
 
-    std::set<Channel*> channelsCopy = joinedChannels;
+    // Copy the handles: leaving a channel edits the client's list, and a
+    // channel left empty is deleted (its handle then resolves to NULL)
+    std::vector<ChannelHandle> channelsCopy = client->getJoinedChannels();
 
-    for (std::set<Channel*>::iterator it = channelsCopy.begin();
+    for (std::vector<ChannelHandle>::iterator it = channelsCopy.begin();
          it != channelsCopy.end(); ++it) {
-        Channel* channel = *it;
+        Channel* channel = _channels.resolve(*it);
         if (channel) {
-            // Broadcast QUIT message to channel members before removing
-            std::string quitMsg = ":" + client->getPrefix() + " QUIT :Client disconnected\r\n";
-            channel->broadcast(quitMsg, client->getFd());
-            ngircd_log("info", std::string("Client quit on channel ") + channel->getName() + ": " + client->getPrefix());
+            if (logEnabled("debug")) {
+                ngircd_log("debug", std::string("Client quit on channel ") + channel->getName() + ": " + client->getPrefix());
+            }
 
             removeClientFromChannel(client, channel);
         }
     }
 }
+
+// Queue a line once for every local user who shares at least one channel
+// with the client (the client itself excluded). Each call takes a fresh
+// epoch; a peer already stamped with it was reached through an earlier
+// channel and is skipped, so no per-call set is needed.
+void Server::notifyNeighbors(Client* client, const std::string& line) {
+    OutboundMessage outbound(line);
+    unsigned long epoch = ++_fanoutEpoch;
+    client->setFanoutMark(epoch);
+
+    const std::vector<ChannelHandle>& channels = client->getJoinedChannels();
+    for (size_t i = 0; i < channels.size(); ++i) {
+        Channel* channel = _channels.resolve(channels[i]);
+        if (!channel) continue;
+        const std::map<int, Client*>& members = channel->getMembers();
+        for (std::map<int, Client*>::const_iterator it = members.begin(); it != members.end(); ++it) {
+            Client* peer = it->second;
+            if (peer->isRemote() || peer->getFanoutMark() == epoch) continue;
+            peer->setFanoutMark(epoch);
+            outbound.deliver(peer);
+        }
+    }
+}
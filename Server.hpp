@@ -3,61 +3,301 @@
 #include <map>
 #include <string>
 #include <sys/epoll.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "ServerConfig.hpp"
+#include "ChannelStore.hpp"
+#include "NickRegistry.hpp"
+#include "TrafficCapture.hpp"
+#include "FanoutPool.hpp"
+#include "ChannelRegistry.hpp"
+#include "Admission.hpp"
+#include "Arena.hpp"
+#include "ICommand.hpp"
+#include "StringPool.hpp"
+#include "AuthPool.hpp"
 
 class Client;
 class ICommand;
 class Channel;
+class SharedMessage;
+struct iovec;
 
 class Server {
 public:
-    Server(int port, const std::string& password);
+    explicit Server(const ServerConfig& config);
     ~Server();
 
     void run();
     int getPort() const;
     void enableEpollOut(int fd);
     void disableEpollOut(int fd);
+    void scheduleFlush(Client* client);
+    // For clients a fan-out worker has already marked flush-pending
+    void scheduleFlushes(const std::vector<int>& fds);
+    // Safe from any thread, provided the client outlives the call: queues
+    // message in the client's inbox and wakes the event loop to send it.
+    // For threads that run while the loop does; fan-out workers write the
+    // send queues directly, and credential checks return through AuthPool.
+    void postFromThread(Client* client, SharedMessage* message);
+    // Any thread: a client's buffers grew or shrank by delta heap bytes
+    void adjustBufferBytes(long delta);
     const std::string& getPassword() const;
     const std::string getServerName() const;
     const std::string getStartTimeString() const;
     void shutdown();
+    // The hand-over SIGUSR2 starts (ServerUpgrade.cpp), asked for by an
+    // operator's UPGRADE; it begins once the current tick is done
+    void requestUpgrade(Client* client);
+    // Scratch memory for command handlers, taken back when the tick ends
+    Arena& getArena();
+    // Client hostnames, interned: every client behind one gateway shares a
+    // copy. Event loop thread only.
+    uint32_t internHostname(const std::string& hostname);
+    void releaseHostname(uint32_t id);
+    const std::string& getHostname(uint32_t id) const;
+
+    // Credential checks (ServerAuth.cpp). hasCredentials() tells whether
+    // the --accounts file lists any of that kind. startAuth() hands the
+    // check to the worker pool and holds the client's further input until
+    // the result is in; false, with nothing changed, when too many checks
+    // are in flight.
+    bool hasCredentials(AccountStore::Kind kind) const;
+    bool startAuth(Client* client, AccountStore::Kind kind, const std::string& name, const std::string& password);
+    // Any thread: a check has finished (AuthPool)
+    void authCompleted();
+    // Registered nicknames (ServerAuth.cpp). nickAllowed() is false when
+    // <nick> is registered to an account other than the client's; it
+    // only reads memory. nickSeen() stamps a nickname its owner is using.
+    NickRegistry& getNickRegistry();
+    bool nickAllowed(const Client* client, const std::string& nick) const;
+    void nickSeen(const Client* client, const std::string& nick);
 
     // Channel management (basic operations)
     Channel* getChannel(const std::string& channelName);
+    // For names still in the arena, without copying them out
+    Channel* getChannel(const char* channelName, size_t length);
+    Channel* resolveChannel(ChannelHandle handle) const;
+    // Channel iteration by registry slot, stable while the caller yields
+    size_t getChannelSlotCount() const;
+    Channel* getChannelAtSlot(size_t slot) const;
     Channel* getOrCreateChannel(const std::string& channelName);
+    // JOIN creates a channel in two steps, so that a refused join leaves
+    // nothing behind: prepareChannel() builds it with its stored metadata
+    // but outside the registry, for the join to be checked against, and
+    // adoptChannel() registers it, counting it against the creator's
+    // creation rate. A channel never adopted is simply deleted.
+    Channel* prepareChannel(const std::string& channelName);
+    void adoptChannel(Channel* channel, Client* creator);
+    // False while <client>, or all clients together, have created as many
+    // channels as --channel-create-rate(-global) allow this minute
+    bool mayCreateChannel(const Client* client) const;
     void removeChannel(const std::string& channelName);
+    void saveChannelState(Channel* channel);
     Client* getClientByFd(int fd);
     Client* getClientByNickname(const std::string& nickname);
+    Client* getClientByNickname(const char* nickname, size_t length);
+    const std::map<int, Client*>& getClients() const;
+    const std::map<int, Client*>& getRemoteClients() const;
 
     // Client-Channel operations (high-level helpers)
     void addClientToChannel(Client* client, Channel* channel);
     void removeClientFromChannel(Client* client, Channel* channel);
-    void removeClientFromAllChannels(Client* client);
+    void removeClientFromAllChannels(Client* client, const std::string& reason = "Client disconnected");
+    void notifyNeighbors(Client* client, const std::string& line);
+
+    // Server linking (ServerLink.cpp)
+    bool acceptLink(Client* link, const std::string& serverName, const std::string& description);
+    void introduceUser(Client* client);
+    void nicknameChanged(Client* client, const std::string& oldPrefix);
+    void propagate(const std::string& line, Client* exceptLink);
+    void propagate(const char* line, size_t length, Client* exceptLink);
+    void relayToChannel(Channel* channel, const std::string& line, Client* exceptLink);
+    void relayToChannel(Channel* channel, const char* line, size_t length, Client* exceptLink);
+    std::string getServerInfo(const std::string& serverName) const;
+    int getServerHopcount(const std::string& serverName) const;
+
+    // Appends the parameters of a command line, from start on, to args (in
+    // args' arena); a ':' parameter runs to the end
+    static void splitArgs(const std::string& commandLine, size_t start, CommandArgs& args);
+    static void splitArgs(const char* line, size_t length, size_t start, CommandArgs& args);
+
+    // Entry points that bypass the event loop, for bench/micro_bench.cpp.
+    // fd may be any number no open descriptor uses; nothing is sent on it.
+    Client* adoptClient(int fd, const std::string& hostname);
+    void receive(int fd, const std::string& bytes);
+    void dropClient(int fd);
 
 private:
     Server();
     Server(const Server& other);
     Server& operator=(const Server& other);
 
+    // A server somewhere behind one of our links; "link" is the local
+    // connection its traffic arrives on
+    struct LinkedServer {
+        std::string parent;
+        std::string description;
+        int hopcount;
+        Client* link;
+    };
+
     std::string _serverName;
-    int _port;
-    std::string _password;
+    ServerConfig _config;
     int _serverFd;
     int _epollFd;
     std::string _startTimeString;
     std::vector<struct epoll_event> _events;
     std::map<int, Client*> _clients;
     std::map<std::string, ICommand*> _commands;
-    std::map<std::string, Channel*> _channels;
+    ChannelRegistry _channels;
+    std::vector<int> _dirtyClients;
+    ChannelStore _channelStore;
+    NickRegistry _nickRegistry;
+    TrafficCapture _capture;
+    FanoutPool _fanoutPool;
+    std::map<std::string, LinkedServer> _servers;
+    std::map<int, Client*> _remoteClients;
+    std::vector<Client*> _links;
+    int _nextRemoteId;
+    int _uplinkFd;
+    time_t _nextLinkAttempt;
+    // Bumped once per fan-out pass; clients record the last one that reached them
+    unsigned long _fanoutEpoch;
+    // Line break offsets of the receive buffer being framed, reused across reads
+    std::vector<uint32_t> _lineMarks;
+    Arena _arena;
+    StringPool _hostnames;
+    // Cross-thread delivery: an eventfd in the epoll set, written at most
+    // once per loop tick, and a lock-free stack of clients whose inbox has
+    // been announced since, linked through the clients themselves
+    int _wakeFd;
+    int _wakePending;
+    Client* _readyInboxes;
+    // Memory accounting (ServerMemory.cpp): client buffer bytes, kept
+    // current by the clients, plus the shared lines they refer to (counted
+    // once, by SharedMessage), plus everything else as of the last audit
+    size_t _bufferBytes;
+    size_t _auditedBytes;
+    time_t _lastAudit;
+    bool _refusingConnections;
+    unsigned long _refusedConnections;
+    // Connection admission (ServerAdmission.cpp). Turned-away connections
+    // are counted per verdict and summed up in the log now and then. A
+    // SIGHUP reload parses the rule file on a thread of its own, which
+    // leaves the result in _reloadedRules/_reloadError, sets _reloadDone
+    // and wakes the loop through _wakeFd.
+    Admission _admission;
+    unsigned long _rejected[Admission::VERDICT_COUNT];
+    time_t _lastAdmissionReport;
+    pthread_t _reloadThread;
+    bool _reloading;
+    int _reloadDone;
+    AdmissionRules* _reloadedRules;
+    std::string _reloadError;
+    // Graceful shutdown (ServerShutdown.cpp): set once a shutdown is
+    // asked for, until every send queue is flushed or the deadline (in
+    // CLOCK_MONOTONIC milliseconds) passes. Connections that hang up in
+    // the meantime are closed at once and kept here until then.
+    bool _draining;
+    long long _drainDeadline;
+    std::vector<Client*> _drainClosed;
+    size_t _drainedClients;
+    // SO_BUSY_POLL could be set (ServerBusyPoll.cpp)
+    bool _socketBusyPoll;
+    // Credential checks (ServerAuth.cpp): the --accounts file (NULL if
+    // none), the pool that verifies passwords, the last ticket handed
+    // out, and a hash of the default cost that unknown names are checked
+    // against
+    AccountStore* _accounts;
+    AuthPool _authPool;
+    unsigned long _authTickets;
+    std::string _decoyHash;
+    // Channel creation: the current rate window and the channels created
+    // in it, and where the reclaimer's sweep for empty channels is
+    time_t _createWindow;
+    size_t _channelsCreated;
+    size_t _reclaimCursor;
+    time_t _nextReclaim;
 
     void _initCommands();
     void _cleanupCommands();
     void _initServer();
+    void _initEpoll();
+    void _openChannelStore();
+    void _openNickRegistry();
+    void _openCapture();
     const std::string _generateTimeString(time_t startTime) const;
     void _handleNewConnection();
     void _handleClientRecv(int fd);
+    void _processRecvBuffer(int fd);
+    void _drainInboxes();
+    void _drainReadyInboxes();
+    void _wakeLoop();
     void _handleClientSend(int fd);
+    void _flushDirtyClients();
+    void _pumpReplyStreams(Client* client);
     void _handleClientDisconnect(int fd);
-    void _processCommand(int fd, const std::string& commandLine);
-    std::vector<std::string> _splitArgs(const std::string& commandLine);
+    void _processCommand(int fd, const char* commandLine, size_t length);
+    void _reclaimEmptyChannels();
+
+    // Memory budget (ServerMemory.cpp)
+    size_t _memoryInUse() const;
+    void _auditMemory(std::string& report);
+    void _enforceMemoryBudget();
+    size_t _shedLargestQueues(size_t target);
+
+    // Connection admission (ServerAdmission.cpp)
+    void _initAdmission();
+    bool _screenConnection(int fd, const struct sockaddr* addr, time_t now, PrefixTree::Address& address);
+    void _countConnection(Client* client);
+    void _releaseConnection(Client* client);
+    void _startRulesReload();
+    static void* _reloadMain(void* arg);
+    void _maintainAdmission();
+
+    // Graceful shutdown (ServerShutdown.cpp)
+    void _beginDrain();
+    bool _drainFinished() const;
+    int _drainWait() const;
+    void _discardInput(int fd);
+    void _closeDrainingClient(int fd);
+
+    // Credential checks (ServerAuth.cpp)
+    void _initAuth();
+    void _finishAuth();
+    void _abandonAuth();
+
+    // Low-latency busy-poll mode (ServerBusyPoll.cpp)
+    void _initBusyPoll();
+    void _enableBusyPoll(int fd);
+    int _waitEvents(int timeoutMs);
+
+    // MSG_ZEROCOPY for large flushes (ServerZerocopy.cpp)
+    void _initZerocopy();
+    void _enableZerocopy(Client* client);
+    int _zerocopySpan(const Client* client, const struct iovec* iov, int count) const;
+    static ssize_t _sendZerocopy(int fd, struct iovec* iov, int count);
+    bool _reapZerocopy(Client* client);
+
+    // Hot upgrade: hand every socket and all state to a freshly exec'd binary (ServerUpgrade.cpp)
+    bool _performUpgrade();
+    int _takeUpgradeChannel();
+    void _resumeFromUpgrade(int channelFd);
+    std::string _serializeState(std::vector<int>& fds) const;
+    void _restoreState(const std::string& state, const std::vector<int>& fds);
+
+    // Server linking (ServerLink.cpp)
+    void _maintainUplink();
+    void _finishConnect(int fd);
+    void _closeLink(Client* link, const std::string& reason);
+    void _processLinkLine(Client* link, const std::string& line);
+    void _processLinkCommand(Client* link, const std::string& prefix, const std::vector<std::string>& args, const std::string& line);
+    Client* _remoteSource(Client* link, const std::string& prefix);
+    void _introduceRemoteUser(Client* link, const std::string& serverName, const std::vector<std::string>& args);
+    void _sendBurst(Client* link);
+    void _splitServer(const std::string& serverName, const std::string& reason, Client* exceptLink);
+    void _removeRemoteUser(Client* user, const std::string& reason);
+    void _killUser(Client* user, const std::string& reason, Client* exceptLink);
+    void _applyRemoteModes(Channel* channel, const std::vector<std::string>& args, size_t first, const std::string& setter);
 };
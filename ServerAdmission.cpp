@@ -0,0 +1,140 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "utils.hpp"
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Seconds between two summaries of turned-away connections
+#define ADMISSION_REPORT_INTERVAL 10
+
+static std::string describeRules(const std::string& path, const AdmissionRules* rules) {
+    std::ostringstream oss;
+    oss << path << " (" << rules->rules().size() << " rule(s))";
+    return oss.str();
+}
+
+// At startup, before any connection (a handed-over one included) is counted
+void Server::_initAdmission() {
+    _admission.setLimits(_config.maxPerIp, _config.maxPerSubnet);
+    if (_config.admissionRules.empty()) return;
+
+    std::string error;
+    AdmissionRules* rules = AdmissionRules::load(_config.admissionRules, error);
+    if (!rules) {
+        throw std::runtime_error("Error: admission rules: " + error);
+    }
+    _admission.replaceRules(rules);
+    ngircd_log("info", "Admission rules loaded from " + describeRules(_config.admissionRules, rules));
+}
+
+// Right after accept(). False if the connection was turned away, in which
+// case it has been sent its ERROR line and closed; address is filled in
+// either way.
+bool Server::_screenConnection(int fd, const struct sockaddr* addr, time_t now, PrefixTree::Address& address) {
+    if (!PrefixTree::fromSockaddr(addr, address)) {
+        std::memset(&address, 0, sizeof(address));
+    }
+    const char* farewell = NULL;
+    Admission::Verdict verdict = _admission.check(address, now, farewell);
+    if (verdict == Admission::ADMIT) {
+        return true;
+    }
+    // Best effort, as for the memory refusal: the socket is new and empty
+    ssize_t sent = send(fd, farewell, std::strlen(farewell), MSG_NOSIGNAL | MSG_DONTWAIT);
+    (void)sent;
+    close(fd);
+    ++_rejected[verdict];
+    return false;
+}
+
+// For connections that did not come through accept() in this process
+void Server::_countConnection(Client* client) {
+    PrefixTree::Address address;
+    int length;
+    if (client->isAdmitted() || !PrefixTree::parse(client->getHostname(), address, length)) {
+        return;
+    }
+    _admission.admit(address);
+    client->setAdmitted(true);
+}
+
+void Server::_releaseConnection(Client* client) {
+    PrefixTree::Address address;
+    int length;
+    if (!client->isAdmitted() || !PrefixTree::parse(client->getHostname(), address, length)) {
+        return;
+    }
+    _admission.release(address);
+    client->setAdmitted(false);
+}
+
+// On SIGHUP. The file is read and parsed off the event loop; the loop
+// keeps admitting with the current rules until the new set is adopted.
+void Server::_startRulesReload() {
+    if (_config.admissionRules.empty()) {
+        ngircd_log("warning", "Reload signal received, but no --admission-rules file is configured");
+        return;
+    }
+    if (_reloading) {
+        ngircd_log("warning", "Reload signal received while the admission rules are still being read; ignored");
+        return;
+    }
+    ngircd_log("info", "Reload signal received, reading admission rules from " + _config.admissionRules);
+    _reloadDone = 0;
+    _reloadedRules = NULL;
+    _reloadError.clear();
+    if (pthread_create(&_reloadThread, NULL, &Server::_reloadMain, this) != 0) {
+        ngircd_log("error", "Could not start a thread to reload the admission rules");
+        return;
+    }
+    _reloading = true;
+}
+
+// Touches nothing but the reload fields and the wakeup eventfd
+void* Server::_reloadMain(void* arg) {
+    Server* server = static_cast<Server*>(arg);
+    server->_reloadedRules = AdmissionRules::load(server->_config.admissionRules, server->_reloadError);
+    __atomic_store_n(&server->_reloadDone, 1, __ATOMIC_RELEASE);
+    server->_wakeLoop();
+    return NULL;
+}
+
+// Once per loop tick: adopts a finished reload and, every so often, logs
+// how many connections were turned away and why
+void Server::_maintainAdmission() {
+    if (_reloading && __atomic_load_n(&_reloadDone, __ATOMIC_ACQUIRE)) {
+        pthread_join(_reloadThread, NULL);
+        _reloading = false;
+        if (_reloadedRules) {
+            ngircd_log("info", "Admission rules reloaded from " + describeRules(_config.admissionRules, _reloadedRules));
+            _admission.replaceRules(_reloadedRules);
+            _reloadedRules = NULL;
+        } else {
+            ngircd_log("error", "Admission rules not reloaded, keeping the previous ones: " + _reloadError);
+        }
+    }
+
+    time_t now = time(NULL);
+    if (now - _lastAdmissionReport < ADMISSION_REPORT_INTERVAL) return;
+    unsigned long total = 0;
+    for (int v = 0; v < Admission::VERDICT_COUNT; ++v) {
+        total += _rejected[v];
+    }
+    if (total == 0) return;
+
+    std::ostringstream oss;
+    oss << "Turned away " << total << " connection(s):";
+    const char* separator = " ";
+    for (int v = 0; v < Admission::VERDICT_COUNT; ++v) {
+        if (_rejected[v] == 0) continue;
+        oss << separator << _rejected[v] << " " << Admission::describe(static_cast<Admission::Verdict>(v));
+        separator = ", ";
+        _rejected[v] = 0;
+    }
+    ngircd_log("warning", oss.str());
+    _lastAdmissionReport = now;
+}
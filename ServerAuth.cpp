@@ -0,0 +1,144 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "PasswordHash.hpp"
+#include "utils.hpp"
+#include <sstream>
+#include <stdexcept>
+
+// Credentials are salted slow hashes (PasswordHash), so a check takes tens
+// of milliseconds of CPU; it runs on the AuthPool threads. The client is
+// held meanwhile: the command that started the check has returned, but
+// the lines after it stay in the receive buffer until _finishAuth() has
+// replied and resumes parsing. At startup, before any client exists.
+void Server::_initAuth() {
+    if (_config.accounts.empty()) return;
+
+    std::string error;
+    _accounts = AccountStore::load(_config.accounts, error);
+    if (!_accounts) {
+        throw std::runtime_error("Error: accounts: " + error);
+    }
+    _decoyHash = PasswordHash::decoy();
+    _authPool.start(this, _config.authThreads, _config.authPending);
+
+    std::ostringstream oss;
+    oss << "Accounts loaded from " << _config.accounts << " (" << _accounts->count(AccountStore::ACCOUNT)
+        << " account(s), " << _accounts->count(AccountStore::OPER) << " oper(s))";
+    ngircd_log("info", oss.str());
+}
+
+bool Server::hasCredentials(AccountStore::Kind kind) const {
+    return _accounts && _accounts->count(kind) > 0;
+}
+
+bool Server::startAuth(Client* client, AccountStore::Kind kind, const std::string& name, const std::string& password) {
+    if (++_authTickets == 0) ++_authTickets;
+    unsigned long ticket = _authTickets;
+
+    AuthJob* job = new AuthJob();
+    job->fd = client->getFd();
+    job->ticket = ticket;
+    job->kind = kind;
+    job->name = name;
+    const std::string* hash = _accounts ? _accounts->find(kind, job->name) : NULL;
+    job->known = hash != NULL;
+    job->hash = hash ? *hash : _decoyHash;
+    job->password = password;
+    job->granted = false;
+    if (!_authPool.submit(job)) {
+        delete job;
+        std::ostringstream oss;
+        oss << "Credential check for fd=" << client->getFd() << " refused: too many in flight";
+        ngircd_log("debug", oss.str());
+        return false;
+    }
+    client->setAuthTicket(ticket);
+    return true;
+}
+
+// Any thread
+void Server::authCompleted() {
+    _wakeLoop();
+}
+
+// On every wake-up of the loop
+void Server::_finishAuth() {
+    std::vector<AuthJob*> done;
+    _authPool.collect(done);
+    for (size_t i = 0; i < done.size(); ++i) {
+        AuthJob* job = done[i];
+        std::map<int, Client*>::iterator it = _clients.find(job->fd);
+        if (_draining || it == _clients.end() || it->second->getAuthTicket() != job->ticket) {
+            delete job;
+            continue;
+        }
+        Client* client = it->second;
+        client->setAuthTicket(0);
+        std::string what = (job->kind == AccountStore::OPER) ? "OPER" : "SASL login";
+        if (!job->granted) {
+            if (job->kind == AccountStore::OPER) {
+                client->reply(464, "");
+            } else {
+                client->setSasl(false, "");
+                client->reply(904, "");
+            }
+            ngircd_log("warning", "Failed " + what + " as " + job->name + " from " + client->getPrefix());
+        } else {
+            if (job->kind == AccountStore::OPER) {
+                client->addMode('o');
+                client->reply(381, "");
+                client->queueMessage(":" + client->getNickname() + " MODE " + client->getNickname() + " :+o\r\n");
+            } else {
+                client->setSasl(false, "");
+                client->setAccount(job->name);
+                client->reply(900, client->getPrefix() + " " + job->name);
+                client->reply(903, "");
+            }
+            ngircd_log("info", what + " as " + job->name + " from " + client->getPrefix());
+        }
+        delete job;
+        _processRecvBuffer(it->first);
+    }
+}
+
+// After a hot upgrade, in the new process: the checks the old process
+// still had out are answered as failed, and the clients' held lines parsed
+void Server::_abandonAuth() {
+    std::vector<int> held;
+    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        Client* client = it->second;
+        if (!client->isAuthPending()) continue;
+        client->setAuthTicket(0);
+        if (client->isSaslStarted()) {
+            client->setSasl(false, "");
+            client->reply(904, "");
+        } else {
+            client->reply(464, "");
+        }
+        held.push_back(it->first);
+    }
+    for (size_t i = 0; i < held.size(); ++i) {
+        if (_clients.count(held[i])) {
+            _processRecvBuffer(held[i]);
+        }
+    }
+}
+
+NickRegistry& Server::getNickRegistry() {
+    return _nickRegistry;
+}
+
+// Nicknames used on linked servers are not checked: each server enforces
+// its own registry for its own clients
+bool Server::nickAllowed(const Client* client, const std::string& nick) const {
+    const char* owner = _nickRegistry.owner(nick);
+    return !owner || client->getAccount() == owner;
+}
+
+void Server::nickSeen(const Client* client, const std::string& nick) {
+    if (client->getAccount().empty()) return;
+    const char* owner = _nickRegistry.owner(nick);
+    if (owner && client->getAccount() == owner) {
+        _nickRegistry.seen(nick, time(NULL));
+    }
+}
@@ -0,0 +1,110 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "utils.hpp"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+// Linux 5.11; older headers lack it
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+// Stack touched up front, so that deep call chains do not fault later
+#define BUSY_POLL_STACK_PREFAULT (256 * 1024)
+
+static long long monotonicUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void prefaultStack() {
+    volatile char stack[BUSY_POLL_STACK_PREFAULT];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+// Low-latency mode, for deployments that would rather burn a core than
+// wait for the scheduler: the reactor runs on --reactor-cpu, its memory is
+// faulted in and locked, sockets busy-poll the device queue, and the loop
+// spins on epoll_wait() for --busy-poll microseconds after every event
+// before it blocks. At startup, on the reactor thread, after the fan-out
+// workers are started (they keep their own affinity).
+void Server::_initBusyPoll() {
+    if (_config.reactorCpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(_config.reactorCpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+            throw std::runtime_error(std::string("Error: cannot pin the reactor to --reactor-cpu: ") + std::strerror(errno));
+        }
+        std::ostringstream oss;
+        oss << "Reactor pinned to CPU " << _config.reactorCpu;
+        ngircd_log("info", oss.str());
+    }
+    if (_config.busyPoll == 0) return;
+
+    // Freed heap stays mapped, and so locked, rather than going back to the
+    // kernel to be faulted in again
+    mallopt(M_MMAP_MAX, 0);
+    mallopt(M_TRIM_THRESHOLD, -1);
+    prefaultStack();
+    // Under a finite RLIMIT_MEMLOCK, MCL_FUTURE would turn growth past the
+    // limit into failed allocations
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY && geteuid() != 0) {
+        std::ostringstream oss;
+        oss << "RLIMIT_MEMLOCK is " << limit.rlim_cur << " bytes; memory is not locked";
+        ngircd_log("warning", oss.str());
+    } else if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0) {
+        ngircd_log("warning", std::string("mlockall() failed, memory is not locked: ") + std::strerror(errno));
+    }
+
+    // Raising SO_BUSY_POLL past net.core.busy_read takes CAP_NET_ADMIN;
+    // without it the loop still spins, only the sockets do not
+    int probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        throw std::runtime_error("Error: socket() failed");
+    }
+    int usecs = static_cast<int>(_config.busyPoll);
+    _socketBusyPoll = setsockopt(probe, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) == 0;
+    if (!_socketBusyPoll) {
+        ngircd_log("warning", std::string("SO_BUSY_POLL not available, sockets will not busy-poll: ") + std::strerror(errno));
+    }
+    close(probe);
+
+    std::ostringstream oss;
+    oss << "Busy polling: the event loop spins for " << _config.busyPoll << " us after each event";
+    ngircd_log("info", oss.str());
+}
+
+void Server::_enableBusyPoll(int fd) {
+    if (!_socketBusyPoll) return;
+    int usecs = static_cast<int>(_config.busyPoll);
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+}
+
+// epoll_wait(), spinning first in busy-poll mode. The yield costs next to
+// nothing on a core of its own and lets clients run on a shared one.
+int Server::_waitEvents(int timeoutMs) {
+    if (_config.busyPoll > 0 && timeoutMs != 0) {
+        long long until = monotonicUs() + static_cast<long long>(_config.busyPoll);
+        do {
+            int n = epoll_wait(_epollFd, _events.data(), _events.size(), 0);
+            if (n != 0) return n;
+            sched_yield();
+        } while (monotonicUs() < until);
+    }
+    return epoll_wait(_epollFd, _events.data(), _events.size(), timeoutMs);
+}
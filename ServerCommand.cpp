@@ -0,0 +1,27 @@
+#include "ServerCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+
+ServerCommand::ServerCommand() {}
+
+ServerCommand::~ServerCommand() {}
+
+bool ServerCommand::requiresRegistration() const {
+    return false;
+}
+
+// SERVER <servername> <hopcount> :<description>
+void ServerCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    if (client->hasRegistered() || !client->getNickname().empty() || !client->getUsername().empty()) {
+        client->reply(462, " :Connection already registered");
+        return;
+    }
+
+    if (args.size() < 3) {
+        client->reply(461, toString(args[0]));
+        return;
+    }
+
+    std::string description = (args.size() > 3) ? toString(args[3]) : "";
+    server.acceptLink(client, toString(args[1]), description);
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+// Handles the SERVER command: turns an unregistered connection into a server link
+class ServerCommand : public ICommand {
+public:
+    ServerCommand();
+    virtual ~ServerCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    ServerCommand(const ServerCommand& other);
+    ServerCommand& operator=(const ServerCommand& other);
+};
@@ -0,0 +1,108 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <vector>
+
+#define DEFAULT_HISTORY_LINES 100
+#define DEFAULT_HISTORY_BYTES 32768
+#define DEFAULT_CHANNEL_DB ""
+#define DEFAULT_SERVER_NAME "ft_irc"
+#define DEFAULT_FANOUT_THREADS 0
+#define DEFAULT_FANOUT_THRESHOLD 4096
+#define MAX_FANOUT_THREADS 64
+#define DEFAULT_MEMORY_BUDGET 0
+// Shares of the memory budget, in percent, from which idle buffers are
+// shrunk, new connections are refused and the largest queues are dropped
+#define MEMORY_SHRINK_PERCENT 80
+#define MEMORY_REFUSE_PERCENT 90
+#define MEMORY_SHED_PERCENT 100
+#define DEFAULT_MAX_PER_IP 0
+#define DEFAULT_MAX_PER_SUBNET 0
+#define DEFAULT_ZEROCOPY_THRESHOLD 0
+#define DEFAULT_DRAIN_TIMEOUT 5
+#define MAX_DRAIN_TIMEOUT 3600
+#define DEFAULT_BUSY_POLL 0
+#define MAX_BUSY_POLL 1000000
+#define DEFAULT_AUTH_THREADS 2
+#define MAX_AUTH_THREADS 64
+#define DEFAULT_AUTH_PENDING 64
+#define MAX_AUTH_PENDING 65536
+#define DEFAULT_CHANNEL_CREATE_RATE 20
+#define DEFAULT_CHANNEL_CREATE_RATE_GLOBAL 1000
+#define MAX_CHANNEL_CREATE_RATE 1000000
+
+// Runtime settings: <port> <password> from the command line, plus optional
+// --name=value switches parsed by validateInput()
+struct ServerConfig {
+    ServerConfig();
+
+    int port;
+    std::string password;
+
+    // Name of this server on the network, and the "host:port" of the server
+    // to link to ("" for a standalone or leaf-accepting server)
+    std::string serverName;
+    std::string link;
+    // Shared by linked servers, never the connection password; "" refuses
+    // every SERVER handshake
+    std::string linkPassword;
+
+    // Per-channel message history limits (0 disables history)
+    size_t historyLines;
+    size_t historyBytes;
+
+    // Memory-mapped channel metadata file ("" disables persistence)
+    std::string channelDb;
+
+    // File that client traffic is appended to for bench/replay ("" disables)
+    std::string captureFile;
+
+    // Worker threads for broadcasts to channels of at least fanoutThreshold
+    // members (0 threads: every broadcast runs on the event loop)
+    size_t fanoutThreads;
+    size_t fanoutThreshold;
+
+    // Bytes that buffers, channels and queued replies may use in total
+    // before the server starts shedding load (0: no limit)
+    size_t memoryBudget;
+
+    // Connection admission: a deny/limit rule file, re-read on SIGHUP
+    // ("" for none), and the most connections one address or one IPv4 /24
+    // (IPv6 /64) may hold at once (0: no limit)
+    std::string admissionRules;
+    size_t maxPerIp;
+    size_t maxPerSubnet;
+
+    // Flushes of at least this many queued bytes go out with MSG_ZEROCOPY
+    // (0: never); see bench/zerocopy_bench for where it starts to pay
+    size_t zerocopyThreshold;
+
+    // Seconds a shutdown goes on flushing send queues before it closes
+    // the connections that still have bytes left (0: one last try only)
+    size_t drainTimeout;
+
+    // Low-latency mode: microseconds the event loop spins on epoll_wait()
+    // after each event before it blocks, also used as the sockets'
+    // SO_BUSY_POLL (0: off), and the CPU the reactor thread is pinned to
+    // (-1: none)
+    size_t busyPoll;
+    int reactorCpu;
+
+    // Account and oper credentials ("" for none), the threads that check
+    // passwords against them, and the most checks queued or running at
+    // once before further logins are told to try again
+    std::string accounts;
+    size_t authThreads;
+    size_t authPending;
+    // Registered nicknames ("" for none): a snapshot and <path>.log
+    std::string nickDb;
+
+    // Channels one client, and all clients together, may create per
+    // minute (0: no limit)
+    size_t channelCreateRate;
+    size_t channelCreateRateGlobal;
+
+    // How this process was started, so that a hot upgrade can exec it again
+    std::string executable;
+    std::vector<std::string> arguments;
+};
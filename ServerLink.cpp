@@ -0,0 +1,757 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "OutboundMessage.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <set>
+#include <sstream>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Server-to-server linking.
+//
+// Peers speak a small TS-style text protocol over an ordinary client port:
+//
+//   PASS <link password>                 handshake, both directions
+//   SERVER <name> 1 :<description>
+//   :<parent> SERVER <name> <hop> :<description>
+//   :<server> NICK <nick> <hop> <ts> <user> <host> :<realname>
+//   :<server> TBURST <channel> <ts> <setter> :<topic>
+//   :<server> SJOIN <channel> <ts> +<modes> [params] :[@]<nick> ...
+//   :<server> MODE <channel> +bbb <mask> ...   (after SJOIN; also +e, +I)
+//   :<server> SQUIT <name> :<reason>
+//   :<server> KILL <nick> :<reason>
+//
+// and otherwise forwards the client lines it already produces (JOIN, PART,
+// KICK, TOPIC, MODE, PRIVMSG, INVITE, NICK, QUIT) with the user's prefix.
+// Every user carries the time its nick was taken; when two servers disagree
+// about a nick or a channel, the older timestamp wins.
+
+#define LINK_RETRY_SECONDS 10
+#define LINK_DESCRIPTION "ft_irc server"
+#define SJOIN_MEMBER_BYTES 400
+
+namespace {
+
+std::string numberString(long value) {
+    std::ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+std::string nickOf(const std::string& prefix) {
+    return prefix.substr(0, prefix.find('!'));
+}
+
+// Compares every byte whatever the first difference, so that the time a
+// refusal takes says nothing about the link password
+bool sameSecret(const std::string& given, const std::string& expected) {
+    if (given.size() != expected.size()) return false;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < given.size(); ++i) {
+        diff |= static_cast<unsigned char>(given[i] ^ expected[i]);
+    }
+    return diff == 0;
+}
+
+std::string introLine(const std::string& serverName, const Client* user, int hopcount) {
+    return ":" + serverName + " NICK " + user->getNickname() + " " + numberString(hopcount) + " "
+        + numberString(static_cast<long>(user->getNickTs())) + " " + user->getUsername() + " "
+        + user->getHostname() + " :" + user->getRealname() + "\r\n";
+}
+
+}
+
+bool Server::acceptLink(Client* link, const std::string& serverName, const std::string& description) {
+    if (_config.linkPassword.empty()) {
+        ngircd_log("warning", "Link from " + link->getHostname() + " as " + serverName + " refused: no --link-password");
+        _closeLink(link, "Links are not enabled");
+        return false;
+    }
+    if (!sameSecret(link->getPassword(), _config.linkPassword)) {
+        ngircd_log("warning", "Link from " + link->getHostname() + " as " + serverName + " gave a bad password");
+        _closeLink(link, "Bad link password");
+        return false;
+    }
+    if (serverName == _serverName || _servers.count(serverName)) {
+        _closeLink(link, "Server " + serverName + " already exists");
+        return false;
+    }
+
+    if (!link->isLinkInitiated()) {
+        link->queueMessage("PASS " + _config.linkPassword + "\r\n");
+        link->queueMessage("SERVER " + _serverName + " 1 :" + LINK_DESCRIPTION + "\r\n");
+    }
+    link->setServerLink(serverName);
+
+    LinkedServer& entry = _servers[serverName];
+    entry.parent = _serverName;
+    entry.description = description;
+    entry.hopcount = 1;
+    entry.link = link;
+    _links.push_back(link);
+
+    propagate(":" + _serverName + " SERVER " + serverName + " 2 :" + description + "\r\n", link);
+    _sendBurst(link);
+
+    std::ostringstream oss;
+    oss << "Linked with server " << serverName << " (fd=" << link->getFd() << ")";
+    ngircd_log("info", oss.str());
+    return true;
+}
+
+void Server::introduceUser(Client* client) {
+    client->setNickTs(time(NULL));
+    client->setHomeServer(_serverName);
+    propagate(introLine(_serverName, client, 1), NULL);
+}
+
+void Server::nicknameChanged(Client* client, const std::string& oldPrefix) {
+    std::string nickMsg = ":" + oldPrefix + " NICK " + client->getNickname() + "\r\n";
+    client->queueMessage(nickMsg);
+    notifyNeighbors(client, nickMsg);
+
+    client->setNickTs(time(NULL));
+    propagate(":" + oldPrefix + " NICK " + client->getNickname() + " :"
+        + numberString(static_cast<long>(client->getNickTs())) + "\r\n", NULL);
+}
+
+void Server::propagate(const std::string& line, Client* exceptLink) {
+    propagate(line.data(), line.size(), exceptLink);
+}
+
+void Server::propagate(const char* line, size_t length, Client* exceptLink) {
+    for (size_t i = 0; i < _links.size(); ++i) {
+        if (_links[i] != exceptLink) {
+            _links[i]->queueMessage(line, length);
+        }
+    }
+}
+
+// Send a channel message once to every link that leads to a member. The
+// epoch mark lets one pass over the members skip links already served.
+void Server::relayToChannel(Channel* channel, const std::string& line, Client* exceptLink) {
+    relayToChannel(channel, line.data(), line.size(), exceptLink);
+}
+
+void Server::relayToChannel(Channel* channel, const char* line, size_t length, Client* exceptLink) {
+    if (_links.empty()) return;
+
+    ++_fanoutEpoch;
+    const std::map<int, Client*>& members = channel->getMembers();
+    for (std::map<int, Client*>::const_iterator it = members.begin(); it != members.end(); ++it) {
+        Client* link = it->second->getUplink();
+        if (!link || link == exceptLink || link->getFanoutMark() == _fanoutEpoch) continue;
+        link->setFanoutMark(_fanoutEpoch);
+        link->queueMessage(line, length);
+    }
+}
+
+std::string Server::getServerInfo(const std::string& serverName) const {
+    if (serverName == _serverName) {
+        return LINK_DESCRIPTION;
+    }
+    std::map<std::string, LinkedServer>::const_iterator it = _servers.find(serverName);
+    return (it != _servers.end()) ? it->second.description : "";
+}
+
+int Server::getServerHopcount(const std::string& serverName) const {
+    std::map<std::string, LinkedServer>::const_iterator it = _servers.find(serverName);
+    return (it != _servers.end()) ? it->second.hopcount : 0;
+}
+
+// Keep the configured outgoing link up, retrying every LINK_RETRY_SECONDS.
+// The address is expected to be numeric or in /etc/hosts; a slow resolver
+// would stall the loop here.
+void Server::_maintainUplink() {
+    if (_config.link.empty() || _uplinkFd >= 0) return;
+    time_t now = time(NULL);
+    if (now < _nextLinkAttempt) return;
+    _nextLinkAttempt = now + LINK_RETRY_SECONDS;
+
+    size_t colon = _config.link.rfind(':');
+    std::string host = _config.link.substr(0, colon);
+    std::string port = _config.link.substr(colon + 1);
+
+    struct addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = NULL;
+    int rc = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
+    if (rc != 0) {
+        ngircd_log("warning", "Cannot resolve link " + _config.link + ": " + gai_strerror(rc));
+        return;
+    }
+
+    int fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ngircd_log("error", std::string("Link socket() failed: ") + std::strerror(errno));
+        freeaddrinfo(res);
+        return;
+    }
+    if (connect(fd, res->ai_addr, res->ai_addrlen) < 0 && errno != EINPROGRESS) {
+        ngircd_log("warning", "Link to " + _config.link + " failed: " + std::strerror(errno));
+        close(fd);
+        freeaddrinfo(res);
+        return;
+    }
+    freeaddrinfo(res);
+
+    Client* link = new Client(fd, host, this, EPOLLIN | EPOLLOUT);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT;
+    ev.data.fd = fd;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ngircd_log("error", "epoll_ctl add failed for link to " + _config.link);
+        close(fd);
+        delete link;
+        return;
+    }
+    link->setLinkInitiated(true);
+    link->setConnecting(true);
+    _enableZerocopy(link);
+    _enableBusyPoll(fd);
+    _clients[fd] = link;
+    _uplinkFd = fd;
+
+    link->queueMessage("PASS " + _config.linkPassword + "\r\n");
+    link->queueMessage("SERVER " + _serverName + " 1 :" + LINK_DESCRIPTION + "\r\n");
+
+    std::ostringstream oss;
+    oss << "Connecting to link " << _config.link << " (fd=" << fd << ")";
+    ngircd_log("info", oss.str());
+}
+
+void Server::_finishConnect(int fd) {
+    if (!_clients.count(fd)) return;
+    Client* link = _clients[fd];
+
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+        ngircd_log("warning", "Link to " + _config.link + " failed: " + std::strerror(err ? err : errno));
+        _handleClientDisconnect(fd);
+        return;
+    }
+    link->setConnecting(false);
+    ngircd_log("info", "Connected to link " + _config.link);
+    _handleClientSend(fd);
+}
+
+void Server::_closeLink(Client* link, const std::string& reason) {
+    int fd = link->getFd();
+    link->queueMessage("ERROR :" + reason + "\r\n");
+    _handleClientSend(fd);
+    if (_clients.count(fd)) {
+        _handleClientDisconnect(fd);
+    }
+}
+
+// Everything we know, in an order the peer can apply line by line: servers
+// nearest first, then users, then channels (topic before membership so the
+// channel timestamp rule sees both sides' original values).
+void Server::_sendBurst(Client* link) {
+    std::vector<std::pair<int, std::string> > order;
+    for (std::map<std::string, LinkedServer>::const_iterator it = _servers.begin(); it != _servers.end(); ++it) {
+        if (it->second.link != link) {
+            order.push_back(std::make_pair(it->second.hopcount, it->first));
+        }
+    }
+    std::sort(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i) {
+        const LinkedServer& entry = _servers[order[i].second];
+        link->queueMessage(":" + entry.parent + " SERVER " + order[i].second + " "
+            + numberString(entry.hopcount + 1) + " :" + entry.description + "\r\n");
+    }
+
+    for (std::map<int, Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if (it->second->hasRegistered() && !it->second->isServerLink()) {
+            link->queueMessage(introLine(_serverName, it->second, 1));
+        }
+    }
+    for (std::map<int, Client*>::const_iterator it = _remoteClients.begin(); it != _remoteClients.end(); ++it) {
+        Client* user = it->second;
+        if (user->getUplink() != link) {
+            link->queueMessage(introLine(user->getHomeServer(), user, _servers[user->getHomeServer()].hopcount + 1));
+        }
+    }
+
+    for (size_t c = 0; c < _channels.capacity(); ++c) {
+        Channel* channel = _channels.at(c);
+        if (!channel) continue;
+        std::vector<std::string> members;
+        const std::map<int, Client*>& memberMap = channel->getMembers();
+        for (std::map<int, Client*>::const_iterator mit = memberMap.begin(); mit != memberMap.end(); ++mit) {
+            if (mit->second->getUplink() == link) continue;
+            members.push_back((channel->isOperator(mit->first) ? "@" : "") + mit->second->getNickname());
+        }
+        if (members.empty()) continue;
+
+        std::string ts = numberString(static_cast<long>(channel->getCreationTime()));
+        if (!channel->getTopic().empty()) {
+            link->queueMessage(":" + _serverName + " TBURST " + channel->getName() + " " + ts + " "
+                + channel->getTopicSetter() + " :" + channel->getTopic() + "\r\n");
+        }
+
+        std::string head = ":" + _serverName + " SJOIN " + channel->getName() + " " + ts + " " + channel->getModeString();
+        if (channel->hasKey()) head += " " + channel->getKey();
+        if (channel->hasUserLimit()) head += " " + numberString(static_cast<long>(channel->getUserLimit()));
+        head += " :";
+
+        std::string list;
+        for (size_t i = 0; i < members.size(); ++i) {
+            if (!list.empty() && list.size() + members[i].size() > SJOIN_MEMBER_BYTES) {
+                link->queueMessage(head + list + "\r\n");
+                list.clear();
+            }
+            if (!list.empty()) list += " ";
+            list += members[i];
+        }
+        link->queueMessage(head + list + "\r\n");
+
+        static const char listModes[] = "beI";
+        for (size_t m = 0; m < sizeof(listModes) - 1; ++m) {
+            const std::vector<MaskList::Entry>& entries = channel->getMaskList(listModes[m]).entries();
+            std::string letters, masks;
+            for (size_t i = 0; i < entries.size(); ++i) {
+                letters += listModes[m];
+                masks += " " + entries[i].mask;
+                if (masks.size() > SJOIN_MEMBER_BYTES || i + 1 == entries.size()) {
+                    link->queueMessage(":" + _serverName + " MODE " + channel->getName() + " +" + letters + masks + "\r\n");
+                    letters.clear();
+                    masks.clear();
+                }
+            }
+        }
+    }
+}
+
+void Server::_processLinkLine(Client* link, const std::string& line) {
+    std::string prefix = link->getHomeServer();
+    std::string rest = line;
+    if (!rest.empty() && rest[0] == ':') {
+        size_t space = rest.find(' ');
+        if (space == std::string::npos) return;
+        prefix = rest.substr(1, space - 1);
+        rest = rest.substr(space + 1);
+    }
+
+    // Link commands mostly keep what they are given (remote users, topics,
+    // modes), so the arguments are copied out of the arena up front
+    CommandArgs split((ArenaAllocator<ArenaString>(_arena)));
+    splitArgs(rest, 0, split);
+    if (split.empty()) return;
+    std::vector<std::string> args;
+    args.reserve(split.size());
+    for (size_t i = 0; i < split.size(); ++i) {
+        args.push_back(toString(split[i]));
+    }
+    for (size_t i = 0; i < args[0].length(); ++i) {
+        args[0][i] = std::toupper(args[0][i]);
+    }
+    _processLinkCommand(link, prefix, args, line + "\r\n");
+}
+
+// A user prefix is only honoured on the link that user lives behind
+Client* Server::_remoteSource(Client* link, const std::string& prefix) {
+    Client* user = getClientByNickname(nickOf(prefix));
+    if (!user || user->getUplink() != link) {
+        return NULL;
+    }
+    return user;
+}
+
+void Server::_processLinkCommand(Client* link, const std::string& prefix, const std::vector<std::string>& args, const std::string& line) {
+    const std::string& cmd = args[0];
+    std::map<std::string, LinkedServer>::iterator source = _servers.find(prefix);
+    bool fromServer = source != _servers.end() && source->second.link == link;
+
+    if (cmd == "PING") {
+        link->queueMessage(":" + _serverName + " PONG " + _serverName + (args.size() > 1 ? " :" + args[1] : "") + "\r\n");
+    }
+    else if (cmd == "PONG") {
+    }
+    else if (cmd == "ERROR") {
+        ngircd_log("warning", "Link " + link->getHomeServer() + " reported: " + (args.size() > 1 ? args[1] : ""));
+    }
+    else if (cmd == "SERVER") {
+        if (!fromServer || args.size() < 3) return;
+        const std::string& name = args[1];
+        if (name == _serverName || _servers.count(name)) {
+            _closeLink(link, "Server " + name + " already exists");
+            return;
+        }
+        LinkedServer& entry = _servers[name];
+        entry.parent = prefix;
+        entry.description = (args.size() > 3) ? args[3] : "";
+        entry.hopcount = std::atoi(args[2].c_str());
+        entry.link = link;
+        propagate(":" + prefix + " SERVER " + name + " " + numberString(entry.hopcount + 1) + " :" + entry.description + "\r\n", link);
+        ngircd_log("info", "Server " + name + " introduced by " + prefix);
+    }
+    else if (cmd == "SQUIT") {
+        if (args.size() < 2) return;
+        std::map<std::string, LinkedServer>::iterator it = _servers.find(args[1]);
+        if (it == _servers.end() || it->second.link != link) return;
+        std::string reason = (args.size() > 2) ? args[2] : "";
+        if (args[1] == link->getHomeServer()) {
+            _closeLink(link, reason);
+        } else {
+            _splitServer(args[1], reason, link);
+        }
+    }
+    else if (cmd == "NICK" && args.size() >= 7) {
+        if (fromServer) {
+            _introduceRemoteUser(link, prefix, args);
+        }
+    }
+    else if (cmd == "NICK") {
+        Client* user = _remoteSource(link, prefix);
+        if (!user || args.size() < 2) return;
+        const std::string& newNick = args[1];
+        time_t ts = (args.size() > 2) ? static_cast<time_t>(std::atol(args[2].c_str())) : time(NULL);
+        std::string oldPrefix = user->getPrefix();
+
+        Client* existing = getClientByNickname(newNick);
+        if (existing && existing != user) {
+            bool existingLoses = !existing->hasRegistered() || existing->getNickTs() >= ts;
+            bool userLoses = existing->hasRegistered() && existing->getNickTs() <= ts;
+            ngircd_log("warning", "Nick collision on " + newNick + " (nick change from " + link->getHomeServer() + ")");
+            if (existingLoses) {
+                _killUser(existing, "Nick collision", link);
+            }
+            if (userLoses) {
+                link->queueMessage(":" + _serverName + " KILL " + newNick + " :Nick collision\r\n");
+                propagate(":" + oldPrefix + " QUIT :Nick collision\r\n", link);
+                _removeRemoteUser(user, "Nick collision");
+                return;
+            }
+        }
+        user->setNickname(newNick);
+        user->setNickTs(ts);
+        notifyNeighbors(user, ":" + oldPrefix + " NICK " + newNick + "\r\n");
+        propagate(line, link);
+    }
+    else if (cmd == "QUIT") {
+        Client* user = _remoteSource(link, prefix);
+        if (!user) return;
+        propagate(line, link);
+        _removeRemoteUser(user, (args.size() > 1) ? args[1] : "");
+    }
+    else if (cmd == "KILL") {
+        if (args.size() < 2) return;
+        Client* target = getClientByNickname(args[1]);
+        if (!target) return;
+        _killUser(target, (args.size() > 2) ? args[2] : "Killed", link);
+    }
+    else if (cmd == "JOIN") {
+        Client* user = _remoteSource(link, prefix);
+        if (!user || args.size() < 2) return;
+        Channel* channel = getOrCreateChannel(args[1]);
+        if (channel->isMember(user->getFd())) return;
+        addClientToChannel(user, channel);
+        channel->broadcast(line, user->getFd());
+        propagate(line, link);
+    }
+    else if (cmd == "PART") {
+        Client* user = _remoteSource(link, prefix);
+        if (!user || args.size() < 2) return;
+        Channel* channel = getChannel(args[1]);
+        if (!channel || !channel->isMember(user->getFd())) return;
+        channel->broadcast(line, user->getFd());
+        propagate(line, link);
+        removeClientFromChannel(user, channel);
+    }
+    else if (cmd == "KICK") {
+        if ((!fromServer && !_remoteSource(link, prefix)) || args.size() < 3) return;
+        Channel* channel = getChannel(args[1]);
+        Client* target = channel ? channel->findClientByNickname(args[2]) : NULL;
+        if (!target) return;
+        channel->broadcastToAll(line);
+        propagate(line, link);
+        removeClientFromChannel(target, channel);
+    }
+    else if (cmd == "TOPIC") {
+        if ((!fromServer && !_remoteSource(link, prefix)) || args.size() < 3) return;
+        Channel* channel = getChannel(args[1]);
+        if (!channel) return;
+        channel->setTopic(args[2], nickOf(prefix));
+        saveChannelState(channel);
+        channel->broadcastToAll(line);
+        propagate(line, link);
+    }
+    else if (cmd == "MODE") {
+        if ((!fromServer && !_remoteSource(link, prefix)) || args.size() < 3) return;
+        Channel* channel = getChannel(args[1]);
+        if (!channel) return;
+        _applyRemoteModes(channel, args, 2, prefix);
+        saveChannelState(channel);
+        channel->broadcastToAll(line);
+        propagate(line, link);
+    }
+    else if (cmd == "PRIVMSG" || cmd == "NOTICE") {
+        Client* user = _remoteSource(link, prefix);
+        if (!user || args.size() < 3) return;
+        const std::string& target = args[1];
+        if (target[0] == '#' || target[0] == '&') {
+            Channel* channel = getChannel(target);
+            if (!channel) return;
+            OutboundMessage outbound(line);
+            channel->recordMessage(user->getPrefix(), args[2].data(), args[2].size(), outbound);
+            channel->broadcast(outbound, user);
+            relayToChannel(channel, line, link);
+        } else {
+            Client* dest = getClientByNickname(target);
+            if (dest && dest->getUplink() != link) {
+                OutboundMessage outbound(line);
+                outbound.deliver(dest);
+            }
+        }
+    }
+    else if (cmd == "INVITE") {
+        if (!_remoteSource(link, prefix) || args.size() < 3) return;
+        Client* target = getClientByNickname(args[1]);
+        if (!target || target->getUplink() == link) return;
+        if (!target->isRemote()) {
+            Channel* channel = getChannel(args[2]);
+            if (channel) {
+                channel->inviteClient(target->getFd());
+            }
+        }
+        target->queueMessage(line);
+    }
+    else if (cmd == "TBURST") {
+        if (!fromServer || args.size() < 5) return;
+        Channel* channel = getOrCreateChannel(args[1]);
+        time_t ts = static_cast<time_t>(std::atol(args[2].c_str()));
+        const std::string& topic = args[4];
+
+        // Older channel wins; on a tie both sides settle on the same topic
+        bool adopt;
+        if (channel->getMembers().empty()) {
+            channel->setCreationTime(ts);
+            adopt = true;
+        } else if (ts != channel->getCreationTime()) {
+            adopt = ts < channel->getCreationTime();
+        } else {
+            adopt = topic > channel->getTopic();
+        }
+        if (adopt && topic != channel->getTopic()) {
+            channel->setTopic(topic, args[3]);
+            saveChannelState(channel);
+            channel->broadcastToAll(":" + prefix + " TOPIC " + args[1] + " :" + topic + "\r\n");
+        }
+        propagate(line, link);
+    }
+    else if (cmd == "SJOIN") {
+        if (!fromServer || args.size() < 5) return;
+        const std::string& name = args[1];
+        time_t ts = static_cast<time_t>(std::atol(args[2].c_str()));
+        Channel* channel = getOrCreateChannel(name);
+        bool wasEmpty = channel->getMembers().empty();
+        bool theirsOlder = !wasEmpty && ts < channel->getCreationTime();
+        bool keepTheirs = wasEmpty || ts <= channel->getCreationTime();
+
+        if (theirsOlder) {
+            // Our side of the channel is the younger one: its modes and
+            // operators give way to the peer's
+            std::string modes = channel->getModeString().substr(1);
+            if (!modes.empty()) {
+                channel->removeMode('i');
+                channel->removeMode('t');
+                channel->setKey("");
+                channel->setUserLimit(0);
+                channel->broadcastToAll(":" + _serverName + " MODE " + name + " -" + modes + "\r\n");
+            }
+            const std::map<int, Client*>& members = channel->getMembers();
+            for (std::map<int, Client*>::const_iterator it = members.begin(); it != members.end(); ++it) {
+                if (channel->isOperator(it->first)) {
+                    channel->removeOperator(it->first);
+                    channel->broadcastToAll(":" + _serverName + " MODE " + name + " -o " + it->second->getNickname() + "\r\n");
+                }
+            }
+        }
+        if (wasEmpty || theirsOlder) {
+            channel->setCreationTime(ts);
+        }
+        if (keepTheirs && args[3].size() > 1) {
+            std::vector<std::string> modeArgs(args.begin(), args.end() - 1);
+            _applyRemoteModes(channel, modeArgs, 3, prefix);
+            std::string change = args[3];
+            for (size_t i = 4; i + 1 < args.size(); ++i) {
+                change += " " + args[i];
+            }
+            channel->broadcastToAll(":" + prefix + " MODE " + name + " " + change + "\r\n");
+        }
+
+        std::istringstream iss(args.back());
+        std::string token;
+        while (iss >> token) {
+            bool op = token[0] == '@';
+            std::string nick = op ? token.substr(1) : token;
+            Client* user = _remoteSource(link, nick);
+            if (!user || channel->isMember(user->getFd())) continue;
+            addClientToChannel(user, channel);
+            if (op && keepTheirs) {
+                channel->addOperator(user->getFd());
+            } else {
+                channel->removeOperator(user->getFd());
+            }
+            channel->broadcast(":" + user->getPrefix() + " JOIN " + name + "\r\n", user->getFd());
+            if (op && keepTheirs) {
+                channel->broadcastToAll(":" + prefix + " MODE " + name + " +o " + nick + "\r\n");
+            }
+        }
+        if (channel->getMembers().empty()) {
+            removeChannel(name);
+            return;
+        }
+        saveChannelState(channel);
+        propagate(line, link);
+    }
+    else if (cmd.size() == 3 && std::isdigit(cmd[0]) && std::isdigit(cmd[1]) && std::isdigit(cmd[2])) {
+        // Numeric reply for one of our users
+        if (args.size() < 2) return;
+        Client* target = getClientByNickname(args[1]);
+        if (target && target->getUplink() != link) {
+            target->queueMessage(line);
+        }
+    }
+    else {
+        ngircd_log("debug", "Ignoring " + cmd + " from link " + link->getHomeServer());
+    }
+}
+
+void Server::_introduceRemoteUser(Client* link, const std::string& serverName, const std::vector<std::string>& args) {
+    // NICK <nick> <hop> <ts> <user> <host> :<realname>
+    const std::string& nick = args[1];
+    time_t ts = static_cast<time_t>(std::atol(args[3].c_str()));
+
+    Client* existing = getClientByNickname(nick);
+    if (existing) {
+        bool existingLoses = !existing->hasRegistered() || existing->getNickTs() >= ts;
+        bool introLoses = existing->hasRegistered() && existing->getNickTs() <= ts;
+        ngircd_log("warning", "Nick collision on " + nick + " (introduced by " + serverName + ")");
+        if (existingLoses) {
+            _killUser(existing, "Nick collision", link);
+        }
+        if (introLoses) {
+            // The peer drops its own copy once it sees ours, unless both go
+            if (existingLoses) {
+                link->queueMessage(":" + _serverName + " KILL " + nick + " :Nick collision\r\n");
+            }
+            return;
+        }
+    }
+
+    Client* user = new Client(_nextRemoteId--, args[5], this, 0);
+    user->setNickname(nick);
+    user->setUsername(args[4]);
+    user->setRealname(args[6]);
+    user->setHasRegistered(true);
+    user->setUplink(link);
+    user->setHomeServer(serverName);
+    user->setNickTs(ts);
+    _remoteClients[user->getFd()] = user;
+
+    propagate(introLine(serverName, user, std::atoi(args[2].c_str()) + 1), link);
+}
+
+void Server::_splitServer(const std::string& serverName, const std::string& reason, Client* exceptLink) {
+    std::map<std::string, LinkedServer>::iterator it = _servers.find(serverName);
+    if (it == _servers.end()) return;
+
+    // The server and everything introduced behind it
+    std::set<std::string> gone;
+    gone.insert(serverName);
+    bool grew = true;
+    while (grew) {
+        grew = false;
+        for (std::map<std::string, LinkedServer>::iterator sit = _servers.begin(); sit != _servers.end(); ++sit) {
+            if (!gone.count(sit->first) && gone.count(sit->second.parent)) {
+                gone.insert(sit->first);
+                grew = true;
+            }
+        }
+    }
+
+    std::string quitReason = it->second.parent + " " + serverName;
+    Client* directLink = (it->second.hopcount == 1) ? it->second.link : NULL;
+    std::vector<Client*> users;
+    for (std::map<int, Client*>::iterator cit = _remoteClients.begin(); cit != _remoteClients.end(); ++cit) {
+        if (gone.count(cit->second->getHomeServer()) || (directLink && cit->second->getUplink() == directLink)) {
+            users.push_back(cit->second);
+        }
+    }
+    for (size_t i = 0; i < users.size(); ++i) {
+        _removeRemoteUser(users[i], quitReason);
+    }
+    for (std::set<std::string>::iterator git = gone.begin(); git != gone.end(); ++git) {
+        _servers.erase(*git);
+    }
+
+    propagate(":" + _serverName + " SQUIT " + serverName + " :" + reason + "\r\n", exceptLink);
+
+    std::ostringstream oss;
+    oss << "Split from " << serverName << " (" << gone.size() << " server(s), " << users.size() << " user(s)): " << reason;
+    ngircd_log("info", oss.str());
+}
+
+void Server::_removeRemoteUser(Client* user, const std::string& reason) {
+    removeClientFromAllChannels(user, reason);
+    _remoteClients.erase(user->getFd());
+    delete user;
+}
+
+void Server::_killUser(Client* user, const std::string& reason, Client* exceptLink) {
+    if (!user->isRemote()) {
+        int fd = user->getFd();
+        user->queueMessage("ERROR :Closing Link: " + user->getNickname() + " (" + reason + ")\r\n");
+        _handleClientSend(fd);
+        if (_clients.count(fd)) {
+            _handleClientDisconnect(fd);
+        }
+        return;
+    }
+    propagate(":" + _serverName + " KILL " + user->getNickname() + " :" + reason + "\r\n", exceptLink);
+    _removeRemoteUser(user, "Killed (" + reason + ")");
+}
+
+void Server::_applyRemoteModes(Channel* channel, const std::vector<std::string>& args, size_t first, const std::string& setter) {
+    const std::string& modes = args[first];
+    size_t param = first + 1;
+    bool add = true;
+
+    for (size_t i = 0; i < modes.size(); ++i) {
+        char mode = modes[i];
+        if (mode == '+' || mode == '-') {
+            add = (mode == '+');
+        } else if (mode == 'i' || mode == 't') {
+            if (add) channel->addMode(mode);
+            else channel->removeMode(mode);
+        } else if (mode == 'k') {
+            if (!add) channel->setKey("");
+            else if (param < args.size()) channel->setKey(args[param++]);
+        } else if (mode == 'l') {
+            if (!add) channel->setUserLimit(0);
+            else if (param < args.size()) channel->setUserLimit(static_cast<size_t>(std::strtoul(args[param++].c_str(), NULL, 10)));
+        } else if (Channel::isListMode(mode) && param < args.size()) {
+            std::string mask = MaskList::normalize(args[param++]);
+            if (add) channel->addListMask(mode, mask, setter, time(NULL));
+            else channel->removeListMask(mode, mask);
+        } else if (mode == 'o' && param < args.size()) {
+            Client* member = channel->findClientByNickname(args[param++]);
+            if (!member) continue;
+            if (add) channel->addOperator(member->getFd());
+            else channel->removeOperator(member->getFd());
+        }
+    }
+}
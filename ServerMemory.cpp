@@ -0,0 +1,187 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "MessageInbox.hpp"
+#include "utils.hpp"
+#include <algorithm>
+#include <ctime>
+#include <functional>
+#include <sstream>
+#include <utility>
+
+// A share of the budget in percent, without overflowing near SIZE_MAX
+static size_t budgetShare(size_t budget, size_t percent) {
+    return budget / 100 * percent + budget % 100 * percent / 100;
+}
+
+static std::string describeClient(const Client* client) {
+    if (!client->getNickname().empty()) {
+        return client->getNickname();
+    }
+    std::ostringstream oss;
+    oss << "fd=" << client->getFd();
+    return oss.str();
+}
+
+void Server::adjustBufferBytes(long delta) {
+    __atomic_add_fetch(&_bufferBytes, static_cast<size_t>(delta), __ATOMIC_RELAXED);
+}
+
+size_t Server::_memoryInUse() const {
+    return __atomic_load_n(&_bufferBytes, __ATOMIC_RELAXED) + SharedMessage::liveBytes() + _auditedBytes;
+}
+
+// Recounts everything except the client buffers and describes where the
+// memory is, largest client and channel included
+void Server::_auditMemory(std::string& report) {
+    size_t audited = 0;
+    size_t clientBytes = 0;
+    const Client* largestClient = NULL;
+    size_t largestClientBytes = 0;
+    const std::map<int, Client*>* maps[2] = { &_clients, &_remoteClients };
+    for (size_t m = 0; m < 2; ++m) {
+        for (std::map<int, Client*>::const_iterator it = maps[m]->begin(); it != maps[m]->end(); ++it) {
+            size_t bytes = it->second->memoryUsage();
+            clientBytes += bytes;
+            audited += bytes - it->second->getBufferBytes();
+            if (bytes > largestClientBytes) {
+                largestClient = it->second;
+                largestClientBytes = bytes;
+            }
+        }
+    }
+
+    size_t channelBytes = 0;
+    size_t channelCount = 0;
+    const Channel* largestChannel = NULL;
+    size_t largestChannelBytes = 0;
+    for (size_t slot = 0; slot < getChannelSlotCount(); ++slot) {
+        const Channel* channel = getChannelAtSlot(slot);
+        if (!channel) continue;
+        size_t bytes = channel->memoryUsage();
+        channelBytes += bytes;
+        ++channelCount;
+        if (bytes > largestChannelBytes) {
+            largestChannel = channel;
+            largestChannelBytes = bytes;
+        }
+    }
+    audited += channelBytes + _admission.memoryUsage() + _arena.memoryUsage() + _hostnames.memoryUsage();
+
+    _auditedBytes = audited;
+    _lastAudit = time(NULL);
+
+    std::ostringstream oss;
+    oss << "clients " << clientBytes << " bytes (" << (_clients.size() + _remoteClients.size()) << " clients";
+    if (largestClient) {
+        oss << ", largest " << describeClient(largestClient) << " " << largestClientBytes;
+    }
+    oss << "), channels " << channelBytes << " bytes (" << channelCount << " channels";
+    if (largestChannel) {
+        oss << ", largest " << largestChannel->getName() << " " << largestChannelBytes;
+    }
+    oss << "), shared lines " << SharedMessage::liveBytes() << " bytes";
+    report = oss.str();
+}
+
+// Once per loop tick. With a budget set, escalates as usage climbs: idle
+// buffer capacity is given back (checked once a second), then accepts are
+// refused, then the clients with the most queued bytes are disconnected
+void Server::_enforceMemoryBudget() {
+    size_t budget = _config.memoryBudget;
+    if (budget == 0) return;
+
+    std::string report;
+    if (time(NULL) != _lastAudit) {
+        _auditMemory(report);
+    }
+    size_t refuseAt = budgetShare(budget, MEMORY_REFUSE_PERCENT);
+    size_t used = _memoryInUse();
+
+    if (!report.empty() && used >= budgetShare(budget, MEMORY_SHRINK_PERCENT)) {
+        size_t shrunk = 0;
+        size_t freed = 0;
+        for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+            size_t bytes = it->second->shrinkBuffers();
+            if (bytes > 0) {
+                ++shrunk;
+                freed += bytes;
+            }
+        }
+        std::ostringstream oss;
+        oss << "Memory pressure: " << used << " of " << budget << " bytes in use; " << report
+            << "; shrank " << shrunk << " idle buffer(s), freed " << freed << " bytes";
+        if (_refusingConnections) {
+            oss << "; " << _refusedConnections << " connection(s) refused so far";
+        }
+        ngircd_log("warning", oss.str());
+        used = _memoryInUse();
+    }
+
+    if (used >= budgetShare(budget, MEMORY_SHED_PERCENT)) {
+        bool audited = !report.empty();
+        size_t shed = _shedLargestQueues(refuseAt);
+        if (shed > 0) {
+            _auditMemory(report);
+            used = _memoryInUse();
+        }
+        // Once a second at most: nothing may be left that shedding can reach
+        if (used >= refuseAt && (shed > 0 || audited)) {
+            std::ostringstream oss;
+            oss << "Memory still over target after disconnecting " << shed << " client(s): "
+                << used << " bytes in use, target " << refuseAt;
+            ngircd_log("warning", oss.str());
+        }
+    }
+
+    bool refuse = used >= refuseAt;
+    if (refuse != _refusingConnections) {
+        std::ostringstream oss;
+        if (refuse) {
+            oss << "Refusing new connections: " << used << " of " << budget << " bytes in use";
+            _refusedConnections = 0;
+        } else {
+            oss << "Accepting connections again: " << used << " of " << budget << " bytes in use, "
+                << _refusedConnections << " connection(s) were refused";
+        }
+        ngircd_log("warning", oss.str());
+        _refusingConnections = refuse;
+    }
+}
+
+// Disconnects local users, most queued bytes first, until usage is below
+// target; returns how many. Server links are kept, and so are clients with
+// nothing queued, since dropping them would not stop the growth.
+size_t Server::_shedLargestQueues(size_t target) {
+    std::vector<std::pair<size_t, int> > queues;
+    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        Client* client = it->second;
+        if (client->isServerLink() || client->isConnecting()) continue;
+        size_t queued = client->getQueuedBytes();
+        if (queued > 0) {
+            queues.push_back(std::make_pair(queued, it->first));
+        }
+    }
+    std::sort(queues.begin(), queues.end(), std::greater<std::pair<size_t, int> >());
+
+    size_t shed = 0;
+    for (size_t i = 0; i < queues.size() && _memoryInUse() >= target; ++i) {
+        std::map<int, Client*>::iterator it = _clients.find(queues[i].second);
+        if (it == _clients.end()) continue;
+        Client* client = it->second;
+        size_t held = client->memoryUsage();
+        {
+            std::ostringstream oss;
+            oss << "Disconnecting " << describeClient(client) << " to relieve memory: " << client->getQueuedBytes()
+                << " bytes queued, " << held << " bytes held; " << _memoryInUse() << " bytes in use, target " << target;
+            ngircd_log("warning", oss.str());
+        }
+        // The buffer bytes leave the running total when the client is deleted
+        size_t rest = held - client->getBufferBytes();
+        _auditedBytes -= std::min(rest, _auditedBytes);
+        client->clearSendBuffer(client->getSendQueue().size());
+        _handleClientDisconnect(it->first);
+        ++shed;
+    }
+    return shed;
+}
@@ -0,0 +1,187 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "utils.hpp"
+#include <cerrno>
+#include <ctime>
+#include <sstream>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+// Longest the loop sleeps while draining, so that the deadline is noticed
+#define DRAIN_POLL_MS 1000
+// Input read and dropped per readiness event while draining; a client
+// that keeps sending cannot hold up the loop
+#define DRAIN_READ_BYTES 4096
+#define DRAIN_READS 16
+
+static long long monotonicMs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+// A shutdown first drains: no more connections are accepted and every one
+// gets an ERROR line at the end of its send queue. The loop then only
+// flushes (input is read and dropped, since unread input would make close()
+// reset the connection and throw away what is still queued) until every
+// queue is empty or --drain-timeout passes; shutdown() closes the rest.
+void Server::_beginDrain() {
+    _draining = true;
+    _drainDeadline = monotonicMs() + static_cast<long long>(_config.drainTimeout) * 1000;
+
+    if (_serverFd >= 0) {
+        {
+            std::ostringstream oss;
+            oss << "Closing server socket (fd=" << _serverFd << ")";
+            ngircd_log("info", oss.str());
+        }
+        epoll_ctl(_epollFd, EPOLL_CTL_DEL, _serverFd, NULL);
+        close(_serverFd);
+        _serverFd = -1;
+    }
+
+    // Replies still to be generated (LIST and the like) are dropped, so
+    // that ERROR is the last line a client reads
+    std::vector<int> connecting;
+    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        Client* client = it->second;
+        if (client->isConnecting()) {
+            connecting.push_back(it->first);
+            continue;
+        }
+        while (client->hasReplyStreams()) {
+            client->popReplyStream();
+        }
+        client->queueMessage("ERROR :Server is shutting down\r\n");
+    }
+    // Outgoing links not yet connected have nothing to say
+    for (size_t i = 0; i < connecting.size(); ++i) {
+        _closeDrainingClient(connecting[i]);
+    }
+    _flushDirtyClients();
+
+    std::ostringstream oss;
+    oss << "Draining " << _clients.size() << " client(s) for up to " << _config.drainTimeout << " second(s)";
+    ngircd_log("info", oss.str());
+}
+
+bool Server::_drainFinished() const {
+    if (monotonicMs() >= _drainDeadline) {
+        return true;
+    }
+    for (std::map<int, Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if (!it->second->getSendQueue().empty()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// epoll_wait() timeout while draining
+int Server::_drainWait() const {
+    long long left = _drainDeadline - monotonicMs();
+    if (left <= 0) return 0;
+    return (left < DRAIN_POLL_MS) ? static_cast<int>(left) : DRAIN_POLL_MS;
+}
+
+void Server::_discardInput(int fd) {
+    std::map<int, Client*>::iterator it = _clients.find(fd);
+    if (it == _clients.end()) return;
+    Client* client = it->second;
+    char buffer[DRAIN_READ_BYTES];
+    for (int reads = 0; reads < DRAIN_READS; ++reads) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n > 0) continue;
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+        if (n == 0 && !client->getSendQueue().empty()) {
+            // Half-closed: the peer may still be reading, so only stop
+            // watching for input
+            struct epoll_event ev;
+            ev.events = client->getEpollEvents() & ~static_cast<uint32_t>(EPOLLIN);
+            ev.data.fd = fd;
+            if (epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &ev) == 0) {
+                client->setEpollEvents(ev.events);
+            }
+            return;
+        }
+        _closeDrainingClient(fd);
+        return;
+    }
+}
+
+// Disconnects while draining: no QUIT goes out after the ERROR lines, and
+// the client object stays alive (channels still point at it) until
+// shutdown() frees everything
+void Server::_closeDrainingClient(int fd) {
+    Client* client = _clients[fd];
+    _capture.recordClose(fd);
+    if (client->hasRegistered()) {
+        nickSeen(client, client->getNickname());
+    }
+    if (client->getSendQueue().empty()) {
+        ++_drainedClients;
+    }
+    epoll_ctl(_epollFd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    _releaseConnection(client);
+    _drainClosed.push_back(client);
+    _clients.erase(fd);
+}
+
+void Server::shutdown() {
+    ngircd_log("info", "Starting graceful shutdown...");
+    if (!_draining) {
+        _beginDrain();
+    }
+    // One last non-blocking write of whatever is still queued
+    _flushDirtyClients();
+
+    // Every socket gets its FIN (after the bytes already handed to the
+    // kernel) before any is closed
+    size_t total = _clients.size() + _drainClosed.size();
+    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if (it->second->getSendQueue().empty()) {
+            ++_drainedClients;
+        }
+        if (it->second->hasRegistered()) {
+            nickSeen(it->second, it->second->getNickname());
+        }
+        ::shutdown(it->first, SHUT_WR);
+    }
+    _drainReadyInboxes();
+    for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        close(it->first);
+        delete it->second;
+    }
+    _clients.clear();
+    for (size_t i = 0; i < _drainClosed.size(); ++i) {
+        delete _drainClosed[i];
+    }
+    _drainClosed.clear();
+    {
+        std::ostringstream oss;
+        oss << "Drained " << _drainedClients << " of " << total << " client(s)";
+        if (_drainedClients < total) {
+            oss << "; " << (total - _drainedClients) << " closed with bytes still queued";
+        }
+        ngircd_log("info", oss.str());
+    }
+
+    // Flush channel metadata to disk
+    _channelStore.close();
+    _nickRegistry.close();
+
+    if (_epollFd >= 0) {
+        {
+            std::ostringstream oss;
+            oss << "Closing epoll instance (fd=" << _epollFd << ")";
+            ngircd_log("info", oss.str());
+        }
+        close(_epollFd);
+        _epollFd = -1;
+    }
+
+    ngircd_log("info", "Graceful shutdown complete.");
+}
@@ -0,0 +1,624 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "utils.hpp"
+
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+// Hot upgrade.
+//
+// The running process forks and execs the binary it was started from, with
+// one end of a UNIX socketpair announced through UPGRADE_ENV. Once the new
+// process reports ready, the old one sends a serialized snapshot of every
+// client and channel, then the listening socket and all client sockets as
+// SCM_RIGHTS batches. The new process rebuilds its state, acknowledges and
+// takes over the epoll loop; the old process then exits without closing
+// anything on the wire.
+
+#define UPGRADE_ENV "FT_IRC_UPGRADE_FD"
+#define UPGRADE_MAGIC 0x46545547u
+#define UPGRADE_VERSION 6u
+#define UPGRADE_FD_BATCH 250
+#define UPGRADE_READY_TIMEOUT_MS 5000
+#define UPGRADE_ACK_TIMEOUT_MS 30000
+// Credential check a client was held for when the state was taken
+#define UPGRADE_HELD_NONE 0
+#define UPGRADE_HELD_OPER 1
+#define UPGRADE_HELD_SASL 2
+#define UPGRADE_HELD_TICKET (~0UL)
+
+extern char** environ;
+extern volatile sig_atomic_t g_upgrade_requested;
+
+namespace {
+
+class StateWriter {
+public:
+    void putU8(uint8_t value) { _data.push_back(static_cast<char>(value)); }
+    void putU32(uint32_t value) { _putRaw(&value, sizeof(value)); }
+    void putU64(uint64_t value) { _putRaw(&value, sizeof(value)); }
+    void putString(const std::string& value) {
+        putU32(static_cast<uint32_t>(value.size()));
+        _data.append(value);
+    }
+    const std::string& data() const { return _data; }
+
+private:
+    void _putRaw(const void* value, size_t length) { _data.append(static_cast<const char*>(value), length); }
+
+    std::string _data;
+};
+
+class StateReader {
+public:
+    explicit StateReader(const std::string& data) : _data(data), _pos(0) {}
+
+    uint8_t getU8() { uint8_t value; _getRaw(&value, sizeof(value)); return value; }
+    uint32_t getU32() { uint32_t value; _getRaw(&value, sizeof(value)); return value; }
+    uint64_t getU64() { uint64_t value; _getRaw(&value, sizeof(value)); return value; }
+    std::string getString() {
+        uint32_t length = getU32();
+        _need(length);
+        std::string value = _data.substr(_pos, length);
+        _pos += length;
+        return value;
+    }
+
+private:
+    void _need(size_t length) {
+        if (_data.size() - _pos < length) {
+            throw std::runtime_error("Error: truncated upgrade state");
+        }
+    }
+    void _getRaw(void* value, size_t length) {
+        _need(length);
+        std::memcpy(value, _data.data() + _pos, length);
+        _pos += length;
+    }
+
+    const std::string& _data;
+    size_t _pos;
+};
+
+uint64_t nowUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+bool waitReadable(int fd, int timeoutMs) {
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    int ret;
+    do {
+        ret = poll(&pfd, 1, timeoutMs);
+    } while (ret < 0 && errno == EINTR);
+    return ret > 0;
+}
+
+bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool readAll(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = recv(fd, data, length, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+bool sendFds(int sock, const int* fds, size_t count) {
+    char marker = 'F';
+    struct iovec iov;
+    iov.iov_base = &marker;
+    iov.iov_len = 1;
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * UPGRADE_FD_BATCH)];
+    } control;
+    std::memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+    ssize_t n;
+    do {
+        n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+    return n == 1;
+}
+
+// Appends the fds carried by one batch to out; returns false on failure
+bool recvFds(int sock, std::vector<int>& out) {
+    char marker;
+    struct iovec iov;
+    iov.iov_base = &marker;
+    iov.iov_len = 1;
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int) * UPGRADE_FD_BATCH)];
+    } control;
+
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != 1 || (msg.msg_flags & MSG_CTRUNC)) {
+        return false;
+    }
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const int* fds = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+        out.insert(out.end(), fds, fds + count);
+    }
+    return true;
+}
+
+// Sends the state and the sockets and waits for the acknowledgement; NULL
+// once the new process has taken over, otherwise what went wrong
+const char* handOver(int sock, const std::string& state, const std::vector<int>& fds) {
+    uint64_t length = state.size();
+    if (!writeAll(sock, reinterpret_cast<const char*>(&length), sizeof(length))
+        || !writeAll(sock, state.data(), state.size())) {
+        return "cannot send state";
+    }
+    for (size_t i = 0; i < fds.size(); i += UPGRADE_FD_BATCH) {
+        size_t count = fds.size() - i < UPGRADE_FD_BATCH ? fds.size() - i : UPGRADE_FD_BATCH;
+        if (!sendFds(sock, &fds[i], count)) {
+            return "cannot pass sockets";
+        }
+    }
+    char ack = 0;
+    if (!waitReadable(sock, UPGRADE_ACK_TIMEOUT_MS) || !readAll(sock, &ack, 1) || ack != 'A') {
+        return "new process did not acknowledge";
+    }
+    return NULL;
+}
+
+void abortUpgrade(pid_t child, int sock, const std::string& reason) {
+    ngircd_log("error", "Upgrade aborted: " + reason);
+    close(sock);
+    kill(child, SIGTERM);
+    waitpid(child, NULL, 0);
+}
+
+} // namespace
+
+std::string Server::_serializeState(std::vector<int>& fds) const {
+    StateWriter out;
+    out.putU32(UPGRADE_MAGIC);
+    out.putU32(UPGRADE_VERSION);
+
+    fds.push_back(_serverFd);
+
+    // Server links are not handed over: peers see the link drop and users
+    // behind it split off, and the new process links up again on its own.
+    // Remote channel members are skipped the same way, having no fd to map.
+    std::vector<const Client*> clients;
+    for (std::map<int, Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if (!it->second->isServerLink() && !it->second->isLinkInitiated()) {
+            clients.push_back(it->second);
+        }
+    }
+
+    out.putU32(static_cast<uint32_t>(clients.size()));
+    for (size_t i = 0; i < clients.size(); ++i) {
+        const Client* client = clients[i];
+        fds.push_back(client->getFd());
+        out.putU32(static_cast<uint32_t>(client->getFd()));
+        out.putString(client->getHostname());
+        out.putString(client->getNickname());
+        out.putString(client->getUsername());
+        out.putString(client->getRealname());
+        out.putString(client->getPassword());
+        out.putU8(client->hasRegistered() ? 1 : 0);
+        out.putU64(static_cast<uint64_t>(client->getNickTs()));
+        out.putString(client->getModes());
+        out.putU32(client->getCaps());
+        out.putU8(client->isCapNegotiating() ? 1 : 0);
+        out.putString(client->getAccount());
+        out.putU8(!client->isAuthPending() ? UPGRADE_HELD_NONE
+                  : client->isSaslStarted() ? UPGRADE_HELD_SASL : UPGRADE_HELD_OPER);
+        out.putU8(static_cast<uint8_t>(client->getZerocopy()));
+        out.putU32(client->getSendQueue().getZerocopyNext());
+        out.putString(client->getRecvBuffer());
+        out.putString(client->getSendQueue().str());
+    }
+
+    out.putU32(static_cast<uint32_t>(_channels.size()));
+    for (size_t c = 0; c < _channels.capacity(); ++c) {
+        const Channel* channel = _channels.at(c);
+        if (!channel) continue;
+        out.putString(channel->getName());
+        out.putString(channel->getTopic());
+        out.putString(channel->getTopicSetter());
+        out.putString(channel->getKey());
+        out.putU64(channel->getUserLimit());
+        out.putU64(static_cast<uint64_t>(channel->getCreationTime()));
+        out.putString(channel->getModeString().substr(1));
+
+        const std::map<int, Client*>& members = channel->getMembers();
+        out.putU32(static_cast<uint32_t>(members.size()));
+        for (std::map<int, Client*>::const_iterator mit = members.begin(); mit != members.end(); ++mit) {
+            out.putU32(static_cast<uint32_t>(mit->first));
+            out.putU8(channel->isOperator(mit->first) ? 1 : 0);
+        }
+
+        const std::set<int>& invites = channel->getInviteList();
+        out.putU32(static_cast<uint32_t>(invites.size()));
+        for (std::set<int>::const_iterator iit = invites.begin(); iit != invites.end(); ++iit) {
+            out.putU32(static_cast<uint32_t>(*iit));
+        }
+
+        for (const char* mode = "beI"; *mode; ++mode) {
+            const std::vector<MaskList::Entry>& entries = channel->getMaskList(*mode).entries();
+            out.putU32(static_cast<uint32_t>(entries.size()));
+            for (size_t m = 0; m < entries.size(); ++m) {
+                out.putString(entries[m].mask);
+                out.putString(entries[m].setBy);
+                out.putU64(static_cast<uint64_t>(entries[m].setAt));
+            }
+        }
+
+        const MessageHistory& history = channel->getHistory();
+        out.putU64(history.firstSeq());
+        out.putU32(static_cast<uint32_t>(history.getLineCount()));
+        for (uint64_t seq = history.firstSeq(); seq < history.endSeq(); ++seq) {
+            const MessageHistory::Entry* entry = history.find(seq);
+            out.putString(history.prefixOf(*entry));
+            out.putU64(entry->timeMs);
+            out.putString(history.textOf(*entry));
+        }
+    }
+    return out.data();
+}
+
+void Server::_restoreState(const std::string& state, const std::vector<int>& fds) {
+    StateReader in(state);
+    if (in.getU32() != UPGRADE_MAGIC || in.getU32() != UPGRADE_VERSION) {
+        throw std::runtime_error("Error: incompatible upgrade state");
+    }
+
+    uint32_t clientCount = in.getU32();
+    if (fds.size() != static_cast<size_t>(clientCount) + 1) {
+        throw std::runtime_error("Error: upgrade state does not match the received sockets");
+    }
+    _serverFd = fds[0];
+    _initEpoll();
+
+    std::map<int, int> fdMap;
+    for (uint32_t i = 0; i < clientCount; ++i) {
+        int oldFd = static_cast<int>(in.getU32());
+        int fd = fds[i + 1];
+        fdMap[oldFd] = fd;
+
+        Client* client = new Client(fd, in.getString(), this, EPOLLIN);
+        _clients[fd] = client;
+        _countConnection(client);
+        client->setNickname(in.getString());
+        client->setUsername(in.getString());
+        client->setRealname(in.getString());
+        client->setPassword(in.getString());
+        client->setHasRegistered(in.getU8() != 0);
+        client->setNickTs(static_cast<time_t>(in.getU64()));
+        std::string modes = in.getString();
+        for (size_t m = 0; m < modes.size(); ++m) {
+            client->addMode(modes[m]);
+        }
+        client->setCaps(in.getU32());
+        client->setCapNegotiating(in.getU8() != 0);
+        client->setAccount(in.getString());
+        // Held until _resumeFromUpgrade() has answered the check the old
+        // process had running; no check of this process has a ticket yet
+        uint8_t held = in.getU8();
+        if (held != UPGRADE_HELD_NONE) {
+            client->setSasl(held == UPGRADE_HELD_SASL, "");
+            client->setAuthTicket(UPGRADE_HELD_TICKET);
+        }
+        // SO_ZEROCOPY stays set on the socket, and its completions keep
+        // counting from where this process left off
+        uint8_t zerocopy = in.getU8();
+        client->setZerocopy(zerocopy <= ZEROCOPY_COPIED ? static_cast<ZerocopyMode>(zerocopy) : ZEROCOPY_OFF);
+        client->setZerocopyNext(in.getU32());
+        if (client->getZerocopy() == ZEROCOPY_OFF) {
+            _enableZerocopy(client);
+        }
+        _enableBusyPoll(fd);
+        std::string recvBuffer = in.getString();
+        client->appendRecvBuffer(recvBuffer.data(), recvBuffer.size());
+        std::string sendBuffer = in.getString();
+        client->appendSendBuffer(sendBuffer.data(), sendBuffer.size());
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            throw std::runtime_error("Error: epoll_ctl(ADD) failed for a handed-over client");
+        }
+        if (!sendBuffer.empty()) {
+            scheduleFlush(client);
+        }
+    }
+
+    uint32_t channelCount = in.getU32();
+    for (uint32_t i = 0; i < channelCount; ++i) {
+        std::string name = in.getString();
+        // An older binary kept "#a" and "#A" apart; the members of a later
+        // casemapped duplicate join the first one and the rest is dropped
+        Channel* merged = _channels.find(name);
+        Channel* channel = new Channel(name, _config.historyLines, _config.historyBytes);
+        if (!merged) {
+            channel->setHandle(_channels.insert(channel));
+            channel->setFanoutPool(&_fanoutPool);
+        }
+        Channel* target = merged ? merged : channel;
+
+        std::string topic = in.getString();
+        std::string topicSetter = in.getString();
+        if (!topic.empty()) {
+            channel->setTopic(topic, topicSetter);
+        }
+        std::string key = in.getString();
+        if (!key.empty()) {
+            channel->setKey(key);
+        }
+        uint64_t userLimit = in.getU64();
+        if (userLimit > 0) {
+            channel->setUserLimit(static_cast<size_t>(userLimit));
+        }
+        channel->setCreationTime(static_cast<time_t>(in.getU64()));
+        std::string modes = in.getString();
+        for (size_t m = 0; m < modes.size(); ++m) {
+            channel->addMode(modes[m]);
+        }
+
+        std::vector<std::pair<int, bool> > members;
+        uint32_t memberCount = in.getU32();
+        for (uint32_t m = 0; m < memberCount; ++m) {
+            int oldFd = static_cast<int>(in.getU32());
+            bool isOperator = in.getU8() != 0;
+            std::map<int, int>::iterator fit = fdMap.find(oldFd);
+            if (fit != fdMap.end()) {
+                members.push_back(std::make_pair(fit->second, isOperator));
+            }
+        }
+        for (size_t m = 0; m < members.size(); ++m) {
+            Client* client = _clients[members[m].first];
+            target->addClient(client);
+            client->addChannel(target->getHandle());
+        }
+        // addClient() made the first member an operator; put the real ones back
+        for (size_t m = 0; m < members.size(); ++m) {
+            if (members[m].second) target->addOperator(members[m].first);
+            else target->removeOperator(members[m].first);
+        }
+
+        uint32_t inviteCount = in.getU32();
+        for (uint32_t m = 0; m < inviteCount; ++m) {
+            std::map<int, int>::iterator fit = fdMap.find(static_cast<int>(in.getU32()));
+            if (fit != fdMap.end()) {
+                target->inviteClient(fit->second);
+            }
+        }
+
+        for (const char* mode = "beI"; *mode; ++mode) {
+            uint32_t maskCount = in.getU32();
+            for (uint32_t m = 0; m < maskCount; ++m) {
+                std::string mask = in.getString();
+                std::string setBy = in.getString();
+                target->addListMask(*mode, mask, setBy, static_cast<time_t>(in.getU64()));
+            }
+        }
+
+        MessageHistory& history = channel->getHistory();
+        history.resetSequence(in.getU64());
+        uint32_t lineCount = in.getU32();
+        for (uint32_t m = 0; m < lineCount; ++m) {
+            std::string prefix = in.getString();
+            uint64_t timeMs = in.getU64();
+            history.append(prefix, in.getString(), timeMs);
+        }
+
+        // A channel held only by users behind a server link has nobody left
+        if (merged) {
+            delete channel;
+        } else if (channel->getMembers().empty()) {
+            _channels.erase(channel->getHandle());
+            delete channel;
+        }
+    }
+}
+
+void Server::requestUpgrade(Client* client) {
+    ngircd_log("info", "Upgrade requested by operator " + client->getNickname());
+    g_upgrade_requested = 1;
+}
+
+bool Server::_performUpgrade() {
+    uint64_t startUs = nowUs();
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+        ngircd_log("error", std::string("Upgrade aborted: socketpair() failed: ") + std::strerror(errno));
+        return false;
+    }
+
+    // A compaction child left running would race the new process's own
+    _nickRegistry.settle();
+
+    // Everything the child needs is prepared before fork(): between fork()
+    // and exec() it must not allocate
+    std::vector<char*> argv;
+    for (size_t i = 0; i < _config.arguments.size(); ++i) {
+        argv.push_back(const_cast<char*>(_config.arguments[i].c_str()));
+    }
+    argv.push_back(NULL);
+
+    std::ostringstream envEntry;
+    envEntry << UPGRADE_ENV << "=" << sv[1];
+    std::string upgradeEnv = envEntry.str();
+    std::vector<char*> envp;
+    for (char** env = environ; *env; ++env) {
+        envp.push_back(*env);
+    }
+    envp.push_back(const_cast<char*>(upgradeEnv.c_str()));
+    envp.push_back(NULL);
+
+    pid_t child = fork();
+    if (child < 0) {
+        ngircd_log("error", std::string("Upgrade aborted: fork() failed: ") + std::strerror(errno));
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (child == 0) {
+        // Every other descriptor is close-on-exec; only the child's end survives
+        fcntl(sv[1], F_SETFD, 0);
+        execve(_config.executable.c_str(), &argv[0], &envp[0]);
+        _exit(127);
+    }
+    close(sv[1]);
+    int sock = sv[0];
+
+    char ready = 0;
+    if (!waitReadable(sock, UPGRADE_READY_TIMEOUT_MS) || !readAll(sock, &ready, 1) || ready != 'R') {
+        abortUpgrade(child, sock, "new process did not become ready");
+        return false;
+    }
+
+    // Lines other threads posted go out with the send queues; if the
+    // upgrade fails they are simply sent from here
+    _drainInboxes();
+    // Flushed so that the new process's records follow this one's; the
+    // loop is paused, so nothing is missed until it is reopened
+    _capture.close();
+
+    // Clients held for a credential check are handed over as they are; the
+    // new process answers the check once it has taken over
+    std::vector<int> fds;
+    std::string state = _serializeState(fds);
+    const char* failure = handOver(sock, state, fds);
+    if (failure) {
+        abortUpgrade(child, sock, failure);
+        _openCapture();
+        return false;
+    }
+    close(sock);
+
+    {
+        std::ostringstream oss;
+        oss << "Upgrade complete: handed " << _clients.size() << " connection(s) and "
+            << _channels.size() << " channel(s) (" << state.size() << " bytes of state) to pid "
+            << child << "; loop paused for " << (nowUs() - startUs) / 1000.0 << " ms";
+        ngircd_log("info", oss.str());
+    }
+    return true;
+}
+
+int Server::_takeUpgradeChannel() {
+    const char* value = getenv(UPGRADE_ENV);
+    if (!value) {
+        return -1;
+    }
+    int fd = std::atoi(value);
+    unsetenv(UPGRADE_ENV);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+void Server::_resumeFromUpgrade(int channelFd) {
+    uint64_t startUs = nowUs();
+
+    uint64_t length = 0;
+    if (!writeAll(channelFd, "R", 1)
+        || !readAll(channelFd, reinterpret_cast<char*>(&length), sizeof(length))) {
+        close(channelFd);
+        throw std::runtime_error("Error: upgrade handshake failed");
+    }
+    std::string state(length, '\0');
+    if (length > 0 && !readAll(channelFd, &state[0], length)) {
+        close(channelFd);
+        throw std::runtime_error("Error: cannot read upgrade state");
+    }
+
+    // The first field after the header is the client count; +1 for the listener
+    StateReader peek(state);
+    peek.getU32();
+    peek.getU32();
+    size_t expected = static_cast<size_t>(peek.getU32()) + 1;
+    std::vector<int> fds;
+    while (fds.size() < expected) {
+        if (!recvFds(channelFd, fds)) {
+            for (size_t i = 0; i < fds.size(); ++i) close(fds[i]);
+            close(channelFd);
+            throw std::runtime_error("Error: cannot receive handed-over sockets");
+        }
+    }
+
+    _restoreState(state, fds);
+    _openChannelStore();
+    _openNickRegistry();
+    _openCapture();
+
+    if (!writeAll(channelFd, "A", 1)) {
+        close(channelFd);
+        throw std::runtime_error("Error: cannot acknowledge upgrade");
+    }
+    close(channelFd);
+
+    // The hand-over is final: checks the old process never finished fail
+    // here, and the lines held behind them are parsed by this process
+    _abandonAuth();
+
+    std::ostringstream oss;
+    oss << "Resumed from upgrade on port " << _config.port << ": " << _clients.size()
+        << " connection(s), " << _channels.size() << " channel(s) restored in "
+        << (nowUs() - startUs) / 1000.0 << " ms";
+    ngircd_log("info", oss.str());
+}
@@ -0,0 +1,117 @@
+#include "Server.hpp"
+#include "Client.hpp"
+#include "utils.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+
+// Room for the completions one recvmsg() on the error queue returns
+#define ZEROCOPY_CONTROL_BYTES 256
+// Shortest segment worth pinning
+#define ZEROCOPY_MIN_SEGMENT 4096
+
+// At startup: fails early when the kernel has no MSG_ZEROCOPY, rather than
+// on every connection
+void Server::_initZerocopy() {
+    if (_config.zerocopyThreshold == 0) return;
+    int probe = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (probe < 0) {
+        throw std::runtime_error("Error: socket() failed");
+    }
+    int one = 1;
+    int result = setsockopt(probe, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one));
+    close(probe);
+    if (result < 0) {
+        throw std::runtime_error("Error: --zerocopy-threshold needs SO_ZEROCOPY, which this kernel does not support");
+    }
+    std::ostringstream oss;
+    oss << "Runs of large send queue segments from " << _config.zerocopyThreshold << " bytes on are sent with MSG_ZEROCOPY";
+    ngircd_log("info", oss.str());
+}
+
+void Server::_enableZerocopy(Client* client) {
+    if (_config.zerocopyThreshold == 0) return;
+    int one = 1;
+    if (setsockopt(client->getFd(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        std::ostringstream oss;
+        oss << "[Socket " << client->getFd() << "] SO_ZEROCOPY failed: " << std::strerror(errno);
+        ngircd_log("warning", oss.str());
+        return;
+    }
+    client->setZerocopy(ZEROCOPY_ON);
+}
+
+// How many of the leading iovecs to send with MSG_ZEROCOPY (0: copy them
+// all). Pinning costs a page per fragment whatever its length, so only a
+// run of segments of a page or more qualifies, and only once it adds up to
+// the threshold: in practice the coalesced bytes of a server link or of a
+// long reply, rather than broadcast lines, which each stay small.
+int Server::_zerocopySpan(const Client* client, const struct iovec* iov, int count) const {
+    if (_config.zerocopyThreshold == 0 || client->getZerocopy() != ZEROCOPY_ON) return 0;
+    size_t bytes = 0;
+    int span = 0;
+    while (span < count && iov[span].iov_len >= ZEROCOPY_MIN_SEGMENT) {
+        bytes += iov[span].iov_len;
+        ++span;
+    }
+    return bytes >= _config.zerocopyThreshold ? span : 0;
+}
+
+// The kernel reads the pages after this returns; the caller must pin what
+// was sent (Client::clearSendBufferZerocopy) when the result is positive.
+// Returns -1 with errno ENOBUFS when the socket is out of option memory
+// for more notifications, in which case the bytes are to be copied.
+ssize_t Server::_sendZerocopy(int fd, struct iovec* iov, int count) {
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = count;
+    return sendmsg(fd, &msg, MSG_ZEROCOPY | MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+// Completions arrive on the socket's error queue, which epoll reports as
+// EPOLLERR. Reads all of them, releasing the buffers they cover; returns
+// false if the socket also has a real error.
+bool Server::_reapZerocopy(Client* client) {
+    int fd = client->getFd();
+    char control[ZEROCOPY_CONTROL_BYTES];
+    while (true) {
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            break;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                continue;
+            }
+            struct sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY || err.ee_errno != 0) continue;
+            // ee_info..ee_data is the range of sends completed
+            client->zerocopyCompleted(err.ee_data);
+            if ((err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && client->getZerocopy() == ZEROCOPY_ON) {
+                // Pinning bought nothing; copying up front is cheaper
+                client->setZerocopy(ZEROCOPY_COPIED);
+                std::ostringstream oss;
+                oss << "[Socket " << fd << "] kernel copied zerocopy sends, using plain sends";
+                ngircd_log("debug", oss.str());
+            }
+        }
+    }
+    int error = 0;
+    socklen_t length = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0) {
+        return false;
+    }
+    return error == 0;
+}
@@ -0,0 +1,61 @@
+#include "StringPool.hpp"
+#include "MemoryUsage.hpp"
+
+StringPool::StringPool() {}
+
+StringPool::~StringPool() {}
+
+uint32_t StringPool::intern(const std::string& value) {
+    std::map<std::string, uint32_t>::iterator it = _index.find(value);
+    if (it != _index.end()) {
+        _slots[it->second].refs++;
+        return it->second;
+    }
+
+    uint32_t id;
+    if (!_freeSlots.empty()) {
+        id = _freeSlots.back();
+        _freeSlots.pop_back();
+    } else {
+        id = static_cast<uint32_t>(_slots.size());
+        _slots.push_back(Slot());
+    }
+    _slots[id].value = value;
+    _slots[id].refs = 1;
+    _index[value] = id;
+    return id;
+}
+
+void StringPool::retain(uint32_t id) {
+    if (id < _slots.size() && _slots[id].refs > 0) {
+        _slots[id].refs++;
+    }
+}
+
+void StringPool::release(uint32_t id) {
+    if (id >= _slots.size() || _slots[id].refs == 0) return;
+    if (--_slots[id].refs > 0) return;
+
+    _index.erase(_slots[id].value);
+    std::string().swap(_slots[id].value);
+    _freeSlots.push_back(id);
+}
+
+const std::string& StringPool::get(uint32_t id) const {
+    return _slots[id].value;
+}
+
+size_t StringPool::size() const {
+    return _index.size();
+}
+
+size_t StringPool::memoryUsage() const {
+    size_t bytes = heapBytes(_slots) + heapBytes(_index) + heapBytes(_freeSlots);
+    for (size_t i = 0; i < _slots.size(); ++i) {
+        bytes += heapBytes(_slots[i].value);
+    }
+    for (std::map<std::string, uint32_t>::const_iterator it = _index.begin(); it != _index.end(); ++it) {
+        bytes += heapBytes(it->first);
+    }
+    return bytes;
+}
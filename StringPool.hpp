@@ -0,0 +1,35 @@
+#pragma once
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+// Reference-counted string interning. Equal strings share one slot and are
+// referred to by a small integer id; a slot is recycled once its last
+// reference is released.
+class StringPool {
+public:
+    StringPool();
+    ~StringPool();
+
+    uint32_t intern(const std::string& value);
+    void retain(uint32_t id);
+    void release(uint32_t id);
+    const std::string& get(uint32_t id) const;
+    size_t size() const;
+    // Heap bytes of the slots and the index
+    size_t memoryUsage() const;
+
+private:
+    StringPool(const StringPool& other);
+    StringPool& operator=(const StringPool& other);
+
+    struct Slot {
+        std::string value;
+        uint32_t refs;
+    };
+
+    std::vector<Slot> _slots;
+    std::map<std::string, uint32_t> _index;
+    std::vector<uint32_t> _freeSlots;
+};
@@ -12,13 +12,13 @@ bool TopicCommand::requiresRegistration() const {
     return true;
 }
 
-void TopicCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void TopicCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     if (args.size() != 2 && args.size() != 3) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
-    std::string channelName = args[1];
+    std::string channelName = toString(args[1]);
     Channel* channel = server.getChannel(channelName);
     if (!isValidChannelName(channelName) || !channel) {
         client->reply(403, channelName + " :No such channel");
@@ -50,9 +50,11 @@ void TopicCommand::execute(Server& server, Client* client, const std::vector<std
         return;
     }
 
-    std::string newTopic = args[2];
+    std::string newTopic = toString(args[2]);
     channel->setTopic(newTopic, client->getNickname());
+    server.saveChannelState(channel);
 
     std::string topicMsg = ":" + client->getPrefix() + " TOPIC " + channelName + " :" + newTopic + "\r\n";
     channel->broadcastToAll(topicMsg);
+    server.propagate(topicMsg, NULL);
 }
@@ -0,0 +1,152 @@
+#include "TrafficCapture.hpp"
+#include "utils.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+TrafficCapture::TrafficCapture()
+    : _fd(-1), _stopping(false), _writeFailed(false) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_wakeup, NULL);
+}
+
+TrafficCapture::~TrafficCapture() {
+    close();
+    pthread_cond_destroy(&_wakeup);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool TrafficCapture::open(const std::string& path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        ngircd_log("warning", "Cannot open capture file " + path + ": " + std::strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (st.st_size == 0 && write(fd, CAPTURE_MAGIC, 8) != 8)) {
+        ngircd_log("warning", "Cannot write capture file " + path + ": " + std::strerror(errno));
+        ::close(fd);
+        return false;
+    }
+
+    _fd = fd;
+    _path = path;
+    _stopping = false;
+    _writeFailed = false;
+    if (pthread_create(&_writer, NULL, &TrafficCapture::_writerMain, this) != 0) {
+        ngircd_log("warning", "Cannot start the capture writer for " + path);
+        ::close(_fd);
+        _fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// Stops the writer once everything queued so far is on disk. The set of
+// captured connections is kept, so reopening in the same process carries on.
+void TrafficCapture::close() {
+    if (_fd < 0) return;
+
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_signal(&_wakeup);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_writer, NULL);
+
+    ::close(_fd);
+    _fd = -1;
+    _pending.clear();
+}
+
+bool TrafficCapture::isOpen() const {
+    return _fd >= 0;
+}
+
+void TrafficCapture::recordAccept(int fd, const std::string& hostname) {
+    if (_fd < 0) return;
+    _connections.insert(fd);
+    _append(CAPTURE_ACCEPT, fd, hostname.data(), hostname.size());
+}
+
+void TrafficCapture::recordData(int fd, const char* data, size_t len) {
+    if (_fd < 0 || !_connections.count(fd)) return;
+    _append(CAPTURE_DATA, fd, data, len);
+}
+
+void TrafficCapture::recordClose(int fd) {
+    if (_fd < 0 || !_connections.erase(fd)) return;
+    _append(CAPTURE_CLOSE, fd, NULL, 0);
+}
+
+void TrafficCapture::_append(uint8_t type, int fd, const char* data, size_t len) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t micros = static_cast<uint64_t>(tv.tv_sec) * 1000000u + tv.tv_usec;
+    int32_t connection = fd;
+    uint32_t length = static_cast<uint32_t>(len);
+
+    char header[CAPTURE_RECORD_HEADER];
+    header[0] = static_cast<char>(type);
+    std::memcpy(header + 1, &connection, 4);
+    std::memcpy(header + 5, &micros, 8);
+    std::memcpy(header + 13, &length, 4);
+
+    pthread_mutex_lock(&_mutex);
+    bool failed = _writeFailed || _pending.size() > CAPTURE_MAX_PENDING;
+    if (!failed) {
+        bool wasEmpty = _pending.empty();
+        _pending.append(header, sizeof(header));
+        if (len) _pending.append(data, len);
+        if (wasEmpty) pthread_cond_signal(&_wakeup);
+    }
+    pthread_mutex_unlock(&_mutex);
+
+    // A capture with holes would replay as something that never happened
+    if (failed) {
+        ngircd_log("warning", "Capture to " + _path + " stopped: the writer fell behind or failed");
+        close();
+    }
+}
+
+void* TrafficCapture::_writerMain(void* arg) {
+    static_cast<TrafficCapture*>(arg)->_writerLoop();
+    return NULL;
+}
+
+void TrafficCapture::_writerLoop() {
+    std::string batch;
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        while (_pending.empty() && !_stopping) {
+            pthread_cond_wait(&_wakeup, &_mutex);
+        }
+        if (_pending.empty()) break;
+        batch.swap(_pending);
+        pthread_mutex_unlock(&_mutex);
+
+        size_t offset = 0;
+        bool ok = true;
+        while (offset < batch.size()) {
+            ssize_t n = write(_fd, batch.data() + offset, batch.size() - offset);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) {
+                ok = false;
+                break;
+            }
+            offset += n;
+        }
+        batch.clear();
+
+        pthread_mutex_lock(&_mutex);
+        if (!ok) {
+            _writeFailed = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_mutex);
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <set>
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+
+#define CAPTURE_MAGIC "IRCCAP01"
+// Record header: type (1 byte), connection (4), microseconds since the
+// epoch (8), payload length (4), all in host byte order
+#define CAPTURE_RECORD_HEADER 17
+// Unwritten bytes beyond which capturing is abandoned rather than stall
+#define CAPTURE_MAX_PENDING (64 * 1024 * 1024)
+
+enum CaptureRecordType {
+    CAPTURE_ACCEPT = 1,  // payload: the peer's address
+    CAPTURE_DATA = 2,    // payload: bytes as received
+    CAPTURE_CLOSE = 3    // no payload
+};
+
+// Records accepted connections, everything they send and when they go away
+// to an append-only file, for bench/replay. The event loop only appends to
+// a memory buffer; a writer thread moves it to disk. A file that already
+// exists is appended to (as after a hot upgrade), so its magic appears once
+// at the start and records carry absolute timestamps.
+class TrafficCapture {
+public:
+    TrafficCapture();
+    ~TrafficCapture();
+
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+
+    void recordAccept(int fd, const std::string& hostname);
+    void recordData(int fd, const char* data, size_t len);
+    void recordClose(int fd);
+
+private:
+    TrafficCapture(const TrafficCapture& other);
+    TrafficCapture& operator=(const TrafficCapture& other);
+
+    void _append(uint8_t type, int fd, const char* data, size_t len);
+    static void* _writerMain(void* arg);
+    void _writerLoop();
+
+    int _fd;
+    std::string _path;
+    // Connections whose accept was recorded; others are not captured
+    std::set<int> _connections;
+
+    pthread_t _writer;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _wakeup;
+    // Guarded by _mutex
+    std::string _pending;
+    bool _stopping;
+    bool _writeFailed;
+};
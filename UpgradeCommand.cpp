@@ -0,0 +1,22 @@
+#include "UpgradeCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+
+UpgradeCommand::UpgradeCommand() {}
+
+UpgradeCommand::~UpgradeCommand() {}
+
+bool UpgradeCommand::requiresRegistration() const {
+    return true;
+}
+
+void UpgradeCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    (void)args;
+    if (!client->hasMode('o')) {
+        client->reply(481, "");
+        return;
+    }
+    client->queueMessage(":" + server.getServerName() + " NOTICE " + client->getNickname()
+                         + " :Upgrading, connections are handed over to the new binary\r\n");
+    server.requestUpgrade(client);
+}
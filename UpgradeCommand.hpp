@@ -0,0 +1,20 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+// Handles UPGRADE: an IRC operator starts the same hot upgrade as SIGUSR2
+// (Server::requestUpgrade). Anyone else gets ERR_NOPRIVILEGES.
+class UpgradeCommand : public ICommand {
+public:
+    UpgradeCommand();
+    virtual ~UpgradeCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    UpgradeCommand(const UpgradeCommand& other);
+    UpgradeCommand& operator=(const UpgradeCommand& other);
+};
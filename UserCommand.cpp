@@ -10,7 +10,7 @@ bool UserCommand::requiresRegistration() const {
     return false;
 }
 
-void UserCommand::execute(Server& server, Client* client, const std::vector<std::string>& args) {
+void UserCommand::execute(Server& server, Client* client, const CommandArgs& args) {
     (void)server;
 
     if (client->hasRegistered()) {
@@ -19,7 +19,7 @@ void UserCommand::execute(Server& server, Client* client, const std::vector<std:
     }
 
     if (args.size() != 5) {
-        client->reply(461, args[0]);
+        client->reply(461, toString(args[0]));
         return;
     }
 
@@ -28,6 +28,6 @@ void UserCommand::execute(Server& server, Client* client, const std::vector<std:
         return;
     }
 
-    client->setUsername(args[1]);
-    client->setRealname(args[4]);
+    client->setUsername(toString(args[1]));
+    client->setRealname(toString(args[4]));
 }
@@ -11,7 +11,7 @@ public:
     virtual ~UserCommand();
 
     virtual bool requiresRegistration() const;
-    virtual void execute(Server& server, Client* client, const std::vector<std::string>& args);
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
 
 private:
     UserCommand(const UserCommand& other);
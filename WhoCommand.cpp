@@ -0,0 +1,123 @@
+#include "WhoCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "ReplyStream.hpp"
+#include "utils.hpp"
+#include "MemoryUsage.hpp"
+#include <sstream>
+
+static std::string whoLine(Server& server, const std::string& channelName, Channel* channel, Client* user) {
+    const std::string& home = user->isRemote() ? user->getHomeServer() : server.getServerName();
+    std::ostringstream line;
+    line << channelName << " " << user->getUsername() << " " << user->getHostname() << " " << home
+         << " " << user->getNickname() << " H" << (user->hasMode('o') ? "*" : "")
+         << ((channel && channel->isOperator(user->getFd())) ? "@" : "")
+         << " :" << server.getServerHopcount(home) << " " << user->getRealname();
+    return line.str();
+}
+
+// One RPL_WHOREPLY per matching user. A channel mask lists that channel's
+// members; any other mask is matched against every user's nickname,
+// username, host, server and real name, local users first. Both walks
+// continue from the last key sent, so users who come or go while the reply
+// is paused are listed at most once.
+class WhoStream : public ReplyStream {
+public:
+    WhoStream(const std::string& mask, bool operatorsOnly)
+        : _mask(mask), _operatorsOnly(operatorsOnly), _channelQuery(false), _channel(INVALID_CHANNEL_HANDLE),
+          _remotePhase(false), _started(false), _lastKey(0) {}
+
+    virtual size_t memoryUsage() const {
+        return sizeof(*this) + heapBytes(_mask);
+    }
+
+    // A channel that does not exist (INVALID_CHANNEL_HANDLE) lists nobody
+    void setChannel(ChannelHandle channel) {
+        _channelQuery = true;
+        _channel = channel;
+    }
+
+    virtual bool resume(Server& server, Client* client) {
+        if (_channelQuery) {
+            Channel* channel = server.resolveChannel(_channel);
+            if (channel && !_walk(server, client, channel, channel->getMembers())) {
+                return false;
+            }
+        } else {
+            if (!_remotePhase) {
+                if (!_walk(server, client, NULL, server.getClients())) {
+                    return false;
+                }
+                _remotePhase = true;
+                _started = false;
+            }
+            if (!_walk(server, client, NULL, server.getRemoteClients())) {
+                return false;
+            }
+        }
+        client->reply(315, _mask + " :End of WHO list");
+        return true;
+    }
+
+private:
+    bool _matches(Server& server, Client* user) const {
+        if (!user->hasRegistered() || user->isServerLink()) {
+            return false;
+        }
+        if (_operatorsOnly && !user->hasMode('o')) {
+            return false;
+        }
+        if (_mask.empty() || _mask == "0" || _mask == "*") {
+            return true;
+        }
+        const std::string& home = user->isRemote() ? user->getHomeServer() : server.getServerName();
+        return ircMatch(_mask, user->getNickname()) || ircMatch(_mask, user->getUsername())
+            || ircMatch(_mask, user->getHostname()) || ircMatch(_mask, home)
+            || ircMatch(_mask, user->getRealname());
+    }
+
+    // Returns true once the walk reached the end of users
+    bool _walk(Server& server, Client* client, Channel* channel, const std::map<int, Client*>& users) {
+        std::map<int, Client*>::const_iterator it = _started ? users.upper_bound(_lastKey) : users.begin();
+        for (; it != users.end() && client->getSendQueue().size() < SENDQ_WATERMARK; ++it) {
+            _lastKey = it->first;
+            _started = true;
+            if (channel) {
+                if (_operatorsOnly && !it->second->hasMode('o')) continue;
+                client->reply(352, whoLine(server, channel->getName(), channel, it->second));
+            } else if (_matches(server, it->second)) {
+                client->reply(352, whoLine(server, "*", NULL, it->second));
+            }
+        }
+        return it == users.end();
+    }
+
+    std::string _mask;
+    bool _operatorsOnly;
+    bool _channelQuery;
+    ChannelHandle _channel;
+    bool _remotePhase;
+    bool _started;
+    int _lastKey;
+};
+
+WhoCommand::WhoCommand() {}
+WhoCommand::~WhoCommand() {}
+
+bool WhoCommand::requiresRegistration() const {
+    return true;
+}
+
+// WHO [<mask> ["o"]]
+void WhoCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    std::string mask = (args.size() > 1) ? toString(args[1]) : "*";
+    bool operatorsOnly = args.size() > 2 && args[2] == "o";
+
+    WhoStream* stream = new WhoStream(mask, operatorsOnly);
+    if (isValidChannelName(mask)) {
+        Channel* channel = server.getChannel(mask);
+        stream->setChannel(channel ? channel->getHandle() : INVALID_CHANNEL_HANDLE);
+    }
+    client->addReplyStream(stream);
+}
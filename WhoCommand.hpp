@@ -0,0 +1,18 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+class WhoCommand : public ICommand {
+public:
+    WhoCommand();
+    virtual ~WhoCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    WhoCommand(const WhoCommand& other);
+    WhoCommand& operator=(const WhoCommand& other);
+};
@@ -0,0 +1,108 @@
+#include "WhoisCommand.hpp"
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "ReplyStream.hpp"
+#include "MemoryUsage.hpp"
+#include <sstream>
+
+#define WHOIS_CHANNELS_LINE_BYTES 400
+
+// Answers one nickname at a time; a user in many channels gets several
+// RPL_WHOISCHANNELS lines, continued by position in the user's channel list.
+// The user is looked up again on every resume in case they left meanwhile.
+class WhoisStream : public ReplyStream {
+public:
+    WhoisStream(const std::vector<std::string>& nicknames, const std::string& query)
+        : _nicknames(nicknames), _query(query), _next(0), _nextChannel(0), _inUser(false) {}
+
+    virtual size_t memoryUsage() const {
+        return sizeof(*this) + heapBytes(_nicknames) + heapBytes(_query);
+    }
+
+    virtual bool resume(Server& server, Client* client) {
+        while (client->getSendQueue().size() < SENDQ_WATERMARK) {
+            if (_next >= _nicknames.size()) {
+                client->reply(318, _query + " :End of WHOIS list");
+                return true;
+            }
+            const std::string& nickname = _nicknames[_next];
+            Client* user = server.getClientByNickname(nickname);
+            if (!user) {
+                if (!_inUser) {
+                    client->reply(401, nickname + " :No such nick/channel");
+                }
+                _nextUser();
+                continue;
+            }
+            if (!_inUser) {
+                const std::string& home = user->isRemote() ? user->getHomeServer() : server.getServerName();
+                client->reply(311, user->getNickname() + " " + user->getUsername() + " " + user->getHostname()
+                    + " * :" + user->getRealname());
+                client->reply(312, user->getNickname() + " " + home + " :" + server.getServerInfo(home));
+                if (user->hasMode('o')) {
+                    client->reply(313, user->getNickname() + " :is an IRC operator");
+                }
+                _inUser = true;
+            }
+
+            const std::vector<ChannelHandle>& channels = user->getJoinedChannels();
+            std::string list;
+            for (; _nextChannel < channels.size() && list.size() < WHOIS_CHANNELS_LINE_BYTES; ++_nextChannel) {
+                Channel* channel = server.resolveChannel(channels[_nextChannel]);
+                if (!channel) continue;
+                if (!list.empty()) list += " ";
+                if (channel->isOperator(user->getFd())) list += "@";
+                list += channel->getName();
+            }
+            if (!list.empty()) {
+                client->reply(319, user->getNickname() + " :" + list);
+            }
+            if (_nextChannel >= channels.size()) {
+                _nextUser();
+            }
+        }
+        return false;
+    }
+
+private:
+    void _nextUser() {
+        ++_next;
+        _nextChannel = 0;
+        _inUser = false;
+    }
+
+    std::vector<std::string> _nicknames;
+    std::string _query;
+    size_t _next;
+    size_t _nextChannel;
+    bool _inUser;
+};
+
+WhoisCommand::WhoisCommand() {}
+WhoisCommand::~WhoisCommand() {}
+
+bool WhoisCommand::requiresRegistration() const {
+    return true;
+}
+
+// WHOIS [<server>] <nick>{,<nick>}
+// Every user on the network is known here, so the server argument is ignored
+void WhoisCommand::execute(Server& server, Client* client, const CommandArgs& args) {
+    (void)server;
+
+    if (args.size() < 2 || args.back().empty()) {
+        client->reply(431, ":No nickname given");
+        return;
+    }
+    std::string query = toString(args.back());
+    std::vector<std::string> nicknames;
+    std::istringstream iss(query);
+    std::string nickname;
+    while (std::getline(iss, nickname, ',')) {
+        if (!nickname.empty()) {
+            nicknames.push_back(nickname);
+        }
+    }
+    client->addReplyStream(new WhoisStream(nicknames, query));
+}
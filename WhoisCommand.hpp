@@ -0,0 +1,18 @@
+#pragma once
+#include "ICommand.hpp"
+
+class Server;
+class Client;
+
+class WhoisCommand : public ICommand {
+public:
+    WhoisCommand();
+    virtual ~WhoisCommand();
+
+    virtual bool requiresRegistration() const;
+    virtual void execute(Server& server, Client* client, const CommandArgs& args);
+
+private:
+    WhoisCommand(const WhoisCommand& other);
+    WhoisCommand& operator=(const WhoisCommand& other);
+};
@@ -0,0 +1,286 @@
+// Channel churn against a running ircserv.
+//
+//   churn_bench <password> <port> seed [clients] [count]
+//   churn_bench <password> <port> churn [clients] [count] [server_pid]
+//
+// seed creates #locked0..#locked<count-1> with key "secret" and stays
+// joined until the server goes away, so that a server stopped meanwhile
+// leaves them in its channel store. churn then runs three phases of
+// <count> operations spread over <clients> users:
+//   locked: JOIN #lockedN with a wrong key (channels that exist only in
+//           the store, so each JOIN would have to create one)
+//   churn:  JOIN and PART a name nobody else uses
+//   spray:  JOIN a new name and stay
+// After each phase it counts the server's channels with LIST and, given
+// the server's pid, reads its resident memory. See churn_bench.sh.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define RECV_TIMEOUT_S 10
+// Operations each user has in flight at once
+#define BATCH 50
+
+namespace {
+
+enum Phase { LOCKED, CHURN, SPRAY };
+
+struct User {
+    int fd;
+    std::string nick;
+    std::string in;
+};
+
+struct Tally {
+    long joined;
+    long refused;
+    long rejected;
+};
+
+long long nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv;
+    tv.tv_sec = RECV_TIMEOUT_S;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, 0);
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Next complete line, blocking; false on EOF or timeout
+bool readLine(User& user, std::string& line) {
+    for (;;) {
+        size_t pos = user.in.find("\r\n");
+        if (pos != std::string::npos) {
+            line = user.in.substr(0, pos);
+            user.in.erase(0, pos + 2);
+            return true;
+        }
+        char buf[65536];
+        ssize_t n = recv(user.fd, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        user.in.append(buf, n);
+    }
+}
+
+bool hasNumeric(const std::string& line, const char* numeric) {
+    size_t space = line.find(' ');
+    return space != std::string::npos && line.compare(space + 1, 3, numeric) == 0
+        && line.size() > space + 4 && line[space + 4] == ' ';
+}
+
+bool isOwn(const User& user, const std::string& line, const char* command) {
+    std::string prefix = ":" + user.nick + "!";
+    return line.compare(0, prefix.size(), prefix) == 0 && line.find(std::string(" ") + command + " ") != std::string::npos;
+}
+
+bool connectUser(int port, const std::string& password, const std::string& nick, User& user) {
+    user.fd = connectTo(port);
+    user.nick = nick;
+    if (user.fd < 0) return false;
+    if (!sendAll(user.fd, "PASS " + password + "\r\nNICK " + nick + "\r\nUSER " + nick + " 0 * :bench\r\n")) {
+        return false;
+    }
+    std::string line;
+    while (readLine(user, line)) {
+        if (hasNumeric(line, "001")) return true;
+    }
+    return false;
+}
+
+std::string opFor(Phase phase, const User& user, long n) {
+    std::ostringstream oss;
+    if (phase == LOCKED) {
+        oss << "JOIN #locked" << n << " wrong\r\n";
+    } else if (phase == CHURN) {
+        oss << "JOIN #c_" << user.nick << "_" << n << "\r\nPART #c_" << user.nick << "_" << n << "\r\n";
+    } else {
+        oss << "JOIN #s_" << user.nick << "_" << n << "\r\n";
+    }
+    return oss.str();
+}
+
+// Reads until <count> operations have concluded
+bool settle(User& user, Phase phase, long count, Tally& tally) {
+    std::string line;
+    while (count > 0) {
+        if (!readLine(user, line)) return false;
+        bool joined = isOwn(user, line, "JOIN");
+        bool refused = hasNumeric(line, "263");
+        bool rejected = hasNumeric(line, "471") || hasNumeric(line, "473") || hasNumeric(line, "474")
+            || hasNumeric(line, "475");
+        if (joined) ++tally.joined;
+        if (refused) ++tally.refused;
+        if (rejected) ++tally.rejected;
+        // A JOIN and PART pair ends with the PART, or with 403 or 442 if
+        // the JOIN failed
+        bool parted = isOwn(user, line, "PART") || hasNumeric(line, "403") || hasNumeric(line, "442");
+        if (phase == CHURN ? parted : (joined || refused || rejected)) {
+            --count;
+        }
+    }
+    return true;
+}
+
+long countChannels(User& user) {
+    if (!sendAll(user.fd, "LIST\r\n")) return -1;
+    long channels = 0;
+    std::string line;
+    while (readLine(user, line)) {
+        if (hasNumeric(line, "322")) ++channels;
+        if (hasNumeric(line, "323")) return channels;
+    }
+    return -1;
+}
+
+long residentKb(const std::string& pid) {
+    if (pid.empty()) return -1;
+    std::ifstream status(("/proc/" + pid + "/status").c_str());
+    std::string key;
+    while (status >> key) {
+        if (key == "VmRSS:") {
+            long kb = -1;
+            status >> kb;
+            return kb;
+        }
+    }
+    return -1;
+}
+
+int seed(int port, const std::string& password, long count) {
+    User user;
+    if (!connectUser(port, password, "seeder", user)) {
+        std::fprintf(stderr, "churn_bench: cannot register\n");
+        return 1;
+    }
+    for (long i = 0; i < count; i += BATCH) {
+        std::ostringstream batch;
+        long end = i + BATCH < count ? i + BATCH : count;
+        for (long n = i; n < end; ++n) {
+            batch << "JOIN #locked" << n << "\r\nMODE #locked" << n << " +k secret\r\n";
+        }
+        std::string line;
+        if (!sendAll(user.fd, batch.str())) return 1;
+        for (long done = i; done < end;) {
+            if (!readLine(user, line)) return 1;
+            if (line.find(" MODE #locked") != std::string::npos && line.find("+k") != std::string::npos) ++done;
+        }
+    }
+    std::printf("seeded %ld\n", count);
+    std::fflush(stdout);
+    // Stay in the channels until the server stops
+    char buf[4096];
+    for (;;) {
+        ssize_t n = recv(user.fd, buf, sizeof(buf), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) break;
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::fprintf(stderr, "Usage: %s <password> <port> seed|churn [clients] [count] [server_pid]\n", argv[0]);
+        return 1;
+    }
+    std::string password = argv[1];
+    int port = std::atoi(argv[2]);
+    std::string mode = argv[3];
+    long clients = (argc > 4) ? std::atol(argv[4]) : 20;
+    long count = (argc > 5) ? std::atol(argv[5]) : 20000;
+    std::string pid = (argc > 6) ? argv[6] : "";
+    if (clients <= 0 || count <= 0) {
+        std::fprintf(stderr, "churn_bench: clients and count must be > 0\n");
+        return 1;
+    }
+    if (mode == "seed") {
+        return seed(port, password, count);
+    }
+
+    std::vector<User> users(clients);
+    for (long c = 0; c < clients; ++c) {
+        std::ostringstream nick;
+        nick << "ch" << c;
+        if (!connectUser(port, password, nick.str(), users[c])) {
+            std::fprintf(stderr, "churn_bench: cannot register %s\n", nick.str().c_str());
+            return 1;
+        }
+    }
+
+    const char* names[] = { "locked", "churn", "spray" };
+    long perUser = count / clients;
+    std::printf("start channels=%ld rss_kb=%ld\n", countChannels(users[0]), residentKb(pid));
+    for (int p = LOCKED; p <= SPRAY; ++p) {
+        Phase phase = static_cast<Phase>(p);
+        Tally tally = { 0, 0, 0 };
+        long long start = nowNs();
+        for (long i = 0; i < perUser; i += BATCH) {
+            long end = i + BATCH < perUser ? i + BATCH : perUser;
+            for (long c = 0; c < clients; ++c) {
+                std::string batch;
+                for (long n = i; n < end; ++n) {
+                    // Users take turns over the locked names
+                    batch += opFor(phase, users[c], phase == LOCKED ? n * clients + c : n);
+                }
+                if (!sendAll(users[c].fd, batch)) {
+                    std::fprintf(stderr, "churn_bench: send failed\n");
+                    return 1;
+                }
+            }
+            for (long c = 0; c < clients; ++c) {
+                if (!settle(users[c], phase, end - i, tally)) {
+                    std::fprintf(stderr, "churn_bench: %s: connection lost or stalled\n", names[p]);
+                    return 1;
+                }
+            }
+        }
+        double ms = (nowNs() - start) / 1e6;
+        std::printf("%s ops=%ld ms=%.0f joined=%ld refused=%ld rejected=%ld channels=%ld rss_kb=%ld\n",
+                    names[p], perUser * clients, ms, tally.joined, tally.refused, tally.rejected,
+                    countChannels(users[0]), residentKb(pid));
+    }
+    for (long c = 0; c < clients; ++c) {
+        close(users[c].fd);
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#!/bin/bash
+# 保存済みのチャンネルを用意してから、作成数の上限なしと既定の上限で
+# ircserv を起動し、churn_bench を回して比べる。
+# 使い方: bench/churn_bench.sh [clients] [count]
+#   (リポジトリのルートで、make bench の後)
+
+CLIENTS=${1:-20}
+COUNT=${2:-20000}
+PASSWORD=benchpass
+PORT=6668
+DIR=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$DIR"' EXIT
+
+# 鍵付きのチャンネルを作り、メンバーがいるうちにサーバを止めてストアに残す
+./ircserv $PORT $PASSWORD --channel-db="$DIR/seed.chandb" --channel-create-rate=0 \
+    --channel-create-rate-global=0 > "$DIR/seed.log" 2>&1 &
+SERVER=$!
+sleep 0.5
+./bench/churn_bench $PASSWORD $PORT seed 1 "$COUNT" > "$DIR/seed.out" &
+until grep -q seeded "$DIR/seed.out" 2>/dev/null; do sleep 0.2; done
+kill $SERVER
+wait 2>/dev/null
+
+for MODE in unlimited default; do
+    OPTIONS=""
+    if [ "$MODE" = unlimited ]; then
+        OPTIONS="--channel-create-rate=0 --channel-create-rate-global=0"
+    fi
+    cp "$DIR/seed.chandb" "$DIR/$MODE.chandb"
+    ./ircserv $PORT $PASSWORD --channel-db="$DIR/$MODE.chandb" --history-lines=0 $OPTIONS > "$DIR/$MODE.log" 2>&1 &
+    SERVER=$!
+    sleep 0.5
+    echo "== $MODE"
+    ./bench/churn_bench $PASSWORD $PORT churn "$CLIENTS" "$COUNT" $SERVER
+    kill $SERVER
+    wait 2>/dev/null
+done
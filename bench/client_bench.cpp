@@ -0,0 +1,106 @@
+// Resident memory per connection.
+//
+//   client_bench [clients] [hosts]
+//
+// Attaches clients to a Server without sockets (see micro_bench.cpp),
+// registers each through PASS/NICK/USER with a typical real name and
+// joins it to two of about two thousand channels. Everything sent is
+// thrown away as it would be read, then the bench reports how much the
+// process grew per client, and what the clients account for themselves.
+// The clients come from `hosts` distinct hostnames, like users behind a
+// few NAT gateways. Prints JSON on stdout.
+
+#include "../Server.hpp"
+#include "../Client.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unistd.h>
+
+volatile sig_atomic_t g_shutdown_requested = 0;
+volatile sig_atomic_t g_upgrade_requested = 0;
+volatile sig_atomic_t g_reload_requested = 0;
+
+namespace {
+
+const int FIRST_FAKE_FD = 1 << 24;
+
+long residentBytes() {
+    long pages = 0;
+    long resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+// As if every client had read what it was sent (channel members see
+// each other join), so that the figure is that of idle connections
+void discardOutput(Server& server) {
+    const std::map<int, Client*>& clients = server.getClients();
+    for (std::map<int, Client*>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+        it->second->clearSendBuffer(it->second->getSendQueue().size());
+    }
+}
+
+std::string hostFor(long n) {
+    std::ostringstream oss;
+    oss << "gw" << n << ".nat.pool.example.net";
+    return oss.str();
+}
+
+}
+
+int main(int argc, char** argv) {
+    long clients = (argc > 1) ? std::atol(argv[1]) : 20000;
+    long hosts = (argc > 2) ? std::atol(argv[2]) : 100;
+    if (clients <= 0 || hosts <= 0) {
+        std::fprintf(stderr, "Usage: %s [clients] [hosts]\n", argv[0]);
+        return 1;
+    }
+
+    std::ofstream devnull("/dev/null");
+    std::streambuf* saved = std::cout.rdbuf(devnull.rdbuf());
+
+    ServerConfig config;
+    config.password = "bench";
+    config.channelDb = "";
+    config.historyLines = 0;
+    long before = 0;
+    long after = 0;
+    size_t accounted = 0;
+    try {
+        Server server(config);
+        before = residentBytes();
+        for (long i = 0; i < clients; ++i) {
+            int fd = FIRST_FAKE_FD + static_cast<int>(i);
+            Client* client = server.adoptClient(fd, hostFor(i % hosts));
+            std::ostringstream lines;
+            lines << "PASS bench\r\nNICK user" << i << "\r\nUSER ident" << i
+                  << " 0 * :Firstname Lastname of somewhere\r\nJOIN #chan" << (i % 1000) << ",#room" << (i % 997) << "\r\n";
+            server.receive(fd, lines.str());
+            client->clearSendBuffer(client->getSendQueue().size());
+            if (i % 256 == 255 || i + 1 == clients) {
+                discardOutput(server);
+            }
+        }
+        after = residentBytes();
+        const std::map<int, Client*>& all = server.getClients();
+        for (std::map<int, Client*>::const_iterator it = all.begin(); it != all.end(); ++it) {
+            accounted += it->second->memoryUsage();
+        }
+    } catch (const std::exception& e) {
+        std::cout.rdbuf(saved);
+        std::fprintf(stderr, "client_bench: %s\n", e.what());
+        return 1;
+    }
+    std::cout.rdbuf(saved);
+
+    std::printf("{\"clients\": %ld, \"hosts\": %ld, \"sizeof_client\": %lu, \"rss_per_client\": %.0f, \"accounted_per_client\": %.0f}\n",
+                clients, hosts, static_cast<unsigned long>(sizeof(Client)),
+                static_cast<double>(after - before) / clients, static_cast<double>(accounted) / clients);
+    return 0;
+}
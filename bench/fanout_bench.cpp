@@ -0,0 +1,125 @@
+// Broadcast latency against channel size and fan-out thread count.
+//
+//   fanout_bench [iterations]
+//
+// For channels of 1k, 10k and 100k members, times Channel::broadcast with
+// 1 (inline on the calling thread), 2, 4, 8 and 16 threads. Members are
+// attached on descriptor numbers no socket uses, as in micro_bench, and
+// their send queues are emptied between broadcasts outside the timing.
+// Prints one JSON object on stdout; a summary table goes to stderr.
+
+#include "../Server.hpp"
+#include "../Client.hpp"
+#include "../Channel.hpp"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+volatile sig_atomic_t g_shutdown_requested = 0;
+volatile sig_atomic_t g_upgrade_requested = 0;
+volatile sig_atomic_t g_reload_requested = 0;
+
+namespace {
+
+const int FIRST_FAKE_FD = 1 << 24;
+
+struct Result {
+    size_t members;
+    size_t threads;
+    double meanUs;
+    double p99Us;
+};
+
+double nowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+Result run(size_t members, size_t threads, int iterations) {
+    ServerConfig config;
+    config.password = "bench";
+    config.channelDb = "";
+    config.historyLines = 0;
+    config.fanoutThreads = threads - 1;
+    config.fanoutThreshold = 1;
+    Server server(config);
+
+    Channel* channel = server.getOrCreateChannel("#bench");
+    std::vector<Client*> users;
+    for (size_t i = 0; i < members; ++i) {
+        int fd = FIRST_FAKE_FD + static_cast<int>(i);
+        Client* client = server.adoptClient(fd, "127.0.0.1");
+        std::ostringstream nick;
+        nick << "u" << i;
+        client->setNickname(nick.str());
+        client->setHasRegistered(true);
+        server.addClientToChannel(client, channel);
+        users.push_back(client);
+    }
+
+    const std::string message = ":u0!u0@127.0.0.1 PRIVMSG #bench :hello everybody in this channel\r\n";
+    std::vector<double> samples;
+    for (int i = 0; i < iterations; ++i) {
+        double start = nowSec();
+        channel->broadcast(message, users[0]->getFd());
+        samples.push_back(nowSec() - start);
+        for (size_t u = 0; u < users.size(); ++u) {
+            users[u]->clearSendBuffer(users[u]->getSendQueue().size());
+        }
+    }
+
+    std::sort(samples.begin(), samples.end());
+    double total = 0;
+    for (size_t i = 0; i < samples.size(); ++i) total += samples[i];
+    Result r;
+    r.members = members;
+    r.threads = threads;
+    r.meanUs = total / samples.size() * 1e6;
+    r.p99Us = samples[samples.size() * 99 / 100] * 1e6;
+    return r;
+}
+
+}
+
+int main(int argc, char** argv) {
+    int iterations = (argc > 1) ? std::atoi(argv[1]) : 50;
+    if (iterations <= 0) {
+        std::fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    std::ofstream devnull("/dev/null");
+    std::streambuf* saved = std::cout.rdbuf(devnull.rdbuf());
+
+    static const size_t sizes[] = { 1000, 10000, 100000 };
+    static const size_t threadCounts[] = { 1, 2, 4, 8, 16 };
+    std::vector<Result> results;
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]); ++t) {
+            Result r = run(sizes[s], threadCounts[t], iterations);
+            std::fprintf(stderr, "members=%-7lu threads=%-3lu mean=%10.1fus p99=%10.1fus\n",
+                         static_cast<unsigned long>(r.members), static_cast<unsigned long>(r.threads),
+                         r.meanUs, r.p99Us);
+            results.push_back(r);
+        }
+    }
+    std::cout.rdbuf(saved);
+
+    std::printf("{\n  \"iterations\": %d,\n  \"broadcasts\": [\n", iterations);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::printf("    {\"members\": %lu, \"threads\": %lu, \"mean_us\": %.1f, \"p99_us\": %.1f}%s\n",
+                    static_cast<unsigned long>(r.members), static_cast<unsigned long>(r.threads),
+                    r.meanUs, r.p99Us, (i + 1 < results.size()) ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
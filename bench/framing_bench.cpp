@@ -0,0 +1,224 @@
+// Line framing throughput.
+//
+//   framing_bench [megabytes] [rounds]
+//
+// Checks the scanner on hand-made cases (forbidden bytes, CR split from its
+// LF, lines over the limit), then fills a buffer with client-like lines (a
+// mix of "\r\n" and bare "\n" endings, 20 to 400 bytes long, one in 64
+// carrying a forbidden byte and one in 64 too long). First times the raw scan over the whole
+// buffer, scalar against scanLineBreaks as built (AVX2/SSE2 when the
+// compiler targets them). Then frames it the way the server does, fed in
+// recv()-sized blocks: the old find("\r\n") + erase per line against one
+// scan per block and a single erase, counting the lines dropped and the
+// lines answered with ERR_INPUTTOOLONG.
+
+#include "../LineScanner.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <sys/time.h>
+
+#define MAX_LINE_LENGTH 510
+
+namespace {
+
+long long nowUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<long long>(tv.tv_sec) * 1000000LL + tv.tv_usec;
+}
+
+std::string makeInput(size_t bytes) {
+    static const char* const verbs[] = { "PRIVMSG #bench :", "NOTICE someone :", "PING :", "MODE #bench +o " };
+    std::string out;
+    out.reserve(bytes + 512);
+    unsigned int seed = 12345;
+    while (out.size() < bytes) {
+        seed = seed * 1103515245u + 12345u;
+        out += verbs[(seed >> 16) % 4];
+        size_t body = 20 + (seed >> 8) % 380;
+        if (((seed >> 20) & 63) == 1) body = 600;
+        for (size_t i = 0; i < body; ++i) {
+            out += static_cast<char>('a' + (i * 7 + seed) % 26);
+        }
+        if (((seed >> 20) & 63) == 2) out[out.size() - body / 2] = ((seed >> 5) & 1) ? '\r' : '\x07';
+        out += ((seed >> 4) & 1) ? "\r\n" : "\n";
+    }
+    return out;
+}
+
+#define RECV_BLOCK 16384
+
+// The framing loop ircserv used before: find and erase once per line, CRLF only
+size_t framePerLine(const std::string& input) {
+    std::string buf;
+    size_t lines = 0;
+    for (size_t off = 0; off < input.size(); off += RECV_BLOCK) {
+        buf.append(input, off, RECV_BLOCK);
+        while (true) {
+            size_t crlf = buf.find("\r\n");
+            if (crlf == std::string::npos) break;
+            std::string line = buf.substr(0, crlf);
+            buf.erase(0, crlf + 2);
+            lines += !line.empty();
+        }
+    }
+    return lines;
+}
+
+struct Framed {
+    size_t lines;
+    size_t dropped;
+    size_t tooLong;
+};
+
+// One call of Server::_processRecvBuffer, without the command dispatch
+void frameBuffer(std::string& buf, size_t& scanned, std::vector<uint32_t>& marks, Framed& framed) {
+    marks.clear();
+    scanLineBreaks(buf.data() + scanned, buf.size() - scanned, marks);
+    size_t start = 0;
+    bool forbidden = false;
+    for (size_t m = 0; m < marks.size(); ++m) {
+        if (marks[m] & LINE_SCAN_FORBIDDEN) {
+            forbidden = true;
+            continue;
+        }
+        size_t end = scanned + marks[m];
+        size_t lineEnd = (end > start && buf[end - 1] == '\r') ? end - 1 : end;
+        if (forbidden) {
+            ++framed.dropped;
+        } else if (lineEnd - start > MAX_LINE_LENGTH) {
+            ++framed.tooLong;
+        } else {
+            std::string line = buf.substr(start, lineEnd - start);
+            framed.lines += !line.empty();
+        }
+        start = end + 1;
+        forbidden = false;
+    }
+    buf.erase(0, start);
+    if (forbidden) {
+        scanned = 0;
+    } else {
+        scanned = (!buf.empty() && buf[buf.size() - 1] == '\r') ? buf.size() - 1 : buf.size();
+    }
+}
+
+Framed frameScanned(const std::string& input, std::vector<uint32_t>& marks) {
+    std::string buf;
+    size_t scanned = 0;
+    Framed framed = { 0, 0, 0 };
+    for (size_t off = 0; off < input.size(); off += RECV_BLOCK) {
+        buf.append(input, off, RECV_BLOCK);
+        frameBuffer(buf, scanned, marks, framed);
+    }
+    return framed;
+}
+
+struct Case {
+    const char* name;
+    std::string input;
+    size_t lines;
+    size_t dropped;
+    size_t tooLong;
+};
+
+// The hand-made cases, each framed whole and split at every byte, and
+// scanned with both scanners
+bool checkCases() {
+    std::string longLine(MAX_LINE_LENGTH + 1, 'x');
+    std::string padding(40, 'p');
+    Case cases[] = {
+        { "crlf and lf", "PING :a\r\nPING :b\nPING :c\r\n", 3, 0, 0 },
+        { "nul", std::string("PING :a\0b\r\nPING :c\r\n", 20), 1, 1, 0 },
+        { "cr inside", "PRIVMSG #a :x\ry\r\nPING :c\n", 1, 1, 0 },
+        { "cr doubled", "PING :a\r\r\nPING :b\r\n", 1, 1, 0 },
+        { "bell", padding + "\x07\r\n" + padding + "\r\n", 1, 1, 0 },
+        { "formatting", "PRIVMSG #a :\x01" "ACTION \x02" "b\x03" "4c\x0f\x1d\x1f\t\x01\r\n", 1, 0, 0 },
+        { "too long", longLine + "\r\n" + longLine.substr(1) + "\r\n", 1, 0, 1 },
+    };
+    bool ok = true;
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); ++c) {
+        const Case& test = cases[c];
+        std::vector<uint32_t> simd;
+        std::vector<uint32_t> scalar;
+        scanLineBreaks(test.input.data(), test.input.size(), simd);
+        scanLineBreaksScalar(test.input.data(), test.input.size(), scalar);
+        bool same = simd == scalar;
+        bool split = true;
+        for (size_t cut = 0; cut <= test.input.size(); ++cut) {
+            std::string buf = test.input.substr(0, cut);
+            size_t scanned = 0;
+            Framed framed = { 0, 0, 0 };
+            frameBuffer(buf, scanned, simd, framed);
+            buf += test.input.substr(cut);
+            frameBuffer(buf, scanned, simd, framed);
+            split = split && framed.lines == test.lines && framed.dropped == test.dropped
+                && framed.tooLong == test.tooLong;
+        }
+        std::printf("check %-12s %s\n", test.name, same && split ? "ok" : "FAILED");
+        ok = ok && same && split;
+    }
+    return ok;
+}
+
+void report(const char* name, size_t bytes, int rounds, long long elapsedUs, size_t lines) {
+    double gbps = static_cast<double>(bytes) * rounds / (elapsedUs / 1e6) / 1e9;
+    std::printf("%-8s %8.2f GB/s  %lu lines/round\n", name, gbps, static_cast<unsigned long>(lines));
+}
+
+}
+
+int main(int argc, char** argv) {
+    size_t megabytes = (argc > 1) ? std::strtoul(argv[1], NULL, 10) : 64;
+    int rounds = (argc > 2) ? std::atoi(argv[2]) : 20;
+    if (megabytes == 0 || megabytes >= 2048 || rounds <= 0) {
+        std::fprintf(stderr, "Usage: %s [megabytes (1-2047)] [rounds]\n", argv[0]);
+        return 1;
+    }
+    if (!checkCases()) return 1;
+    std::string input = makeInput(megabytes << 20);
+    std::vector<uint32_t> marks;
+    marks.reserve(input.size() / 16);
+
+#if defined(__AVX2__)
+    const char* simd = "avx2";
+#elif defined(__SSE2__)
+    const char* simd = "sse2";
+#else
+    const char* simd = "scalar";
+#endif
+    std::printf("input=%lu bytes rounds=%d scanner=%s\n", static_cast<unsigned long>(input.size()), rounds, simd);
+
+    long long start = nowUs();
+    for (int r = 0; r < rounds; ++r) {
+        marks.clear();
+        scanLineBreaksScalar(input.data(), input.size(), marks);
+    }
+    report("scalar", input.size(), rounds, nowUs() - start, marks.size());
+
+    start = nowUs();
+    for (int r = 0; r < rounds; ++r) {
+        marks.clear();
+        scanLineBreaks(input.data(), input.size(), marks);
+    }
+    report(simd, input.size(), rounds, nowUs() - start, marks.size());
+
+    size_t lines = 0;
+    start = nowUs();
+    for (int r = 0; r < rounds; ++r) {
+        lines = framePerLine(input);
+    }
+    report("old", input.size(), rounds, nowUs() - start, lines);
+
+    Framed framed = { 0, 0, 0 };
+    start = nowUs();
+    for (int r = 0; r < rounds; ++r) {
+        framed = frameScanned(input, marks);
+    }
+    report("new", input.size(), rounds, nowUs() - start, framed.lines);
+    std::printf("new      dropped %lu, too long %lu per round\n",
+                static_cast<unsigned long>(framed.dropped), static_cast<unsigned long>(framed.tooLong));
+    return 0;
+}
@@ -0,0 +1,184 @@
+// Cross-thread delivery into one client under producer contention.
+//
+//   inbox_bench [messages per producer]
+//
+// 1, 2, 4 and 8 producer threads post lines to a single inbox while a
+// consumer thread, standing in for the event loop, sleeps on an eventfd
+// and drains whenever woken. Producers write the eventfd only when they
+// are the first to announce the inbox since the last drain, as
+// Server::postFromThread does. The same run is repeated with a
+// mutex-guarded deque in place of MessageInbox for comparison.
+// Prints one JSON object on stdout; a summary goes to stderr.
+
+#include "../MessageInbox.hpp"
+#include "../SendQueue.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+const std::string LINE = ":someone!user@host PRIVMSG #channel :a line of typical length\r\n";
+
+double nowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The baseline: one lock around a deque, plus the same announcement flag
+class LockedInbox {
+public:
+    LockedInbox() : _signalled(false) { pthread_mutex_init(&_mutex, NULL); }
+    ~LockedInbox() { pthread_mutex_destroy(&_mutex); }
+
+    bool pushAndMark(SharedMessage* message) {
+        pthread_mutex_lock(&_mutex);
+        _queue.push_back(message);
+        bool first = !_signalled;
+        _signalled = true;
+        pthread_mutex_unlock(&_mutex);
+        return first;
+    }
+
+    size_t drainInto(SendQueue& out) {
+        pthread_mutex_lock(&_mutex);
+        std::deque<SharedMessage*> taken;
+        taken.swap(_queue);
+        _signalled = false;
+        pthread_mutex_unlock(&_mutex);
+        for (size_t i = 0; i < taken.size(); ++i) {
+            out.append(taken[i]);
+        }
+        return taken.size();
+    }
+
+private:
+    pthread_mutex_t _mutex;
+    std::deque<SharedMessage*> _queue;
+    bool _signalled;
+};
+
+struct Run {
+    bool lockFree;
+    long perProducer;
+    int wakeFd;
+    int wakePending;
+    long wakeWrites;
+    MessageInbox inbox;
+    LockedInbox locked;
+};
+
+void announce(Run& run) {
+    if (__atomic_exchange_n(&run.wakePending, 1, __ATOMIC_ACQ_REL) == 0) {
+        __atomic_add_fetch(&run.wakeWrites, 1, __ATOMIC_RELAXED);
+        uint64_t one = 1;
+        ssize_t written = write(run.wakeFd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+void* producer(void* arg) {
+    Run& run = *static_cast<Run*>(arg);
+    for (long i = 0; i < run.perProducer; ++i) {
+        SharedMessage* message = SharedMessage::create(LINE, 1);
+        bool first;
+        if (run.lockFree) {
+            run.inbox.push(message);
+            first = run.inbox.markSignalled();
+        } else {
+            first = run.locked.pushAndMark(message);
+        }
+        if (first) announce(run);
+    }
+    return NULL;
+}
+
+struct Result {
+    const char* queue;
+    int producers;
+    long messages;
+    double seconds;
+    long wakeups;
+};
+
+Result measure(bool lockFree, int producers, long perProducer) {
+    Run run;
+    run.lockFree = lockFree;
+    run.perProducer = perProducer;
+    run.wakeFd = eventfd(0, EFD_CLOEXEC);
+    run.wakePending = 0;
+    run.wakeWrites = 0;
+
+    long expected = perProducer * producers;
+    long received = 0;
+    long wakeups = 0;
+    SendQueue sendQueue;
+    std::vector<pthread_t> threads(producers);
+
+    double start = nowSec();
+    for (int p = 0; p < producers; ++p) {
+        pthread_create(&threads[p], NULL, producer, &run);
+    }
+    while (received < expected) {
+        uint64_t count;
+        ssize_t got = read(run.wakeFd, &count, sizeof(count));
+        (void)got;
+        ++wakeups;
+        __atomic_store_n(&run.wakePending, 0, __ATOMIC_SEQ_CST);
+        received += lockFree ? run.inbox.drainInto(sendQueue) : run.locked.drainInto(sendQueue);
+        sendQueue.clear();
+    }
+    double elapsed = nowSec() - start;
+    for (int p = 0; p < producers; ++p) {
+        pthread_join(threads[p], NULL);
+    }
+    close(run.wakeFd);
+
+    Result r;
+    r.queue = lockFree ? "mpsc" : "mutex";
+    r.producers = producers;
+    r.messages = expected;
+    r.seconds = elapsed;
+    r.wakeups = wakeups;
+    return r;
+}
+
+}
+
+int main(int argc, char** argv) {
+    long perProducer = (argc > 1) ? std::atol(argv[1]) : 200000;
+    if (perProducer <= 0) {
+        std::fprintf(stderr, "Usage: %s [messages per producer]\n", argv[0]);
+        return 1;
+    }
+
+    static const int producerCounts[] = { 1, 2, 4, 8 };
+    std::vector<Result> results;
+    for (int lockFree = 1; lockFree >= 0; --lockFree) {
+        for (size_t i = 0; i < sizeof(producerCounts) / sizeof(producerCounts[0]); ++i) {
+            Result r = measure(lockFree != 0, producerCounts[i], perProducer);
+            std::fprintf(stderr, "%-6s producers=%d %10.0f msg/s  %6.1f msg/wakeup\n", r.queue, r.producers,
+                         r.messages / r.seconds, static_cast<double>(r.messages) / r.wakeups);
+            results.push_back(r);
+        }
+    }
+
+    std::printf("{\n  \"messages_per_producer\": %ld,\n  \"runs\": [\n", perProducer);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        std::printf("    {\"queue\": \"%s\", \"producers\": %d, \"messages\": %ld, \"seconds\": %.6f, "
+                    "\"messages_per_sec\": %.0f, \"wakeups\": %ld}%s\n",
+                    r.queue, r.producers, r.messages, r.seconds, r.messages / r.seconds, r.wakeups,
+                    (i + 1 < results.size()) ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Round-trip latency of single messages through an idle ircserv.
+//
+//   latency_bench <password> <port> [messages] [gap_us]
+//
+// Registers two users; the first sends <messages> PRIVMSGs to the second,
+// one at a time, each only after the previous one arrived and <gap_us> more
+// have passed. The server has gone back to sleep in between, so every
+// message measures the wakeup path as well as the command itself.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define RECV_TIMEOUT_S 5
+
+namespace {
+
+long long nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval tv;
+    tv.tv_sec = RECV_TIMEOUT_S;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    return fd;
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, 0);
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Blocking read until a line containing <needle> arrives
+bool waitFor(int fd, std::string& in, const std::string& needle) {
+    for (;;) {
+        size_t pos;
+        while ((pos = in.find("\r\n")) != std::string::npos) {
+            bool found = in.substr(0, pos).find(needle) != std::string::npos;
+            in.erase(0, pos + 2);
+            if (found) return true;
+        }
+        char buf[4096];
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) return false;
+        in.append(buf, n);
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <password> <port> [messages] [gap_us]\n", argv[0]);
+        return 1;
+    }
+    std::string password = argv[1];
+    int port = std::atoi(argv[2]);
+    long messages = (argc > 3) ? std::atol(argv[3]) : 5000;
+    long gapUs = (argc > 4) ? std::atol(argv[4]) : 200;
+    if (messages <= 0 || gapUs < 0) {
+        std::fprintf(stderr, "latency_bench: messages must be > 0 and gap_us >= 0\n");
+        return 1;
+    }
+
+    int fds[2];
+    std::string in[2];
+    for (int i = 0; i < 2; ++i) {
+        fds[i] = connectTo(port);
+        if (fds[i] < 0) {
+            std::fprintf(stderr, "latency_bench: cannot connect to port %d\n", port);
+            return 1;
+        }
+        std::ostringstream reg;
+        reg << "PASS " << password << "\r\nNICK lat" << i << "\r\nUSER lat" << i << " 0 * :bench\r\n";
+        if (!sendAll(fds[i], reg.str()) || !waitFor(fds[i], in[i], " 001 ")) {
+            std::fprintf(stderr, "latency_bench: registration failed\n");
+            return 1;
+        }
+    }
+
+    std::vector<long> latencies;
+    latencies.reserve(static_cast<size_t>(messages));
+    struct timespec gap;
+    gap.tv_sec = gapUs / 1000000;
+    gap.tv_nsec = (gapUs % 1000000) * 1000;
+    for (long i = 0; i < messages; ++i) {
+        if (gapUs > 0) nanosleep(&gap, NULL);
+        std::ostringstream msg;
+        msg << "PRIVMSG lat1 :p " << i << "\r\n";
+        std::ostringstream tag;
+        tag << ":p " << i;
+        long long start = nowNs();
+        if (!sendAll(fds[0], msg.str()) || !waitFor(fds[1], in[1], tag.str())) {
+            std::fprintf(stderr, "latency_bench: message %ld lost\n", i);
+            return 1;
+        }
+        latencies.push_back(static_cast<long>((nowNs() - start) / 1000));
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("messages=%ld gap=%ldus p50=%ldus p90=%ldus p99=%ldus max=%ldus\n",
+                messages, gapUs, latencies[latencies.size() / 2], latencies[latencies.size() * 90 / 100],
+                latencies[latencies.size() * 99 / 100], latencies.back());
+
+    close(fds[0]);
+    close(fds[1]);
+    return 0;
+}
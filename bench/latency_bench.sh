@@ -0,0 +1,26 @@
+#!/bin/bash
+# 既定のモードと --busy-poll で ircserv を起動し、latency_bench を回して比べる。
+# 使い方: bench/latency_bench.sh [messages] [gap_us] [busy_poll_us] [reactor_cpu]
+#   (リポジトリのルートで、make bench の後)
+
+MESSAGES=${1:-5000}
+GAP=${2:-200}
+BUSY_POLL=${3:-50}
+CPU=${4:-}
+PASSWORD=benchpass
+PORT=6665
+DIR=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$DIR"' EXIT
+
+for MODE in default busy-poll; do
+    OPTIONS=""
+    if [ "$MODE" = busy-poll ]; then
+        OPTIONS="--busy-poll=$BUSY_POLL${CPU:+ --reactor-cpu=$CPU}"
+    fi
+    ./ircserv $PORT $PASSWORD --channel-db= --history-lines=0 $OPTIONS > "$DIR/$MODE.log" 2>&1 &
+    sleep 0.5
+    echo -n "$MODE: "
+    ./bench/latency_bench $PASSWORD $PORT "$MESSAGES" "$GAP"
+    kill $(jobs -p) 2>/dev/null
+    wait 2>/dev/null
+done
@@ -0,0 +1,256 @@
+// Load generator for one or more linked ircserv processes.
+//
+//   link_bench <password> <port>[,<port>...] [clients] [messages]
+//
+// Spreads <clients> users round-robin over the ports, joins them all to
+// #bench, then lets the first user on every port send <messages> channel
+// messages. Every message carries its send time, so each receiver records
+// the end-to-end latency; throughput counts deliveries to all receivers.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define BENCH_CHANNEL "#bench"
+#define SEND_BATCH 32
+#define RUN_TIMEOUT_US 60000000LL
+
+namespace {
+
+struct Conn {
+    int fd;
+    int port;
+    std::string in;
+    std::string out;
+    bool joined;
+    bool sender;
+    long sent;
+    long received;
+};
+
+long long nowUs() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<long long>(tv.tv_sec) * 1000000LL + tv.tv_usec;
+}
+
+int connectTo(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+std::vector<int> parsePorts(const std::string& list) {
+    std::vector<int> ports;
+    std::istringstream iss(list);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (!item.empty()) ports.push_back(std::atoi(item.c_str()));
+    }
+    return ports;
+}
+
+// One poll() round: write what is queued, read what arrived. Returns false
+// when a connection was lost.
+bool pump(std::vector<Conn>& conns, int timeoutMs) {
+    std::vector<struct pollfd> pfds(conns.size());
+    for (size_t i = 0; i < conns.size(); ++i) {
+        pfds[i].fd = conns[i].fd;
+        pfds[i].events = POLLIN | (conns[i].out.empty() ? 0 : POLLOUT);
+        pfds[i].revents = 0;
+    }
+    if (poll(&pfds[0], pfds.size(), timeoutMs) < 0 && errno != EINTR) return false;
+
+    for (size_t i = 0; i < conns.size(); ++i) {
+        Conn& c = conns[i];
+        if (pfds[i].revents & (POLLERR | POLLHUP)) return false;
+        if ((pfds[i].revents & POLLOUT) && !c.out.empty()) {
+            ssize_t n = send(c.fd, c.out.data(), c.out.size(), 0);
+            if (n > 0) c.out.erase(0, n);
+        }
+        if (pfds[i].revents & POLLIN) {
+            char buf[65536];
+            ssize_t n;
+            while ((n = recv(c.fd, buf, sizeof(buf), 0)) > 0) {
+                c.in.append(buf, n);
+            }
+            if (n == 0) return false;
+        }
+    }
+    return true;
+}
+
+bool nextLine(Conn& c, std::string& line) {
+    size_t pos = c.in.find("\r\n");
+    if (pos == std::string::npos) return false;
+    line = c.in.substr(0, pos);
+    c.in.erase(0, pos + 2);
+    return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <password> <port>[,<port>...] [clients] [messages]\n", argv[0]);
+        return 1;
+    }
+    std::string password = argv[1];
+    std::vector<int> ports = parsePorts(argv[2]);
+    int clients = (argc > 3) ? std::atoi(argv[3]) : 40;
+    long messages = (argc > 4) ? std::atol(argv[4]) : 2000;
+    if (ports.empty() || clients < static_cast<int>(ports.size()) + 1 || messages <= 0) {
+        std::fprintf(stderr, "link_bench: need at least one more client than ports, and messages > 0\n");
+        return 1;
+    }
+
+    std::vector<Conn> conns(clients);
+    for (int i = 0; i < clients; ++i) {
+        Conn& c = conns[i];
+        c.port = ports[i % ports.size()];
+        c.fd = connectTo(c.port);
+        if (c.fd < 0) {
+            std::fprintf(stderr, "link_bench: cannot connect to port %d\n", c.port);
+            return 1;
+        }
+        c.joined = false;
+        c.sender = i < static_cast<int>(ports.size());
+        c.sent = 0;
+        c.received = 0;
+        std::ostringstream reg;
+        reg << "PASS " << password << "\r\nNICK b" << i << "\r\nUSER b" << i << " 0 * :bench\r\nJOIN " << BENCH_CHANNEL << "\r\n";
+        c.out = reg.str();
+    }
+
+    // Wait for every JOIN, then for one probe from each sender to reach
+    // everybody: only then has the membership crossed all links
+    int joined = 0;
+    long long deadline = nowUs() + 10000000LL;
+    while (joined < clients) {
+        if (!pump(conns, 100) || nowUs() > deadline) {
+            std::fprintf(stderr, "link_bench: registration failed (%d/%d joined)\n", joined, clients);
+            return 1;
+        }
+        for (size_t i = 0; i < conns.size(); ++i) {
+            std::string line;
+            while (nextLine(conns[i], line)) {
+                if (!conns[i].joined && line.find(" 366 ") != std::string::npos) {
+                    conns[i].joined = true;
+                    ++joined;
+                }
+            }
+        }
+    }
+    for (int round = 0;; ++round) {
+        if (round == 100) {
+            std::fprintf(stderr, "link_bench: channel never converged across links\n");
+            return 1;
+        }
+        std::ostringstream probe;
+        probe << "PRIVMSG " << BENCH_CHANNEL << " :sync " << round << "\r\n";
+        for (size_t i = 0; i < conns.size(); ++i) {
+            if (conns[i].sender) conns[i].out += probe.str();
+        }
+        std::ostringstream tag;
+        tag << ":sync " << round;
+        std::vector<size_t> seen(conns.size(), 0);
+        long long until = nowUs() + 200000LL;
+        while (nowUs() < until) {
+            if (!pump(conns, 20)) return 1;
+            for (size_t i = 0; i < conns.size(); ++i) {
+                std::string line;
+                while (nextLine(conns[i], line)) {
+                    if (line.find(tag.str()) != std::string::npos) ++seen[i];
+                }
+            }
+        }
+        bool converged = true;
+        for (size_t i = 0; i < conns.size(); ++i) {
+            size_t expected = ports.size() - (conns[i].sender ? 1 : 0);
+            if (seen[i] != expected) converged = false;
+        }
+        if (converged) break;
+    }
+
+    // Measured run
+    long senders = static_cast<long>(ports.size());
+    long long expected = 0;
+    for (size_t i = 0; i < conns.size(); ++i) {
+        expected += (conns[i].sender ? senders - 1 : senders) * messages;
+    }
+    std::vector<long> latencies;
+    latencies.reserve(static_cast<size_t>(expected));
+
+    long long start = nowUs();
+    long long delivered = 0;
+    while (delivered < expected) {
+        long long now = nowUs();
+        if (now - start > RUN_TIMEOUT_US) {
+            std::fprintf(stderr, "link_bench: timed out with %lld/%lld deliveries\n", delivered, expected);
+            return 1;
+        }
+        for (size_t i = 0; i < conns.size(); ++i) {
+            Conn& c = conns[i];
+            if (!c.sender || c.sent >= messages || !c.out.empty()) continue;
+            std::ostringstream batch;
+            for (int b = 0; b < SEND_BATCH && c.sent < messages; ++b, ++c.sent) {
+                batch << "PRIVMSG " << BENCH_CHANNEL << " :t " << now << " " << c.sent << "\r\n";
+            }
+            c.out = batch.str();
+        }
+        if (!pump(conns, 10)) {
+            std::fprintf(stderr, "link_bench: connection lost\n");
+            return 1;
+        }
+        long long recvTime = nowUs();
+        for (size_t i = 0; i < conns.size(); ++i) {
+            std::string line;
+            while (nextLine(conns[i], line)) {
+                size_t pos = line.find(" :t ");
+                if (pos == std::string::npos) continue;
+                latencies.push_back(static_cast<long>(recvTime - std::atoll(line.c_str() + pos + 4)));
+                ++conns[i].received;
+                ++delivered;
+            }
+        }
+    }
+    double elapsed = (nowUs() - start) / 1e6;
+
+    std::sort(latencies.begin(), latencies.end());
+    long p50 = latencies[latencies.size() / 2];
+    long p99 = latencies[latencies.size() * 99 / 100];
+    std::printf("servers=%lu clients=%d messages=%ld deliveries=%lld elapsed=%.3fs "
+                "sent/s=%.0f delivered/s=%.0f p50=%ldus p99=%ldus\n",
+                static_cast<unsigned long>(ports.size()), clients, senders * messages, delivered, elapsed,
+                senders * messages / elapsed, delivered / elapsed, p50, p99);
+
+    for (size_t i = 0; i < conns.size(); ++i) {
+        close(conns[i].fd);
+    }
+    return 0;
+}
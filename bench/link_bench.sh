@@ -0,0 +1,29 @@
+#!/bin/bash
+# 1・2・4 台の ircserv を一直線にリンクして link_bench を回す。
+# 使い方: bench/link_bench.sh [clients] [messages]   (リポジトリのルートで、make bench の後)
+
+CLIENTS=${1:-40}
+MESSAGES=${2:-2000}
+PASSWORD=benchpass
+BASE_PORT=6665
+DIR=$(mktemp -d)
+trap 'kill $(jobs -p) 2>/dev/null; rm -rf "$DIR"' EXIT
+
+for SERVERS in 1 2 4; do
+    PORTS=""
+    for ((i = 0; i < SERVERS; ++i)); do
+        PORT=$((BASE_PORT + i))
+        LINK=""
+        if ((i > 0)); then
+            LINK="--link=127.0.0.1:$((PORT - 1))"
+        fi
+        ./ircserv $PORT $PASSWORD --server-name=bench$i --link-password=benchlink --channel-db= --history-lines=0 $LINK \
+            > "$DIR/server$i.log" 2>&1 &
+        PORTS="$PORTS${PORTS:+,}$PORT"
+        sleep 0.3
+    done
+    sleep 1
+    ./bench/link_bench $PASSWORD "$PORTS" "$CLIENTS" "$MESSAGES"
+    kill $(jobs -p) 2>/dev/null
+    wait 2>/dev/null
+done
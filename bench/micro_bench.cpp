@@ -0,0 +1,380 @@
+// Socket-free microbenchmarks of the server's hot paths.
+//
+//   micro_bench [scale]
+//
+// Builds a Server without starting its event loop and attaches clients on
+// descriptor numbers no socket uses, so nothing is ever sent: replies pile
+// up in the send queues and are thrown away between timed sections. The
+// server's own log goes to /dev/null (its formatting is still paid for).
+// Prints one JSON object on stdout; scale multiplies the iteration counts
+// and the large member counts, so runs to be compared must use the same one.
+// The command handler runs and the PRIVMSG dispatch run also count
+// operator new calls per command.
+
+#include "../Server.hpp"
+#include "../Client.hpp"
+#include "../Channel.hpp"
+#include "../NamesCommand.hpp"
+#include "../ReplyStream.hpp"
+#include "../PrivmsgCommand.hpp"
+#include "../JoinCommand.hpp"
+#include "../PartCommand.hpp"
+#include "../KickCommand.hpp"
+#include "../ModeCommand.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <new>
+
+volatile sig_atomic_t g_shutdown_requested = 0;
+volatile sig_atomic_t g_upgrade_requested = 0;
+volatile sig_atomic_t g_reload_requested = 0;
+
+// Every heap allocation through new; the bench starts no threads
+static unsigned long g_allocations = 0;
+
+void* operator new(std::size_t size) throw(std::bad_alloc) {
+    ++g_allocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) throw() {
+    std::free(p);
+}
+
+namespace {
+
+// Well above any descriptor the process can have open
+const int FIRST_FAKE_FD = 1 << 24;
+int g_nextFd = FIRST_FAKE_FD;
+
+struct Result {
+    std::string name;
+    long ops;
+    double seconds;
+    // Per op, or negative if not counted
+    double allocations;
+};
+
+std::vector<Result> g_results;
+
+double nowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void record(const std::string& name, long ops, double seconds, double allocations = -1) {
+    Result r;
+    r.name = name;
+    r.ops = ops;
+    r.seconds = seconds;
+    r.allocations = allocations;
+    g_results.push_back(r);
+    std::fprintf(stderr, "%-24s %10ld ops %12.1f ns/op", name.c_str(), ops, seconds * 1e9 / ops);
+    if (allocations >= 0) {
+        std::fprintf(stderr, " %8.1f allocs/op", allocations);
+    }
+    std::fprintf(stderr, "\n");
+}
+
+std::string nickFor(int n) {
+    std::ostringstream oss;
+    oss << "u" << n;
+    return oss.str();
+}
+
+// A registered local user, set up directly rather than through PASS/NICK/USER
+Client* addUser(Server& server) {
+    int fd = g_nextFd++;
+    Client* client = server.adoptClient(fd, "127.0.0.1");
+    std::string nick = nickFor(fd - FIRST_FAKE_FD);
+    client->setNickname(nick);
+    client->setUsername(nick);
+    client->setRealname(nick);
+    client->setHasRegistered(true);
+    return client;
+}
+
+Channel* fillChannel(Server& server, const std::string& name, size_t members, std::vector<Client*>& users) {
+    Channel* channel = server.getOrCreateChannel(name);
+    for (size_t i = 0; i < members; ++i) {
+        Client* client = addUser(server);
+        server.addClientToChannel(client, channel);
+        users.push_back(client);
+    }
+    return channel;
+}
+
+void discardOutput(Server& server) {
+    const std::map<int, Client*>& clients = server.getClients();
+    for (std::map<int, Client*>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+        it->second->clearSendBuffer(it->second->getSendQueue().size());
+    }
+}
+
+ServerConfig benchConfig() {
+    ServerConfig config;
+    config.password = "bench";
+    config.channelDb = "";
+    config.historyLines = 0;
+    // The JOIN run creates its channels again on every iteration
+    config.channelCreateRate = 0;
+    config.channelCreateRateGlobal = 0;
+    return config;
+}
+
+void benchParse(long iterations) {
+    const std::string line = "#bench,#other key :the trailing parameter of a typical message";
+    Arena arena;
+    size_t total = 0;
+    double start = nowSec();
+    for (long i = 0; i < iterations; ++i) {
+        CommandArgs args((ArenaAllocator<ArenaString>(arena)));
+        Server::splitArgs(line, 0, args);
+        total += args.size();
+        arena.reset();
+    }
+    double elapsed = nowSec() - start;
+    if (total == 0) std::abort();
+    record("parse_line", iterations, elapsed);
+}
+
+// Framing, parsing and dispatch of PRIVMSG to one user, fed a batch at a time
+void benchDispatch(long iterations) {
+    Server server(benchConfig());
+    Client* sender = addUser(server);
+    Client* target = addUser(server);
+    const long batch = 100;
+    std::string lines;
+    for (long i = 0; i < batch; ++i) {
+        lines += "PRIVMSG " + target->getNickname() + " :hello there\r\n";
+    }
+    double elapsed = 0;
+    unsigned long allocations = 0;
+    long done = 0;
+    for (; done < iterations; done += batch) {
+        unsigned long before = g_allocations;
+        double start = nowSec();
+        server.receive(sender->getFd(), lines);
+        elapsed += nowSec() - start;
+        allocations += g_allocations - before;
+        discardOutput(server);
+    }
+    record("dispatch_privmsg", done, elapsed, static_cast<double>(allocations) / done);
+}
+
+void benchBroadcast(size_t members, long iterations) {
+    Server server(benchConfig());
+    std::vector<Client*> users;
+    Channel* channel = fillChannel(server, "#bench", members, users);
+    const std::string message = ":u0!u0@127.0.0.1 PRIVMSG #bench :hello everybody in this channel\r\n";
+    double elapsed = 0;
+    for (long i = 0; i < iterations; ++i) {
+        double start = nowSec();
+        channel->broadcast(message, users[0]->getFd());
+        elapsed += nowSec() - start;
+        if (users.size() > 1000 || i % 64 == 63) {
+            discardOutput(server);
+        }
+    }
+    std::ostringstream name;
+    name << "broadcast_" << members;
+    record(name.str(), iterations, elapsed);
+}
+
+// JOIN from a new user into a channel that already has `members` users
+void benchJoin(size_t members, long joins) {
+    Server server(benchConfig());
+    std::vector<Client*> users;
+    fillChannel(server, "#big", members, users);
+    std::vector<Client*> joiners;
+    for (long i = 0; i < joins; ++i) {
+        joiners.push_back(addUser(server));
+    }
+    double elapsed = 0;
+    for (long i = 0; i < joins; ++i) {
+        double start = nowSec();
+        server.receive(joiners[i]->getFd(), "JOIN #big\r\n");
+        elapsed += nowSec() - start;
+        discardOutput(server);
+    }
+    std::ostringstream name;
+    name << "join_into_" << members;
+    record(name.str(), joins, elapsed);
+}
+
+// Complete NAMES reply for one channel, including the send-queue pauses
+void benchNames(size_t members, long renders) {
+    Server server(benchConfig());
+    std::vector<Client*> users;
+    Channel* channel = fillChannel(server, "#big", members, users);
+    Client* client = users[0];
+    std::vector<std::string> names(1, channel->getName());
+    double start = nowSec();
+    for (long i = 0; i < renders; ++i) {
+        NamesReplyStream stream(names);
+        while (!stream.resume(server, client)) {
+            client->clearSendBuffer(client->getSendQueue().size());
+        }
+        client->clearSendBuffer(client->getSendQueue().size());
+    }
+    std::ostringstream name;
+    name << "names_" << members;
+    record(name.str(), renders, nowSec() - start);
+}
+
+// Users spread over many shared channels all disconnect; each QUIT reaches
+// every neighbour once
+void benchDisconnect(size_t clients, size_t channels, size_t perClient) {
+    Server server(benchConfig());
+    std::vector<Channel*> chans;
+    for (size_t c = 0; c < channels; ++c) {
+        chans.push_back(server.getOrCreateChannel("#c" + nickFor(static_cast<int>(c))));
+    }
+    std::vector<Client*> users;
+    for (size_t i = 0; i < clients; ++i) {
+        Client* client = addUser(server);
+        for (size_t k = 0; k < perClient; ++k) {
+            server.addClientToChannel(client, chans[(i + k * 7) % channels]);
+        }
+        users.push_back(client);
+    }
+    double elapsed = 0;
+    for (size_t i = 0; i < users.size(); ++i) {
+        int fd = users[i]->getFd();
+        double start = nowSec();
+        server.dropClient(fd);
+        elapsed += nowSec() - start;
+        if (i % 64 == 63) {
+            discardOutput(server);
+        }
+    }
+    std::ostringstream name;
+    name << "disconnect_" << clients;
+    record(name.str(), static_cast<long>(clients), elapsed);
+}
+
+
+// One command line split and handed to its handler directly, without
+// framing or logging, so that the allocations counted are those of the
+// split, the handler and what it sends. undo, if any, runs untimed after
+// each call to restore the state.
+void benchCommand(const std::string& name, Server& server, ICommand& command, Client* client,
+                  const std::string& line, ICommand* undo, const std::string& undoLine, long iterations) {
+    double elapsed = 0;
+    unsigned long allocations = 0;
+    for (long i = 0; i < iterations; ++i) {
+        unsigned long before = g_allocations;
+        double start = nowSec();
+        CommandArgs args((ArenaAllocator<ArenaString>(server.getArena())));
+        Server::splitArgs(line, 0, args);
+        command.execute(server, client, args);
+        elapsed += nowSec() - start;
+        allocations += g_allocations - before;
+        if (undo) {
+            CommandArgs undoArgs((ArenaAllocator<ArenaString>(server.getArena())));
+            Server::splitArgs(undoLine, 0, undoArgs);
+            undo->execute(server, client, undoArgs);
+        }
+        server.getArena().reset();
+        if (i % 64 == 63) {
+            discardOutput(server);
+        }
+    }
+    discardOutput(server);
+    record(name, iterations, elapsed, static_cast<double>(allocations) / iterations);
+}
+
+// Undoes "KICK <channel> <nicks>": puts the users back in the channel
+class RejoinCommand : public ICommand {
+public:
+    RejoinCommand() {}
+    virtual bool requiresRegistration() const { return true; }
+    virtual void execute(Server& server, Client* client, const CommandArgs& args) {
+        (void)client;
+        Channel* channel = server.getChannel(args[1].data(), args[1].size());
+        ArenaVector<ArenaString>::type nicks((ArenaAllocator<ArenaString>(server.getArena())));
+        splitList(args[2], ',', nicks);
+        for (size_t i = 0; i < nicks.size(); ++i) {
+            server.addClientToChannel(server.getClientByNickname(nicks[i].data(), nicks[i].size()), channel);
+        }
+    }
+};
+
+void benchCommands(long iterations) {
+    Server server(benchConfig());
+    std::vector<Client*> users;
+    fillChannel(server, "#alpha", 10, users);
+    fillChannel(server, "#beta", 10, users);
+    fillChannel(server, "#gamma", 10, users);
+    Client* op = users[0];
+    server.addClientToChannel(op, server.getChannel("#beta"));
+    server.addClientToChannel(op, server.getChannel("#gamma"));
+    server.getChannel("#alpha")->addOperator(op->getFd());
+
+    PrivmsgCommand privmsg;
+    JoinCommand join;
+    PartCommand part;
+    KickCommand kick;
+    ModeCommand mode;
+    RejoinCommand rejoin;
+    benchCommand("cmd_privmsg_3_channels", server, privmsg, op,
+                 "PRIVMSG #alpha,#beta,#gamma :hello there", NULL, "", iterations);
+    benchCommand("cmd_join_part_2", server, join, users[1],
+                 "JOIN #delta,#epsilon key1,key2", &part, "PART #delta,#epsilon", iterations / 4);
+    benchCommand("cmd_mode_o_t", server, mode, op,
+                 "MODE #alpha +ot-t " + users[2]->getNickname(), &mode, "MODE #alpha -o " + users[2]->getNickname(), iterations);
+    std::string kickLine = "KICK #alpha " + users[3]->getNickname() + "," + users[4]->getNickname() + " :bye";
+    benchCommand("cmd_kick_2", server, kick, op, kickLine, &rejoin, kickLine, iterations / 4);
+}
+}
+
+int main(int argc, char** argv) {
+    long scale = (argc > 1) ? std::atol(argv[1]) : 1;
+    if (scale <= 0) {
+        std::fprintf(stderr, "Usage: %s [scale]\n", argv[0]);
+        return 1;
+    }
+
+    std::ofstream devnull("/dev/null");
+    std::streambuf* saved = std::cout.rdbuf(devnull.rdbuf());
+
+    try {
+        benchParse(1000000 * scale);
+        benchDispatch(100000 * scale);
+        benchBroadcast(10, 200000 * scale);
+        benchBroadcast(1000, 5000 * scale);
+        benchBroadcast(100000 * scale, 50);
+        benchJoin(10000 * scale, 1000);
+        benchNames(10000 * scale, 200);
+        benchDisconnect(10000 * scale, 100, 5);
+        benchCommands(100000 * scale);
+    } catch (const std::exception& e) {
+        std::cout.rdbuf(saved);
+        std::fprintf(stderr, "micro_bench: %s\n", e.what());
+        return 1;
+    }
+    std::cout.rdbuf(saved);
+
+    std::printf("{\n  \"scale\": %ld,\n  \"benchmarks\": [\n", scale);
+    for (size_t i = 0; i < g_results.size(); ++i) {
+        const Result& r = g_results[i];
+        std::printf("    {\"name\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, \"ns_per_op\": %.1f, \"ops_per_sec\": %.0f",
+                    r.name.c_str(), r.ops, r.seconds, r.seconds * 1e9 / r.ops, r.ops / r.seconds);
+        if (r.allocations >= 0) {
+            std::printf(", \"allocs_per_op\": %.1f", r.allocations);
+        }
+        std::printf("}%s\n", (i + 1 < g_results.size()) ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+// Cost of the registered-nickname registry at scale.
+//
+//   nickdb_bench [nicknames] [dir]
+//
+// Registers <nicknames> nicknames in a registry under <dir> (default /tmp),
+// compacts it, then reopens it and reports how long opening took and how
+// much it made resident (both should not depend on the count), the cost of
+// an ownership check on a cold and a warm mapping, and the cost of opening
+// again with a log tail to replay. Prints JSON on stdout.
+
+#include "../NickRegistry.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+volatile sig_atomic_t g_shutdown_requested = 0;
+volatile sig_atomic_t g_upgrade_requested = 0;
+volatile sig_atomic_t g_reload_requested = 0;
+
+#define LOOKUPS 1000000
+#define TAIL_RECORDS 10000
+
+namespace {
+
+long long nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+long residentBytes() {
+    long pages = 0;
+    long resident = 0;
+    std::ifstream statm("/proc/self/statm");
+    statm >> pages >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+std::string nickFor(long n) {
+    char buffer[16];
+    std::snprintf(buffer, sizeof(buffer), "n%07ld", n);
+    return buffer;
+}
+
+void removeFiles(const std::string& path) {
+    unlink(path.c_str());
+    unlink((path + ".log").c_str());
+    unlink((path + ".tmp").c_str());
+    unlink((path + ".log.tmp").c_str());
+}
+
+// Ns per owner() over names drawn from <names>
+double lookupNs(const NickRegistry& registry, const std::vector<std::string>& names, long& found) {
+    found = 0;
+    long long start = nowNs();
+    for (size_t i = 0; i < names.size(); ++i) {
+        if (registry.owner(names[i])) ++found;
+    }
+    return static_cast<double>(nowNs() - start) / names.size();
+}
+
+}
+
+int main(int argc, char** argv) {
+    long count = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    std::string dir = (argc > 2) ? argv[2] : "/tmp";
+    if (count <= 0 || count > 9999999) {
+        std::fprintf(stderr, "Usage: %s [nicknames (1-9999999)] [dir]\n", argv[0]);
+        return 1;
+    }
+    std::ostringstream pathStream;
+    pathStream << dir << "/nickdb_bench." << getpid();
+    std::string path = pathStream.str();
+    removeFiles(path);
+
+    std::ofstream devnull("/dev/null");
+    std::streambuf* saved = std::cout.rdbuf(devnull.rdbuf());
+
+    NickRegistry registry;
+    if (!registry.open(path)) {
+        std::cout.rdbuf(saved);
+        std::fprintf(stderr, "nickdb_bench: cannot open %s\n", path.c_str());
+        return 1;
+    }
+    time_t now = time(NULL);
+    long long start = nowNs();
+    for (long i = 0; i < count; ++i) {
+        std::ostringstream account;
+        account << "acct" << i;
+        registry.claim(nickFor(i), account.str(), now);
+        // As the event loop would: compactions start on their own
+        registry.maintain(now + i / 100000);
+    }
+    double buildMs = (nowNs() - start) / 1e6;
+
+    // Everything into the snapshot, as if the interval had passed
+    registry.settle();
+    start = nowNs();
+    registry.maintain(now + 100000);
+    registry.settle();
+    double compactMs = (nowNs() - start) / 1e6;
+    registry.close();
+
+    long rssBefore = residentBytes();
+    start = nowNs();
+    bool opened = registry.open(path);
+    double openMs = (nowNs() - start) / 1e6;
+    long openRss = residentBytes() - rssBefore;
+    if (!opened || registry.size() != static_cast<size_t>(count)) {
+        std::cout.rdbuf(saved);
+        std::fprintf(stderr, "nickdb_bench: reopened with %lu of %ld nicknames\n",
+                     static_cast<unsigned long>(registry.size()), count);
+        removeFiles(path);
+        return 1;
+    }
+
+    std::vector<std::string> hits;
+    std::vector<std::string> misses;
+    srand(42);
+    for (long i = 0; i < LOOKUPS; ++i) {
+        hits.push_back(nickFor(static_cast<long>((static_cast<double>(rand()) / RAND_MAX) * (count - 1))));
+        misses.push_back("m" + nickFor(i).substr(1));
+    }
+    long found = 0;
+    double coldNs = lookupNs(registry, hits, found);
+    double warmNs = lookupNs(registry, hits, found);
+    long missFound = 0;
+    double missNs = lookupNs(registry, misses, missFound);
+
+    for (long i = 0; i < TAIL_RECORDS; ++i) {
+        registry.seen(nickFor(i), now + 3600);
+    }
+    registry.close();
+    start = nowNs();
+    registry.open(path);
+    double replayOpenMs = (nowNs() - start) / 1e6;
+    registry.close();
+    removeFiles(path);
+
+    std::cout.rdbuf(saved);
+    std::printf("{\"nicknames\": %ld, \"build_ms\": %.0f, \"compact_ms\": %.1f, \"open_ms\": %.3f, "
+                "\"open_rss\": %ld, \"lookup_cold_ns\": %.0f, \"lookup_warm_ns\": %.0f, \"lookup_miss_ns\": %.0f, "
+                "\"hits\": %ld, \"open_with_%d_log_records_ms\": %.2f}\n",
+                count, buildMs, compactMs, openMs, openRss, coldNs, warmNs, missNs,
+                found, TAIL_RECORDS, replayOpenMs);
+    return missFound == 0 && found == LOOKUPS ? 0 : 1;
+}
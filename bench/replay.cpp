@@ -0,0 +1,188 @@
+// Replays a traffic capture (ircserv --capture=PATH) into an in-process
+// server.
+//
+//   replay <capture> <password> [speed]
+//
+// Without a speed the records are fed back to back; with one they keep
+// their original spacing divided by speed (1 = real time). Connections are
+// attached on descriptor numbers no socket uses, and whatever the server
+// queues for them is thrown away. The server starts empty, so a capture
+// taken after a hot upgrade only replays the connections accepted since.
+// Prints one JSON object on stdout with the time spent per data record.
+
+#include "../Server.hpp"
+#include "../Client.hpp"
+#include "../TrafficCapture.hpp"
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+volatile sig_atomic_t g_shutdown_requested = 0;
+volatile sig_atomic_t g_upgrade_requested = 0;
+volatile sig_atomic_t g_reload_requested = 0;
+
+namespace {
+
+// Well above any descriptor the process can have open
+const int FIRST_FAKE_FD = 1 << 24;
+const size_t DISCARD_EVERY = 256;
+
+struct Record {
+    uint8_t type;
+    int32_t connection;
+    uint64_t micros;
+    const char* payload;
+    uint32_t length;
+};
+
+double nowSec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+bool readFile(const char* path, std::string& out) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) return false;
+    out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    return true;
+}
+
+// Splits the file into records; false if it is not a capture or is cut short
+bool parseCapture(const std::string& data, std::vector<Record>& records) {
+    if (data.size() < 8 || data.compare(0, 8, CAPTURE_MAGIC) != 0) return false;
+    size_t pos = 8;
+    while (pos + CAPTURE_RECORD_HEADER <= data.size()) {
+        Record r;
+        r.type = static_cast<uint8_t>(data[pos]);
+        std::memcpy(&r.connection, data.data() + pos + 1, 4);
+        std::memcpy(&r.micros, data.data() + pos + 5, 8);
+        std::memcpy(&r.length, data.data() + pos + 13, 4);
+        pos += CAPTURE_RECORD_HEADER;
+        if (r.length > data.size() - pos) return false;
+        r.payload = data.data() + pos;
+        pos += r.length;
+        records.push_back(r);
+    }
+    return pos == data.size();
+}
+
+void discardOutput(Server& server) {
+    const std::map<int, Client*>& clients = server.getClients();
+    for (std::map<int, Client*>::const_iterator it = clients.begin(); it != clients.end(); ++it) {
+        it->second->clearSendBuffer(it->second->getSendQueue().size());
+    }
+}
+
+void sleepUntil(double deadline) {
+    double left = deadline - nowSec();
+    if (left > 0) {
+        usleep(static_cast<useconds_t>(left * 1e6));
+    }
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::fprintf(stderr, "Usage: %s <capture> <password> [speed]\n", argv[0]);
+        return 1;
+    }
+    double speed = (argc > 3) ? std::atof(argv[3]) : 0;
+    if (argc > 3 && speed <= 0) {
+        std::fprintf(stderr, "replay: speed must be positive\n");
+        return 1;
+    }
+
+    std::string data;
+    std::vector<Record> records;
+    if (!readFile(argv[1], data)) {
+        std::fprintf(stderr, "replay: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if (!parseCapture(data, records)) {
+        std::fprintf(stderr, "replay: %s is not a complete capture file\n", argv[1]);
+        return 1;
+    }
+
+    std::ofstream devnull("/dev/null");
+    std::streambuf* saved = std::cout.rdbuf(devnull.rdbuf());
+
+    ServerConfig config;
+    config.password = argv[2];
+    config.channelDb = "";
+    Server server(config);
+
+    // Capture connection -> descriptor it has in the replay
+    std::map<int32_t, int> live;
+    int nextFd = FIRST_FAKE_FD;
+    std::vector<double> latencies;
+    uint64_t bytes = 0;
+    size_t connections = 0;
+    size_t skipped = 0;
+
+    double start = nowSec();
+    for (size_t i = 0; i < records.size(); ++i) {
+        const Record& r = records[i];
+        if (speed > 0) {
+            sleepUntil(start + (r.micros - records[0].micros) / 1e6 / speed);
+        }
+
+        std::map<int32_t, int>::iterator it = live.find(r.connection);
+        if (r.type == CAPTURE_ACCEPT) {
+            // Descriptor reused without a recorded close: the old one is gone
+            if (it != live.end()) {
+                server.dropClient(it->second);
+            }
+            int fd = nextFd++;
+            server.adoptClient(fd, std::string(r.payload, r.length));
+            live[r.connection] = fd;
+            ++connections;
+        } else if (r.type == CAPTURE_DATA) {
+            if (it == live.end() || !server.getClientByFd(it->second)) {
+                ++skipped;
+                continue;
+            }
+            double before = nowSec();
+            server.receive(it->second, std::string(r.payload, r.length));
+            latencies.push_back(nowSec() - before);
+            bytes += r.length;
+        } else if (r.type == CAPTURE_CLOSE) {
+            if (it != live.end()) {
+                if (server.getClientByFd(it->second)) {
+                    server.dropClient(it->second);
+                }
+                live.erase(it);
+            }
+        }
+        if (i % DISCARD_EVERY == DISCARD_EVERY - 1) {
+            discardOutput(server);
+        }
+    }
+    double elapsed = nowSec() - start;
+    std::cout.rdbuf(saved);
+
+    std::sort(latencies.begin(), latencies.end());
+    double p50 = latencies.empty() ? 0 : latencies[latencies.size() / 2];
+    double p99 = latencies.empty() ? 0 : latencies[latencies.size() * 99 / 100];
+    double worst = latencies.empty() ? 0 : latencies.back();
+    double captured = records.empty() ? 0 : (records.back().micros - records[0].micros) / 1e6;
+    std::printf("{\n  \"records\": %lu, \"connections\": %lu, \"data_records\": %lu, \"skipped\": %lu,\n"
+                "  \"bytes\": %llu, \"captured_seconds\": %.3f, \"speed\": %.3f, \"elapsed_seconds\": %.6f,\n"
+                "  \"records_per_sec\": %.0f, \"bytes_per_sec\": %.0f,\n"
+                "  \"data_record_us\": {\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}\n}\n",
+                static_cast<unsigned long>(records.size()), static_cast<unsigned long>(connections),
+                static_cast<unsigned long>(latencies.size()), static_cast<unsigned long>(skipped),
+                static_cast<unsigned long long>(bytes), captured, speed, elapsed,
+                records.size() / elapsed, bytes / elapsed, p50 * 1e6, p99 * 1e6, worst * 1e6);
+    return 0;
+}
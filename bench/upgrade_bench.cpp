@@ -0,0 +1,321 @@
+// Hot upgrade under load.
+//
+//   upgrade_bench <password> <port> <server_pid> [connections] [channel_size]
+//
+// Opens <connections> registered loopback connections to the server, in
+// channels of <channel_size> members, spread over source addresses
+// 127.0.0.2 and up so that the ephemeral ports do not run out. A probe
+// user then messages itself about once a millisecond while the server is
+// sent SIGUSR2. Reports how long the old process took to hand over and go
+// away, and the pause the probe saw: its longest round trip while the
+// upgrade ran, against the ones before. Finally every connection messages
+// itself once more through the new process, to show none was lost. The
+// server logs its own side ("loop paused for", "restored in"); see
+// upgrade_bench.sh. Needs a descriptor limit above <connections>, in this
+// process and the server's, and a server that lets the channels be created
+// that fast (--channel-create-rate-global=0).
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef IP_BIND_ADDRESS_NO_PORT
+#define IP_BIND_ADDRESS_NO_PORT 24
+#endif
+
+// Connections per loopback source address, well under the ephemeral range
+#define PER_SOURCE 20000
+// Connections registered at a time, within the server's listen backlog (10)
+#define SETUP_BATCH 8
+#define WAIT_TIMEOUT_MS 30000
+#define PROBE_GAP_US 1000
+#define MAX_PROBES 200000
+
+namespace {
+
+struct Conn {
+    int fd;
+    std::string nick;
+    std::string in;
+    bool matched;
+};
+
+struct Probe {
+    long long sentNs;
+    long long rttNs;
+};
+
+long long nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<long long>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+int connectFrom(int port, long n) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + n / PER_SOURCE);
+    if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+bool sendAll(int fd, const std::string& data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        off += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// Reads the connections in [first, last) until each has received <token>,
+// or, when toSelf is set, " PRIVMSG <its nick>" followed by <token>
+bool waitFor(int epfd, std::vector<Conn>& conns, size_t first, size_t last, const std::string& token, bool toSelf) {
+    for (size_t i = first; i < last; ++i) {
+        conns[i].matched = false;
+    }
+    size_t waiting = last - first;
+    long long deadline = nowNs() + WAIT_TIMEOUT_MS * 1000000LL;
+    struct epoll_event events[256];
+    char buf[16384];
+    while (waiting > 0) {
+        if (nowNs() > deadline) return false;
+        int ready = epoll_wait(epfd, events, 256, 100);
+        if (ready < 0 && errno != EINTR) return false;
+        for (int e = 0; e < ready; ++e) {
+            Conn& conn = conns[events[e].data.u32];
+            ssize_t n = recv(conn.fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n == 0) return false;
+            if (n < 0) continue;
+            conn.in.append(buf, n);
+            size_t end = conn.in.rfind('\n');
+            if (end == std::string::npos) continue;
+            if (!conn.matched && events[e].data.u32 >= first && events[e].data.u32 < last) {
+                std::string wanted = toSelf ? " PRIVMSG " + conn.nick + token : token;
+                if (conn.in.find(wanted) < end) {
+                    conn.matched = true;
+                    --waiting;
+                }
+            }
+            conn.in.erase(0, end + 1);
+        }
+    }
+    return true;
+}
+
+bool processGone(pid_t pid) {
+    std::ostringstream path;
+    path << "/proc/" << pid << "/stat";
+    std::ifstream stat(path.str().c_str());
+    std::string field;
+    // pid (comm) state: a zombie has finished too
+    if (!(stat >> field >> field >> field)) return true;
+    return field == "Z" || field == "X";
+}
+
+struct ProbeRun {
+    int fd;
+    volatile int stop;
+    std::vector<Probe> probes;
+    bool failed;
+};
+
+void* runProbe(void* arg) {
+    ProbeRun& run = *static_cast<ProbeRun*>(arg);
+    std::string in;
+    char buf[4096];
+    for (long n = 0; !run.stop && run.probes.size() < MAX_PROBES; ++n) {
+        std::ostringstream line;
+        line << "PRIVMSG probe :p" << n << "\r\n";
+        std::ostringstream tail;
+        tail << " :p" << n << "\r\n";
+        Probe probe;
+        probe.sentNs = nowNs();
+        if (!sendAll(run.fd, line.str())) {
+            run.failed = true;
+            return NULL;
+        }
+        while (in.find(tail.str()) == std::string::npos) {
+            ssize_t got = recv(run.fd, buf, sizeof(buf), 0);
+            if (got <= 0) {
+                run.failed = true;
+                return NULL;
+            }
+            in.append(buf, got);
+        }
+        probe.rttNs = nowNs() - probe.sentNs;
+        run.probes.push_back(probe);
+        in.clear();
+        usleep(PROBE_GAP_US);
+    }
+    return NULL;
+}
+
+}
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        std::fprintf(stderr, "Usage: %s <password> <port> <server_pid> [connections] [channel_size]\n", argv[0]);
+        return 1;
+    }
+    std::string password = argv[1];
+    int port = std::atoi(argv[2]);
+    pid_t server = static_cast<pid_t>(std::atol(argv[3]));
+    long count = (argc > 4) ? std::atol(argv[4]) : 50000;
+    long channelSize = (argc > 5) ? std::atol(argv[5]) : 10;
+    if (count <= 0 || channelSize <= 0 || server <= 0) {
+        std::fprintf(stderr, "upgrade_bench: connections, channel_size and server_pid must be > 0\n");
+        return 1;
+    }
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < static_cast<rlim_t>(count + 64)) {
+        std::fprintf(stderr, "upgrade_bench: %ld connections need a descriptor limit above %ld (ulimit -n is %lu)\n",
+                     count, count + 64, static_cast<unsigned long>(limit.rlim_cur));
+        return 1;
+    }
+
+    int epfd = epoll_create1(0);
+    std::vector<Conn> conns(count);
+    long long start = nowNs();
+    for (long first = 0; first < count; first += SETUP_BATCH) {
+        long last = first + SETUP_BATCH < count ? first + SETUP_BATCH : count;
+        for (long i = first; i < last; ++i) {
+            Conn& conn = conns[i];
+            std::ostringstream nick;
+            nick << "u" << i;
+            conn.nick = nick.str();
+            conn.fd = connectFrom(port, i);
+            if (conn.fd < 0) {
+                std::fprintf(stderr, "upgrade_bench: connection %ld: %s\n", i, std::strerror(errno));
+                return 1;
+            }
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.u32 = static_cast<uint32_t>(i);
+            epoll_ctl(epfd, EPOLL_CTL_ADD, conn.fd, &ev);
+            std::ostringstream hello;
+            hello << "PASS " << password << "\r\nNICK " << conn.nick << "\r\nUSER " << conn.nick
+                  << " 0 * :bench\r\nJOIN #g" << i / channelSize << "\r\n";
+            if (!sendAll(conn.fd, hello.str())) {
+                std::fprintf(stderr, "upgrade_bench: send failed on connection %ld\n", i);
+                return 1;
+            }
+        }
+        // RPL_ENDOFNAMES closes the JOIN
+        if (!waitFor(epfd, conns, first, last, " 366 ", false)) {
+            std::fprintf(stderr, "upgrade_bench: connections %ld-%ld did not finish joining\n", first, last - 1);
+            return 1;
+        }
+    }
+    double setupMs = (nowNs() - start) / 1e6;
+    long channels = (count + channelSize - 1) / channelSize;
+    std::printf("connections=%ld channels=%ld setup_ms=%.0f\n", count, channels, setupMs);
+    std::fflush(stdout);
+
+    ProbeRun probe;
+    probe.fd = connectFrom(port, 0);
+    probe.stop = 0;
+    probe.failed = false;
+    probe.probes.reserve(MAX_PROBES);
+    if (probe.fd < 0 || !sendAll(probe.fd, "PASS " + password + "\r\nNICK probe\r\nUSER probe 0 * :bench\r\n")) {
+        std::fprintf(stderr, "upgrade_bench: cannot connect the probe\n");
+        return 1;
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, runProbe, &probe);
+
+    // A second of undisturbed round trips to compare against
+    usleep(1000000);
+    long long signalNs = nowNs();
+    if (kill(server, SIGUSR2) < 0) {
+        std::fprintf(stderr, "upgrade_bench: cannot signal %d: %s\n", static_cast<int>(server), std::strerror(errno));
+        probe.stop = 1;
+        pthread_join(thread, NULL);
+        return 1;
+    }
+    while (!processGone(server)) {
+        if (nowNs() - signalNs > WAIT_TIMEOUT_MS * 1000000LL) {
+            std::fprintf(stderr, "upgrade_bench: the old process is still running\n");
+            break;
+        }
+        usleep(1000);
+    }
+    long long goneNs = nowNs();
+    usleep(500000);
+    probe.stop = 1;
+    pthread_join(thread, NULL);
+    if (probe.failed) {
+        std::fprintf(stderr, "upgrade_bench: the probe lost its connection\n");
+        return 1;
+    }
+
+    std::vector<long long> before;
+    long long pauseNs = 0;
+    for (size_t i = 0; i < probe.probes.size(); ++i) {
+        const Probe& p = probe.probes[i];
+        if (p.sentNs + p.rttNs < signalNs) {
+            before.push_back(p.rttNs);
+        } else if (p.sentNs < goneNs) {
+            pauseNs = std::max(pauseNs, p.rttNs);
+        }
+    }
+    std::sort(before.begin(), before.end());
+    double beforeP50 = before.empty() ? 0 : before[before.size() / 2] / 1e6;
+    double beforeMax = before.empty() ? 0 : before.back() / 1e6;
+    std::printf("upgrade signal_to_exit_ms=%.1f probe_pause_ms=%.1f before_p50_ms=%.3f before_max_ms=%.3f probes=%lu\n",
+                (goneNs - signalNs) / 1e6, pauseNs / 1e6, beforeP50, beforeMax,
+                static_cast<unsigned long>(probe.probes.size()));
+    std::fflush(stdout);
+
+    // Every connection through the new process
+    start = nowNs();
+    for (long i = 0; i < count; ++i) {
+        if (!sendAll(conns[i].fd, "PRIVMSG " + conns[i].nick + " :still here\r\n")) {
+            std::fprintf(stderr, "upgrade_bench: connection %ld is gone\n", i);
+            return 1;
+        }
+    }
+    bool alive = waitFor(epfd, conns, 0, count, " :still here", true);
+    std::printf("alive=%s check_ms=%.0f\n", alive ? "all" : "NOT ALL", (nowNs() - start) / 1e6);
+    for (long i = 0; i < count; ++i) {
+        close(conns[i].fd);
+    }
+    close(probe.fd);
+    close(epfd);
+    return alive ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+#!/bin/bash
+# ircserv を起動し、upgrade_bench で多数の接続を張ったまま SIGUSR2 で
+# ホットアップグレードさせ、クライアント側の停止時間とサーバ側の記録を並べる。
+# 使い方: bench/upgrade_bench.sh [connections] [channel_size]
+#   (リポジトリのルートで、make bench の後。connections より大きな
+#    ulimit -n が必要)
+
+CONNECTIONS=${1:-50000}
+CHANNEL_SIZE=${2:-10}
+PASSWORD=benchpass
+PORT=6669
+DIR=$(mktemp -d)
+NEW=""
+trap 'kill $(jobs -p) $NEW 2>/dev/null; rm -rf "$DIR"' EXIT
+
+if ! ulimit -n $((CONNECTIONS + 256)) 2>/dev/null; then
+    echo "ulimit -n $((CONNECTIONS + 256)) is not allowed here (limit $(ulimit -Hn))" >&2
+    exit 1
+fi
+
+# Its channels are all created within seconds
+./ircserv $PORT $PASSWORD --history-lines=0 --channel-create-rate=0 --channel-create-rate-global=0 \
+    > "$DIR/server.log" 2>&1 &
+SERVER=$!
+sleep 0.5
+./bench/upgrade_bench $PASSWORD $PORT $SERVER "$CONNECTIONS" "$CHANNEL_SIZE"
+STATUS=$?
+grep -ho "Upgrade complete.*\|Resumed from upgrade.*" "$DIR/server.log"
+# The new process holds the listening socket now
+NEW=$(ss -Hltnp "sport = :$PORT" | sed -n 's/.*pid=\([0-9]*\).*/\1/p' | head -1)
+exit $STATUS
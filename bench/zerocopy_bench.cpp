@@ -0,0 +1,252 @@
+// Plain writev() against MSG_ZEROCOPY for flushes of different sizes.
+//
+//   zerocopy_bench [megabytes per run]
+//
+// A loopback TCP connection is set up and a thread drains the receiving
+// end. The sender pushes the same amount of data in flushes of 4KB up to
+// 1MB, each one contiguous segment as the coalesced bytes of a server link
+// or a long reply are (the only segments the server pins), once with
+// writev() and once with sendmsg(MSG_ZEROCOPY), reaping completions from
+// the error queue as the server does. Throughput
+// and the sender's CPU time per megabyte are reported for both, along with
+// the smallest flush size from which zerocopy used less CPU: a starting
+// point for --zerocopy-threshold. Over loopback the kernel copies zerocopy
+// sends when they are received (the completions say so), so the numbers
+// show the bookkeeping overhead rather than the saving a real NIC gives;
+// run it between two hosts for the latter.
+// Prints one JSON object on stdout; a summary goes to stderr.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <linux/errqueue.h>
+
+namespace {
+
+const size_t FLUSH_SIZES[] = {4096, 8192, 16384, 32768, 65536, 131072, 262144, 1048576};
+const size_t FLUSH_SIZE_COUNT = sizeof(FLUSH_SIZES) / sizeof(FLUSH_SIZES[0]);
+// Largest flush
+const size_t BUFFER_SIZE = 1048576;
+
+double nowSec(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void fail(const char* what) {
+    std::perror(what);
+    std::exit(1);
+}
+
+void* drainMain(void* arg) {
+    int fd = static_cast<int>(reinterpret_cast<intptr_t>(arg));
+    std::vector<char> buffer(1 << 20);
+    while (read(fd, &buffer[0], buffer.size()) > 0) {
+    }
+    return NULL;
+}
+
+struct Connection {
+    int sender;
+    int receiver;
+    pthread_t drain;
+};
+
+Connection openConnection(bool zerocopy) {
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) fail("socket");
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(addr);
+    if (bind(listener, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) fail("bind");
+    if (listen(listener, 1) < 0) fail("listen");
+    if (getsockname(listener, reinterpret_cast<struct sockaddr*>(&addr), &length) < 0) fail("getsockname");
+
+    Connection connection;
+    connection.sender = socket(AF_INET, SOCK_STREAM, 0);
+    if (connection.sender < 0) fail("socket");
+    int one = 1;
+    if (zerocopy && setsockopt(connection.sender, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        fail("SO_ZEROCOPY");
+    }
+    if (connect(connection.sender, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) fail("connect");
+    connection.receiver = accept(listener, NULL, NULL);
+    if (connection.receiver < 0) fail("accept");
+    close(listener);
+    pthread_create(&connection.drain, NULL, drainMain, reinterpret_cast<void*>(static_cast<intptr_t>(connection.receiver)));
+    return connection;
+}
+
+void closeConnection(Connection& connection) {
+    shutdown(connection.sender, SHUT_WR);
+    pthread_join(connection.drain, NULL);
+    close(connection.sender);
+    close(connection.receiver);
+}
+
+// Completion bookkeeping for one zerocopy socket
+struct Completions {
+    uint32_t sent;
+    uint32_t done;
+    unsigned long copied;
+};
+
+void reap(int fd, Completions& completions, bool wait) {
+    while (true) {
+        if (wait) {
+            struct pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = 0;
+            poll(&pfd, 1, 100);
+        }
+        char control[256];
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EAGAIN && wait) continue;
+            return;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR) continue;
+            struct sock_extended_err err;
+            std::memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+            if (err.ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+            completions.done = err.ee_data + 1;
+            if (err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                completions.copied += err.ee_data - err.ee_info + 1;
+            }
+        }
+        wait = false;
+    }
+}
+
+// One flush, written until all of it is out
+void flush(int fd, const char* buffer, size_t size, bool zerocopy, Completions& completions) {
+    size_t left = size;
+    while (left > 0) {
+        struct iovec iov;
+        iov.iov_base = const_cast<char*>(buffer);
+        iov.iov_len = left;
+        ssize_t sent;
+        if (zerocopy) {
+            struct msghdr msg;
+            std::memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            sent = sendmsg(fd, &msg, MSG_ZEROCOPY);
+            if (sent < 0 && errno == ENOBUFS) {
+                reap(fd, completions, true);
+                continue;
+            }
+            if (sent > 0) {
+                ++completions.sent;
+                reap(fd, completions, false);
+            }
+        } else {
+            sent = writev(fd, &iov, 1);
+        }
+        if (sent < 0) fail(zerocopy ? "sendmsg" : "writev");
+        left -= static_cast<size_t>(sent);
+        buffer += sent;
+    }
+}
+
+struct Result {
+    double megabytesPerSec;
+    double cpuMsPerMegabyte;
+    double copiedShare;
+};
+
+Result run(const char* buffer, size_t flushSize, size_t totalBytes, bool zerocopy) {
+    Connection connection = openConnection(zerocopy);
+    Completions completions;
+    completions.sent = 0;
+    completions.done = 0;
+    completions.copied = 0;
+    size_t flushes = totalBytes / flushSize;
+
+    double wallStart = nowSec(CLOCK_MONOTONIC);
+    double cpuStart = nowSec(CLOCK_THREAD_CPUTIME_ID);
+    for (size_t i = 0; i < flushes; ++i) {
+        flush(connection.sender, buffer, flushSize, zerocopy, completions);
+    }
+    while (completions.done != completions.sent) {
+        reap(connection.sender, completions, true);
+    }
+    double cpu = nowSec(CLOCK_THREAD_CPUTIME_ID) - cpuStart;
+    double wall = nowSec(CLOCK_MONOTONIC) - wallStart;
+    closeConnection(connection);
+
+    double megabytes = static_cast<double>(flushes * flushSize) / (1 << 20);
+    Result result;
+    result.megabytesPerSec = megabytes / wall;
+    result.cpuMsPerMegabyte = cpu * 1000 / megabytes;
+    result.copiedShare = completions.sent ? static_cast<double>(completions.copied) / completions.sent : 0;
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t megabytes = (argc > 1) ? std::strtoul(argv[1], NULL, 10) : 512;
+    if (megabytes == 0) megabytes = 512;
+    size_t totalBytes = megabytes << 20;
+
+    std::vector<char> buffer(BUFFER_SIZE);
+    for (size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = static_cast<char>('a' + i % 26);
+    }
+
+    std::string json = "{\"megabytes\":";
+    char number[64];
+    std::snprintf(number, sizeof(number), "%lu", static_cast<unsigned long>(megabytes));
+    json += number;
+    json += ",\"runs\":[";
+    size_t crossover = 0;
+    for (size_t i = 0; i < FLUSH_SIZE_COUNT; ++i) {
+        Result plain = run(&buffer[0], FLUSH_SIZES[i], totalBytes, false);
+        Result zerocopy = run(&buffer[0], FLUSH_SIZES[i], totalBytes, true);
+        if (!crossover && zerocopy.cpuMsPerMegabyte < plain.cpuMsPerMegabyte) {
+            crossover = FLUSH_SIZES[i];
+        }
+        std::fprintf(stderr, "flush %7lu B: writev %8.1f MB/s %6.3f ms/MB cpu | zerocopy %8.1f MB/s %6.3f ms/MB cpu (%3.0f%% copied)\n",
+            static_cast<unsigned long>(FLUSH_SIZES[i]), plain.megabytesPerSec, plain.cpuMsPerMegabyte,
+            zerocopy.megabytesPerSec, zerocopy.cpuMsPerMegabyte, zerocopy.copiedShare * 100);
+        char entry[320];
+        std::snprintf(entry, sizeof(entry),
+            "%s{\"flush_bytes\":%lu,\"writev_mb_s\":%.1f,\"writev_cpu_ms_per_mb\":%.4f,"
+            "\"zerocopy_mb_s\":%.1f,\"zerocopy_cpu_ms_per_mb\":%.4f,\"zerocopy_copied\":%.3f}",
+            i ? "," : "", static_cast<unsigned long>(FLUSH_SIZES[i]), plain.megabytesPerSec, plain.cpuMsPerMegabyte,
+            zerocopy.megabytesPerSec, zerocopy.cpuMsPerMegabyte, zerocopy.copiedShare);
+        json += entry;
+    }
+    std::snprintf(number, sizeof(number), "%lu", static_cast<unsigned long>(crossover));
+    json += "],\"crossover_bytes\":";
+    json += number;
+    json += "}";
+    if (crossover) {
+        std::fprintf(stderr, "zerocopy uses less CPU from %lu-byte flushes\n", static_cast<unsigned long>(crossover));
+    } else {
+        std::fprintf(stderr, "zerocopy never used less CPU here\n");
+    }
+    std::printf("%s\n", json.c_str());
+    return 0;
+}
@@ -1,14 +1,28 @@
 #include "Server.hpp"
 #include "utils.hpp"
+#include "PasswordHash.hpp"
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
+#include <string>
 #include <signal.h>
 
 // Global flag for graceful shutdown
 volatile sig_atomic_t g_shutdown_requested = 0;
+// Set by SIGUSR2: hand the live sockets over to a new ircserv binary
+volatile sig_atomic_t g_upgrade_requested = 0;
+// Set by SIGHUP: re-read the --admission-rules file
+volatile sig_atomic_t g_reload_requested = 0;
 
 void signalHandler(int signum) {
-    (void)signum;
+    if (signum == SIGUSR2) {
+        g_upgrade_requested = 1;
+        return;
+    }
+    if (signum == SIGHUP) {
+        g_reload_requested = 1;
+        return;
+    }
     g_shutdown_requested = 1;
 }
 
@@ -16,12 +30,47 @@ void setupSignalHandlers() {
     signal(SIGPIPE, SIG_IGN);
     signal(SIGINT, signalHandler);
     signal(SIGTERM, signalHandler);
+    signal(SIGUSR2, signalHandler);
+    signal(SIGHUP, signalHandler);
+}
+
+// ircserv --mkpasswd[=ITERATIONS]: reads a password from the first line of
+// standard input and prints its hash for the --accounts file
+static int makePassword(const char* option) {
+    unsigned long iterations = PasswordHash::DEFAULT_ITERATIONS;
+    if (option[10] == '=') {
+        char* end = NULL;
+        iterations = std::strtoul(option + 11, &end, 10);
+        if (*end != '\0' || iterations < 1000 || iterations > 100000000) {
+            std::cerr << "--mkpasswd: iterations must be between 1000 and 100000000" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } else if (option[10] != '\0') {
+        std::cerr << "Usage: <program> --mkpasswd[=ITERATIONS] < password" << std::endl;
+        return EXIT_FAILURE;
+    }
+    std::string password;
+    if (!std::getline(std::cin, password) || password.empty()) {
+        std::cerr << "--mkpasswd: no password on standard input" << std::endl;
+        return EXIT_FAILURE;
+    }
+    try {
+        std::cout << PasswordHash::create(password, static_cast<unsigned int>(iterations)) << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return 0;
 }
 
 int main(const int argc, const char **argv) {
-    std::pair<int, std::string> inputParams;
+    if (argc == 2 && std::strncmp(argv[1], "--mkpasswd", 10) == 0) {
+        return makePassword(argv[1]);
+    }
+
+    ServerConfig config;
     try {
-        inputParams = validateInput(argc, argv);
+        config = validateInput(argc, argv);
     } catch (const std::exception& e) {
         std::cerr << "Input validation error: " << e.what() << std::endl;
         return EXIT_FAILURE;
@@ -30,7 +79,7 @@ int main(const int argc, const char **argv) {
     setupSignalHandlers();
 
     try {
-        Server irc_server(inputParams.first, inputParams.second);
+        Server irc_server(config);
         irc_server.run();
     } catch (const std::exception& e) {
         std::cerr << "Server runtime error: " << e.what() << std::endl;
@@ -4,6 +4,11 @@
 #include <string>
 #include <cerrno>
 #include <climits>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <unistd.h>
+#include <sched.h>
 
 static int parse_and_validate_port(const std::string& portStr) {
     if (portStr.length() != 4) {
@@ -43,28 +48,233 @@ static void validate_password(const std::string& password) {
     }
 }
 
-std::pair<int, std::string> validateInput(const int& argc, const char**& argv) {
-    if (argc != 3) {
-        throw std::invalid_argument("Usage: <program> <port> <password>");
+ServerConfig::ServerConfig()
+    : port(0),
+      password(""),
+      serverName(DEFAULT_SERVER_NAME),
+      link(""),
+      linkPassword(""),
+      historyLines(DEFAULT_HISTORY_LINES),
+      historyBytes(DEFAULT_HISTORY_BYTES),
+      channelDb(DEFAULT_CHANNEL_DB),
+      captureFile(""),
+      fanoutThreads(DEFAULT_FANOUT_THREADS),
+      fanoutThreshold(DEFAULT_FANOUT_THRESHOLD),
+      memoryBudget(DEFAULT_MEMORY_BUDGET),
+      admissionRules(""),
+      maxPerIp(DEFAULT_MAX_PER_IP),
+      maxPerSubnet(DEFAULT_MAX_PER_SUBNET),
+      zerocopyThreshold(DEFAULT_ZEROCOPY_THRESHOLD),
+      drainTimeout(DEFAULT_DRAIN_TIMEOUT),
+      busyPoll(DEFAULT_BUSY_POLL),
+      reactorCpu(-1),
+      authThreads(DEFAULT_AUTH_THREADS),
+      authPending(DEFAULT_AUTH_PENDING),
+      channelCreateRate(DEFAULT_CHANNEL_CREATE_RATE),
+      channelCreateRateGlobal(DEFAULT_CHANNEL_CREATE_RATE_GLOBAL) {
+}
+
+static size_t parse_size_option(const std::string& name, const std::string& value) {
+    if (value.empty()) {
+        throw std::invalid_argument("Option --" + name + " needs a value");
+    }
+    for (size_t i = 0; i < value.length(); ++i) {
+        if (!std::isdigit(static_cast<unsigned char>(value[i]))) {
+            throw std::invalid_argument("Option --" + name + " must be a non-negative number");
+        }
+    }
+    errno = 0;
+    unsigned long parsed = std::strtoul(value.c_str(), NULL, 10);
+    if (errno == ERANGE) {
+        throw std::out_of_range("Option --" + name + " is out of range");
+    }
+    return static_cast<size_t>(parsed);
+}
+
+// A size in bytes, optionally followed by K, M or G (powers of 1024)
+static size_t parse_bytes_option(const std::string& name, const std::string& value) {
+    size_t shift = 0;
+    std::string digits = value;
+    if (!value.empty()) {
+        switch (value[value.length() - 1]) {
+            case 'K': case 'k': shift = 10; break;
+            case 'M': case 'm': shift = 20; break;
+            case 'G': case 'g': shift = 30; break;
+        }
+    }
+    if (shift) {
+        digits.erase(digits.length() - 1);
+    }
+    size_t parsed = parse_size_option(name, digits);
+    if (parsed > (static_cast<size_t>(-1) >> shift)) {
+        throw std::out_of_range("Option --" + name + " is out of range");
+    }
+    return parsed << shift;
+}
+
+static void parse_option(ServerConfig& config, const std::string& arg) {
+    if (arg.compare(0, 2, "--") != 0) {
+        throw std::invalid_argument("Unexpected argument: " + arg);
+    }
+    size_t eq = arg.find('=');
+    std::string name = arg.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+    std::string value = (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+    if (eq == std::string::npos) {
+        throw std::invalid_argument("Option --" + name + " needs a value");
+    }
+
+    if (name == "history-lines") {
+        config.historyLines = parse_size_option(name, value);
+    } else if (name == "history-bytes") {
+        config.historyBytes = parse_size_option(name, value);
+    } else if (name == "channel-db") {
+        config.channelDb = value;
+    } else if (name == "fanout-threads") {
+        config.fanoutThreads = parse_size_option(name, value);
+        if (config.fanoutThreads > MAX_FANOUT_THREADS) {
+            throw std::out_of_range("Option --fanout-threads is out of range");
+        }
+    } else if (name == "fanout-threshold") {
+        config.fanoutThreshold = parse_size_option(name, value);
+        if (config.fanoutThreshold == 0) {
+            throw std::invalid_argument("Option --fanout-threshold must be positive");
+        }
+    } else if (name == "memory-budget") {
+        config.memoryBudget = parse_bytes_option(name, value);
+    } else if (name == "admission-rules") {
+        config.admissionRules = value;
+    } else if (name == "max-per-ip" || name == "max-per-subnet") {
+        size_t limit = parse_size_option(name, value);
+        if (limit > 0xffffffffUL) {
+            throw std::out_of_range("Option --" + name + " is out of range");
+        }
+        (name == "max-per-ip" ? config.maxPerIp : config.maxPerSubnet) = limit;
+    } else if (name == "zerocopy-threshold") {
+        config.zerocopyThreshold = parse_bytes_option(name, value);
+    } else if (name == "drain-timeout") {
+        config.drainTimeout = parse_size_option(name, value);
+        if (config.drainTimeout > MAX_DRAIN_TIMEOUT) {
+            throw std::out_of_range("Option --drain-timeout is out of range");
+        }
+    } else if (name == "busy-poll") {
+        config.busyPoll = parse_size_option(name, value);
+        if (config.busyPoll > MAX_BUSY_POLL) {
+            throw std::out_of_range("Option --busy-poll is out of range");
+        }
+    } else if (name == "reactor-cpu") {
+        size_t cpu = parse_size_option(name, value);
+        if (cpu >= CPU_SETSIZE) {
+            throw std::out_of_range("Option --reactor-cpu is out of range");
+        }
+        config.reactorCpu = static_cast<int>(cpu);
+    } else if (name == "accounts") {
+        config.accounts = value;
+    } else if (name == "auth-threads") {
+        config.authThreads = parse_size_option(name, value);
+        if (config.authThreads == 0 || config.authThreads > MAX_AUTH_THREADS) {
+            throw std::out_of_range("Option --auth-threads is out of range");
+        }
+    } else if (name == "auth-pending") {
+        config.authPending = parse_size_option(name, value);
+        if (config.authPending == 0 || config.authPending > MAX_AUTH_PENDING) {
+            throw std::out_of_range("Option --auth-pending is out of range");
+        }
+    } else if (name == "nick-db") {
+        config.nickDb = value;
+    } else if (name == "channel-create-rate") {
+        config.channelCreateRate = parse_size_option(name, value);
+        if (config.channelCreateRate > MAX_CHANNEL_CREATE_RATE) {
+            throw std::out_of_range("Option --channel-create-rate is out of range");
+        }
+    } else if (name == "channel-create-rate-global") {
+        config.channelCreateRateGlobal = parse_size_option(name, value);
+        if (config.channelCreateRateGlobal > MAX_CHANNEL_CREATE_RATE) {
+            throw std::out_of_range("Option --channel-create-rate-global is out of range");
+        }
+    } else if (name == "capture") {
+        config.captureFile = value;
+    } else if (name == "server-name") {
+        if (value.empty() || value.find_first_of(" ,:!@*?") != std::string::npos || value.length() > 63) {
+            throw std::invalid_argument("Option --server-name must be 1-63 characters without spaces or \",:!@*?\"");
+        }
+        config.serverName = value;
+    } else if (name == "link") {
+        size_t colon = value.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == value.length()
+            || value.find_first_not_of("0123456789", colon + 1) != std::string::npos) {
+            throw std::invalid_argument("Option --link must be host:port");
+        }
+        config.link = value;
+    } else if (name == "link-password") {
+        validate_password(value);
+        config.linkPassword = value;
+    } else if (name == "log-level") {
+        if (!setLogLevel(value)) {
+            throw std::invalid_argument("Option --log-level must be debug, info, warning or error");
+        }
+    } else {
+        throw std::invalid_argument("Unknown option: --" + name);
     }
+}
+
+// Path of the binary on disk, looked up now: after a redeploy /proc/self/exe
+// would still point at the old, replaced file
+static std::string resolve_executable(const std::string& argv0) {
+    char resolved[PATH_MAX];
+    if (argv0.find('/') != std::string::npos && realpath(argv0.c_str(), resolved)) {
+        return resolved;
+    }
+    ssize_t length = readlink("/proc/self/exe", resolved, sizeof(resolved) - 1);
+    if (length > 0) {
+        resolved[length] = '\0';
+        return resolved;
+    }
+    return argv0;
+}
+
+ServerConfig validateInput(const int& argc, const char**& argv) {
+    if (argc < 3) {
+        throw std::invalid_argument("Usage: <program> <port> <password> [--option=value ...]");
+    }
+
+    ServerConfig config;
 
     std::string portStr = argv[1];
-    int port = parse_and_validate_port(portStr);
+    config.port = parse_and_validate_port(portStr);
 
     std::string password = argv[2];
     validate_password(password);
+    config.password = password;
 
-    return std::make_pair(port, password);
+    for (int i = 3; i < argc; ++i) {
+        parse_option(config, argv[i]);
+    }
+
+    if (!config.link.empty() && config.linkPassword.empty()) {
+        throw std::invalid_argument("Option --link needs --link-password");
+    }
+    if (!config.linkPassword.empty() && config.linkPassword == config.password) {
+        throw std::invalid_argument("Option --link-password must differ from the connection password");
+    }
+
+    config.arguments.assign(argv, argv + argc);
+    config.executable = resolve_executable(argv[0]);
+
+    return config;
 }
 
 bool isValidChannelName(const std::string& name) {
-    if (name.empty() || name.length() > 50) {
+    return isValidChannelName(name.data(), name.size());
+}
+
+bool isValidChannelName(const char* name, size_t length) {
+    if (length == 0 || length > 50) {
         return false;
     }
     if (name[0] != '#' && name[0] != '&') {
         return false;
     }
-    for (size_t i = 1; i < name.length(); ++i) {
+    for (size_t i = 1; i < length; ++i) {
         char c = name[i];
         if (c == ' ' || c == ',' || c == '\r' || c == '\n' || c == '\0' || c == '\a' || c == ':') {
             return false;
@@ -72,3 +282,104 @@ bool isValidChannelName(const std::string& name) {
     }
     return true;
 }
+
+char ircToLower(char c) {
+    if (c >= 'A' && c <= '^') {
+        return static_cast<char>(c + ('a' - 'A'));
+    }
+    return c;
+}
+
+// FNV-1a over the casefolded name
+uint32_t ircHash(const std::string& name) {
+    return ircHash(name.data(), name.size());
+}
+
+uint32_t ircHash(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(ircToLower(name[i]));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Compares a name against a NUL-terminated one without building a folded copy
+bool ircEquals(const std::string& name, const char* other) {
+    return ircEquals(name.data(), name.size(), other);
+}
+
+bool ircEquals(const char* name, size_t length, const char* other) {
+    for (size_t i = 0; i < length; ++i) {
+        if (other[i] == '\0' || ircToLower(name[i]) != ircToLower(other[i])) {
+            return false;
+        }
+    }
+    return other[length] == '\0';
+}
+
+// Greedy matcher: on a mismatch, retry from just after the last '*'
+bool ircMatch(const std::string& mask, const std::string& text) {
+    size_t m = 0, t = 0;
+    size_t starMask = std::string::npos, starText = 0;
+    while (t < text.size()) {
+        if (m < mask.size() && (mask[m] == '?' || ircToLower(mask[m]) == ircToLower(text[t]))) {
+            ++m;
+            ++t;
+        } else if (m < mask.size() && mask[m] == '*') {
+            starMask = m++;
+            starText = t;
+        } else if (starMask != std::string::npos) {
+            m = starMask + 1;
+            t = ++starText;
+        } else {
+            return false;
+        }
+    }
+    while (m < mask.size() && mask[m] == '*') ++m;
+    return m == mask.size();
+}
+
+// Simple ngircd-like logger compatible with C++98
+// Index into LOG_LEVELS of the least severe level still printed
+static size_t g_logThreshold = 1;
+static const char* const LOG_LEVELS[] = { "debug", "info", "warning", "error" };
+#define LOG_LEVEL_COUNT (sizeof(LOG_LEVELS) / sizeof(LOG_LEVELS[0]))
+
+static size_t log_rank(const char* level) {
+    for (size_t i = 0; i < LOG_LEVEL_COUNT; ++i) {
+        if (std::strcmp(level, LOG_LEVELS[i]) == 0) {
+            return i;
+        }
+    }
+    return LOG_LEVEL_COUNT;
+}
+
+bool setLogLevel(const std::string& level) {
+    size_t rank = log_rank(level.c_str());
+    if (rank == LOG_LEVEL_COUNT) {
+        return false;
+    }
+    g_logThreshold = rank;
+    return true;
+}
+
+bool logEnabled(const char* level) {
+    return log_rank(level) >= g_logThreshold;
+}
+
+void ngircd_log(const std::string& level, const std::string& msg) {
+    if (!logEnabled(level.c_str())) {
+        return;
+    }
+    time_t t = time(NULL);
+    struct tm* tm_info = localtime(&t);
+    char timebuf[64];
+    if (tm_info) {
+        strftime(timebuf, sizeof(timebuf), "%b %d %H:%M:%S", tm_info);
+    } else {
+        std::strncpy(timebuf, "0000-00-00 00:00:00", sizeof(timebuf));
+        timebuf[sizeof(timebuf)-1] = '\0';
+    }
+    std::cout << "[" << timebuf << "] : " << level << ": " << msg << std::endl;
+}
@@ -2,7 +2,25 @@
 #include <string>
 #include <map>
 #include <stdexcept>
+#include <stdint.h>
+#include "ServerConfig.hpp"
 
-std::pair<int, std::string> validateInput(const int& argc, const char**& argv);
+ServerConfig validateInput(const int& argc, const char**& argv);
 
 bool isValidChannelName(const std::string& name);
+bool isValidChannelName(const char* name, size_t length);
+
+// RFC 1459 casemapping: A-Z and []\^ fold to a-z and {}|~
+char ircToLower(char c);
+uint32_t ircHash(const std::string& name);
+uint32_t ircHash(const char* name, size_t length);
+bool ircEquals(const std::string& name, const char* other);
+bool ircEquals(const char* name, size_t length, const char* other);
+// Wildcard match ('*' any run, '?' one character) under the same casemapping
+bool ircMatch(const std::string& mask, const std::string& text);
+
+// Simple ngircd-like logger; levels below --log-level (default "info") are
+// dropped, so callers building an expensive message check logEnabled first
+void ngircd_log(const std::string& level, const std::string& msg);
+bool logEnabled(const char* level);
+bool setLogLevel(const std::string& level);